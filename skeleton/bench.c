@@ -0,0 +1,246 @@
+/***************************************************************************
+ *  Title: Bench
+ * -------------------------------------------------------------------------
+ *    Purpose: The bench builtin, which times repeated runs of a
+ *    command
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: bench.c,v $
+ ***************************************************************************/
+#define _GNU_SOURCE
+#define __BENCH_IMPL__
+
+/************System include***********************************************/
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+/************Private include**********************************************/
+#include "bench.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* runs bench times by default */
+#define BENCH_RUNS 10
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+/* prints one row of bench's report */
+static void
+BenchRow(char*, double*, int);
+/* orders doubles for qsort */
+static int
+CompareDoubles(const void*, const void*);
+/* rounds a square root to the nearest integer */
+static unsigned long long
+RoundSqrt(unsigned long long);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+/*
+ * RunBench
+ *
+ * arguments:
+ *   commandT *cmd: the bench command line
+ *
+ * returns: none
+ *
+ * Implements "bench [-n runs] [-w warmup] command [arg]...". The
+ * command is looked up once, in PATH even if it names a builtin, and
+ * the same commandT is forked and exec'd warmup times untimed, then
+ * runs times, each as a foreground job in a process group of its own.
+ * Wall time is taken from before the fork to the reaping of the
+ * child, CPU time is the child's user plus system time. The report
+ * goes to the standard error, so the command's output can be
+ * redirected on its own. ^C or ^Z ends the runs early. $? is 0, or
+ * the status of the last run that failed.
+ */
+void
+RunBench(commandT* cmd)
+{
+  int runs = BENCH_RUNS, warmup = 0, failed = 0, status = 0;
+  struct rusage r0, r1;
+  struct timespec t0, t1;
+  double* wall;
+  double* cpu;
+  bool done;
+  commandT* c;
+  int i, n, k;
+
+  lastStatus = 2;
+  for (i = 1; i < cmd->argc && cmd->argv[i][0] == '-'; i++)
+    {
+      char* opt = cmd->argv[i];
+      char* val;
+
+      if (strcmp(opt, "--") == 0)
+        {
+          i++;
+          break;
+        }
+      if ((opt[1] != 'n' && opt[1] != 'w')
+          || (val = opt[2] != 0 ? opt + 2 : cmd->argv[++i]) == NULL)
+        break;
+      if (opt[1] == 'n')
+        runs = atoi(val);
+      else
+        warmup = atoi(val);
+    }
+  if (i >= cmd->argc || cmd->argv[i][0] == '-' || runs < 1 || warmup < 0)
+    {
+      fprintf(stderr, "usage: bench [-n runs] [-w warmup] command "
+              "[arg]...\n");
+      return;
+    }
+
+  n = cmd->argc - i;
+  c = malloc(sizeof(commandT) + sizeof(char*) * (n + 1));
+  memcpy(c->argv, cmd->argv + i, sizeof(char*) * n);
+  c->argv[n] = NULL;
+  c->argc = n;
+  c->name = c->argv[0];
+  if (!ResolveExternalCmd(c))
+    {
+      lastStatus = 127;
+      free(c);
+      return;
+    }
+
+  wall = malloc(sizeof(double) * runs * 2);
+  cpu = wall + runs;
+  for (k = -warmup, n = 0; k < runs; k++)
+    {
+      getrusage(RUSAGE_CHILDREN, &r0);
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      done = RunProgram(c, cmd, NULL);
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      getrusage(RUSAGE_CHILDREN, &r1);
+      if (!done || lastStatus == 128 + SIGINT)
+        break; // not forked, numbered and reported, or interrupted
+      if (lastStatus != 0)
+        {
+          failed++;
+          status = lastStatus;
+        }
+      if (k < 0)
+        continue;
+      wall[n] = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+      cpu[n++] = (r1.ru_utime.tv_sec - r0.ru_utime.tv_sec
+                  + r1.ru_stime.tv_sec - r0.ru_stime.tv_sec) * 1e3
+        + (r1.ru_utime.tv_usec - r0.ru_utime.tv_usec
+           + r1.ru_stime.tv_usec - r0.ru_stime.tv_usec) / 1e3;
+    }
+
+  if (n > 0)
+    {
+      fprintf(stderr, "bench: %d runs of %s", n, c->name);
+      for (i = 1; i < c->argc; i++)
+        fprintf(stderr, " %s", c->argv[i]);
+      fprintf(stderr, ", %d warmup\n%-8s %10s %10s %10s %10s %10s %10s\n",
+              warmup, "ms", "min", "mean", "median", "p95", "p99", "stddev");
+      BenchRow("wall", wall, n);
+      BenchRow("cpu", cpu, n);
+    }
+  if (k == runs)
+    {
+      if (failed > 0)
+        fprintf(stderr, "bench: %d of %d runs failed\n", failed,
+                runs + warmup);
+      lastStatus = status;
+    }
+  free(wall);
+  free(c->name);
+  free(c);
+} /* RunBench */
+
+
+/*
+ * BenchRow
+ *
+ * arguments:
+ *   char *label: what the times are
+ *   double *v: the times of the runs, which are sorted in place
+ *   int n: their number
+ *
+ * returns: none
+ *
+ * Percentiles are by nearest rank; the standard deviation is that of
+ * the sample.
+ */
+static void
+BenchRow(char* label, double* v, int n)
+{
+  double sum = 0, sq = 0, mean;
+  unsigned long long sd = 0; // in microseconds
+  int i;
+
+  qsort(v, n, sizeof(double), CompareDoubles);
+  for (i = 0; i < n; i++)
+    sum += v[i];
+  mean = sum / n;
+  for (i = 0; i < n; i++)
+    sq += (v[i] - mean) * (v[i] - mean);
+  // The variance in square microseconds; the ranks are ceil(n * p).
+  if (n > 1)
+    sd = RoundSqrt(sq / (n - 1) * 1e6 + 0.5);
+  fprintf(stderr, "%-8s %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n", label,
+          v[0], mean, n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2,
+          v[(n * 95 + 99) / 100 - 1], v[(n * 99 + 99) / 100 - 1],
+          sd / 1000.0);
+} /* BenchRow */
+
+
+/*
+ * CompareDoubles
+ *
+ * arguments:
+ *   const void *a: a double
+ *   const void *b: another
+ *
+ * returns: int: less than, equal to or greater than 0 as a is less
+ *               than, equal to or greater than b
+ */
+static int
+CompareDoubles(const void* a, const void* b)
+{
+  double x = *(const double*) a, y = *(const double*) b;
+
+  return (x > y) - (x < y);
+} /* CompareDoubles */
+
+
+/*
+ * RoundSqrt
+ *
+ * arguments:
+ *   unsigned long long x: the number
+ *
+ * returns: unsigned long long: its square root, rounded to nearest
+ *
+ * Newton's method on integers, so that tsh needs no libm.
+ */
+static unsigned long long
+RoundSqrt(unsigned long long x)
+{
+  unsigned long long r = x, y;
+
+  if (x < 2)
+    return x;
+  // Decreases from above to the floor of the root.
+  for (y = x / 2 + x % 2; y < r; y = (y + x / y) / 2)
+    r = y;
+  return x - r * r > r ? r + 1 : r;
+} /* RoundSqrt */
+
+
@@ -0,0 +1,58 @@
+/***************************************************************************
+ *  Title: Bench
+ * -------------------------------------------------------------------------
+ *    Purpose: The bench builtin, which times repeated runs of a
+ *    command
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: bench.h,v $
+ ***************************************************************************/
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "runtime.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __BENCH_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Run the bench builtin
+ * ---------------------------------------------------------------------
+ *    Purpose: Implements "bench [-n runs] [-w warmup] command
+ *    [arg]...": runs the command warmup times untimed, then runs
+ *    times, and reports the spread of its wall and CPU times on the
+ *    standard error.
+ *    Input: the bench command line
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RunBench(commandT*);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __BENCH_H__ */
@@ -0,0 +1,857 @@
+/***************************************************************************
+ *  Title: Codec
+ * -------------------------------------------------------------------------
+ *    Purpose: The compressed redirections <z and >z, which gzip or
+ *    zstd a command's input or output on a thread of the shell
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: codec.c,v $
+ ***************************************************************************/
+#define _GNU_SOURCE
+#define __CODEC_IMPL__
+
+/************System include***********************************************/
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__has_include)
+#if __has_include(<zlib.h>)
+#include <zlib.h>
+#define HAVE_ZLIB
+#endif
+#endif
+
+/************Private include**********************************************/
+#include "codec.h"
+#include "io.h"
+#include "memprof.h"
+#include "script.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* bytes read or written at a time on the file, and the size asked of
+ * the pipe */
+#define CODECBUF (1 << 20)
+
+/* bytes read or written at a time on the pipe */
+#define CODECCHUNK (1 << 17)
+
+/* the most codecs whose descriptors a child is sure to drop */
+#define CODECMAX 32
+
+/* formats */
+#define FMT_PLAIN 0
+#define FMT_GZIP  1
+#define FMT_ZSTD  2
+
+/* the libraries, loaded when first needed */
+#define ZLIBSO "libz.so.1"
+#define ZSTDSO "libzstd.so.1"
+
+/* the little of the zstd API used, which is stable; zstd.h is often
+ * missing where the library is installed */
+typedef struct zstd_in_t
+{
+  const void* src;
+  size_t size;
+  size_t pos;
+} zstdInT;
+
+typedef struct zstd_out_t
+{
+  void* dst;
+  size_t size;
+  size_t pos;
+} zstdOutT;
+
+#define ZSTD_LEVEL    100 /* ZSTD_c_compressionLevel */
+#define ZSTD_WORKERS  400 /* ZSTD_c_nbWorkers */
+#define ZSTD_CONTINUE 0   /* ZSTD_e_continue */
+#define ZSTD_END      2   /* ZSTD_e_end */
+
+typedef struct zstd_t
+{
+  bool tried;
+  void* handle;
+  void* (*createCCtx)(void);
+  size_t (*freeCCtx)(void*);
+  size_t (*setParameter)(void*, int, int);
+  size_t (*compressStream2)(void*, zstdOutT*, zstdInT*, int);
+  void* (*createDCtx)(void);
+  size_t (*freeDCtx)(void*);
+  size_t (*decompressStream)(void*, zstdOutT*, zstdInT*);
+  unsigned (*isError)(size_t);
+  const char* (*getErrorName)(size_t);
+} zstdT;
+
+#ifdef HAVE_ZLIB
+typedef struct zlib_t
+{
+  bool tried;
+  void* handle;
+  int (*deflateInit2_)(z_streamp, int, int, int, int, int, const char*,
+                       int);
+  int (*deflate)(z_streamp, int);
+  int (*deflateEnd)(z_streamp);
+  int (*inflateInit2_)(z_streamp, int, const char*, int);
+  int (*inflate)(z_streamp, int);
+  int (*inflateReset)(z_streamp);
+  int (*inflateEnd)(z_streamp);
+} zlibT;
+#endif
+
+struct codec_t
+{
+  char* name;      /* the file, for errors */
+  int file;
+  int pipe;        /* the thread's end */
+  bool write;      /* compressing into the file */
+  int format;      /* of a file written */
+  int level;       /* or -1 for the default */
+  int threads;     /* zstd's workers, or 0 */
+  int slot;        /* in gFds, or -1 */
+  char* big;       /* CODECBUF bytes, for the file */
+  char* small;     /* CODECCHUNK bytes, for the pipe */
+  const char* error; /* what went wrong, or NULL */
+  int err;         /* or the errno of a failed call */
+  bool broken;     /* the command stopped reading */
+  int refs;        /* the thread's and the owner's */
+  pthread_t thread;
+};
+
+/************Global Variables*********************************************/
+
+static zstdT gZstd;
+#ifdef HAVE_ZLIB
+static zlibT gZlib;
+#endif
+
+/* the descriptors of live codecs, plus one, by pairs: the file, which
+ * also claims the slot, then the pipe; 0 when free */
+static int gFds[2 * CODECMAX];
+
+/************Function Prototypes******************************************/
+/* loads libzstd */
+static bool
+LoadZstd();
+/* loads libz */
+static bool
+LoadZlib();
+/* reads a variable that is a number */
+static int
+VarInt(char*, int);
+/* a codec's thread */
+static void*
+CodecRun(void*);
+/* closes a codec's descriptors and drops the thread's reference */
+static void
+Release(codecT*);
+/* frees a codec, reporting its error */
+static void
+CodecFree(codecT*);
+/* records the first error */
+static void
+Fail(codecT*, const char*, int);
+/* reads at least some bytes */
+static ssize_t
+Fill(codecT*, int, char*, size_t, size_t);
+/* writes all of a buffer */
+static bool
+Put(codecT*, int, char*, size_t);
+/* compresses the pipe into the file with zstd */
+static void
+ZstdOut(codecT*);
+/* expands zstd from the file into the pipe */
+static void
+ZstdIn(codecT*, size_t);
+/* compresses the pipe into the file with gzip */
+static void
+GzipOut(codecT*);
+/* expands gzip from the file into the pipe */
+static void
+GzipIn(codecT*, size_t);
+/* copies the file into the pipe as it is */
+static void
+PlainIn(codecT*, size_t);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+/*
+ * CodecOpen
+ *
+ * arguments:
+ *   char *file: the file
+ *   int flags: how to open it, O_RDONLY for <z
+ *   codecT **cp: receives the codec
+ *
+ * returns: int: the command's end of the pipe, or -1
+ *
+ * The thread is started with every signal blocked, so signals go to
+ * the shell's own thread and a write to a pipe nobody reads fails
+ * with EPIPE. The file and pipe are read and written in large blocks
+ * while the command keeps to its own pace on the pipe, which is made
+ * as big as it may be.
+ */
+int
+CodecOpen(char* file, int flags, codecT** cp)
+{
+  codecT* c;
+  sigset_t all, old;
+  int fd, p[2], end, len = strlen(file), i, none;
+  bool write = (flags & O_ACCMODE) != O_RDONLY;
+  int format = len > 4 && strcmp(file + len - 4, ".zst") == 0
+    ? FMT_ZSTD : FMT_GZIP;
+
+  // Input may be either; which it is is only known once it is read.
+  if (!write)
+    {
+      LoadZstd();
+      LoadZlib();
+    }
+  else if (!(format == FMT_ZSTD ? LoadZstd() : LoadZlib()))
+    {
+      fprintf(stderr, "%s: %s: %s is not available\n", SHELLNAME, file,
+              format == FMT_ZSTD ? ZSTDSO : ZLIBSO);
+      return -1;
+    }
+  if ((fd = open(file, flags | O_CLOEXEC, 0666)) < 0)
+    {
+      PrintPError(file);
+      return -1;
+    }
+  c = calloc(1, sizeof(codecT));
+  c->name = strdup(file);
+  c->file = fd;
+  c->write = write;
+  c->format = format;
+  c->level = VarInt("ZLEVEL", -1);
+  c->threads = VarInt("ZTHREADS", 0);
+  c->slot = -1;
+  c->refs = 2;
+  if (pipe2(p, O_CLOEXEC) != 0)
+    {
+      PrintPError("pipe");
+      CodecFree(c);
+      close(fd);
+      return -1;
+    }
+  fcntl(p[0], F_SETPIPE_SZ, CODECBUF);
+  c->pipe = c->write ? p[0] : p[1];
+  end = c->write ? p[1] : p[0];
+  c->big = malloc(CODECBUF);
+  c->small = malloc(CODECCHUNK);
+  for (i = 0, none = 0; i < CODECMAX; i++, none = 0)
+    if (__atomic_compare_exchange_n(&gFds[2 * i], &none, fd + 1, FALSE,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+      {
+        __atomic_store_n(&gFds[2 * i + 1], c->pipe + 1, __ATOMIC_SEQ_CST);
+        c->slot = i;
+        break;
+      }
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  MemLibc(TRUE); // the thread's stack and TLS are kept for reuse
+  errno = pthread_create(&c->thread, NULL, CodecRun, c);
+  MemLibc(FALSE);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (errno != 0)
+    {
+      PrintPError("pthread_create");
+      close(end);
+      c->refs = 1;
+      Release(c);
+      return -1;
+    }
+  *cp = c;
+  return end;
+} /* CodecOpen */
+
+
+/*
+ * CodecClose
+ *
+ * arguments:
+ *   codecT *c: a codec
+ *   bool wait: whether to wait for its thread
+ *
+ *
+ * returns: bool: FALSE if the thread met an error, which it reported
+ *
+ * Whichever of the thread and the shell lets go of the codec last
+ * frees it.
+ */
+bool
+CodecClose(codecT* c, bool wait)
+{
+  bool ok;
+
+  if (wait)
+    pthread_join(c->thread, NULL);
+  else
+    pthread_detach(c->thread);
+  ok = !wait || (c->error == NULL && c->err == 0);
+  if (__atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    CodecFree(c);
+  return ok;
+} /* CodecClose */
+
+
+/*
+ * CodecForget
+ *
+ * arguments: none
+ *
+ * returns: none
+ */
+void
+CodecForget()
+{
+  int i, fd;
+
+  for (i = 0; i < 2 * CODECMAX; i++)
+    if ((fd = __atomic_load_n(&gFds[i], __ATOMIC_SEQ_CST)) != 0)
+      {
+        close(fd - 1);
+        gFds[i] = 0;
+      }
+} /* CodecForget */
+
+
+/*
+ * LoadZstd
+ *
+ * arguments: none
+ *
+ * returns: bool: TRUE if libzstd is loaded
+ */
+static bool
+LoadZstd()
+{
+  void* h;
+
+  if (gZstd.tried)
+    return gZstd.handle != NULL;
+  gZstd.tried = TRUE;
+  MemLibc(TRUE);
+  h = dlopen(ZSTDSO, RTLD_NOW | RTLD_LOCAL);
+  MemLibc(FALSE);
+  if (h == NULL)
+    return FALSE;
+  if ((gZstd.createCCtx = dlsym(h, "ZSTD_createCCtx")) == NULL
+      || (gZstd.freeCCtx = dlsym(h, "ZSTD_freeCCtx")) == NULL
+      || (gZstd.setParameter = dlsym(h, "ZSTD_CCtx_setParameter")) == NULL
+      || (gZstd.compressStream2 = dlsym(h, "ZSTD_compressStream2")) == NULL
+      || (gZstd.createDCtx = dlsym(h, "ZSTD_createDCtx")) == NULL
+      || (gZstd.freeDCtx = dlsym(h, "ZSTD_freeDCtx")) == NULL
+      || (gZstd.decompressStream = dlsym(h, "ZSTD_decompressStream")) == NULL
+      || (gZstd.isError = dlsym(h, "ZSTD_isError")) == NULL
+      || (gZstd.getErrorName = dlsym(h, "ZSTD_getErrorName")) == NULL)
+    {
+      dlclose(h);
+      return FALSE;
+    }
+  gZstd.handle = h;
+  return TRUE;
+} /* LoadZstd */
+
+
+/*
+ * LoadZlib
+ *
+ * arguments: none
+ *
+ * returns: bool: TRUE if libz is loaded
+ *
+ * Without zlib.h at build time, gzip is never available.
+ */
+static bool
+LoadZlib()
+{
+#ifdef HAVE_ZLIB
+  void* h;
+
+  if (gZlib.tried)
+    return gZlib.handle != NULL;
+  gZlib.tried = TRUE;
+  MemLibc(TRUE);
+  h = dlopen(ZLIBSO, RTLD_NOW | RTLD_LOCAL);
+  MemLibc(FALSE);
+  if (h == NULL)
+    return FALSE;
+  if ((gZlib.deflateInit2_ = dlsym(h, "deflateInit2_")) == NULL
+      || (gZlib.deflate = dlsym(h, "deflate")) == NULL
+      || (gZlib.deflateEnd = dlsym(h, "deflateEnd")) == NULL
+      || (gZlib.inflateInit2_ = dlsym(h, "inflateInit2_")) == NULL
+      || (gZlib.inflate = dlsym(h, "inflate")) == NULL
+      || (gZlib.inflateReset = dlsym(h, "inflateReset")) == NULL
+      || (gZlib.inflateEnd = dlsym(h, "inflateEnd")) == NULL)
+    {
+      dlclose(h);
+      return FALSE;
+    }
+  gZlib.handle = h;
+  return TRUE;
+#else
+  return FALSE;
+#endif
+} /* LoadZlib */
+
+
+/*
+ * VarInt
+ *
+ * arguments:
+ *   char *name: a variable
+ *   int dflt: the value if it is unset or not a number
+ *
+ * returns: int: its value
+ */
+static int
+VarInt(char* name, int dflt)
+{
+  char* v = GetVar(name);
+
+  if (v == NULL || v[0] < '0' || v[0] > '9')
+    return dflt;
+  return atoi(v);
+} /* VarInt */
+
+
+/*
+ * CodecRun
+ *
+ * arguments:
+ *   void *arg: the codec
+ *
+ * returns: void*: NULL
+ *
+ * Closing its end of the pipe, when done or on an error, is what lets
+ * the command see the end of its input, or fail writing more output,
+ * as it would at the end of a pipe to gzip.
+ */
+static void*
+CodecRun(void* arg)
+{
+  codecT* c = arg;
+  ssize_t n = 0;
+
+  if (c->write && c->format == FMT_ZSTD)
+    ZstdOut(c);
+  else if (c->write)
+    GzipOut(c);
+  else if ((n = Fill(c, c->file, c->big, CODECBUF, 4)) < 0)
+    ;
+  else if (n >= 4 && memcmp(c->big, "\x28\xb5\x2f\xfd", 4) == 0)
+    ZstdIn(c, n);
+  else if (n >= 2 && memcmp(c->big, "\x1f\x8b", 2) == 0)
+    GzipIn(c, n);
+  else
+    PlainIn(c, n);
+  Release(c);
+  return NULL;
+} /* CodecRun */
+
+
+/*
+ * Release
+ *
+ * arguments:
+ *   codecT *c: a codec whose thread is done
+ *
+ * returns: none
+ *
+ * Each descriptor leaves gFds before it is closed, so a child forked
+ * meanwhile never closes a number that was since reused.
+ */
+static void
+Release(codecT* c)
+{
+  if (c->slot >= 0)
+    __atomic_store_n(&gFds[2 * c->slot + 1], 0, __ATOMIC_SEQ_CST);
+  close(c->pipe);
+  if (c->slot >= 0)
+    __atomic_store_n(&gFds[2 * c->slot], 0, __ATOMIC_SEQ_CST);
+  if (close(c->file) != 0 && c->write)
+    Fail(c, NULL, errno);
+  if (__atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    CodecFree(c);
+} /* Release */
+
+
+/*
+ * CodecFree
+ *
+ * arguments:
+ *   codecT *c: a codec its thread and the shell are done with
+ *
+ * returns: none
+ */
+static void
+CodecFree(codecT* c)
+{
+  if (c->error != NULL || c->err != 0)
+    fprintf(stderr, "%s: %s: %s\n", SHELLNAME, c->name,
+            c->error != NULL ? c->error : strerror(c->err));
+  free(c->name);
+  free(c->big);
+  free(c->small);
+  free(c);
+} /* CodecFree */
+
+
+/*
+ * Fail
+ *
+ * arguments:
+ *   codecT *c: a codec
+ *   const char *error: what went wrong, or NULL
+ *   int err: or the errno of a call that failed
+ *
+ * returns: none
+ */
+static void
+Fail(codecT* c, const char* error, int err)
+{
+  if (c->error == NULL && c->err == 0)
+    {
+      c->error = error;
+      c->err = err;
+    }
+} /* Fail */
+
+
+/*
+ * Fill
+ *
+ * arguments:
+ *   codecT *c: a codec
+ *   int fd: the descriptor to read
+ *   char *buf: where to
+ *   size_t size: the most to read
+ *   size_t min: how many bytes to wait for
+ *
+ * returns: ssize_t: the bytes read, fewer than min only at the end of
+ *                   the input, or -1 on an error
+ */
+static ssize_t
+Fill(codecT* c, int fd, char* buf, size_t size, size_t min)
+{
+  size_t got = 0;
+  ssize_t n;
+
+  while (got < min)
+    {
+      if ((n = read(fd, buf + got, size - got)) < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        {
+          Fail(c, NULL, errno);
+          return -1;
+        }
+      if (n == 0)
+        break;
+      got += n;
+    }
+  return got;
+} /* Fill */
+
+
+/*
+ * Put
+ *
+ * arguments:
+ *   codecT *c: a codec
+ *   int fd: the descriptor to write
+ *   char *buf: the bytes
+ *   size_t n: their number
+ *
+ * returns: bool: FALSE if not all could be written
+ *
+ * A command that stops reading its input is no error.
+ */
+static bool
+Put(codecT* c, int fd, char* buf, size_t n)
+{
+  ssize_t k;
+
+  while (n > 0)
+    {
+      if ((k = write(fd, buf, n)) < 0 && errno == EINTR)
+        continue;
+      if (k < 0 && errno == EPIPE && fd == c->pipe)
+        c->broken = TRUE;
+      else if (k < 0)
+        Fail(c, NULL, errno);
+      if (k < 0)
+        return FALSE;
+      buf += k;
+      n -= k;
+    }
+  return TRUE;
+} /* Put */
+
+
+/*
+ * ZstdOut
+ *
+ * arguments:
+ *   codecT *c: a codec writing a .zst file
+ *
+ * returns: none
+ *
+ * Ends the frame at the end of the command's output; with >>z the
+ * file gets one frame more, which zstd reads as one stream.
+ */
+static void
+ZstdOut(codecT* c)
+{
+  void* cx = gZstd.createCCtx();
+  zstdOutT out = { c->big, CODECBUF, 0 };
+  zstdInT in;
+  ssize_t n;
+  size_t r;
+
+  if (cx == NULL)
+    {
+      Fail(c, "out of memory", 0);
+      return;
+    }
+  if (c->level >= 0)
+    gZstd.setParameter(cx, ZSTD_LEVEL, c->level);
+  if (c->threads > 0)
+    gZstd.setParameter(cx, ZSTD_WORKERS, c->threads);
+  do
+    {
+      if ((n = Fill(c, c->pipe, c->small, CODECCHUNK, 1)) < 0)
+        break;
+      in.src = c->small;
+      in.size = n;
+      in.pos = 0;
+      do
+        {
+          if (out.pos == out.size)
+            {
+              if (!Put(c, c->file, c->big, out.pos))
+                goto done;
+              out.pos = 0;
+            }
+          r = gZstd.compressStream2(cx, &out, &in,
+                                    n == 0 ? ZSTD_END : ZSTD_CONTINUE);
+          if (gZstd.isError(r))
+            {
+              Fail(c, gZstd.getErrorName(r), 0);
+              goto done;
+            }
+        }
+      while (n == 0 ? r != 0 : in.pos < in.size);
+    }
+  while (n > 0);
+  if (n == 0)
+    Put(c, c->file, c->big, out.pos);
+ done:
+  gZstd.freeCCtx(cx);
+} /* ZstdOut */
+
+
+/*
+ * ZstdIn
+ *
+ * arguments:
+ *   codecT *c: a codec reading zstd
+ *   size_t n: the bytes of the file already in c->big
+ *
+ * returns: none
+ */
+static void
+ZstdIn(codecT* c, size_t n)
+{
+  void* dx = gZstd.createDCtx != NULL ? gZstd.createDCtx() : NULL;
+  zstdInT in = { c->big, n, 0 };
+  zstdOutT out = { c->small, CODECCHUNK, 0 };
+  ssize_t k;
+  size_t r = 1;
+
+  if (dx == NULL)
+    {
+      Fail(c, gZstd.handle == NULL ? ZSTDSO " is not available"
+           : "out of memory", 0);
+      return;
+    }
+  for (;;)
+    {
+      if (in.pos == in.size && out.pos < out.size)
+        { // zstd holds nothing more for the pipe
+          if ((k = Fill(c, c->file, c->big, CODECBUF, 1)) <= 0)
+            break;
+          in.size = k;
+          in.pos = 0;
+        }
+      out.pos = 0;
+      r = gZstd.decompressStream(dx, &out, &in);
+      if (gZstd.isError(r))
+        {
+          Fail(c, gZstd.getErrorName(r), 0);
+          break;
+        }
+      if (!Put(c, c->pipe, c->small, out.pos))
+        break;
+    }
+  if (r != 0 && !c->broken)
+    Fail(c, "unexpected end of input", 0);
+  gZstd.freeDCtx(dx);
+} /* ZstdIn */
+
+
+/*
+ * GzipOut
+ *
+ * arguments:
+ *   codecT *c: a codec writing gzip
+ *
+ * returns: none
+ *
+ * As gzip, >>z adds a member, and a reader expands them all.
+ */
+static void
+GzipOut(codecT* c)
+{
+#ifdef HAVE_ZLIB
+  z_stream z;
+  ssize_t n;
+  int r = Z_OK;
+
+  memset(&z, 0, sizeof(z));
+  if (gZlib.deflateInit2_(&z, c->level > 9 ? 9 : c->level, Z_DEFLATED,
+                          15 + 16, 8, Z_DEFAULT_STRATEGY, ZLIB_VERSION,
+                          sizeof(z)) != Z_OK)
+    {
+      Fail(c, "out of memory", 0);
+      return;
+    }
+  z.next_out = (Bytef*) c->big;
+  z.avail_out = CODECBUF;
+  do
+    {
+      if ((n = Fill(c, c->pipe, c->small, CODECCHUNK, 1)) < 0)
+        break;
+      z.next_in = (Bytef*) c->small;
+      z.avail_in = n;
+      do
+        {
+          if (z.avail_out == 0)
+            {
+              if (!Put(c, c->file, c->big, CODECBUF))
+                goto done;
+              z.next_out = (Bytef*) c->big;
+              z.avail_out = CODECBUF;
+            }
+          r = gZlib.deflate(&z, n == 0 ? Z_FINISH : Z_NO_FLUSH);
+        }
+      while (r != Z_STREAM_ERROR
+             && (n == 0 ? r != Z_STREAM_END : z.avail_in > 0));
+    }
+  while (n > 0 && r != Z_STREAM_ERROR);
+  if (r == Z_STREAM_END)
+    Put(c, c->file, c->big, CODECBUF - z.avail_out);
+ done:
+  gZlib.deflateEnd(&z);
+#endif
+} /* GzipOut */
+
+
+/*
+ * GzipIn
+ *
+ * arguments:
+ *   codecT *c: a codec reading gzip
+ *   size_t n: the bytes of the file already in c->big
+ *
+ * returns: none
+ */
+static void
+GzipIn(codecT* c, size_t n)
+{
+#ifdef HAVE_ZLIB
+  z_stream z;
+  ssize_t k;
+  int r = Z_OK;
+  bool ended = FALSE;
+
+  memset(&z, 0, sizeof(z));
+  if (gZlib.handle == NULL)
+    {
+      Fail(c, ZLIBSO " is not available", 0);
+      return;
+    }
+  if (gZlib.inflateInit2_(&z, 15 + 32, ZLIB_VERSION, sizeof(z)) != Z_OK)
+    {
+      Fail(c, "out of memory", 0);
+      return;
+    }
+  z.next_in = (Bytef*) c->big;
+  z.avail_in = n;
+  z.avail_out = 1;
+  for (;;)
+    {
+      if (z.avail_in == 0 && z.avail_out > 0)
+        { // zlib holds nothing more for the pipe
+          if ((k = Fill(c, c->file, c->big, CODECBUF, 1)) <= 0)
+            break;
+          z.next_in = (Bytef*) c->big;
+          z.avail_in = k;
+        }
+      z.next_out = (Bytef*) c->small;
+      z.avail_out = CODECCHUNK;
+      r = gZlib.inflate(&z, Z_NO_FLUSH);
+      if (r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR)
+        {
+          Fail(c, z.msg != NULL ? z.msg : "corrupt input", 0);
+          break;
+        }
+      if (!Put(c, c->pipe, c->small, CODECCHUNK - z.avail_out))
+        break;
+      ended = r == Z_STREAM_END;
+      if (ended) // another member may follow
+        gZlib.inflateReset(&z);
+    }
+  if (!ended && !c->broken)
+    Fail(c, "unexpected end of input", 0);
+  gZlib.inflateEnd(&z);
+#else
+  Fail(c, ZLIBSO " is not available", 0);
+#endif
+} /* GzipIn */
+
+
+/*
+ * PlainIn
+ *
+ * arguments:
+ *   codecT *c: a codec reading neither gzip nor zstd
+ *   size_t n: the bytes of the file already in c->big
+ *
+ * returns: none
+ */
+static void
+PlainIn(codecT* c, size_t n)
+{
+  ssize_t k = n;
+
+  while (k > 0 && Put(c, c->pipe, c->big, k))
+    k = Fill(c, c->file, c->big, CODECBUF, 1);
+} /* PlainIn */
@@ -0,0 +1,90 @@
+/***************************************************************************
+ *  Title: Codec
+ * -------------------------------------------------------------------------
+ *    Purpose: The compressed redirections <z and >z, which gzip or
+ *    zstd a command's input or output on a thread of the shell
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: codec.h,v $
+ ***************************************************************************/
+
+#ifndef __CODEC_H__
+#define __CODEC_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __CODEC_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* a file being compressed into or expanded from, by its own thread */
+typedef struct codec_t codecT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Start a compressed redirection
+ * ---------------------------------------------------------------------
+ *    Purpose: Opens the file and starts a thread that, for a file
+ *    opened to read, expands it into a pipe, and otherwise compresses
+ *    what comes out of a pipe into it. Output is zstd for a name
+ *    ending in .zst and gzip for any other; input is told by its
+ *    first bytes, and passed on as it is if it is neither. $ZLEVEL
+ *    sets the level and $ZTHREADS how many threads zstd uses.
+ *    Input: the file, the flags to open it with, and where to put
+ *    the codec
+ *    Output: the command's end of the pipe, close-on-exec, or -1 after
+ *    reporting an error
+ ***********************************************************************/
+EXTERN int
+CodecOpen(char*, int, codecT**);
+
+/***********************************************************************
+ *  Title: End a compressed redirection
+ * ---------------------------------------------------------------------
+ *    Purpose: Once every copy of the command's end of the pipe is
+ *    closed, waits for the thread to finish the file and reports any
+ *    error it met. Without waiting the thread is left to finish on
+ *    its own, for a job that was stopped.
+ *    Input: the codec and whether to wait
+ *    Output: FALSE if it waited and there was an error
+ ***********************************************************************/
+EXTERN bool
+CodecClose(codecT*, bool);
+
+/***********************************************************************
+ *  Title: Drop the codecs in a child
+ * ---------------------------------------------------------------------
+ *    Purpose: Closes, in a child just forked, the files and pipe ends
+ *    the codec threads of the shell use. The threads are not in the
+ *    child, and a copy of a pipe end would keep a reader from seeing
+ *    the end of its input.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+CodecForget();
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __CODEC_H__ */
@@ -0,0 +1,803 @@
+/***************************************************************************
+ *  Title: Edit
+ * -------------------------------------------------------------------------
+ *    Purpose: The line editor used when tsh reads commands from a
+ *    terminal
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: edit.c,v $
+ ***************************************************************************/
+#define __EDIT_IMPL__
+
+/************System include***********************************************/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "edit.h"
+#include "jobring.h"
+#include "runtime.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* keys read from the terminal at once */
+#define EDITKEYS 4096
+
+/* the width assumed of a terminal that does not say */
+#define EDITCOLS 80
+
+/* a common tail this short is written again rather than shifted */
+#define TAILCHEAP 4
+
+/* escape sequence states */
+#define ESC_NONE 0
+#define ESC_SEEN 1  /* after ESC */
+#define ESC_CSI 2   /* after ESC [ or ESC O, reading the number */
+#define ESC_MOD 3   /* after the ; of a modifier, which is ignored */
+
+/* the key sent by backspace; <termios.h> has CTRL() for the others */
+#define DEL 0x7f
+
+/************Global Variables*********************************************/
+
+/* keys read past the end of the last line */
+static char gKeys[EDITKEYS];
+static int gKeyNext = 0;
+static int gKeyLen = 0;
+
+/************Function Prototypes******************************************/
+/* the cells shown on a terminal of a given width */
+static int
+Width(int);
+/* reads the terminal's width */
+static int
+Columns();
+/* inserts bytes at the cursor */
+static void
+Insert(editT*, char*, int);
+/* deletes a range of the line */
+static void
+Delete(editT*, int, int);
+/* finds the start of the next cell */
+static int
+Next(editT*, int);
+/* finds the start of the cell before */
+static int
+Prev(editT*, int);
+/* finds the start of a cell some cells back */
+static int
+Back(editT*, int, int);
+/* finds the start of the word before */
+static int
+WordBack(editT*, int);
+/* finds the end of the word after */
+static int
+WordOn(editT*, int);
+/* acts on the last byte of an escape sequence */
+static void
+EscapeKey(editT*, char);
+/* packs the bytes of a cell as they are shown */
+static unsigned
+Pack(char*, int);
+/* writes cells */
+static int
+PutCells(unsigned*, int, char*);
+/* moves the terminal's cursor */
+static int
+Move(editT*, int, unsigned*, char*);
+/* the length of a number in decimal */
+static int
+Digits(int);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+/*
+ * EditLine
+ *
+ * arguments:
+ *   char **buf: the line buffer, resized as necessary
+ *   int size: its size, less the NUL
+ *
+ * returns: int: 1 for a line, 0 at the end of input, or -1 if the
+ *               terminal is not the shell's to edit on
+ *
+ * The terminal is in raw mode only while the line is read, with
+ * signals off so ^C and ^Z are keys, and output processing left on
+ * for the jobs. Keys are read as many at a time as have arrived, and
+ * the screen is updated once they are all applied, in a single write:
+ * over a slow link a burst of typing or a paste costs one round of
+ * updates, not one per key. While waiting the output of background
+ * jobs is drained as it is for any other read of a command.
+ */
+int
+EditLine(char** buf, int size)
+{
+  struct termios saved, raw;
+  char out[EDITOUTMAX];
+  editT e;
+  int n;
+
+  if (!isatty(STDOUT_FILENO) || tcgetpgrp(STDIN_FILENO) != getpgrp()
+      || tcgetattr(STDIN_FILENO, &saved) != 0)
+    return -1;
+  raw = saved;
+  raw.c_iflag &= ~(ICRNL | INLCR | IXON | ISTRIP);
+  raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  fflush(stdout);
+  if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) != 0)
+    return -1;
+
+  EditStart(&e, buf, size, Columns());
+  while (!e.done)
+    {
+      if (gKeyNext == gKeyLen)
+        {
+          if ((n = EditRender(&e, Columns(), out)) > 0)
+            n = write(STDOUT_FILENO, out, n);
+          JobOutWait(STDIN_FILENO);
+          if ((n = read(STDIN_FILENO, gKeys, sizeof(gKeys))) < 0
+              && errno == EINTR)
+            continue;
+          if (n <= 0)
+            {
+              e.done = -1;
+              break;
+            }
+          gKeyNext = 0;
+          gKeyLen = n;
+        }
+      gKeyNext += EditKeys(&e, gKeys + gKeyNext, gKeyLen - gKeyNext);
+    }
+  n = EditRender(&e, Columns(), out);
+  if (e.cancel)
+    {
+      out[n++] = '^';
+      out[n++] = 'C';
+      e.len = 0;
+      (*buf)[0] = '\0';
+    }
+  if (e.done > 0 || e.len > 0)
+    {
+      out[n++] = '\r';
+      out[n++] = '\n';
+    }
+  if (n > 0)
+    n = write(STDOUT_FILENO, out, n);
+  tcsetattr(STDIN_FILENO, TCSADRAIN, &saved);
+  return e.done > 0 || e.len > 0;
+} /* EditLine */
+
+
+/*
+ * EditStart
+ *
+ * arguments:
+ *   editT *e: the editor
+ *   char **buf: the line buffer
+ *   int size: its size, less the NUL
+ *   int cols: the width of the terminal
+ *
+ * returns: none
+ */
+void
+EditStart(editT* e, char** buf, int size, int cols)
+{
+  e->buf = buf;
+  e->max = size;
+  e->len = e->pos = e->off = 0;
+  e->width = Width(cols);
+  e->done = 0;
+  e->esc = ESC_NONE;
+  e->arg = 0;
+  e->nshown = e->col = 0;
+  e->clear = e->cancel = FALSE;
+  (*buf)[0] = '\0';
+} /* EditStart */
+
+
+/*
+ * EditKeys
+ *
+ * arguments:
+ *   editT *e: the editor
+ *   char *keys: the keys
+ *   int n: their number
+ *
+ * returns: int: the number of keys used, fewer than n if one ended
+ *               the line
+ *
+ * The keys are those of emacs mode in other shells: ^A and ^E go to
+ * the start and end, ^B and ^F, or the arrows, move a character, ESC b
+ * and ESC f a word. Backspace and ^D delete, ^K, ^U and ^W cut to the
+ * end, to the start or the word before. ^L clears the screen. ^C ends
+ * the line, which EditLine then drops, and ^D on an empty line is the
+ * end of input. A run of plain characters, as in a paste, is inserted
+ * in one go.
+ */
+int
+EditKeys(editT* e, char* keys, int n)
+{
+  int i, j;
+
+  for (i = 0; i < n && !e->done; i++)
+    {
+      unsigned char c = keys[i];
+
+      if (e->esc == ESC_SEEN)
+        {
+          e->esc = ESC_NONE;
+          if (c == '[' || c == 'O')
+            {
+              e->esc = ESC_CSI;
+              e->arg = 0;
+            }
+          else if (c == 'b')
+            e->pos = WordBack(e, e->pos);
+          else if (c == 'f')
+            e->pos = WordOn(e, e->pos);
+          continue;
+        }
+      if (e->esc == ESC_CSI && c >= '0' && c <= '9')
+        {
+          if (e->arg < 1000)
+            e->arg = e->arg * 10 + c - '0';
+          continue;
+        }
+      if (e->esc != ESC_NONE)
+        {
+          if (c == '\033')
+            e->esc = ESC_SEEN;
+          else if (c == ';')
+            e->esc = ESC_MOD;
+          else if (c >= 0x40 || c == '~')
+            {
+              e->esc = ESC_NONE;
+              EscapeKey(e, c);
+            }
+          continue;
+        }
+
+      switch (c)
+        {
+        case '\r':
+        case '\n':
+          e->done = 1;
+          break;
+        case CTRL('a'):
+          e->pos = 0;
+          break;
+        case CTRL('b'):
+          e->pos = Prev(e, e->pos);
+          break;
+        case CTRL('c'):
+          e->pos = e->len;
+          e->cancel = TRUE;
+          e->done = 1;
+          break;
+        case CTRL('d'):
+          if (e->len == 0)
+            e->done = -1;
+          else
+            Delete(e, e->pos, Next(e, e->pos));
+          break;
+        case CTRL('e'):
+          e->pos = e->len;
+          break;
+        case CTRL('f'):
+          e->pos = Next(e, e->pos);
+          break;
+        case CTRL('h'):
+        case DEL:
+          Delete(e, Prev(e, e->pos), e->pos);
+          break;
+        case CTRL('k'):
+          Delete(e, e->pos, e->len);
+          break;
+        case CTRL('l'):
+          e->clear = TRUE;
+          break;
+        case CTRL('u'):
+          Delete(e, 0, e->pos);
+          break;
+        case CTRL('w'):
+          Delete(e, WordBack(e, e->pos), e->pos);
+          break;
+        case '\033':
+          e->esc = ESC_SEEN;
+          break;
+        default:
+          if (c < ' ' && c != '\t')
+            break;
+          for (j = i + 1; j < n && keys[j] != DEL
+                 && ((unsigned char) keys[j] >= ' ' || keys[j] == '\t'); j++)
+            ;
+          Insert(e, keys + i, j - i);
+          i = j - 1;
+        }
+    }
+  return i;
+} /* EditKeys */
+
+
+/*
+ * EditRender
+ *
+ * arguments:
+ *   editT *e: the editor
+ *   int cols: the width of the terminal
+ *   char *out: EDITOUTMAX bytes
+ *
+ * returns: int: the number of bytes put in out
+ *
+ * The window is moved only when the cursor leaves it, and then by half
+ * its width, so scrolling along a long line redraws it now and then
+ * rather than on every key. The new cells are compared with those
+ * shown: the common start is left alone, and so is a common tail, by
+ * inserting or deleting characters in front of it, unless it is short
+ * enough to write out again for less. Cursor motion takes whichever of
+ * backspaces, a carriage return, rewriting cells or an escape sequence
+ * is shortest. The column the line starts at is taken as the first.
+ */
+int
+EditRender(editT* e, int cols, char* out)
+{
+  unsigned cells[EDITMAXW];
+  int w = Width(cols);
+  int o = 0, n, cur, a, b, om, nm, k, i;
+
+  if (e->clear)
+    {
+      o += sprintf(out + o, "\033[H\033[2J");
+      e->nshown = e->col = 0;
+      e->clear = FALSE;
+    }
+  if (w != e->width)
+    { // what was shown may have been cut or wrapped
+      if (e->nshown > 0 || e->col > 0)
+        o += sprintf(out + o, "\r\033[K");
+      e->nshown = e->col = 0;
+      e->width = w;
+    }
+
+  if (e->pos < e->off)
+    e->off = Back(e, e->pos, w / 2);
+  else
+    {
+      for (i = e->off, k = 0; i < e->pos && k < w; k++)
+        i = Next(e, i);
+      if (k == w)
+        e->off = Back(e, e->pos, w / 2);
+    }
+  cur = 0;
+  for (i = e->off, n = 0; i < e->len && n < w; n++)
+    {
+      k = Next(e, i);
+      if (i <= e->pos && e->pos < k)
+        cur = n;
+      cells[n] = Pack(*e->buf + i, k - i);
+      i = k;
+    }
+  if (i == e->pos)
+    cur = n;
+
+  for (a = 0; a < n && a < e->nshown && cells[a] == e->shown[a]; a++)
+    ;
+  for (b = 0; b < n - a && b < e->nshown - a
+         && cells[n - 1 - b] == e->shown[e->nshown - 1 - b]; b++)
+    ;
+  if (a < n || a < e->nshown)
+    {
+      if (b <= TAILCHEAP)
+        b = 0;
+      om = e->nshown - a - b;
+      nm = n - a - b;
+      o += Move(e, a, e->shown, out + o);
+      if (b == 0)
+        {
+          o += PutCells(cells + a, nm, out + o);
+          if (om > nm)
+            o += sprintf(out + o, "\033[K");
+        }
+      else
+        {
+          k = om < nm ? om : nm;
+          o += PutCells(cells + a, k, out + o);
+          if (nm > om)
+            {
+              o += sprintf(out + o, "\033[%d@", nm - om);
+              o += PutCells(cells + a + k, nm - om, out + o);
+            }
+          else if (om > nm)
+            o += sprintf(out + o, "\033[%dP", om - nm);
+        }
+      e->col = a + nm;
+    }
+  o += Move(e, cur, cells, out + o);
+  memcpy(e->shown, cells, sizeof(unsigned) * n);
+  e->nshown = n;
+  return o;
+} /* EditRender */
+
+
+/*
+ * Width
+ *
+ * arguments:
+ *   int cols: the width of the terminal
+ *
+ * returns: int: the cells of a line shown at once
+ *
+ * The last column is kept free, as writing there makes some terminals
+ * wrap.
+ */
+static int
+Width(int cols)
+{
+  if (cols - 1 > EDITMAXW)
+    return EDITMAXW;
+  return cols > 2 ? cols - 1 : 1;
+} /* Width */
+
+
+/*
+ * Columns
+ *
+ * arguments: none
+ *
+ * returns: int: the width of the terminal on stdout
+ */
+static int
+Columns()
+{
+  struct winsize ws;
+
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != 0 || ws.ws_col == 0)
+    return EDITCOLS;
+  return ws.ws_col;
+} /* Columns */
+
+
+/*
+ * Insert
+ *
+ * arguments:
+ *   editT *e: the editor
+ *   char *s: the bytes
+ *   int n: their number
+ *
+ * returns: none
+ */
+static void
+Insert(editT* e, char* s, int n)
+{
+  if (e->len + n > e->max)
+    {
+      e->max = (e->len + n) * 2;
+      *e->buf = realloc(*e->buf, e->max + 1);
+    }
+  memmove(*e->buf + e->pos + n, *e->buf + e->pos, e->len - e->pos + 1);
+  memcpy(*e->buf + e->pos, s, n);
+  if (e->off > e->pos)
+    e->off += n;
+  e->len += n;
+  e->pos += n;
+} /* Insert */
+
+
+/*
+ * Delete
+ *
+ * arguments:
+ *   editT *e: the editor
+ *   int from: the first byte to delete
+ *   int to: the byte after the last
+ *
+ * returns: none
+ *
+ * Leaves the cursor, and the start of the window, where they were in
+ * what is left.
+ */
+static void
+Delete(editT* e, int from, int to)
+{
+  if (to <= from)
+    return;
+  memmove(*e->buf + from, *e->buf + to, e->len - to + 1);
+  e->len -= to - from;
+  if (e->pos >= to)
+    e->pos -= to - from;
+  else if (e->pos > from)
+    e->pos = from;
+  if (e->off >= to)
+    e->off -= to - from;
+  else if (e->off > from)
+    e->off = from;
+} /* Delete */
+
+
+/*
+ * Next
+ *
+ * arguments:
+ *   editT *e: the editor
+ *   int i: the start of a cell, or the end of the line
+ *
+ * returns: int: the start of the next cell, or the end of the line
+ *
+ * A cell is a byte and up to three UTF-8 continuation bytes, so a
+ * cell always fits in what Pack packs, even from bytes that are not
+ * UTF-8.
+ */
+static int
+Next(editT* e, int i)
+{
+  int k;
+
+  if (i >= e->len)
+    return e->len;
+  for (i++, k = 0; i < e->len && k < 3 && ((*e->buf)[i] & 0xc0) == 0x80;
+       i++, k++)
+    ;
+  return i;
+} /* Next */
+
+
+/*
+ * Prev
+ *
+ * arguments:
+ *   editT *e: the editor
+ *   int i: a position
+ *
+ * returns: int: the start of the cell before i, or of the one i is in,
+ *               or 0
+ *
+ * Stray continuation bytes, as in a paste of Latin-1, make cells that
+ * cannot be told apart going backwards, so the cells are found going
+ * forward from the byte before them that is not one.
+ */
+static int
+Prev(editT* e, int i)
+{
+  int j, k;
+
+  if (i <= 0)
+    return 0;
+  for (j = i - 1; j > 0 && ((*e->buf)[j] & 0xc0) == 0x80; j--)
+    ;
+  while ((k = Next(e, j)) < i)
+    j = k;
+  return j;
+} /* Prev */
+
+
+/*
+ * Back
+ *
+ * arguments:
+ *   editT *e: the editor
+ *   int i: the start of a cell
+ *   int k: how many cells back
+ *
+ * returns: int: the start of the cell k before i, or 0
+ */
+static int
+Back(editT* e, int i, int k)
+{
+  while (k-- > 0 && i > 0)
+    i = Prev(e, i);
+  return i;
+} /* Back */
+
+
+/*
+ * WordBack
+ *
+ * arguments:
+ *   editT *e: the editor
+ *   int i: a position
+ *
+ * returns: int: the start of the word i is in or after
+ */
+static int
+WordBack(editT* e, int i)
+{
+  while (i > 0 && (*e->buf)[i - 1] == ' ')
+    i--;
+  while (i > 0 && (*e->buf)[i - 1] != ' ')
+    i--;
+  return i;
+} /* WordBack */
+
+
+/*
+ * WordOn
+ *
+ * arguments:
+ *   editT *e: the editor
+ *   int i: a position
+ *
+ * returns: int: the end of the word i is in or before
+ */
+static int
+WordOn(editT* e, int i)
+{
+  while (i < e->len && (*e->buf)[i] == ' ')
+    i++;
+  while (i < e->len && (*e->buf)[i] != ' ')
+    i++;
+  return i;
+} /* WordOn */
+
+
+/*
+ * EscapeKey
+ *
+ * arguments:
+ *   editT *e: the editor
+ *   char c: the last byte of an ESC [ or ESC O sequence
+ *
+ * returns: none
+ *
+ * Handles the arrows, Home, End and Delete as xterm, the Linux console
+ * and screen send them; other keys are ignored.
+ */
+static void
+EscapeKey(editT* e, char c)
+{
+  switch (c)
+    {
+    case 'C':
+      e->pos = Next(e, e->pos);
+      break;
+    case 'D':
+      e->pos = Prev(e, e->pos);
+      break;
+    case 'H':
+      e->pos = 0;
+      break;
+    case 'F':
+      e->pos = e->len;
+      break;
+    case '~':
+      if (e->arg == 1 || e->arg == 7)
+        e->pos = 0;
+      else if (e->arg == 4 || e->arg == 8)
+        e->pos = e->len;
+      else if (e->arg == 3)
+        Delete(e, e->pos, Next(e, e->pos));
+      break;
+    }
+} /* EscapeKey */
+
+
+/*
+ * Pack
+ *
+ * arguments:
+ *   char *s: the bytes of a cell
+ *   int n: their number, 1 to 4
+ *
+ * returns: unsigned: the bytes, the first in the low byte
+ *
+ * A tab, the only control character a line holds, is shown as a
+ * space.
+ */
+static unsigned
+Pack(char* s, int n)
+{
+  unsigned cell = 0;
+
+  while (n-- > 0)
+    cell = (cell << 8) | (unsigned char) s[n];
+  if ((cell & 0xff) < ' ')
+    cell = (cell & ~0xff) | ' ';
+  return cell;
+} /* Pack */
+
+
+/*
+ * PutCells
+ *
+ * arguments:
+ *   unsigned *cells: packed cells
+ *   int n: their number
+ *   char *out: where to put their bytes
+ *
+ * returns: int: the number of bytes put
+ */
+static int
+PutCells(unsigned* cells, int n, char* out)
+{
+  int o = 0, i;
+  unsigned c;
+
+  for (i = 0; i < n; i++)
+    for (c = cells[i]; c != 0; c >>= 8)
+      out[o++] = c & 0xff;
+  return o;
+} /* PutCells */
+
+
+/*
+ * Move
+ *
+ * arguments:
+ *   editT *e: the editor
+ *   int to: the cell to move the terminal's cursor to
+ *   unsigned *cells: what the screen shows up to there
+ *   char *out: where to put the motion
+ *
+ * returns: int: the number of bytes put
+ */
+static int
+Move(editT* e, int to, unsigned* cells, char* out)
+{
+  int d = to - e->col, o = 0, i, bytes, left, cr;
+
+  if (d < 0)
+    {
+      left = 3 + Digits(-d);
+      cr = to == 0 ? 1 : 1 + 3 + Digits(to);
+      if (-d <= left && -d <= cr)
+        for (i = 0; i < -d; i++)
+          out[o++] = '\b';
+      else if (cr < left)
+        {
+          out[o++] = '\r';
+          if (to > 0)
+            o += sprintf(out + o, "\033[%dC", to);
+        }
+      else
+        o += sprintf(out + o, "\033[%dD", -d);
+    }
+  else if (d > 0)
+    {
+      for (i = e->col, bytes = 0; i < to; i++)
+        bytes += cells[i] > 0xffffff ? 4 : cells[i] > 0xffff ? 3
+          : cells[i] > 0xff ? 2 : 1;
+      if (bytes <= 3 + Digits(d))
+        o += PutCells(cells + e->col, d, out);
+      else
+        o += sprintf(out + o, "\033[%dC", d);
+    }
+  e->col = to;
+  return o;
+} /* Move */
+
+
+/*
+ * Digits
+ *
+ * arguments:
+ *   int n: a number, not negative
+ *
+ * returns: int: how many digits it has
+ */
+static int
+Digits(int n)
+{
+  int d = 1;
+
+  while (n >= 10)
+    {
+      n /= 10;
+      d++;
+    }
+  return d;
+} /* Digits */
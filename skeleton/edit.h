@@ -0,0 +1,124 @@
+/***************************************************************************
+ *  Title: Edit
+ * -------------------------------------------------------------------------
+ *    Purpose: The line editor used when tsh reads commands from a
+ *    terminal
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: edit.h,v $
+ ***************************************************************************/
+
+#ifndef __EDIT_H__
+#define __EDIT_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __EDIT_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* the most cells of a line shown at once, whatever the terminal */
+#define EDITMAXW 1024
+
+/* the most EditRender writes for one update */
+#define EDITOUTMAX (4 * EDITMAXW + 64)
+
+/*
+ * A line being edited. Positions are byte offsets into the line; a
+ * cell is one character on the screen, the bytes of one UTF-8
+ * sequence. A line wider than the screen is shown through a window
+ * of width cells starting at off. shown is what the terminal has now,
+ * from the column the line started at, so an update only sends what
+ * changed.
+ */
+typedef struct edit_t
+{
+  char** buf;   /* the caller's line, grown as needed */
+  int max;      /* bytes *buf holds, less the NUL */
+  int len;      /* bytes in the line */
+  int pos;      /* the cursor */
+  int off;      /* the first byte shown */
+  int width;    /* cells shown, one less than the terminal has */
+  int done;     /* 1 once the line is entered, -1 at the end of input */
+  int esc;      /* how far into an escape sequence the keys are */
+  int arg;      /* the number in it */
+  int nshown;
+  int col;      /* the cell the terminal's cursor is on */
+  bool clear;   /* the screen is to be cleared first */
+  bool cancel;  /* the line was ended with ^C */
+  unsigned shown[EDITMAXW]; /* each cell's bytes, packed */
+} editT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Read a line from the terminal
+ * ---------------------------------------------------------------------
+ *    Purpose: Puts the terminal in raw mode and reads a line with the
+ *    editor, sending each batch of keys one write of updates. Keys
+ *    typed past the end of the line are kept for the next call.
+ *    Input: pointer to the buffer (resized as necessary) & its size
+ *    Output: 1 for a line, 0 at the end of input, -1 if stdin and
+ *    stdout are not the terminal of the shell's process group
+ ***********************************************************************/
+EXTERN int
+EditLine(char**, int);
+
+/***********************************************************************
+ *  Title: Start editing a line
+ * ---------------------------------------------------------------------
+ *    Purpose: Empties the line and assumes an empty screen row.
+ *    Input: the editor, the buffer and its size, and the width of
+ *    the terminal
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+EditStart(editT*, char**, int, int);
+
+/***********************************************************************
+ *  Title: Apply keys to a line
+ * ---------------------------------------------------------------------
+ *    Purpose: Edits the line as the keys say, stopping after the one
+ *    that ends it. Escape sequences may be split between calls.
+ *    Input: the editor and the keys
+ *    Output: the number of keys used
+ ***********************************************************************/
+EXTERN int
+EditKeys(editT*, char*, int);
+
+/***********************************************************************
+ *  Title: Update the screen
+ * ---------------------------------------------------------------------
+ *    Purpose: Works out the fewest bytes that bring the terminal from
+ *    what it shows to the line as it is now, in cells the window
+ *    covers, which bounds the cost on a line of any length.
+ *    Input: the editor, the terminal's width, and EDITOUTMAX bytes to
+ *    put the output in
+ *    Output: the number of bytes put there
+ ***********************************************************************/
+EXTERN int
+EditRender(editT*, int, char*);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __EDIT_H__ */
@@ -0,0 +1,289 @@
+/***************************************************************************
+ *  Title: Enable
+ * -------------------------------------------------------------------------
+ *    Purpose: Builtins loaded from shared objects with "enable -f"
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: enable.c,v $
+ ***************************************************************************/
+#define __ENABLE_IMPL__
+
+/************System include***********************************************/
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/************Private include**********************************************/
+#include "enable.h"
+#include "io.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* what the symbol of a builtin is called, after its name */
+#define SYMSUFFIX "_builtin"
+
+/*
+ * A loaded builtin. Each holds its own handle on the shared object,
+ * so the object stays mapped until the last of its builtins is
+ * unloaded.
+ */
+typedef struct loaded_t
+{
+  char* name;
+  char* path;          /* as given to enable -f */
+  void* handle;
+  tshBuiltinT* builtin; /* in the shared object */
+} loadedT;
+
+/************Global Variables*********************************************/
+
+/* the loaded builtins, in the order they were loaded */
+static loadedT* gLoaded = NULL;
+static int gNLoaded = 0;
+static int gMaxLoaded = 0;
+
+/************Function Prototypes******************************************/
+/* loads one builtin from a shared object */
+static bool
+Load(char*, char*);
+/* unloads one builtin */
+static bool
+Unload(char*);
+/* finds the slot of a loaded builtin */
+static int
+LoadedIndex(char*);
+/* calls fini and closes the shared object of a slot */
+static void
+Release(loadedT*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+/*
+ * RunEnable
+ *
+ * arguments:
+ *   commandT *cmd: the enable command line
+ *
+ * returns: none
+ *
+ * Implements "enable -f lib.so name ...", "enable -d name ..." and
+ * "enable". Each name is loaded or unloaded on its own, so one that
+ * fails leaves the others be; $? is 1 if any failed. Without
+ * arguments, prints the enable command that would load each loaded
+ * builtin again.
+ */
+void
+RunEnable(commandT* cmd)
+{
+  int i, first;
+
+  if (cmd->argc == 1)
+    {
+      for (i = 0; i < gNLoaded; i++)
+        printf("enable -f %s %s\n", gLoaded[i].path, gLoaded[i].name);
+      return;
+    }
+  if (strcmp(cmd->argv[1], "-f") == 0 && cmd->argc > 3)
+    first = 3;
+  else if (strcmp(cmd->argv[1], "-d") == 0 && cmd->argc > 2)
+    first = 2;
+  else
+    {
+      fprintf(stderr, "usage: enable [-f lib.so name ... | -d name ...]\n");
+      lastStatus = 2;
+      return;
+    }
+  for (i = first; i < cmd->argc; i++)
+    if (!(first == 3 ? Load(cmd->argv[2], cmd->argv[i])
+          : Unload(cmd->argv[i])))
+      lastStatus = 1;
+} /* RunEnable */
+
+
+/*
+ * EnableFind
+ *
+ * arguments:
+ *   char *name: a command name
+ *
+ * returns: tshBuiltinT*: the loaded builtin of that name, or NULL
+ */
+tshBuiltinT*
+EnableFind(char* name)
+{
+  int i = LoadedIndex(name);
+
+  return i >= 0 ? gLoaded[i].builtin : NULL;
+} /* EnableFind */
+
+
+/*
+ * EnableCleanup
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Unloads the builtins in the reverse of the order they were loaded
+ * in, as their objects' own destructors would run.
+ */
+void
+EnableCleanup()
+{
+  while (gNLoaded > 0)
+    Release(&gLoaded[--gNLoaded]);
+  free(gLoaded);
+  gLoaded = NULL;
+  gMaxLoaded = 0;
+} /* EnableCleanup */
+
+
+/*
+ * Load
+ *
+ * arguments:
+ *   char *path: the shared object
+ *   char *name: the builtin
+ *
+ * returns: bool: FALSE after reporting why the builtin was not loaded
+ *
+ * The object is opened with RTLD_NOW, so a missing symbol is found
+ * here rather than the first time the builtin runs, and RTLD_LOCAL,
+ * so builtins in different objects may use the same names.
+ */
+static bool
+Load(char* path, char* name)
+{
+  char sym[strlen(name) + sizeof(SYMSUFFIX)];
+  tshBuiltinT* b;
+  loadedT* l;
+  void* handle;
+
+  if (IsShellBuiltIn(name) || LoadedIndex(name) >= 0)
+    {
+      fprintf(stderr, "%s: enable: %s: already a builtin\n", SHELLNAME, name);
+      return FALSE;
+    }
+  if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL)
+    {
+      fprintf(stderr, "%s: enable: %s\n", SHELLNAME, dlerror());
+      return FALSE;
+    }
+  sprintf(sym, "%s%s", name, SYMSUFFIX);
+  if ((b = dlsym(handle, sym)) == NULL)
+    {
+      fprintf(stderr, "%s: enable: %s: no %s\n", SHELLNAME, path, sym);
+      dlclose(handle);
+      return FALSE;
+    }
+  if (b->abi != TSH_BUILTIN_ABI)
+    {
+      fprintf(stderr, "%s: enable: %s: ABI %d, not %d\n", SHELLNAME, name,
+              b->abi, TSH_BUILTIN_ABI);
+      dlclose(handle);
+      return FALSE;
+    }
+  if (b->run == NULL)
+    {
+      fprintf(stderr, "%s: enable: %s: no run function\n", SHELLNAME, name);
+      dlclose(handle);
+      return FALSE;
+    }
+  if (b->init != NULL && b->init() != 0)
+    {
+      fprintf(stderr, "%s: enable: %s: init failed\n", SHELLNAME, name);
+      dlclose(handle);
+      return FALSE;
+    }
+
+  if (gNLoaded == gMaxLoaded)
+    {
+      gMaxLoaded = gMaxLoaded * 2 + 4;
+      gLoaded = realloc(gLoaded, sizeof(loadedT) * gMaxLoaded);
+    }
+  l = &gLoaded[gNLoaded++];
+  l->name = strdup(name);
+  l->path = strdup(path);
+  l->handle = handle;
+  l->builtin = b;
+  return TRUE;
+} /* Load */
+
+
+/*
+ * Unload
+ *
+ * arguments:
+ *   char *name: a loaded builtin
+ *
+ * returns: bool: FALSE after reporting that it is not loaded
+ */
+static bool
+Unload(char* name)
+{
+  int i = LoadedIndex(name);
+
+  if (i < 0)
+    {
+      fprintf(stderr, "%s: enable: %s: not loaded\n", SHELLNAME, name);
+      return FALSE;
+    }
+  Release(&gLoaded[i]);
+  memmove(&gLoaded[i], &gLoaded[i + 1], sizeof(loadedT) * (gNLoaded - i - 1));
+  gNLoaded--;
+  return TRUE;
+} /* Unload */
+
+
+/*
+ * LoadedIndex
+ *
+ * arguments:
+ *   char *name: a command name
+ *
+ * returns: int: the slot of the loaded builtin of that name, or -1
+ *
+ * There are seldom more than a few, and none at all unless enable -f
+ * was used, so every command pays at most a short scan.
+ */
+static int
+LoadedIndex(char* name)
+{
+  int i;
+
+  for (i = 0; i < gNLoaded; i++)
+    if (strcmp(gLoaded[i].name, name) == 0)
+      return i;
+  return -1;
+} /* LoadedIndex */
+
+
+/*
+ * Release
+ *
+ * arguments:
+ *   loadedT *l: a loaded builtin
+ *
+ * returns: none
+ *
+ * Frees the slot's strings; the slot itself is the caller's.
+ */
+static void
+Release(loadedT* l)
+{
+  fflush(stdout); // fini may write too
+  if (l->builtin->fini != NULL)
+    l->builtin->fini();
+  dlclose(l->handle);
+  free(l->name);
+  free(l->path);
+} /* Release */
@@ -0,0 +1,79 @@
+/***************************************************************************
+ *  Title: Enable
+ * -------------------------------------------------------------------------
+ *    Purpose: Builtins loaded from shared objects with "enable -f"
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: enable.h,v $
+ ***************************************************************************/
+
+#ifndef __ENABLE_H__
+#define __ENABLE_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "runtime.h"
+#include "tshbuiltin.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __ENABLE_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Run the enable builtin
+ * ---------------------------------------------------------------------
+ *    Purpose: Implements "enable -f lib.so name ...", which loads
+ *    builtins from a shared object, "enable -d name ...", which
+ *    unloads them, and "enable", which lists the loaded ones.
+ *    Input: the enable command line
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RunEnable(commandT*);
+
+/***********************************************************************
+ *  Title: Find a loaded builtin
+ * ---------------------------------------------------------------------
+ *    Purpose: Looks a command name up among the builtins enable has
+ *    loaded.
+ *    Input: the name
+ *    Output: the builtin, or NULL if none of that name is loaded
+ ***********************************************************************/
+EXTERN tshBuiltinT*
+EnableFind(char*);
+
+/***********************************************************************
+ *  Title: Unload every builtin
+ * ---------------------------------------------------------------------
+ *    Purpose: Calls the fini of each loaded builtin and closes the
+ *    shared objects. Called once when the shell exits.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+EnableCleanup();
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __ENABLE_H__ */
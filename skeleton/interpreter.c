@@ -49,11 +49,18 @@
 #include <sys/param.h>
 #include <unistd.h>
 #include "string.h"
+#if defined(__x86_64__) && !defined(TSH_NO_SIMD)
+#define TOK_SIMD
+#include <immintrin.h>
+#endif
 
 /************Private include**********************************************/
 #include "interpreter.h"
 #include "io.h"
+#include "metrics.h"
+#include "probe.h"
 #include "runtime.h"
+#include "script.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -72,14 +79,6 @@ int MAXARGS = 100;
 
 /**************Function Prototypes******************************************/
 
-commandT*
-getCommand(char* cmdLine);
-
-void
-freeCommand(commandT* cmd);
-
-int
-doesFileExist(const char * name);
 /**************Implementation***********************************************/
 
 /*
@@ -91,18 +90,191 @@ doesFileExist(const char * name);
  * returns: none
  *
  * This is the high-level function called by tsh's main to interpret a
- * command line.
+ * command line. The line is handed to the script compiler, which runs
+ * it once any if/while/for/function it opens has been closed.
  */
 void
 Interpret(char* cmdLine)
 {
-  commandT* cmd = getCommand(cmdLine);
-  RunCmd(cmd);
+  MetricsAdd(M_LINES);
+  ScriptFeed(cmdLine);
   fflush(stdout);
-  freeCommand(cmd);
 } /* Interpret */
 
 
+/*
+ * plainRunScalar
+ *
+ * arguments:
+ *   const char *s: pointer into the command line
+ *   size_t n: number of bytes left on the line
+ *   char quote: the active quote character, or 0 if unquoted
+ *
+ * returns: size_t: length of the leading run of plain characters
+ *
+ * Portable version of the plain-run scanner. Outside quotes the
+ * special characters are space, both quotes and backslash; inside a
+ * quoted string only the active quote and backslash are special.
+ */
+static size_t
+plainRunScalar(const char* s, size_t n, char quote)
+{
+  size_t i;
+
+  if (quote != 0)
+    {
+      for (i = 0; i < n; i++)
+        if (s[i] == quote || s[i] == '\\')
+          break;
+      return i;
+    }
+  for (i = 0; i < n; i++)
+    if (s[i] == ' ' || s[i] == '\'' || s[i] == '"' || s[i] == '\\')
+      break;
+  return i;
+} /* plainRunScalar */
+
+
+#ifdef TOK_SIMD
+/*
+ * plainRunSSE2
+ *
+ * Same contract as plainRunScalar. Compares 16 bytes at a time
+ * against the special characters and stops at the first hit; the
+ * tail shorter than a vector is handed to the scalar version.
+ */
+static size_t
+plainRunSSE2(const char* s, size_t n, char quote)
+{
+  __m128i c0, c1, c2, c3;
+  size_t i = 0;
+
+  if (quote != 0)
+    {
+      c0 = c2 = _mm_set1_epi8(quote);
+      c1 = c3 = _mm_set1_epi8('\\');
+    }
+  else
+    {
+      c0 = _mm_set1_epi8(' ');
+      c1 = _mm_set1_epi8('\'');
+      c2 = _mm_set1_epi8('"');
+      c3 = _mm_set1_epi8('\\');
+    }
+
+  for (; i + 16 <= n; i += 16)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*) (s + i));
+      __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, c0),
+                                              _mm_cmpeq_epi8(v, c1)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, c2),
+                                              _mm_cmpeq_epi8(v, c3)));
+      int mask = _mm_movemask_epi8(hit);
+      if (mask != 0)
+        return i + __builtin_ctz(mask);
+    }
+  return i + plainRunScalar(s + i, n - i, quote);
+} /* plainRunSSE2 */
+
+
+/*
+ * plainRunAVX2
+ *
+ * Same contract as plainRunScalar, 32 bytes at a time. Only called
+ * when the CPU reports AVX2 support.
+ */
+__attribute__((target("avx2")))
+static size_t
+plainRunAVX2(const char* s, size_t n, char quote)
+{
+  __m256i c0, c1, c2, c3;
+  size_t i = 0;
+
+  if (quote != 0)
+    {
+      c0 = c2 = _mm256_set1_epi8(quote);
+      c1 = c3 = _mm256_set1_epi8('\\');
+    }
+  else
+    {
+      c0 = _mm256_set1_epi8(' ');
+      c1 = _mm256_set1_epi8('\'');
+      c2 = _mm256_set1_epi8('"');
+      c3 = _mm256_set1_epi8('\\');
+    }
+
+  for (; i + 32 <= n; i += 32)
+    {
+      __m256i v = _mm256_loadu_si256((const __m256i*) (s + i));
+      __m256i hit = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, c0), _mm256_cmpeq_epi8(v, c1)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, c2), _mm256_cmpeq_epi8(v, c3)));
+      unsigned int mask = (unsigned int) _mm256_movemask_epi8(hit);
+      if (mask != 0)
+        return i + __builtin_ctz(mask);
+    }
+  return i + plainRunSSE2(s + i, n - i, quote);
+} /* plainRunAVX2 */
+#endif /* TOK_SIMD */
+
+
+/*
+ * plainRun
+ *
+ * Dispatches to the widest plain-run scanner the CPU supports. The
+ * choice is made once, on the first call.
+ */
+static size_t
+plainRun(const char* s, size_t n, char quote)
+{
+#ifdef TOK_SIMD
+  static size_t (*scan)(const char*, size_t, char) = NULL;
+
+  if (scan == NULL)
+    {
+      __builtin_cpu_init();
+      scan = __builtin_cpu_supports("avx2") ? plainRunAVX2 : plainRunSSE2;
+    }
+  return scan(s, n, quote);
+#else
+  return plainRunScalar(s, n, quote);
+#endif
+} /* plainRun */
+
+
+/*
+ * pushArg
+ *
+ * arguments:
+ *   commandT **cmdp: the command being built; may be reallocated
+ *   int *maxArgs: number of argv slots allocated in *cmdp
+ *   char *arg: the argument text
+ *   int len: length of the argument text
+ *
+ * returns: none
+ *
+ * Appends a copy of the argument to argv, growing the command when
+ * it runs out of slots. argv stays NULL-terminated.
+ */
+static void
+pushArg(commandT** cmdp, int* maxArgs, char* arg, int len)
+{
+  commandT* cmd = *cmdp;
+
+  if (cmd->argc + 1 >= *maxArgs)
+    {
+      *maxArgs *= 2;
+      cmd = realloc(cmd, sizeof(commandT) + sizeof(char*) * *maxArgs);
+      *cmdp = cmd;
+    }
+  cmd->argv[cmd->argc] = malloc(sizeof(char) * (len + 1));
+  memcpy(cmd->argv[cmd->argc], arg, len);
+  cmd->argv[cmd->argc][len] = 0;
+  cmd->argc++;
+  cmd->argv[cmd->argc] = 0;
+} /* pushArg */
+
+
 /*
  * getCommand
  *
@@ -118,29 +290,50 @@ Interpret(char* cmdLine)
  *
  * This function tokenizes the input, preserving quoted strings. It
  * supports escaping quotes and the escape character, '\'.
+ *
+ * Runs of characters that cannot change the tokenizer state are found
+ * with plainRun and copied in one go; only the special characters go
+ * through the per-character state machine below. There is no limit
+ * on the number or length of arguments.
  */
 commandT*
 getCommand(char* cmdLine)
 {
-  commandT* cmd = malloc(sizeof(commandT) + sizeof(char*) * MAXARGS);
+  int maxArgs = MAXARGS;
+  long long t = PROBE_CLOCK(parse_done);
+  PROBE1(parse_start, cmdLine);
+  commandT* cmd = malloc(sizeof(commandT) + sizeof(char*) * maxArgs);
   cmd->argv[0] = 0;
   cmd->name = 0;
   cmd->argc = 0;
 
-  int i, inArg = 0;
+  size_t i, run, len = strlen(cmdLine);
+  int inArg = 0;
   char quote = 0;
   char escape = 0;
 
-  // Set up the initial empty argument
-  char* tmp = malloc(sizeof(char*) * BUFSIZE);
+  // Set up the initial empty argument. No argument is longer than
+  // the line it came from.
+  char* tmp = malloc(sizeof(char) * (len + 1));
   int tmpLen = 0;
   tmp[0] = 0;
 
-  //printf("parsing:%s\n", cmdLine);
-
-  for (i = 0; cmdLine[i] != 0; i++)
+  for (i = 0; i < len; i++)
     {
-      //printf("\tindex %d, char %c\n", i, cmdLine[i]);
+      // Copy a run of plain characters in bulk.
+      if (escape == 0)
+        {
+          run = plainRun(cmdLine + i, len - i, quote);
+          if (run > 0)
+            {
+              memcpy(tmp + tmpLen, cmdLine + i, run);
+              tmpLen += run;
+              inArg = 1;
+              i += run;
+              if (i == len)
+                break;
+            }
+        }
 
       // Check for whitespace
       if (cmdLine[i] == ' ')
@@ -150,15 +343,9 @@ getCommand(char* cmdLine)
           if (quote == 0)
             {
               // End of an argument
-              //printf("\t\tend of argument %d, got:%s\n", cmd.argc, tmp);
-              cmd->argv[cmd->argc] = malloc(sizeof(char) * (tmpLen + 1));
-              strcpy(cmd->argv[cmd->argc], tmp);
-
+              pushArg(&cmd, &maxArgs, tmp, tmpLen);
               inArg = 0;
-              tmp[0] = 0;
               tmpLen = 0;
-              cmd->argc++;
-              cmd->argv[cmd->argc] = 0;
               continue;
             }
         }
@@ -173,14 +360,12 @@ getCommand(char* cmdLine)
             {
               // Escaped quote. Add it to the argument.
               tmp[tmpLen++] = cmdLine[i];
-              tmp[tmpLen] = 0;
               escape = 0;
               continue;
             }
 
           if (quote == 0)
             {
-              //printf("\t\tstarting quote around %c\n", cmdLine[i]);
               quote = cmdLine[i];
               continue;
             }
@@ -188,7 +373,6 @@ getCommand(char* cmdLine)
             {
               if (cmdLine[i] == quote)
                 {
-                  //printf("\t\tfound end quote %c\n", quote);
                   quote = 0;
                   continue;
                 }
@@ -200,7 +384,6 @@ getCommand(char* cmdLine)
         {
           escape = 0;
           tmp[tmpLen++] = '\\';
-          tmp[tmpLen] = 0;
           continue;
         }
 
@@ -208,10 +391,7 @@ getCommand(char* cmdLine)
       if (escape == '\\')
         {
           if (quote != 0)
-            {
-              tmp[tmpLen++] = '\\';
-              tmp[tmpLen] = 0;
-            }
+            tmp[tmpLen++] = '\\';
           escape = 0;
         }
 
@@ -223,26 +403,16 @@ getCommand(char* cmdLine)
         }
 
       tmp[tmpLen++] = cmdLine[i];
-      tmp[tmpLen] = 0;
     }
   // End the final argument, if any.
   if (tmpLen > 0)
-    {
-      //printf("\t\tend of argument %d, got:%s\n", cmd.argc, tmp);
-      cmd->argv[cmd->argc] = malloc(sizeof(char) * (tmpLen + 1));
-      strcpy(cmd->argv[cmd->argc], tmp);
-
-      inArg = 0;
-      tmp[0] = 0;
-      tmpLen = 0;
-      cmd->argc++;
-      cmd->argv[cmd->argc] = 0;
-    }
+    pushArg(&cmd, &maxArgs, tmp, tmpLen);
 
   free(tmp);
 
   cmd->name = cmd->argv[0];
 
+  PROBE3(parse_done, cmd->argv[0], cmd->argc, PROBE_SINCE(t));
   return cmd;
 } /* getCommand */
 
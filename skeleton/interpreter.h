@@ -33,6 +33,7 @@
 /************System include***********************************************/
 
 /************Private include**********************************************/
+#include "runtime.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -63,6 +64,27 @@
 EXTERN void
 Interpret(char*);
 
+/***********************************************************************
+ *  Title: Tokenizes a command line
+ * ---------------------------------------------------------------------
+ *    Purpose: Splits a command line into words, honoring quotes and
+ *    backslash escapes.
+ *    Input: a command line
+ *    Output: a command structure, to be released with freeCommand
+ ***********************************************************************/
+EXTERN commandT*
+getCommand(char*);
+
+/***********************************************************************
+ *  Title: Releases a tokenized command line
+ * ---------------------------------------------------------------------
+ *    Purpose: Frees a command structure returned by getCommand.
+ *    Input: the command structure
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+freeCommand(commandT*);
+
 /************External Declaration*****************************************/
 
 /**************Definition***************************************************/
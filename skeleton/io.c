@@ -34,9 +34,12 @@
  *    Milestone 1
  *
  ***************************************************************************/
+#define _GNU_SOURCE
 #define __IO_IMPL__
 
 /************System include***********************************************/
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -44,9 +47,18 @@
 #include <unistd.h>
 #include <termios.h>
 #include <assert.h>
+#include <poll.h>
+#include <linux/futex.h>
+#include <sys/param.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 
 /************Private include**********************************************/
 #include "io.h"
+#include "edit.h"
+#include "jobring.h"
+#include "probe.h"
 #include "runtime.h"
 
 /************Defines and Typedefs*****************************************/
@@ -56,12 +68,35 @@
  *  structures and arrays, line everything up in neat columns.
  */
 
+/* bytes asked of the kernel per copy_file_range, splice or sendfile */
+#define COPYCHUNK (1 << 30)
+/* buffer of the read/write loop CopyFd falls back on */
+#define COPYBUFSIZE (128 * 1024)
+
 /************Global Variables*********************************************/
 
 /* indicates that the standard input stream is currently read  */
 bool isReading = FALSE;
 
 /************Function Prototypes******************************************/
+/* tells whether the kernel refused a copy call for this pair of files */
+static bool
+CopyRefused(int);
+/* splices from or to a pipe */
+static ssize_t
+CopySplice(int, int, bool);
+/* copies by reading and writing through a buffer */
+static bool
+CopyLoop(int, int);
+/* sleeps until one of a ring's counts moves or the other side closes */
+static void
+SpscWait(spscT*, unsigned*, unsigned, int);
+/* wakes the other side of a ring if it sleeps */
+static void
+SpscWake(spscT*, unsigned*, int);
+/* tells whether stdin has input buffered that a poll would not see */
+static bool
+InputBuffered();
 
 /************External Declaration*****************************************/
 
@@ -151,30 +186,429 @@ IsReading()
                  from stdin
  *   int size: bytes allocated at *buf
  *
- * returns: none
+ * returns: bool: FALSE at the end of input, with nothing read
  *
  * Reads from standard input until it sees a newline or EOF. Stores
- * the string that was read at *buf.
+ * the string that was read at *buf. On the shell's terminal, the line
+ * is read with the editor instead (see EditLine).
  */
-void
+bool
 getCommandLine(char** buf, int size)
 {
-  char ch;
+  int ch;
   size_t used = 0;
   char* cmd = *buf;
+  long long t = PROBE_CLOCK(read_done);
   cmd[0] = '\0';
 
+  PROBE0(read_start);
   isReading = TRUE;
+  if (!InputBuffered() && (ch = EditLine(buf, size)) >= 0)
+    {
+      isReading = FALSE;
+      PROBE3(read_done, ch > 0 ? *buf : NULL, ch > 0 ? strlen(*buf) : 0,
+             PROBE_SINCE(t));
+      return ch > 0;
+    }
+  if (!InputBuffered())
+    JobOutWait(STDIN_FILENO);
   while (((ch = getc(stdin)) != EOF) && (ch != '\n'))
     {
       if (used == size)
         {
           size *= 2;
           cmd = realloc(cmd, sizeof(char) * (size + 1));
+          *buf = cmd;
         }
       cmd[used] = ch;
       used++;
       cmd[used] = '\0';
     }
   isReading = FALSE;
+  PROBE3(read_done, ch != EOF || used > 0 ? cmd : NULL, used,
+         PROBE_SINCE(t));
+  return ch != EOF || used > 0;
 } /* getCommandLine */
+
+
+/*
+ * InputBuffered
+ *
+ * arguments: none
+ *
+ * returns: bool: TRUE if getc(stdin) has bytes to return without
+ *                reading, or if that cannot be told
+ */
+static bool
+InputBuffered()
+{
+#ifdef __GLIBC__
+  return stdin->_IO_read_ptr < stdin->_IO_read_end;
+#else
+  return TRUE;
+#endif
+} /* InputBuffered */
+
+
+
+/*
+ * CopyFd
+ *
+ * arguments:
+ *   int in: descriptor to read until end of file
+ *   int out: descriptor to write
+ *
+ * returns: bool: FALSE after a read or write error, with errno set
+ *
+ * Copies in to out without bringing the data into the shell where
+ * the kernel can move it itself: copy_file_range between regular
+ * files (which may share extents instead of copying), splice when
+ * either side is a pipe, and sendfile from a regular file to anything
+ * else. A call the kernel refuses for this pair (a copy across file
+ * systems, an O_APPEND output, a terminal) falls through to the next,
+ * and last to a plain read/write loop, carrying on from wherever the
+ * file offsets were left.
+ */
+bool
+CopyFd(int in, int out)
+{
+  struct stat si, so;
+  ssize_t n;
+
+  if (fstat(in, &si) != 0 || fstat(out, &so) != 0)
+    return FALSE;
+  if (S_ISREG(si.st_mode) && S_ISREG(so.st_mode))
+    {
+      while ((n = copy_file_range(in, NULL, out, NULL, COPYCHUNK, 0)) > 0
+             || (n < 0 && errno == EINTR))
+        ;
+      if (n == 0)
+        return TRUE;
+      if (!CopyRefused(errno))
+        return FALSE;
+    }
+  if (S_ISFIFO(si.st_mode) || S_ISFIFO(so.st_mode))
+    {
+      n = CopySplice(in, out, S_ISFIFO(si.st_mode) && S_ISREG(so.st_mode));
+      if (n == 0)
+        return TRUE;
+      if (!CopyRefused(errno))
+        return FALSE;
+    }
+  if (S_ISREG(si.st_mode))
+    {
+      while ((n = sendfile(out, in, NULL, COPYCHUNK)) > 0
+             || (n < 0 && errno == EINTR))
+        ;
+      if (n == 0)
+        return TRUE;
+      if (!CopyRefused(errno))
+        return FALSE;
+    }
+  return CopyLoop(in, out);
+} /* CopyFd */
+
+
+/*
+ * CopySplice
+ *
+ * arguments:
+ *   int in: descriptor to read until end of file
+ *   int out: descriptor to write; one of the two is a pipe
+ *   bool wait: whether to poll for input before each splice
+ *
+ * returns: ssize_t: 0 at end of file, else -1 with errno set
+ *
+ * splice takes the offset of a regular file when it starts and
+ * stores it back when it returns, without the lock write holds. Left
+ * waiting on an empty pipe, it would put back an offset that other
+ * writers of the same open file (the shell, a job) have moved on
+ * since, and the next write would land over theirs. So with wait set
+ * the pipe is waited on first and then drained without blocking.
+ */
+static ssize_t
+CopySplice(int in, int out, bool wait)
+{
+  struct pollfd pfd = { in, POLLIN, 0 };
+  unsigned flags = SPLICE_F_MOVE | (wait ? SPLICE_F_NONBLOCK : 0);
+  ssize_t n;
+
+  for (;;)
+    {
+      if (wait && poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        return -1;
+      n = splice(in, NULL, out, NULL, COPYCHUNK, flags);
+      if (n <= 0 && !(n < 0 && (errno == EINTR || errno == EAGAIN)))
+        return n;
+    }
+} /* CopySplice */
+
+
+/*
+ * CopyRefused
+ *
+ * arguments:
+ *   int err: the errno of a failed copy_file_range, splice or sendfile
+ *
+ * returns: bool: TRUE if the call does not support these files, as
+ *                opposed to a real read or write error
+ */
+static bool
+CopyRefused(int err)
+{
+  return err == EINVAL || err == EXDEV || err == ENOSYS || err == EOPNOTSUPP
+    || err == EBADF || err == ESPIPE;
+} /* CopyRefused */
+
+
+/*
+ * CopyLoop
+ *
+ * arguments:
+ *   int in: descriptor to read until end of file
+ *   int out: descriptor to write
+ *
+ * returns: bool: FALSE after a read or write error, with errno set
+ */
+static bool
+CopyLoop(int in, int out)
+{
+  char* buf = malloc(COPYBUFSIZE);
+  ssize_t n, done, w;
+  bool ok = TRUE;
+
+  while (ok)
+    {
+      n = read(in, buf, COPYBUFSIZE);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        {
+          ok = n == 0;
+          break;
+        }
+      for (done = 0; done < n; done += w)
+        if ((w = write(out, buf + done, n - done)) < 0)
+          {
+            if (errno == EINTR)
+              w = 0;
+            else
+              {
+                ok = FALSE;
+                break;
+              }
+          }
+    }
+  free(buf);
+  return ok;
+} /* CopyLoop */
+
+
+/*
+ * SpscNew
+ *
+ * arguments:
+ *   unsigned size: the capacity in bytes, a power of two
+ *
+ * returns: spscT*: an empty ring
+ */
+spscT*
+SpscNew(unsigned size)
+{
+  spscT* r = aligned_alloc(64, sizeof(spscT));
+
+  memset(r, 0, sizeof(spscT));
+  r->buf = malloc(size);
+  r->size = size;
+  return r;
+} /* SpscNew */
+
+
+/*
+ * SpscRoom
+ *
+ * arguments:
+ *   spscT *r: the ring, as its writer
+ *   char **p: receives the address of the room
+ *
+ * returns: size_t: the room up to the end of the buffer, or 0 once
+ *                  the reader has closed
+ *
+ * Only the writer stores tail, so its own count needs no ordering;
+ * head is loaded with acquire so the reader is done with the bytes
+ * before they are written over.
+ */
+size_t
+SpscRoom(spscT* r, char** p)
+{
+  unsigned tail = r->tail, head, off;
+
+  for (;;)
+    {
+      if (__atomic_load_n(&r->closed, __ATOMIC_ACQUIRE) & SPSC_READER)
+        return 0;
+      head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+      if (tail - head < r->size)
+        break;
+      SpscWait(r, &r->head, head, SPSC_WRITER);
+    }
+  off = tail & (r->size - 1);
+  *p = r->buf + off;
+  return MIN(r->size - (tail - head), r->size - off);
+} /* SpscRoom */
+
+
+/*
+ * SpscPut
+ *
+ * arguments:
+ *   spscT *r: the ring, as its writer
+ *   size_t n: bytes written into the room SpscRoom returned
+ *
+ * returns: none
+ */
+void
+SpscPut(spscT* r, size_t n)
+{
+  __atomic_store_n(&r->tail, r->tail + n, __ATOMIC_SEQ_CST);
+  SpscWake(r, &r->tail, SPSC_READER);
+} /* SpscPut */
+
+
+/*
+ * SpscData
+ *
+ * arguments:
+ *   spscT *r: the ring, as its reader
+ *   char **p: receives the address of the data
+ *
+ * returns: size_t: the data up to the end of the buffer, or 0 at end
+ *                  of file
+ *
+ * tail is loaded again after the writer is seen closed: it puts its
+ * last bytes before closing.
+ */
+size_t
+SpscData(spscT* r, char** p)
+{
+  unsigned head = r->head, tail, off;
+  int closed;
+
+  for (;;)
+    {
+      closed = __atomic_load_n(&r->closed, __ATOMIC_ACQUIRE);
+      if (closed & SPSC_READER)
+        return 0;
+      tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+      if (tail != head)
+        break;
+      if (closed & SPSC_WRITER)
+        return 0;
+      SpscWait(r, &r->tail, tail, SPSC_READER);
+    }
+  off = head & (r->size - 1);
+  *p = r->buf + off;
+  return MIN(tail - head, r->size - off);
+} /* SpscData */
+
+
+/*
+ * SpscTake
+ *
+ * arguments:
+ *   spscT *r: the ring, as its reader
+ *   size_t n: bytes consumed of the data SpscData returned
+ *
+ * returns: none
+ */
+void
+SpscTake(spscT* r, size_t n)
+{
+  __atomic_store_n(&r->head, r->head + n, __ATOMIC_SEQ_CST);
+  SpscWake(r, &r->head, SPSC_WRITER);
+} /* SpscTake */
+
+
+/*
+ * SpscClose
+ *
+ * arguments:
+ *   spscT *r: the ring
+ *   int side: SPSC_READER, SPSC_WRITER or both
+ *
+ * returns: none
+ *
+ * Wakes whoever sleeps on either count, as either may be waiting for
+ * the close.
+ */
+void
+SpscClose(spscT* r, int side)
+{
+  __atomic_fetch_or(&r->closed, side, __ATOMIC_SEQ_CST);
+  SpscWake(r, &r->tail, SPSC_READER);
+  SpscWake(r, &r->head, SPSC_WRITER);
+} /* SpscClose */
+
+
+/*
+ * SpscFree
+ *
+ * arguments:
+ *   spscT *r: a ring both sides are done with
+ *
+ * returns: none
+ */
+void
+SpscFree(spscT* r)
+{
+  free(r->buf);
+  free(r);
+} /* SpscFree */
+
+
+/*
+ * SpscWait
+ *
+ * arguments:
+ *   spscT *r: the ring
+ *   unsigned *count: the other side's count
+ *   unsigned seen: its value when the ring was found full or empty
+ *   int side: the side going to sleep
+ *
+ * returns: none
+ *
+ * The side is marked waiting before the count and the closed flags
+ * are looked at again, and the other side stores them before looking
+ * at waiting, all sequentially consistent, so either this side sees
+ * the change or the other sees it waiting and wakes it. The futex
+ * only sleeps while the count is still seen.
+ */
+static void
+SpscWait(spscT* r, unsigned* count, unsigned seen, int side)
+{
+  int other = side == SPSC_READER ? SPSC_WRITER : SPSC_READER;
+
+  __atomic_fetch_or(&r->waiting, side, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(count, __ATOMIC_SEQ_CST) == seen
+      && !(__atomic_load_n(&r->closed, __ATOMIC_SEQ_CST) & (other | side)))
+    syscall(SYS_futex, count, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+  __atomic_fetch_and(&r->waiting, ~side, __ATOMIC_SEQ_CST);
+} /* SpscWait */
+
+
+/*
+ * SpscWake
+ *
+ * arguments:
+ *   spscT *r: the ring
+ *   unsigned *count: the count just stored
+ *   int side: the side that sleeps on it
+ *
+ * returns: none
+ */
+static void
+SpscWake(spscT* r, unsigned* count, int side)
+{
+  if (__atomic_load_n(&r->waiting, __ATOMIC_SEQ_CST) & side)
+    syscall(SYS_futex, count, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+} /* SpscWake */
@@ -54,6 +54,28 @@
 #define EXTERN extern
 #endif
 
+/* the sides of an spscT */
+#define SPSC_READER 1
+#define SPSC_WRITER 2
+
+/*
+ * A ring of bytes between two threads, one writing and one reading,
+ * with no lock: each side stores only its own count, and reads the
+ * other's. A side that finds the ring full or empty sleeps on the
+ * other's count with a futex, and is only woken if it said so in
+ * waiting. The counts wrap, size being a power of two, and are kept
+ * on cache lines of their own.
+ */
+typedef struct spsc_t
+{
+  char* buf;
+  unsigned size;
+  int waiting;   /* the sides asleep */
+  int closed;    /* the sides done with the ring */
+  unsigned head __attribute__ ((aligned(64)));  /* bytes read */
+  unsigned tail __attribute__ ((aligned(64)));  /* bytes written */
+} spscT;
+
 /************Global Variables*********************************************/
 
 /************Function Prototypes******************************************/
@@ -102,12 +124,103 @@ IsReading();
  *  Title: Read one command line from stdin
  * ---------------------------------------------------------------------
  *    Purpose: Reads one command line from stdin and returns it to the
- *    callee.
+ *    callee, letting the user edit it if stdin is a terminal.
  *    Input: pointer to the buffer (will be resized as necessary) & size
+ *    Output: FALSE at the end of input
+ ***********************************************************************/
+EXTERN bool
+getCommandLine(char**, int);
+
+/***********************************************************************
+ *  Title: Copy one descriptor to another
+ * ---------------------------------------------------------------------
+ *    Purpose: Copies everything left to read on the first descriptor
+ *    to the second, with copy_file_range, splice or sendfile when the
+ *    kernel supports the pair, else through a buffer.
+ *    Input: the descriptor to read and the one to write
+ *    Output: FALSE after an error, with errno set
+ ***********************************************************************/
+EXTERN bool
+CopyFd(int, int);
+
+/***********************************************************************
+ *  Title: Make a ring between two threads
+ * ---------------------------------------------------------------------
+ *    Purpose: Allocates an empty spscT.
+ *    Input: its size, a power of two
+ *    Output: the ring
+ ***********************************************************************/
+EXTERN spscT*
+SpscNew(unsigned);
+
+/***********************************************************************
+ *  Title: Find room in a ring
+ * ---------------------------------------------------------------------
+ *    Purpose: For the writer: waits until the ring has room and points
+ *    at it. What is put there is passed on by SpscPut.
+ *    Input: the ring and where to store the address of the room
+ *    Output: how many bytes there is room for in one piece, or 0 once
+ *    the reader is done
+ ***********************************************************************/
+EXTERN size_t
+SpscRoom(spscT*, char**);
+
+/***********************************************************************
+ *  Title: Pass bytes on
+ * ---------------------------------------------------------------------
+ *    Purpose: For the writer: hands the reader the first bytes of the
+ *    room SpscRoom found, waking it if it sleeps.
+ *    Input: the ring and the number of bytes
  *    Output: void
  ***********************************************************************/
 EXTERN void
-getCommandLine(char**, int);
+SpscPut(spscT*, size_t);
+
+/***********************************************************************
+ *  Title: Find data in a ring
+ * ---------------------------------------------------------------------
+ *    Purpose: For the reader: waits until the ring holds data and
+ *    points at it. The data stays until SpscTake.
+ *    Input: the ring and where to store the address of the data
+ *    Output: how many bytes there are in one piece, or 0 once the
+ *    writer is done and the ring is empty
+ ***********************************************************************/
+EXTERN size_t
+SpscData(spscT*, char**);
+
+/***********************************************************************
+ *  Title: Consume bytes
+ * ---------------------------------------------------------------------
+ *    Purpose: For the reader: gives the first bytes SpscData found back
+ *    to the writer, waking it if it sleeps.
+ *    Input: the ring and the number of bytes
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+SpscTake(spscT*, size_t);
+
+/***********************************************************************
+ *  Title: Be done with a ring
+ * ---------------------------------------------------------------------
+ *    Purpose: Marks one side of a ring, or both, as done and wakes the
+ *    other. A closed writer is end of file to the reader; a closed
+ *    reader makes SpscRoom return 0, as a closed pipe would fail a
+ *    write. Closing both stops both sides at once.
+ *    Input: the ring and SPSC_READER, SPSC_WRITER or both
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+SpscClose(spscT*, int);
+
+/***********************************************************************
+ *  Title: Free a ring
+ * ---------------------------------------------------------------------
+ *    Purpose: Frees a ring once both sides are done with it.
+ *    Input: the ring
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+SpscFree(spscT*);
 
 /************External Declaration*****************************************/
 
@@ -0,0 +1,420 @@
+/***************************************************************************
+ *  Title: Job rings
+ * -------------------------------------------------------------------------
+ *    Purpose: The tail of the output of background jobs, kept in a
+ *    ring per job number while JOBOUT is set, and the epoll set that
+ *    drains their pipes
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: jobring.c,v $
+ ***************************************************************************/
+#define _GNU_SOURCE
+#define __JOBRING_IMPL__
+
+/************System include***********************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/param.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "jobring.h"
+#include "io.h"
+#include "runtime.h"
+#include "script.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* pipe events OutDrain handles per epoll_wait */
+#define NEVENTS 64
+
+/*
+ * The tail of the output of a background job started while JOBOUT was
+ * set. The job's standard output and error are a pipe to the shell,
+ * which copies what arrives into buf, overwriting the oldest bytes.
+ * The ring outlives the job until its number is reused.
+ */
+typedef struct ring_t
+{
+  char* buf;
+  size_t size;
+  unsigned long long total; /* bytes ever read; the end is total % size */
+  int fd;       /* read end of the pipe, or -1 once it hit end of file */
+} ringT;
+
+/************Global Variables*********************************************/
+
+/* output rings, indexed by job number */
+static ringT** gRings = NULL;
+static int gMaxRings = 0;
+/* the pipes of the rings still open, with their ringT, and how many */
+static int gOutEpoll = -1;
+static int gNOut = 0;
+/* the job number a ring was last attached to */
+static int gLastRing = 0;
+
+/************Function Prototypes******************************************/
+/* copies what is in a ring's pipe into the ring */
+static void
+RingDrain(ringT*);
+/* releases a ring */
+static void
+RingFree(ringT*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+/*
+ * JobOutSize
+ *
+ * arguments: none
+ *
+ * returns: size_t: the bytes of output to keep per background job,
+ *                  or 0 to keep none
+ *
+ * JOBOUT, a shell or environment variable, is a number of bytes with
+ * an optional k or m suffix.
+ */
+size_t
+JobOutSize()
+{
+  char* v = GetVar("JOBOUT");
+  unsigned long long n;
+  char* end;
+
+  if (v == NULL || v[0] < '0' || v[0] > '9')
+    return 0;
+  n = strtoull(v, &end, 10);
+  if (*end == 'k' || *end == 'K')
+    n <<= 10;
+  else if (*end == 'm' || *end == 'M')
+    n <<= 20;
+  return n;
+} /* JobOutSize */
+
+
+/*
+ * RingAttach
+ *
+ * arguments:
+ *   int id: a job just numbered
+ *   int fd: the read end of its output pipe
+ *   size_t size: the bytes to keep
+ *
+ * returns: none
+ *
+ * The pipe is made non-blocking and added to the set OutDrain waits
+ * on, so its data is only read when the kernel says it is there. A
+ * ring kept from an earlier job with the number is dropped.
+ */
+void
+RingAttach(int id, int fd, size_t size)
+{
+  struct epoll_event ev;
+  ringT* r;
+
+  if (id >= gMaxRings)
+    {
+      gRings = realloc(gRings, sizeof(ringT*) * (id + 16));
+      memset(gRings + gMaxRings, 0, sizeof(ringT*) * (id + 16 - gMaxRings));
+      gMaxRings = id + 16;
+    }
+  RingDrop(id);
+  r = malloc(sizeof(ringT));
+  if ((r->buf = malloc(size)) == NULL)
+    {
+      PrintPError("jobs");
+      close(fd);
+      free(r);
+      return;
+    }
+  r->size = size;
+  r->total = 0;
+  r->fd = fd;
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  if (gOutEpoll < 0)
+    gOutEpoll = epoll_create1(EPOLL_CLOEXEC);
+  ev.events = EPOLLIN;
+  ev.data.ptr = r;
+  epoll_ctl(gOutEpoll, EPOLL_CTL_ADD, fd, &ev);
+  gRings[id] = r;
+  gLastRing = id;
+  gNOut++;
+} /* RingAttach */
+
+
+/*
+ * RingDrop
+ *
+ * arguments:
+ *   int id: a job number
+ *
+ * returns: none
+ */
+void
+RingDrop(int id)
+{
+  if (id < gMaxRings && gRings[id] != NULL)
+    {
+      RingFree(gRings[id]);
+      gRings[id] = NULL;
+    }
+} /* RingDrop */
+
+
+/*
+ * RingDrain
+ *
+ * arguments:
+ *   ringT *r: a ring whose pipe is open
+ *
+ * returns: none
+ *
+ * Reads straight into the ring, wrapping at its end, until the pipe
+ * is empty. At end of file, when every process of the job has exited
+ * or closed it, the pipe is closed.
+ */
+static void
+RingDrain(ringT* r)
+{
+  size_t at;
+  ssize_t n;
+
+  for (;;)
+    {
+      at = r->total % r->size;
+      if ((n = read(r->fd, r->buf + at, r->size - at)) > 0)
+        r->total += n;
+      else if (n < 0 && errno == EINTR)
+        continue;
+      else
+        break;
+    }
+  if (n == 0 || (n < 0 && errno != EAGAIN))
+    {
+      epoll_ctl(gOutEpoll, EPOLL_CTL_DEL, r->fd, NULL);
+      close(r->fd);
+      r->fd = -1;
+      gNOut--;
+    }
+} /* RingDrain */
+
+
+/*
+ * OutDrain
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Drains every ring whose pipe has data or has hit end of file.
+ */
+void
+OutDrain()
+{
+  struct epoll_event ev[NEVENTS];
+  int i, n;
+
+  if (gNOut == 0)
+    return;
+  do
+    {
+      n = epoll_wait(gOutEpoll, ev, NEVENTS, 0);
+      for (i = 0; i < n; i++)
+        RingDrain(ev[i].data.ptr);
+    }
+  while (n == NEVENTS);
+} /* OutDrain */
+
+
+/*
+ * OutFd
+ *
+ * arguments: none
+ *
+ * returns: int: the epoll set of the open ring pipes, or -1 if none
+ *               is open
+ */
+int
+OutFd()
+{
+  return gNOut > 0 ? gOutEpoll : -1;
+} /* OutFd */
+
+
+/*
+ * JobOutWait
+ *
+ * arguments:
+ *   int fd: a descriptor the caller is about to read
+ *
+ * returns: none
+ *
+ * Returns once fd is readable, draining the output rings meanwhile.
+ * Without a ring being filled, returns at once.
+ */
+void
+JobOutWait(int fd)
+{
+  struct pollfd fds[2];
+
+  while (gNOut > 0)
+    {
+      fds[0].fd = fd;
+      fds[1].fd = gOutEpoll;
+      fds[0].events = fds[1].events = POLLIN;
+      if (poll(fds, 2, -1) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return;
+        }
+      if (fds[1].revents & POLLIN)
+        OutDrain();
+      if (fds[0].revents != 0)
+        return;
+    }
+} /* JobOutWait */
+
+
+/*
+ * RingFree
+ *
+ * arguments:
+ *   ringT *r: a ring
+ *
+ * returns: none
+ */
+static void
+RingFree(ringT* r)
+{
+  if (r->fd >= 0)
+    {
+      epoll_ctl(gOutEpoll, EPOLL_CTL_DEL, r->fd, NULL);
+      close(r->fd);
+      gNOut--;
+    }
+  free(r->buf);
+  free(r);
+} /* RingFree */
+
+
+/*
+ * RingPrint
+ *
+ * arguments:
+ *   char *spec: "%N" or "N", or NULL for the current job or, if its
+ *               output is not kept, the last job whose output was
+ *   int cur: the number of the current job, or 0
+ *
+ * returns: none
+ *
+ * Writes the bytes the job's ring holds, oldest first, to standard
+ * output, less the part of a line the ring no longer holds all of.
+ * The ring of a finished job is kept until its number is reused.
+ */
+void
+RingPrint(char* spec, int cur)
+{
+  int id = cur;
+  ringT* r = NULL;
+  size_t len, start, from = 0, at, n;
+
+  if (spec != NULL)
+    id = atoi(spec[0] == '%' ? spec + 1 : spec);
+  else if (id == 0 || id >= gMaxRings || gRings[id] == NULL)
+    id = gLastRing;
+  if (id >= 1 && id < gMaxRings)
+    r = gRings[id];
+  if (r == NULL)
+    {
+      if (spec == NULL)
+        fprintf(stderr, "%s: jobs: no output kept\n", SHELLNAME);
+      else
+        fprintf(stderr, "%s: jobs: %s: no output kept\n", SHELLNAME, spec);
+      lastStatus = 1;
+      return;
+    }
+  if (r->fd >= 0)
+    RingDrain(r);
+  // Bytes are numbered oldest first; the oldest is at start in buf.
+  len = r->total < r->size ? r->total : r->size;
+  start = r->total > r->size ? r->total % r->size : 0;
+  if (r->total > r->size)
+    { // the oldest line was cut short, so begin after it if possible
+      for (from = 0; from < len && r->buf[(start + from) % r->size] != '\n';
+           from++)
+        ;
+      from = from < len ? from + 1 : 0;
+    }
+  for (; from < len; from += n)
+    {
+      at = (start + from) % r->size;
+      n = MIN(len - from, r->size - at);
+      fwrite(r->buf + at, 1, n, stdout);
+    }
+  fflush(stdout);
+} /* RingPrint */
+
+
+/*
+ * RingForget
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Called in a forked child of the shell: what the pipes bring later
+ * is for the shell to read.
+ */
+void
+RingForget()
+{
+  int i;
+
+  for (i = 0; i < gMaxRings; i++)
+    if (gRings[i] != NULL && gRings[i]->fd >= 0)
+      {
+        close(gRings[i]->fd);
+        gRings[i]->fd = -1;
+      }
+  if (gOutEpoll >= 0)
+    close(gOutEpoll);
+  gOutEpoll = -1;
+  gNOut = 0;
+} /* RingForget */
+
+
+/*
+ * RingCleanup
+ *
+ * arguments: none
+ *
+ * returns: none
+ */
+void
+RingCleanup()
+{
+  int i;
+
+  for (i = 0; i < gMaxRings; i++)
+    if (gRings[i] != NULL)
+      RingFree(gRings[i]);
+  free(gRings);
+  gRings = NULL;
+  gMaxRings = 0;
+  if (gOutEpoll >= 0)
+    close(gOutEpoll);
+  gOutEpoll = -1;
+} /* RingCleanup */
@@ -0,0 +1,150 @@
+/***************************************************************************
+ *  Title: Job rings
+ * -------------------------------------------------------------------------
+ *    Purpose: The tail of the output of background jobs, kept in a
+ *    ring per job number while JOBOUT is set, and the epoll set that
+ *    drains their pipes
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: jobring.h,v $
+ ***************************************************************************/
+
+#ifndef __JOBRING_H__
+#define __JOBRING_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+#include <stddef.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __JOBRING_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Read JOBOUT
+ * ---------------------------------------------------------------------
+ *    Purpose: Reads JOBOUT, a shell or environment variable giving a
+ *    number of bytes with an optional k or m suffix.
+ *    Input: void
+ *    Output: the bytes of output to keep per background job, or 0 to
+ *    keep none
+ ***********************************************************************/
+EXTERN size_t
+JobOutSize();
+
+/***********************************************************************
+ *  Title: Keep a job's output
+ * ---------------------------------------------------------------------
+ *    Purpose: Gives a job just numbered a ring, filled from the read
+ *    end of the pipe its output goes to whenever the pipe is drained.
+ *    Input: the job number, the pipe and the bytes to keep
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RingAttach(int, int, size_t);
+
+/***********************************************************************
+ *  Title: Drop a job's output
+ * ---------------------------------------------------------------------
+ *    Purpose: Frees the ring kept for a job number, if any, as when
+ *    the number is reused.
+ *    Input: the job number
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RingDrop(int);
+
+/***********************************************************************
+ *  Title: Print a job's output
+ * ---------------------------------------------------------------------
+ *    Purpose: Implements "jobs -o [%N]": writes what the ring of a job
+ *    holds to standard output.
+ *    Input: "%N" or "N", or NULL for the current job; and the number
+ *    of the current job, or 0
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RingPrint(char*, int);
+
+/***********************************************************************
+ *  Title: Get the descriptor to poll
+ * ---------------------------------------------------------------------
+ *    Purpose: Gives the epoll set of the ring pipes still open, for a
+ *    wait to watch alongside what it waits for.
+ *    Input: void
+ *    Output: the descriptor, or -1 if no pipe is open
+ ***********************************************************************/
+EXTERN int
+OutFd();
+
+/***********************************************************************
+ *  Title: Drain the rings
+ * ---------------------------------------------------------------------
+ *    Purpose: Copies into their rings whatever the open pipes hold,
+ *    without blocking.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+OutDrain();
+
+/***********************************************************************
+ *  Title: Wait for input
+ * ---------------------------------------------------------------------
+ *    Purpose: Waits for a descriptor to be readable while keeping the
+ *    output of background jobs drained into their rings (see JOBOUT
+ *    in tsh(1)), so that a job writing while the shell waits for the
+ *    next line does not block. Returns at once if no job's output is
+ *    being kept.
+ *    Input: the descriptor
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+JobOutWait(int);
+
+/***********************************************************************
+ *  Title: Let go of the pipes in a child
+ * ---------------------------------------------------------------------
+ *    Purpose: Closes the ring pipes and their epoll set in a forked
+ *    child of the shell; the rings stay readable as they were.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RingForget();
+
+/***********************************************************************
+ *  Title: Free the rings
+ * ---------------------------------------------------------------------
+ *    Purpose: Frees every ring and closes their pipes, when the shell
+ *    exits.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RingCleanup();
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __JOBRING_H__ */
@@ -0,0 +1,612 @@
+/***************************************************************************
+ *  Title: Memo
+ * -------------------------------------------------------------------------
+ *    Purpose: The memo builtin, which caches the output and status of
+ *    deterministic commands on disk
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: memo.c,v $
+ ***************************************************************************/
+#define _GNU_SOURCE
+#define __MEMO_IMPL__
+
+/************System include***********************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "memo.h"
+#include "io.h"
+#include "metrics.h"
+#include "script.h"
+#include "timeout.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define USAGE "usage: memo [--ttl dur] [-e var] [-f file] command [args]\n"
+
+/* the cache, under $HOME; outputs are kept in OBJDIR below it */
+#define MEMODIR ".tshmemo"
+#define OBJDIR "obj"
+#define STATSFILE "stats"
+
+/* a hash as a file name */
+#define NAMELEN 17
+
+/*
+ * What the cache holds for a key, in a file named after the key's
+ * hash and followed by the key itself, since two keys may share a
+ * hash. The output is the object named after the hash of its
+ * contents, so commands that print the same thing share one copy.
+ */
+typedef struct memo_entry_t
+{
+  char magic[8];
+  long long made;            /* CLOCK_REALTIME in nanoseconds */
+  long long size;            /* of the output */
+  unsigned long long object; /* hash of the output */
+  int status;
+  long long keyLen;          /* bytes of the key after the entry */
+} memoEntryT;
+
+/* counts kept in the stats file and shared by every tsh using it */
+typedef struct memo_stats_t
+{
+  unsigned long long hits;
+  unsigned long long misses;
+  unsigned long long saved; /* bytes written from the cache */
+} memoStatsT;
+
+/* the bytes a key is hashed from */
+typedef struct memo_key_t
+{
+  char* buf;
+  size_t len;
+  size_t max;
+} memoKeyT;
+
+/************Global Variables*********************************************/
+
+/* first bytes of every entry; the digit is the format version */
+static const char kMagic[8] = "TSHMEMO2";
+
+/* tells apart the output files of memos run inside one another */
+static int gSeq = 0;
+
+/************Function Prototypes******************************************/
+/* opens the cache directory, creating it if need be */
+static int
+MemoDir();
+/* appends a tagged field to a key */
+static void
+KeyAdd(memoKeyT*, char, char*, size_t);
+/* writes a cached output, if the key has one */
+static bool
+MemoServe(int, char*, memoKeyT*, long long);
+/* runs a command and caches what it writes */
+static void
+MemoStore(int, char*, memoKeyT*, commandT*);
+/* makes an output the object named after its hash */
+static bool
+ObjectPut(int, char*, char*, char*, long long);
+/* writes out a whole buffer */
+static bool
+WriteAll(int, char*, size_t);
+/* adds to the counts in the stats file */
+static void
+MemoCount(int, int, int, long long);
+/* prints the counts in the stats file */
+static void
+MemoStats(int);
+/* reads CLOCK_REALTIME in nanoseconds */
+static long long
+Now();
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+/*
+ * RunMemo
+ *
+ * arguments:
+ *   commandT *cmd: the memo command line
+ *
+ * returns: none
+ *
+ * Implements "memo [--ttl dur] [-e var]... [-f file]... cmd [args]".
+ * The key is the words of the command, the working directory, the
+ * value of each var, set or not, and the modification time, size and
+ * inode of each file, so a changed input makes another key. A key in
+ * the cache, and less than dur old if --ttl is given, is a hit: its
+ * output is mapped and written to the standard output and $? set to
+ * its status, without running anything. On a miss the command runs
+ * with its output going to a file in the cache, which is then written
+ * out; a command that finished with a status under 128, that is not
+ * killed or stopped, is kept. The command's input and error output
+ * are not part of the key or the cache. "memo --stats" prints the
+ * hits, misses and bytes written from the cache so far.
+ */
+void
+RunMemo(commandT* cmd)
+{
+  char* vars[cmd->argc];
+  char* files[cmd->argc];
+  char name[NAMELEN];
+  char cwd[PATH_MAX];
+  long long ttl = 0;
+  int nvars = 0, nfiles = 0, dir, i, j;
+  memoKeyT key = { NULL, 0, 0 };
+  struct stat st;
+  commandT* sub;
+
+  lastStatus = 2;
+  for (i = 1; i < cmd->argc && cmd->argv[i][0] == '-'; i++)
+    {
+      char* opt = cmd->argv[i];
+
+      if (strcmp(opt, "--") == 0)
+        {
+          i++;
+          break;
+        }
+      if (strcmp(opt, "--stats") == 0 && cmd->argc == 2)
+        {
+          lastStatus = 0;
+          if ((dir = MemoDir()) >= 0)
+            {
+              MemoStats(dir);
+              close(dir);
+            }
+          return;
+        }
+      if (i + 1 == cmd->argc)
+        break;
+      if (strcmp(opt, "--ttl") == 0)
+        {
+          if (!ParseDuration(cmd->argv[++i], &ttl))
+            {
+              fprintf(stderr, "%s: memo: bad duration %s\n", SHELLNAME,
+                      cmd->argv[i]);
+              return;
+            }
+        }
+      else if (strcmp(opt, "-e") == 0)
+        vars[nvars++] = cmd->argv[++i];
+      else if (strcmp(opt, "-f") == 0)
+        files[nfiles++] = cmd->argv[++i];
+      else
+        break;
+    }
+  if (i == cmd->argc || cmd->argv[i][0] == '-')
+    {
+      fprintf(stderr, USAGE);
+      return;
+    }
+
+  sub = malloc(sizeof(commandT) + sizeof(char*) * (cmd->argc - i + 1));
+  memcpy(sub->argv, cmd->argv + i, sizeof(char*) * (cmd->argc - i + 1));
+  sub->argc = cmd->argc - i;
+  sub->name = sub->argv[0];
+
+  if ((dir = MemoDir()) < 0)
+    { // no cache to use
+      RunCmd(sub);
+      free(sub);
+      return;
+    }
+  for (j = 0; j < sub->argc; j++)
+    KeyAdd(&key, 'a', sub->argv[j], strlen(sub->argv[j]));
+  if (getcwd(cwd, sizeof(cwd)) != NULL)
+    KeyAdd(&key, 'c', cwd, strlen(cwd));
+  for (j = 0; j < nvars; j++)
+    {
+      char* v = GetVar(vars[j]);
+      KeyAdd(&key, 'v', vars[j], strlen(vars[j]));
+      if (v != NULL)
+        KeyAdd(&key, '=', v, strlen(v));
+    }
+  for (j = 0; j < nfiles; j++)
+    {
+      KeyAdd(&key, 'f', files[j], strlen(files[j]));
+      if (stat(files[j], &st) == 0)
+        {
+          long long meta[4] = { st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+                                st.st_size, st.st_ino };
+          KeyAdd(&key, '=', (char*) meta, sizeof(meta));
+        }
+    }
+  snprintf(name, sizeof(name), "%016llx", HashText(key.buf, key.len));
+
+  if (!MemoServe(dir, name, &key, ttl))
+    MemoStore(dir, name, &key, sub);
+  free(key.buf);
+  close(dir);
+  free(sub);
+} /* RunMemo */
+
+
+/*
+ * MemoDir
+ *
+ * arguments: none
+ *
+ * returns: int: a descriptor of $HOME/.tshmemo, or -1 if there is no
+ *               HOME or the directory cannot be made
+ */
+static int
+MemoDir()
+{
+  char* home = getenv("HOME");
+  char path[PATH_MAX];
+  int dir;
+
+  if (home == NULL
+      || snprintf(path, sizeof(path), "%s/%s", home, MEMODIR) >= sizeof(path))
+    return -1;
+  if ((dir = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0
+      && errno == ENOENT && mkdir(path, 0755) == 0)
+    dir = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir >= 0 && mkdirat(dir, OBJDIR, 0755) != 0 && errno != EEXIST)
+    {
+      close(dir);
+      dir = -1;
+    }
+  return dir;
+} /* MemoDir */
+
+
+/*
+ * KeyAdd
+ *
+ * arguments:
+ *   memoKeyT *key: the key so far
+ *   char tag: what kind of field follows
+ *   char *data: the field
+ *   size_t len: its length
+ *
+ * returns: none
+ *
+ * Each field is its tag, its length and its bytes, so no two lists of
+ * fields make the same key.
+ */
+static void
+KeyAdd(memoKeyT* key, char tag, char* data, size_t len)
+{
+  if (key->len + 1 + sizeof(len) + len > key->max)
+    {
+      key->max = (key->len + 1 + sizeof(len) + len) * 2;
+      key->buf = realloc(key->buf, key->max);
+    }
+  key->buf[key->len++] = tag;
+  memcpy(key->buf + key->len, &len, sizeof(len));
+  key->len += sizeof(len);
+  memcpy(key->buf + key->len, data, len);
+  key->len += len;
+} /* KeyAdd */
+
+
+/*
+ * MemoServe
+ *
+ * arguments:
+ *   int dir: the cache
+ *   char *name: the hash of the key
+ *   memoKeyT *key: the key
+ *   long long ttl: the age in nanoseconds past which an entry is
+ *                  stale, or 0 for none
+ *
+ * returns: bool: FALSE on a miss
+ *
+ * The output is mapped and written in one go, so a hit costs a few
+ * system calls whatever its size. An entry for another key with the
+ * same hash, or whose output is missing or of the wrong size, is a
+ * miss, and is replaced.
+ */
+static bool
+MemoServe(int dir, char* name, memoKeyT* key, long long ttl)
+{
+  char obj[sizeof(OBJDIR) + NAMELEN];
+  memoEntryT e;
+  struct stat st;
+  char* p = NULL;
+  char* k;
+  bool ok;
+  int fd;
+
+  if ((fd = openat(dir, name, O_RDONLY | O_CLOEXEC)) < 0)
+    return FALSE;
+  ok = read(fd, &e, sizeof(e)) == sizeof(e)
+    && memcmp(e.magic, kMagic, sizeof(kMagic)) == 0
+    && e.keyLen == key->len;
+  if (ok)
+    {
+      k = malloc(key->len);
+      ok = read(fd, k, key->len) == key->len
+        && memcmp(k, key->buf, key->len) == 0;
+      free(k);
+    }
+  close(fd);
+  if (!ok || (ttl > 0 && Now() - e.made >= ttl))
+    return FALSE;
+
+  snprintf(obj, sizeof(obj), "%s/%016llx", OBJDIR, e.object);
+  if ((fd = openat(dir, obj, O_RDONLY | O_CLOEXEC)) < 0)
+    return FALSE;
+  if (fstat(fd, &st) != 0 || st.st_size != e.size
+      || (e.size > 0
+          && (p = mmap(NULL, e.size, PROT_READ, MAP_PRIVATE, fd, 0))
+             == MAP_FAILED))
+    {
+      close(fd);
+      return FALSE;
+    }
+  close(fd);
+
+  fflush(stdout);
+  ok = e.size == 0 || WriteAll(STDOUT_FILENO, p, e.size);
+  if (e.size > 0)
+    munmap(p, e.size);
+  lastStatus = ok ? e.status : 1;
+  MemoCount(dir, 1, 0, e.size);
+  MetricsAdd(M_MEMOHITS);
+  return TRUE;
+} /* MemoServe */
+
+
+/*
+ * MemoStore
+ *
+ * arguments:
+ *   int dir: the cache
+ *   char *name: the hash of the key
+ *   memoKeyT *key: the key
+ *   commandT *sub: the command
+ *
+ * returns: none
+ *
+ * The output goes to a file of this process's own in the cache, which
+ * becomes the object once its hash is known. The entry is written
+ * the same way and renamed into place, so another shell reading the
+ * cache sees a whole entry or none.
+ */
+static void
+MemoStore(int dir, char* name, memoKeyT* key, commandT* sub)
+{
+  char tmp[32], obj[sizeof(OBJDIR) + NAMELEN];
+  redirT r = { { -1, -1, -1 }, { -1, -1, -1 } };
+  memoEntryT e;
+  struct stat st;
+  char* p = NULL;
+  bool keep;
+  int fd;
+
+  snprintf(tmp, sizeof(tmp), "tmp.%d.%d", (int) getpid(), gSeq++);
+  if ((fd = openat(dir, tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))
+      < 0)
+    {
+      RunCmd(sub);
+      return;
+    }
+  r.fd[1] = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+  RedirSwap(&r);
+  RunCmd(sub);
+  RedirRestore(&r);
+  gSeq--;
+  keep = lastStatus < 128;
+
+  memset(&e, 0, sizeof(e));
+  if (fstat(fd, &st) != 0)
+    st.st_size = -1;
+  else if (st.st_size > 0
+      && (p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+         == MAP_FAILED)
+    p = NULL;
+  close(fd);
+  if (p != NULL || st.st_size == 0)
+    {
+      e.size = st.st_size;
+      e.object = HashText(p, e.size);
+      if (e.size > 0 && !WriteAll(STDOUT_FILENO, p, e.size))
+        keep = FALSE;
+      snprintf(obj, sizeof(obj), "%s/%016llx", OBJDIR, e.object);
+      keep = keep && ObjectPut(dir, tmp, obj, p, e.size);
+      if (p != NULL)
+        munmap(p, e.size);
+    }
+  else
+    keep = FALSE; // the output could not be read back
+  unlinkat(dir, tmp, 0);
+  MemoCount(dir, 0, 1, 0);
+  MetricsAdd(M_MEMOMISSES);
+  if (!keep)
+    return;
+
+  memcpy(e.magic, kMagic, sizeof(kMagic));
+  e.made = Now();
+  e.status = lastStatus;
+  e.keyLen = key->len;
+  if ((fd = openat(dir, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))
+      < 0)
+    return;
+  if (!WriteAll(fd, (char*) &e, sizeof(e))
+      || !WriteAll(fd, key->buf, key->len) || close(fd) != 0
+      || renameat(dir, tmp, dir, name) != 0)
+    unlinkat(dir, tmp, 0);
+} /* MemoStore */
+
+
+/*
+ * ObjectPut
+ *
+ * arguments:
+ *   int dir: the cache
+ *   char *tmp: the file holding an output
+ *   char *obj: the object named after its hash
+ *   char *p: the output, mapped, or NULL if it is empty
+ *   long long size: its size
+ *
+ * returns: bool: FALSE if the output cannot be kept
+ *
+ * Links tmp as the object, which the caller then unlinks. An object
+ * already there is used if it holds the same bytes; one holding other
+ * bytes with the same hash is left alone, and the output not kept.
+ */
+static bool
+ObjectPut(int dir, char* tmp, char* obj, char* p, long long size)
+{
+  struct stat st;
+  char* q;
+  bool same;
+  int fd;
+
+  if (linkat(dir, tmp, dir, obj, 0) == 0)
+    return TRUE;
+  if (errno != EEXIST
+      || (fd = openat(dir, obj, O_RDONLY | O_CLOEXEC)) < 0)
+    return FALSE;
+  same = fstat(fd, &st) == 0 && st.st_size == size;
+  if (same && size > 0)
+    {
+      if ((q = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+        same = FALSE;
+      else
+        {
+          same = memcmp(p, q, size) == 0;
+          munmap(q, size);
+        }
+    }
+  close(fd);
+  return same;
+} /* ObjectPut */
+
+
+/*
+ * WriteAll
+ *
+ * arguments:
+ *   int fd: where to write
+ *   char *p: the bytes
+ *   size_t len: their number
+ *
+ * returns: bool: FALSE if a write failed
+ */
+static bool
+WriteAll(int fd, char* p, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0)
+    {
+      if ((n = write(fd, p, len)) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return FALSE;
+        }
+      p += n;
+      len -= n;
+    }
+  return TRUE;
+} /* WriteAll */
+
+
+/*
+ * MemoCount
+ *
+ * arguments:
+ *   int dir: the cache
+ *   int hits: hits to add
+ *   int misses: misses to add
+ *   long long saved: bytes written from the cache to add
+ *
+ * returns: none
+ *
+ * The stats file is mapped shared and added to atomically, so shells
+ * using the same cache at once lose no counts.
+ */
+static void
+MemoCount(int dir, int hits, int misses, long long saved)
+{
+  memoStatsT* s;
+  struct stat st;
+  int fd;
+
+  if ((fd = openat(dir, STATSFILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)
+    return;
+  if (fstat(fd, &st) == 0 && st.st_size < sizeof(memoStatsT)
+      && ftruncate(fd, sizeof(memoStatsT)) != 0)
+    {
+      close(fd);
+      return;
+    }
+  s = mmap(NULL, sizeof(memoStatsT), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+           0);
+  close(fd);
+  if (s == MAP_FAILED)
+    return;
+  __atomic_add_fetch(&s->hits, hits, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&s->misses, misses, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&s->saved, saved, __ATOMIC_RELAXED);
+  munmap(s, sizeof(memoStatsT));
+} /* MemoCount */
+
+
+/*
+ * MemoStats
+ *
+ * arguments:
+ *   int dir: the cache
+ *
+ * returns: none
+ */
+static void
+MemoStats(int dir)
+{
+  memoStatsT s;
+  int fd;
+
+  memset(&s, 0, sizeof(s));
+  if ((fd = openat(dir, STATSFILE, O_RDONLY | O_CLOEXEC)) >= 0)
+    {
+      if (read(fd, &s, sizeof(s)) != sizeof(s))
+        memset(&s, 0, sizeof(s));
+      close(fd);
+    }
+  printf("hits %llu\nmisses %llu\nsaved %llu bytes\n", s.hits, s.misses,
+         s.saved);
+} /* MemoStats */
+
+
+/*
+ * Now
+ *
+ * arguments: none
+ *
+ * returns: long long: CLOCK_REALTIME in nanoseconds
+ *
+ * Entries outlive the shell, so their age is taken from the wall
+ * clock rather than CLOCK_MONOTONIC.
+ */
+static long long
+Now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+} /* Now */
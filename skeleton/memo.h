@@ -0,0 +1,58 @@
+/***************************************************************************
+ *  Title: Memo
+ * -------------------------------------------------------------------------
+ *    Purpose: The memo builtin, which caches the output and status of
+ *    deterministic commands on disk
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: memo.h,v $
+ ***************************************************************************/
+
+#ifndef __MEMO_H__
+#define __MEMO_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "runtime.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __MEMO_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Run the memo builtin
+ * ---------------------------------------------------------------------
+ *    Purpose: Implements "memo [--ttl dur] [-e var] [-f file] cmd"
+ *    and "memo --stats". A command whose key is in the cache is not
+ *    run: its output is written from the cache and $? set to its
+ *    status. Otherwise it is run and what it wrote kept.
+ *    Input: the memo command line
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RunMemo(commandT*);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __MEMO_H__ */
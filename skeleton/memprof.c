@@ -0,0 +1,467 @@
+/***************************************************************************
+ *  Title: Memprof
+ * -------------------------------------------------------------------------
+ *    Purpose: Allocation profiling build (make tsh-memprof)
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: memprof.c,v $
+ ***************************************************************************/
+#define _GNU_SOURCE
+#define __MEMPROF_IMPL__
+
+/************System include***********************************************/
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "memprof.h"
+
+#ifdef TSH_MEMPROF
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* room for a blockT in front of every block, keeping malloc's
+ * alignment */
+#define HDRSIZE ((sizeof(blockT) + 15) & ~(size_t) 15)
+#define HDR(p) ((blockT*) ((char*) (p) - HDRSIZE))
+
+/* how much of each line the report shows */
+#define TEXTMAX 40
+
+/*
+ * Every block the shell allocates, linked into gLive while it is live,
+ * so that whatever is left at exit can be listed with the line and
+ * phase that allocated it.
+ */
+typedef struct block_t
+{
+  struct block_t* prev;
+  struct block_t* next;
+  void* base;  /* what the C library returned */
+  size_t size; /* what the caller asked for */
+  int line;
+  int phase;
+} blockT;
+
+/* allocation figures of a line or a phase */
+typedef struct stat_t
+{
+  long allocs;
+  long bytes;
+  long peak; /* highest live bytes */
+  long net;  /* live bytes at the end less those at the start */
+} statT;
+
+typedef struct line_t
+{
+  char* text;  /* the whole line, kept with __libc_malloc */
+  size_t len;
+  statT stat;
+  int repeats; /* an earlier line with the same text, or -1 */
+  bool grew;
+} lineT;
+
+/************Global Variables*********************************************/
+
+extern void* __libc_malloc(size_t);
+extern void* __libc_calloc(size_t, size_t);
+extern void* __libc_realloc(void*, size_t);
+extern void __libc_free(void*);
+
+static const char* kPhaseNames[MP_NPHASES] =
+  { "startup", "read", "parse", "run", "exit", "libc" };
+
+static blockT gLive = { &gLive, &gLive, NULL, 0, 0, 0 };
+static long gLiveBytes = 0;
+static int gPhase = MP_STARTUP;
+static bool gLibc = FALSE;
+static int gLock = 0;
+
+static statT gPhases[MP_NPHASES];
+/* the line being run, counted from 1; 0 is startup */
+static int gLine = 0;
+static statT gCur;
+static long gLineStart = 0;
+/* finished lines; kept with __libc_malloc so they are not counted */
+static lineT* gLines = NULL;
+static int gNLines = 0, gMaxLines = 0;
+
+static char gStdinBuf[BUFSIZ];
+static char gStdoutBuf[BUFSIZ];
+
+/************Function Prototypes******************************************/
+
+static void*
+Track(void*, void*, size_t);
+static void
+Untrack(blockT*);
+static void*
+AlignedAlloc(size_t, size_t);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+/*
+ * MemInit
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Gives stdin and stdout static buffers. The C library would malloc
+ * them on first use and only free them after the report.
+ */
+void
+MemInit()
+{
+  setvbuf(stdin, gStdinBuf, _IOFBF, sizeof(gStdinBuf));
+  setvbuf(stdout, gStdoutBuf, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF,
+          sizeof(gStdoutBuf));
+} /* MemInit */
+
+
+/*
+ * MemPhase
+ *
+ * arguments:
+ *   int phase: one of the MP_ constants
+ *
+ * returns: none
+ */
+void
+MemPhase(int phase)
+{
+  gPhase = phase;
+} /* MemPhase */
+
+
+/*
+ * MemLibc
+ *
+ * arguments:
+ *   bool on: whether the shell is calling into the C library
+ *
+ * returns: none
+ */
+void
+MemLibc(bool on)
+{
+  gLibc = on;
+} /* MemLibc */
+
+
+/*
+ * MemLine
+ *
+ * arguments:
+ *   char *text: the input line that was just run
+ *
+ * returns: none
+ *
+ * Closes the figures of a line. A line whose whole text was seen before
+ * should reuse what its first run set up: if it ends with more live
+ * memory than it started with, or allocates more often than the last
+ * time, it is marked as growing.
+ */
+void
+MemLine(char* text)
+{
+  lineT* l;
+  int i;
+
+  if (gNLines == gMaxLines)
+    {
+      gMaxLines = gMaxLines * 2 + 64;
+      gLines = __libc_realloc(gLines, sizeof(lineT) * gMaxLines);
+    }
+  l = &gLines[gNLines];
+  l->len = strlen(text);
+  l->text = __libc_malloc(l->len + 1);
+  memcpy(l->text, text, l->len + 1);
+  gCur.net = gLiveBytes - gLineStart;
+  l->stat = gCur;
+  l->repeats = -1;
+  l->grew = FALSE;
+  for (i = gNLines - 1; i > 0; i--)
+    if (gLines[i].len == l->len
+        && memcmp(gLines[i].text, l->text, l->len) == 0)
+      {
+        l->repeats = i;
+        l->grew = l->stat.net > 0 || l->stat.allocs > gLines[i].stat.allocs;
+        break;
+      }
+  gNLines++;
+
+  gLine++;
+  memset(&gCur, 0, sizeof(gCur));
+  gLineStart = gLiveBytes;
+} /* MemLine */
+
+
+/*
+ * MemReport
+ *
+ * arguments: none
+ *
+ * returns: bool: TRUE if a block other than the C library's is still
+ *                live or a repeated line grew
+ *
+ * Prints one row per input line, then the totals of each phase, then
+ * every block still live, to stderr.
+ */
+bool
+MemReport()
+{
+  bool fail = FALSE;
+  blockT* b;
+  int i;
+
+  MemLine("(exit)");
+  fprintf(stderr, "memprof: %5s %8s %10s %10s %9s  %s\n", "line", "allocs",
+          "bytes", "peak", "net", "text");
+  for (i = 0; i < gNLines; i++)
+    {
+      lineT* l = &gLines[i];
+      fprintf(stderr, "memprof: %5d %8ld %10ld %10ld %+9ld  %.*s%s\n", i,
+              l->stat.allocs, l->stat.bytes, l->stat.peak, l->stat.net,
+              TEXTMAX, l->text, l->grew ? "  <- grew" : "");
+      if (l->grew)
+        {
+          fprintf(stderr, "memprof: line %d repeats line %d and grew\n", i,
+                  l->repeats);
+          fail = TRUE;
+        }
+    }
+
+  fprintf(stderr, "memprof: %-8s %8s %10s %10s\n", "phase", "allocs",
+          "bytes", "peak");
+  for (i = 0; i < MP_NPHASES; i++)
+    fprintf(stderr, "memprof: %-8s %8ld %10ld %10ld\n", kPhaseNames[i],
+            gPhases[i].allocs, gPhases[i].bytes, gPhases[i].peak);
+
+  for (b = gLive.next; b != &gLive; b = b->next)
+    {
+      if (b->phase == MP_LIBC)
+        continue;
+      fprintf(stderr, "memprof: leak: %zu bytes from line %d (%s)\n",
+              b->size, b->line, kPhaseNames[b->phase]);
+      fail = TRUE;
+    }
+  fprintf(stderr, "memprof: %s\n", fail ? "FAIL" : "ok");
+  return fail;
+} /* MemReport */
+
+
+/*
+ * malloc, calloc, realloc, free and the aligned allocators
+ *
+ * Replace the C library's, which stays underneath through its
+ * __libc_ entry points. Defining them in the executable catches the
+ * library's own allocations too, such as those of strdup and fopen.
+ */
+void*
+malloc(size_t size)
+{
+  char* base = __libc_malloc(size + HDRSIZE);
+  return base != NULL ? Track(base, base + HDRSIZE, size) : NULL;
+}
+
+void*
+calloc(size_t n, size_t size)
+{
+  char* base;
+
+  if (size != 0 && n > (SIZE_MAX - HDRSIZE) / size)
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+  base = __libc_calloc(1, n * size + HDRSIZE);
+  return base != NULL ? Track(base, base + HDRSIZE, n * size) : NULL;
+}
+
+void*
+realloc(void* p, size_t size)
+{
+  blockT* h;
+  char* base;
+  void* q;
+
+  if (p == NULL)
+    return malloc(size);
+  h = HDR(p);
+  if (h->base != (void*) h)
+    { // aligned block: its header is not at the start
+      if ((q = malloc(size)) != NULL)
+        {
+          memcpy(q, p, h->size < size ? h->size : size);
+          free(p);
+        }
+      return q;
+    }
+  Untrack(h);
+  base = __libc_realloc(h, size + HDRSIZE);
+  if (base == NULL)
+    {
+      Track(h, p, h->size);
+      return NULL;
+    }
+  return Track(base, base + HDRSIZE, size);
+}
+
+void
+free(void* p)
+{
+  blockT* h;
+
+  if (p == NULL)
+    return;
+  h = HDR(p);
+  Untrack(h);
+  __libc_free(h->base);
+}
+
+void*
+memalign(size_t align, size_t size)
+{
+  return AlignedAlloc(align, size);
+}
+
+void*
+aligned_alloc(size_t align, size_t size)
+{
+  return AlignedAlloc(align, size);
+}
+
+int
+posix_memalign(void** out, size_t align, size_t size)
+{
+  void* p;
+
+  if (align < sizeof(void*) || (align & (align - 1)) != 0)
+    return EINVAL;
+  if ((p = AlignedAlloc(align, size)) == NULL)
+    return ENOMEM;
+  *out = p;
+  return 0;
+}
+
+void*
+valloc(size_t size)
+{
+  return AlignedAlloc(sysconf(_SC_PAGESIZE), size);
+}
+
+void*
+pvalloc(size_t size)
+{
+  size_t page = sysconf(_SC_PAGESIZE);
+  return AlignedAlloc(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t
+malloc_usable_size(void* p)
+{
+  return p != NULL ? HDR(p)->size : 0;
+}
+
+
+/*
+ * AlignedAlloc
+ *
+ * arguments:
+ *   size_t align: a power of two
+ *   size_t size: bytes wanted
+ *
+ * returns: void*: a tracked block aligned to align, or NULL
+ */
+static void*
+AlignedAlloc(size_t align, size_t size)
+{
+  char* base;
+  uintptr_t p;
+
+  if (align <= 16)
+    return malloc(size);
+  if ((base = __libc_malloc(size + align + HDRSIZE)) == NULL)
+    return NULL;
+  p = ((uintptr_t) base + HDRSIZE + align - 1) & ~(uintptr_t) (align - 1);
+  return Track(base, (void*) p, size);
+} /* AlignedAlloc */
+
+
+/*
+ * Track
+ *
+ * arguments:
+ *   void *base: what the C library returned
+ *   void *p: the block handed out, with room for its header in front
+ *   size_t size: its size
+ *
+ * returns: void*: p
+ *
+ * Fills in a block's header, links it into the live list and counts
+ * it against the current line and phase.
+ */
+static void*
+Track(void* base, void* p, size_t size)
+{
+  blockT* h = HDR(p);
+  statT* ph;
+
+  while (__atomic_test_and_set(&gLock, __ATOMIC_ACQUIRE))
+    ;
+  h->base = base;
+  h->size = size;
+  h->line = gLine;
+  h->phase = gLibc ? MP_LIBC : gPhase;
+  h->prev = &gLive;
+  h->next = gLive.next;
+  gLive.next->prev = h;
+  gLive.next = h;
+
+  gLiveBytes += size;
+  ph = &gPhases[h->phase];
+  ph->allocs++;
+  ph->bytes += size;
+  if (gLiveBytes > ph->peak)
+    ph->peak = gLiveBytes;
+  gCur.allocs++;
+  gCur.bytes += size;
+  if (gLiveBytes - gLineStart > gCur.peak)
+    gCur.peak = gLiveBytes - gLineStart;
+  __atomic_clear(&gLock, __ATOMIC_RELEASE);
+  return p;
+} /* Track */
+
+
+/*
+ * Untrack
+ *
+ * arguments:
+ *   blockT *h: the header of a block being freed or moved
+ *
+ * returns: none
+ */
+static void
+Untrack(blockT* h)
+{
+  while (__atomic_test_and_set(&gLock, __ATOMIC_ACQUIRE))
+    ;
+  h->prev->next = h->next;
+  h->next->prev = h->prev;
+  gLiveBytes -= h->size;
+  __atomic_clear(&gLock, __ATOMIC_RELEASE);
+} /* Untrack */
+
+#endif /* TSH_MEMPROF */
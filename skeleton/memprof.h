@@ -0,0 +1,122 @@
+/***************************************************************************
+ *  Title: Memprof
+ * -------------------------------------------------------------------------
+ *    Purpose: Allocation profiling build (make tsh-memprof)
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: memprof.h,v $
+ ***************************************************************************/
+
+#ifndef __MEMPROF_H__
+#define __MEMPROF_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __MEMPROF_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* what the shell is doing when it allocates */
+#define MP_STARTUP 0
+#define MP_READ    1
+#define MP_PARSE   2
+#define MP_RUN     3
+#define MP_EXIT    4
+#define MP_LIBC    5 /* kept by the C library, see MemLibc */
+#define MP_NPHASES 6
+
+/* exit status of a profiled shell that leaked or grew */
+#define MEMPROF_FAIL 99
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+#ifdef TSH_MEMPROF
+
+/***********************************************************************
+ *  Title: Start profiling
+ * ---------------------------------------------------------------------
+ *    Purpose: Gives stdin and stdout static buffers, so the only
+ *    blocks live at exit are the shell's own. Called first in main.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+MemInit();
+
+/***********************************************************************
+ *  Title: Switch phase
+ * ---------------------------------------------------------------------
+ *    Purpose: Charges the following allocations to a phase.
+ *    Input: one of the MP_ constants
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+MemPhase(int);
+
+/***********************************************************************
+ *  Title: Mark C library allocations
+ * ---------------------------------------------------------------------
+ *    Purpose: While set, allocations are charged to MP_LIBC, whose
+ *    blocks are not leaks: memory setenv keeps, for one, is never
+ *    given back.
+ *    Input: TRUE around the call into the library, then FALSE
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+MemLibc(bool);
+
+/***********************************************************************
+ *  Title: End a line
+ * ---------------------------------------------------------------------
+ *    Purpose: Records the allocations made since the last call as
+ *    those of the given input line.
+ *    Input: the line
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+MemLine(char*);
+
+/***********************************************************************
+ *  Title: Report
+ * ---------------------------------------------------------------------
+ *    Purpose: Prints the per-line and per-phase figures and every
+ *    block still live to stderr. Called after all cleanup.
+ *    Input: void
+ *    Output: TRUE if something leaked or a repeated line grew
+ ***********************************************************************/
+EXTERN bool
+MemReport();
+
+#else
+
+#define MemInit()
+#define MemPhase(phase)
+#define MemLibc(on)
+#define MemLine(line)
+#define MemReport() FALSE
+
+#endif /* TSH_MEMPROF */
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __MEMPROF_H__ */
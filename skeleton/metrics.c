@@ -0,0 +1,765 @@
+/***************************************************************************
+ *  Title: Metrics
+ * -------------------------------------------------------------------------
+ *    Purpose: Counters every tsh on a host can publish to one shared
+ *    memory segment, and tsh --top, which shows them live
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: metrics.c,v $
+ ***************************************************************************/
+#define _GNU_SOURCE
+#define __METRICS_IMPL__
+
+/************System include***********************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "metrics.h"
+#include "probe.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* the segment for a $TSHMETRICS that does not name one */
+#define METRICSNAME "/tsh-metrics.%d"
+
+/* shells that can publish at once */
+#define NSLOTS 1024
+
+/*
+ * Spawn latency buckets: the first is under a microsecond, bucket b
+ * from 2^(b-1) up to 2^b microseconds, and the last all from 16ms.
+ */
+#define NBUCKETS 16
+
+/* width of the histogram bars */
+#define BARWIDTH 40
+
+/*
+ * What one shell publishes. Each slot has cache lines of its own, so
+ * shells counting at once do not contend. Counts only grow while the
+ * slot is held; the reader subtracts two reads for rates.
+ */
+typedef struct metrics_slot_t
+{
+  int pid;                            /* the shell's, 0 if the slot is free */
+  int jobs;                           /* background and stopped jobs */
+  long long started;                  /* CLOCK_REALTIME in nanoseconds */
+  unsigned long long count[M_NCOUNTERS];
+  unsigned long long spawn[NBUCKETS]; /* spawn latency histogram */
+  unsigned long long spawnNs;         /* the latencies added up */
+} __attribute__ ((aligned(64))) metricsSlotT;
+
+typedef struct metrics_seg_t
+{
+  char magic[8];
+  int nslots;
+  metricsSlotT retired;               /* counts of shells that are gone */
+  metricsSlotT slot[NSLOTS];
+} metricsSegT;
+
+/************Global Variables*********************************************/
+
+/* first bytes of the segment; the digit is the format version */
+static const char kMagic[8] = "TSHMET1";
+
+/* how tsh --top names the counters */
+static const char* kNames[M_NCOUNTERS] = {
+  "lines",
+  "builtins",
+  "external commands",
+  "forks",
+  "command lookups",
+  "  not found",
+  "PATH table current",
+  "PATH table reloaded",
+  "memo hits",
+  "memo misses",
+  "rc snapshot run",
+  "rc file compiled",
+};
+
+/* the segment and this shell's slot of it, while publishing */
+static metricsSegT* gSeg = NULL;
+static metricsSlotT* gSlot = NULL;
+
+/* the shell that holds the slot, which its children share */
+static pid_t gOwner = 0;
+
+/************Function Prototypes******************************************/
+/* finds the name of the segment */
+static bool
+MetricsName(char*, size_t, bool);
+/* opens and maps the segment */
+static metricsSegT*
+MetricsMap(char*, bool);
+/* tells whether the shell holding a slot is still running */
+static bool
+Alive(int);
+/* moves the counts of one slot to another */
+static void
+SlotFold(metricsSlotT*, metricsSlotT*);
+/* adds up the slots of the segment */
+static void
+TopSum(metricsSegT*, metricsSlotT*);
+/* prints one screen of tsh --top */
+static void
+TopPrint(metricsSegT*, char*, metricsSlotT*, metricsSlotT*, double);
+/* prints the spawn latency histogram */
+static void
+TopSpawn(metricsSlotT*);
+/* prints a line per live shell */
+static void
+TopShells(metricsSegT*, int);
+/* finds a percentile of a histogram */
+static int
+Percentile(unsigned long long*, double);
+/* orders live shells, most lines first */
+static int
+ShellCompare(const void*, const void*);
+/* reads a clock in nanoseconds */
+static long long
+Clock(clockid_t);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+/*
+ * MetricsInit
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Free slots are taken with a compare and swap of their pid, so two
+ * shells starting at once never share one. A slot left by a shell
+ * that was killed is claimed the same way, from the pid it holds.
+ */
+void
+MetricsInit()
+{
+  char name[64];
+  metricsSlotT* s;
+  int i, pid, self = getpid();
+
+  if (!MetricsName(name, sizeof(name), FALSE)
+      || (gSeg = MetricsMap(name, TRUE)) == NULL)
+    return;
+  for (i = 0; i < NSLOTS && gSlot == NULL; i++)
+    {
+      s = &gSeg->slot[i];
+      pid = __atomic_load_n(&s->pid, __ATOMIC_ACQUIRE);
+      if (pid != 0 && Alive(pid))
+        continue;
+      if (!__atomic_compare_exchange_n(&s->pid, &pid, self, FALSE,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        continue;
+      SlotFold(s, &gSeg->retired);
+      __atomic_store_n(&s->started, Clock(CLOCK_REALTIME), __ATOMIC_RELAXED);
+      gSlot = s;
+    }
+  if (gSlot == NULL)
+    {
+      fprintf(stderr, "%s: %s: no free slot\n", SHELLNAME, name);
+      munmap(gSeg, sizeof(metricsSegT));
+      gSeg = NULL;
+      return;
+    }
+  gOwner = self;
+} /* MetricsInit */
+
+
+/*
+ * MetricsAdd
+ *
+ * arguments:
+ *   int c: the counter
+ *
+ * returns: none
+ */
+void
+MetricsAdd(int c)
+{
+  if (gSlot != NULL)
+    __atomic_add_fetch(&gSlot->count[c], 1, __ATOMIC_RELAXED);
+} /* MetricsAdd */
+
+
+/*
+ * MetricsClock
+ *
+ * arguments: none
+ *
+ * returns: long long: CLOCK_MONOTONIC in nanoseconds, or 0 if neither
+ * publishing nor tracing spawns
+ */
+long long
+MetricsClock()
+{
+  return gSlot != NULL || PROBE_ON(spawn) ? ProbeClock() : 0;
+} /* MetricsClock */
+
+
+/*
+ * MetricsSpawn
+ *
+ * arguments:
+ *   long long start: MetricsClock before the fork
+ *
+ * returns: none
+ *
+ * A fork is counted even without a start, which a shell that began
+ * publishing in between would not have.
+ */
+void
+MetricsSpawn(long long start)
+{
+  unsigned long long us;
+  long long ns;
+  int b;
+
+  if (gSlot == NULL)
+    return;
+  __atomic_add_fetch(&gSlot->count[M_FORKS], 1, __ATOMIC_RELAXED);
+  if (start == 0)
+    return;
+  ns = Clock(CLOCK_MONOTONIC) - start;
+  if (ns < 0)
+    ns = 0;
+  us = ns / 1000;
+  b = us == 0 ? 0 : 64 - __builtin_clzll(us);
+  if (b >= NBUCKETS)
+    b = NBUCKETS - 1;
+  __atomic_add_fetch(&gSlot->spawn[b], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&gSlot->spawnNs, ns, __ATOMIC_RELAXED);
+} /* MetricsSpawn */
+
+
+/*
+ * MetricsJobs
+ *
+ * arguments:
+ *   int n: the number of jobs
+ *
+ * returns: none
+ */
+void
+MetricsJobs(int n)
+{
+  if (gSlot != NULL && getpid() == gOwner)
+    __atomic_store_n(&gSlot->jobs, n, __ATOMIC_RELAXED);
+} /* MetricsJobs */
+
+
+/*
+ * MetricsCleanup
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * The counts are moved before the slot is freed, so that a reader
+ * adding up the segment at any time sees each count once, or in the
+ * moment between the two, not at all.
+ */
+void
+MetricsCleanup()
+{
+  if (gSlot == NULL || getpid() != gOwner)
+    return;
+  __atomic_store_n(&gSlot->jobs, 0, __ATOMIC_RELAXED);
+  SlotFold(gSlot, &gSeg->retired);
+  __atomic_store_n(&gSlot->pid, 0, __ATOMIC_RELEASE);
+  munmap(gSeg, sizeof(metricsSegT));
+  gSeg = NULL;
+  gSlot = NULL;
+} /* MetricsCleanup */
+
+
+/*
+ * MetricsTop
+ *
+ * arguments:
+ *   char *arg: the interval in seconds, or NULL
+ *
+ * returns: int: the exit status
+ *
+ * tsh --top reads $TSHMETRICS like any shell, but shows the default
+ * segment when it is not set, so the counters of shells started with
+ * TSHMETRICS=1 can be watched from anywhere.
+ */
+int
+MetricsTop(char* arg)
+{
+  metricsSlotT now, prev;
+  struct timespec ts;
+  metricsSegT* seg;
+  char name[64];
+  double secs = 1;
+  char* end;
+
+  if (arg != NULL)
+    {
+      secs = strtod(arg, &end);
+      if (end == arg || *end != '\0' || secs < 0 || secs > 86400)
+        {
+          fprintf(stderr, "usage: %s --top [seconds]\n", SHELLNAME);
+          return 2;
+        }
+    }
+  MetricsName(name, sizeof(name), TRUE);
+  if ((seg = MetricsMap(name, FALSE)) == NULL)
+    return 1;
+  TopSum(seg, &prev);
+  if (secs == 0 || !isatty(STDOUT_FILENO))
+    {
+      TopPrint(seg, name, &prev, NULL, 0);
+      munmap(seg, sizeof(metricsSegT));
+      return 0;
+    }
+  printf("\033[H\033[J");
+  TopPrint(seg, name, &prev, NULL, 0);
+  fflush(stdout);
+  ts.tv_sec = (time_t) secs;
+  ts.tv_nsec = (secs - ts.tv_sec) * 1e9;
+  for (;;)
+    {
+      nanosleep(&ts, NULL);
+      TopSum(seg, &now);
+      printf("\033[H\033[J");
+      TopPrint(seg, name, &now, &prev, secs);
+      fflush(stdout);
+      prev = now;
+    }
+} /* MetricsTop */
+
+
+/*
+ * MetricsName
+ *
+ * arguments:
+ *   char *buf: where to put the name
+ *   size_t size: of buf
+ *   bool any: TRUE to give the default name if $TSHMETRICS is not set
+ *
+ * returns: bool: FALSE if $TSHMETRICS is not set, or empty, and any is
+ * FALSE
+ */
+static bool
+MetricsName(char* buf, size_t size, bool any)
+{
+  char* v = getenv("TSHMETRICS");
+
+  if ((v == NULL || *v == '\0') && !any)
+    return FALSE;
+  if (v != NULL && v[0] == '/')
+    snprintf(buf, size, "%s", v);
+  else
+    snprintf(buf, size, METRICSNAME, (int) getuid());
+  return TRUE;
+} /* MetricsName */
+
+
+/*
+ * MetricsMap
+ *
+ * arguments:
+ *   char *name: the segment
+ *   bool write: TRUE to publish, creating the segment if need be;
+ *   FALSE to read it
+ *
+ * returns: metricsSegT*: the segment, or NULL after a message
+ *
+ * Shells creating the segment at once all size it the same and write
+ * the same magic, so whichever is first does not matter. A segment of
+ * another size or magic, made by some other version of tsh, is left
+ * alone.
+ */
+static metricsSegT*
+MetricsMap(char* name, bool write)
+{
+  metricsSegT* seg;
+  struct stat st;
+  int fd;
+
+  fd = shm_open(name, write ? O_RDWR | O_CREAT : O_RDONLY, 0600);
+  if (fd < 0)
+    {
+      fprintf(stderr, "%s: %s: %s\n", SHELLNAME, name, strerror(errno));
+      return NULL;
+    }
+  if (fstat(fd, &st) == 0 && st.st_size == 0 && write
+      && ftruncate(fd, sizeof(metricsSegT)) == 0)
+    st.st_size = sizeof(metricsSegT);
+  if (st.st_size != sizeof(metricsSegT))
+    {
+      fprintf(stderr, "%s: %s: not a tsh metrics segment\n", SHELLNAME, name);
+      close(fd);
+      return NULL;
+    }
+  seg = mmap(NULL, sizeof(metricsSegT),
+             write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (seg == MAP_FAILED)
+    {
+      fprintf(stderr, "%s: %s: %s\n", SHELLNAME, name, strerror(errno));
+      return NULL;
+    }
+  if (write && seg->magic[0] == '\0')
+    {
+      seg->nslots = NSLOTS;
+      memcpy(seg->magic, kMagic, sizeof(kMagic));
+    }
+  if (memcmp(seg->magic, kMagic, sizeof(kMagic)) != 0
+      || seg->nslots != NSLOTS)
+    {
+      fprintf(stderr, "%s: %s: not a tsh metrics segment\n", SHELLNAME, name);
+      munmap(seg, sizeof(metricsSegT));
+      return NULL;
+    }
+  return seg;
+} /* MetricsMap */
+
+
+/*
+ * Alive
+ *
+ * arguments:
+ *   int pid: the shell
+ *
+ * returns: bool: FALSE if there is no such process
+ *
+ * A pid reused by another process keeps the slot taken until that
+ * process exits too.
+ */
+static bool
+Alive(int pid)
+{
+  return kill(pid, 0) == 0 || errno != ESRCH;
+} /* Alive */
+
+
+/*
+ * SlotFold
+ *
+ * arguments:
+ *   metricsSlotT *from: the slot to empty
+ *   metricsSlotT *to: the slot to add its counts to
+ *
+ * returns: none
+ *
+ * Each count is swapped for 0 before it is added, so a child of a
+ * gone shell still counting into from loses nothing that is moved.
+ */
+static void
+SlotFold(metricsSlotT* from, metricsSlotT* to)
+{
+  unsigned long long v;
+  int i;
+
+  for (i = 0; i < M_NCOUNTERS; i++)
+    if ((v = __atomic_exchange_n(&from->count[i], 0, __ATOMIC_RELAXED)) != 0)
+      __atomic_add_fetch(&to->count[i], v, __ATOMIC_RELAXED);
+  for (i = 0; i < NBUCKETS; i++)
+    if ((v = __atomic_exchange_n(&from->spawn[i], 0, __ATOMIC_RELAXED)) != 0)
+      __atomic_add_fetch(&to->spawn[i], v, __ATOMIC_RELAXED);
+  if ((v = __atomic_exchange_n(&from->spawnNs, 0, __ATOMIC_RELAXED)) != 0)
+    __atomic_add_fetch(&to->spawnNs, v, __ATOMIC_RELAXED);
+  __atomic_store_n(&from->jobs, 0, __ATOMIC_RELAXED);
+} /* SlotFold */
+
+
+/*
+ * TopSum
+ *
+ * arguments:
+ *   metricsSegT *seg: the segment
+ *   metricsSlotT *sum: where to put the totals
+ *
+ * returns: none
+ *
+ * The totals are of exited shells and every held slot. The pid of sum
+ * is made the number of live shells, and its jobs their jobs.
+ */
+static void
+TopSum(metricsSegT* seg, metricsSlotT* sum)
+{
+  metricsSlotT* s;
+  int i, j, pid;
+
+  memset(sum, 0, sizeof(*sum));
+  for (i = -1; i < NSLOTS; i++)
+    {
+      s = i < 0 ? &seg->retired : &seg->slot[i];
+      pid = __atomic_load_n(&s->pid, __ATOMIC_ACQUIRE);
+      if (i >= 0 && pid == 0)
+        continue;
+      for (j = 0; j < M_NCOUNTERS; j++)
+        sum->count[j] += __atomic_load_n(&s->count[j], __ATOMIC_RELAXED);
+      for (j = 0; j < NBUCKETS; j++)
+        sum->spawn[j] += __atomic_load_n(&s->spawn[j], __ATOMIC_RELAXED);
+      sum->spawnNs += __atomic_load_n(&s->spawnNs, __ATOMIC_RELAXED);
+      if (i >= 0 && Alive(pid))
+        {
+          sum->pid++;
+          sum->jobs += __atomic_load_n(&s->jobs, __ATOMIC_RELAXED);
+        }
+    }
+} /* TopSum */
+
+
+/*
+ * TopPrint
+ *
+ * arguments:
+ *   metricsSegT *seg: the segment
+ *   char *name: its name
+ *   metricsSlotT *now: the totals
+ *   metricsSlotT *prev: the totals secs before, or NULL for no rates
+ *   double secs: the interval
+ *
+ * returns: none
+ *
+ * A count that went down, as one can when a shell's slot is folded
+ * in between the two reads, shows a rate of 0.
+ */
+static void
+TopPrint(metricsSegT* seg, char* name, metricsSlotT* now, metricsSlotT* prev,
+         double secs)
+{
+  static const int hits[] = { M_PATHHITS, M_MEMOHITS, M_SNAPHITS };
+  static const char* caches[] = { "PATH table", "memo", "rc snapshot" };
+  unsigned long long h, m;
+  struct winsize ws;
+  double rate;
+  int i, rows;
+
+  printf("%s: %s, %d shell%s, %d job%s\n\n", SHELLNAME, name, now->pid,
+         now->pid == 1 ? "" : "s", now->jobs, now->jobs == 1 ? "" : "s");
+  printf("%-20s %12s%s\n", "COUNTER", "TOTAL", prev ? "      PER SEC" : "");
+  for (i = 0; i < M_NCOUNTERS; i++)
+    {
+      printf("%-20s %12llu", kNames[i], now->count[i]);
+      if (prev != NULL)
+        {
+          rate = now->count[i] > prev->count[i]
+                   ? (now->count[i] - prev->count[i]) / secs
+                   : 0;
+          printf(" %12.1f", rate);
+        }
+      printf("\n");
+    }
+  printf("\n%-20s %12s %12s %8s\n", "CACHE", "HITS", "MISSES", "RATE");
+  for (i = 0; i < sizeof(hits) / sizeof(hits[0]); i++)
+    {
+      h = now->count[hits[i]];
+      m = now->count[hits[i] + 1];
+      printf("%-20s %12llu %12llu", caches[i], h, m);
+      if (h + m > 0)
+        printf(" %7.1f%%\n", 100.0 * h / (h + m));
+      else
+        printf(" %8s\n", "-");
+    }
+  TopSpawn(now);
+  rows = -1;
+  if (prev != NULL && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0)
+    rows = ws.ws_row - M_NCOUNTERS - 2 * NBUCKETS;
+  TopShells(seg, rows);
+} /* TopPrint */
+
+
+/*
+ * TopSpawn
+ *
+ * arguments:
+ *   metricsSlotT *sum: the totals
+ *
+ * returns: none
+ *
+ * Percentiles are given as the upper bound of their bucket. Only the
+ * buckets from the first to the last that is not empty are drawn.
+ */
+static void
+TopSpawn(metricsSlotT* sum)
+{
+  unsigned long long n = 0, max = 0;
+  int b, first = -1, last = -1, bar;
+
+  for (b = 0; b < NBUCKETS; b++)
+    {
+      n += sum->spawn[b];
+      if (sum->spawn[b] > max)
+        max = sum->spawn[b];
+      if (sum->spawn[b] > 0)
+        {
+          if (first < 0)
+            first = b;
+          last = b;
+        }
+    }
+  if (n == 0)
+    {
+      printf("\nspawn latency: no forks timed\n");
+      return;
+    }
+  printf("\nspawn latency: mean %llu us, p50 < %d us, p90 < %d us, "
+         "p99 < %d us\n", sum->spawnNs / n / 1000,
+         Percentile(sum->spawn, 0.5), Percentile(sum->spawn, 0.9),
+         Percentile(sum->spawn, 0.99));
+  for (b = first; b <= last; b++)
+    {
+      if (b == 0)
+        printf("%16s", "< 1 us");
+      else if (b == NBUCKETS - 1)
+        printf("%10s%3d ms", ">= ", (1 << (b - 1)) / 1000);
+      else
+        printf("%7d-%-5d us", 1 << (b - 1), 1 << b);
+      bar = (sum->spawn[b] * BARWIDTH + max - 1) / max;
+      printf(" %12llu", sum->spawn[b]);
+      if (bar > 0)
+        printf(" %.*s", bar, "########################################");
+      printf("\n");
+    }
+} /* TopSpawn */
+
+
+/*
+ * TopShells
+ *
+ * arguments:
+ *   metricsSegT *seg: the segment
+ *   int rows: the most lines to print, or -1 for all
+ *
+ * returns: none
+ */
+static void
+TopShells(metricsSegT* seg, int rows)
+{
+  static metricsSlotT shells[NSLOTS];
+  long long now = Clock(CLOCK_REALTIME), up;
+  unsigned long long n;
+  metricsSlotT* s;
+  char uptime[16];
+  int i, b, pid, nshells = 0;
+
+  for (i = 0; i < NSLOTS; i++)
+    {
+      s = &seg->slot[i];
+      if ((pid = __atomic_load_n(&s->pid, __ATOMIC_ACQUIRE)) == 0
+          || !Alive(pid))
+        continue;
+      memcpy(&shells[nshells], s, sizeof(*s));
+      shells[nshells++].pid = pid;
+    }
+  if (nshells == 0)
+    return;
+  qsort(shells, nshells, sizeof(shells[0]), ShellCompare);
+  if (rows >= 0 && rows < 1)
+    rows = 1;
+  printf("\n%8s %8s %10s %10s %10s %8s %5s %9s\n", "PID", "UP", "LINES",
+         "BUILTINS", "EXTERNAL", "FORKS", "JOBS", "SPAWN P50");
+  for (i = 0; i < nshells && (rows < 0 || i < rows); i++)
+    {
+      s = &shells[i];
+      up = (now - s->started) / 1000000000LL;
+      if (up < 0)
+        up = 0;
+      if (up < 3600)
+        snprintf(uptime, sizeof(uptime), "%lld:%02lld", up / 60, up % 60);
+      else
+        snprintf(uptime, sizeof(uptime), "%lldh%02lld", up / 3600,
+                 up / 60 % 60);
+      for (b = 0, n = 0; b < NBUCKETS; b++)
+        n += s->spawn[b];
+      printf("%8d %8s %10llu %10llu %10llu %8llu %5d", s->pid, uptime,
+             s->count[M_LINES], s->count[M_BUILTINS], s->count[M_EXTERNALS],
+             s->count[M_FORKS], s->jobs);
+      if (n > 0)
+        printf(" %6d us\n", Percentile(s->spawn, 0.5));
+      else
+        printf(" %9s\n", "-");
+    }
+  if (i < nshells)
+    printf("%8s %d more\n", "...", nshells - i);
+} /* TopShells */
+
+
+/*
+ * Percentile
+ *
+ * arguments:
+ *   unsigned long long *spawn: the histogram
+ *   double q: the fraction of forks at or under the percentile
+ *
+ * returns: int: the upper bound, in microseconds, of the bucket the
+ * percentile falls in; the lower bound for the last bucket
+ */
+static int
+Percentile(unsigned long long* spawn, double q)
+{
+  unsigned long long n = 0, seen = 0;
+  int b;
+
+  for (b = 0; b < NBUCKETS; b++)
+    n += spawn[b];
+  for (b = 0; b < NBUCKETS - 1; b++)
+    {
+      seen += spawn[b];
+      if (seen >= q * n)
+        return 1 << b;
+    }
+  return 1 << (NBUCKETS - 2);
+} /* Percentile */
+
+
+/*
+ * ShellCompare
+ *
+ * arguments:
+ *   const void *a, *b: two copied slots
+ *
+ * returns: int: less than, equal to or greater than 0 as a has
+ * interpreted more, as many or fewer lines than b
+ */
+static int
+ShellCompare(const void* a, const void* b)
+{
+  unsigned long long x = ((metricsSlotT*) a)->count[M_LINES];
+  unsigned long long y = ((metricsSlotT*) b)->count[M_LINES];
+
+  return x > y ? -1 : x < y;
+} /* ShellCompare */
+
+
+/*
+ * Clock
+ *
+ * arguments:
+ *   clockid_t id: the clock
+ *
+ * returns: long long: its time in nanoseconds
+ */
+static long long
+Clock(clockid_t id)
+{
+  struct timespec ts;
+
+  clock_gettime(id, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+} /* Clock */
@@ -0,0 +1,145 @@
+/***************************************************************************
+ *  Title: Metrics
+ * -------------------------------------------------------------------------
+ *    Purpose: Counters every tsh on a host can publish to one shared
+ *    memory segment, and tsh --top, which shows them live
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: metrics.h,v $
+ ***************************************************************************/
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __METRICS_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* the counters, in the order tsh --top shows them */
+#define M_LINES      0  /* command lines interpreted */
+#define M_BUILTINS   1  /* builtins run, in the shell or a child */
+#define M_EXTERNALS  2  /* commands exec'd */
+#define M_FORKS      3
+#define M_LOOKUPS    4  /* commands looked for by getFullPath */
+#define M_NOTFOUND   5  /* of those, not found */
+#define M_PATHHITS   6  /* searches of PATH that found its table current */
+#define M_PATHLOADS  7  /* and those that had to reopen it */
+#define M_MEMOHITS   8
+#define M_MEMOMISSES 9
+#define M_SNAPHITS   10 /* startups that ran the rc snapshot */
+#define M_SNAPMISSES 11 /* and those that compiled the rc file */
+#define M_NCOUNTERS  12
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Start publishing
+ * ---------------------------------------------------------------------
+ *    Purpose: If $TSHMETRICS is set, maps the segment it names, or
+ *    /tsh-metrics.UID for a name without a leading /, creating it if
+ *    need be, and takes a slot of it for this shell. A slot whose
+ *    shell is gone is taken over, its counts added to the totals of
+ *    shells that have exited.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+MetricsInit();
+
+/***********************************************************************
+ *  Title: Count an event
+ * ---------------------------------------------------------------------
+ *    Purpose: Adds one to a counter of the shell's slot with a relaxed
+ *    atomic add, children of the shell sharing the slot. Does nothing
+ *    unless publishing.
+ *    Input: one of the M_ counters
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+MetricsAdd(int);
+
+/***********************************************************************
+ *  Title: Time a fork
+ * ---------------------------------------------------------------------
+ *    Purpose: Reads the clock before a fork, when publishing or when
+ *    the spawn probe is on (see probe.h).
+ *    Input: void
+ *    Output: CLOCK_MONOTONIC in nanoseconds, or 0 if neither
+ ***********************************************************************/
+EXTERN long long
+MetricsClock();
+
+/***********************************************************************
+ *  Title: Count a fork
+ * ---------------------------------------------------------------------
+ *    Purpose: Called in the parent once a fork has returned, and the
+ *    child is in its process group. Counts the fork and puts the time
+ *    since start in the spawn latency histogram.
+ *    Input: what MetricsClock returned before the fork
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+MetricsSpawn(long long);
+
+/***********************************************************************
+ *  Title: Publish the number of jobs
+ * ---------------------------------------------------------------------
+ *    Purpose: Sets the shell's count of background and stopped jobs.
+ *    A child of the shell, with a job table of its own, leaves it.
+ *    Input: the number of jobs
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+MetricsJobs(int);
+
+/***********************************************************************
+ *  Title: Stop publishing
+ * ---------------------------------------------------------------------
+ *    Purpose: Adds the shell's counts to the totals of exited shells
+ *    and frees its slot. Called once when the shell exits.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+MetricsCleanup();
+
+/***********************************************************************
+ *  Title: Show the segment live
+ * ---------------------------------------------------------------------
+ *    Purpose: Implements tsh --top [seconds]: prints the totals of
+ *    every shell publishing to the segment $TSHMETRICS names, their
+ *    rates, the spawn latency histogram and a line per live shell,
+ *    every interval (1 second by default) until interrupted. Prints
+ *    once, without rates, if the interval is 0 or the output is not a
+ *    terminal.
+ *    Input: the interval as given, or NULL
+ *    Output: the exit status
+ ***********************************************************************/
+EXTERN int
+MetricsTop(char*);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __METRICS_H__ */
@@ -0,0 +1,529 @@
+/***************************************************************************
+ *  Title: Place
+ * -------------------------------------------------------------------------
+ *    Purpose: CPU affinity and NUMA memory placement of launched jobs
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: place.c,v $
+ ***************************************************************************/
+#define _GNU_SOURCE
+#define __PLACE_IMPL__
+
+/************System include***********************************************/
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "place.h"
+#include "io.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* where the kernel lists the CPUs of each NUMA node */
+#define NODEDIR "/sys/devices/system/node/node"
+
+/* longest node cpulist that is read */
+#define LISTMAX 4096
+
+/*
+ * A placement. Job n runs on cpus[n % ncpus] with its memory bound
+ * to nodes[n % nnodes]; either list may be empty. Node sets use the
+ * cpu_set_t bitmask too, which has the layout set_mempolicy expects.
+ */
+typedef struct place_t
+{
+  cpu_set_t* cpus;
+  int ncpus;
+  cpu_set_t* nodes;
+  int nnodes;
+  int next; /* slot of the next job */
+} placeT;
+
+/************Global Variables*********************************************/
+
+/* the placement set by "on" without a command */
+static placeT gDefault;
+
+/* the placement of jobs started now: gDefault, or that of an "on"
+ * command that is running */
+static placeT* gActive = &gDefault;
+
+/************Function Prototypes******************************************/
+
+static bool
+ParseSets(char*, cpu_set_t**, int*);
+
+static bool
+ParseList(char*, char*, cpu_set_t*);
+
+static bool
+NodeCpus(cpu_set_t*, cpu_set_t*);
+
+static void
+SplitSets(placeT*, int);
+
+static void
+ShowPlace(placeT*);
+
+static void
+ShowList(cpu_set_t*);
+
+static void
+FreePlace(placeT*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+/*
+ * RunOn
+ *
+ * arguments:
+ *   commandT *cmd: the on command line
+ *
+ * returns: none
+ *
+ * Implements "on [cpus=LIST] [node=LIST] [split=N] [cmd [args]]",
+ * which does the work of taskset and numactl without their execs.
+ * A LIST is CPU or node numbers and ranges such as 0-7,16; several
+ * LISTs separated by '/' are used round-robin, one per job, so that
+ * "on cpus=0-7/8-15 xargs -P 2 ..." spreads the batches over both
+ * halves. With node= and no cpus=, jobs also run on the node's CPUs.
+ * split=N cuts the CPUs (all the shell may use, if none are given)
+ * into sets of N for the same kind of spreading.
+ *
+ * The placement is applied in each child the command forks, so a
+ * builtin such as xargs places every job it starts. Without a
+ * command, the placement becomes the default for all jobs; "on off"
+ * clears the default and "on" alone prints it.
+ */
+void
+RunOn(commandT* cmd)
+{
+  placeT p, *saved;
+  cpu_set_t allowed, used;
+  commandT* sub;
+  int split = 0;
+  bool ok = TRUE;
+  int i, first;
+
+  if (cmd->argc == 1)
+    {
+      ShowPlace(&gDefault);
+      return;
+    }
+  if (cmd->argc == 2 && strcmp(cmd->argv[1], "off") == 0)
+    {
+      FreePlace(&gDefault);
+      return;
+    }
+
+  memset(&p, 0, sizeof(p));
+  for (i = 1; ok && i < cmd->argc; i++)
+    {
+      char* arg = cmd->argv[i];
+      if (strncmp(arg, "cpus=", 5) == 0)
+        ok = ParseSets(arg + 5, &p.cpus, &p.ncpus);
+      else if (strncmp(arg, "node=", 5) == 0)
+        ok = ParseSets(arg + 5, &p.nodes, &p.nnodes);
+      else if (strncmp(arg, "split=", 6) == 0)
+        ok = (split = atoi(arg + 6)) > 0;
+      else
+        break;
+      if (!ok)
+        fprintf(stderr, "%s: on: bad placement %s\n", SHELLNAME, arg);
+    }
+  first = i; // the command, if there is one
+
+  // Jobs on a node run on its CPUs unless told otherwise.
+  if (ok && p.nnodes > 0 && p.ncpus == 0)
+    {
+      p.cpus = calloc(p.nnodes, sizeof(cpu_set_t));
+      p.ncpus = p.nnodes;
+      for (i = 0; ok && i < p.nnodes; i++)
+        ok = NodeCpus(&p.nodes[i], &p.cpus[i]);
+    }
+  if (ok && split > 0)
+    SplitSets(&p, split);
+
+  // A set the shell may not run on would only fail in the child.
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+  for (i = 0; ok && i < p.ncpus; i++)
+    {
+      CPU_AND(&used, &p.cpus[i], &allowed);
+      if (CPU_COUNT(&used) == 0)
+        {
+          fprintf(stderr, "%s: on: no usable CPU in set %d\n", SHELLNAME,
+                  i + 1);
+          ok = FALSE;
+        }
+    }
+  if (!ok)
+    {
+      FreePlace(&p);
+      lastStatus = 1;
+      return;
+    }
+
+  if (first == cmd->argc)
+    { // no command: new default
+      FreePlace(&gDefault);
+      gDefault = p;
+      return;
+    }
+  sub = malloc(sizeof(commandT) + sizeof(char*) * (cmd->argc - first + 1));
+  memcpy(sub->argv, cmd->argv + first,
+         sizeof(char*) * (cmd->argc - first + 1));
+  sub->argc = cmd->argc - first;
+  sub->name = sub->argv[0];
+
+  saved = gActive;
+  gActive = &p;
+  RunCmd(sub);
+  gActive = saved;
+
+  free(sub);
+  FreePlace(&p);
+} /* RunOn */
+
+
+/*
+ * PlaceNext
+ *
+ * arguments: none
+ *
+ * returns: int: the slot of the next job, or -1 if it is not placed
+ *
+ * Picks the placement of a job about to be forked.
+ */
+int
+PlaceNext()
+{
+  int slot = gActive->next;
+
+  if (gActive->ncpus == 0 && gActive->nnodes == 0)
+    return -1;
+  // Wrap at a common multiple so the rotation never skips.
+  gActive->next = (slot + 1) % (MAX(gActive->ncpus, 1)
+                                * MAX(gActive->nnodes, 1));
+  return slot;
+} /* PlaceNext */
+
+
+/*
+ * PlaceApply
+ *
+ * arguments:
+ *   int slot: the slot picked by PlaceNext, or -1
+ *
+ * returns: none
+ *
+ * Places the calling process, which must be a child about to exec.
+ * It exits rather than run the job somewhere it was not meant to.
+ */
+void
+PlaceApply(int slot)
+{
+  if (slot < 0)
+    return;
+  if (gActive->ncpus > 0
+      && sched_setaffinity(0, sizeof(cpu_set_t),
+                           &gActive->cpus[slot % gActive->ncpus]) != 0)
+    {
+      PrintPError("on: sched_setaffinity");
+      _exit(126);
+    }
+  if (gActive->nnodes > 0
+      && syscall(SYS_set_mempolicy, MPOL_BIND,
+                 (unsigned long*) &gActive->nodes[slot % gActive->nnodes],
+                 CPU_SETSIZE + 1) != 0)
+    {
+      PrintPError("on: set_mempolicy");
+      _exit(126);
+    }
+} /* PlaceApply */
+
+
+/*
+ * PlaceCleanup
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Frees the default placement.
+ */
+void
+PlaceCleanup()
+{
+  FreePlace(&gDefault);
+} /* PlaceCleanup */
+
+
+/*
+ * ParseSets
+ *
+ * arguments:
+ *   char *text: LISTs separated by '/'
+ *   cpu_set_t **sets: receives the parsed sets
+ *   int *n: receives their number
+ *
+ * returns: bool: FALSE if text is malformed
+ *
+ * Parses the value of cpus= or node=. A value given twice replaces
+ * the first.
+ */
+static bool
+ParseSets(char* text, cpu_set_t** sets, int* n)
+{
+  char* end;
+  int count = 1;
+  int i;
+
+  for (end = text; *end != 0; end++)
+    if (*end == '/')
+      count++;
+  free(*sets);
+  *sets = calloc(count, sizeof(cpu_set_t));
+  *n = count;
+  for (i = 0; i < count; i++)
+    {
+      for (end = text; *end != 0 && *end != '/'; end++)
+        ;
+      if (!ParseList(text, end, &(*sets)[i]))
+        return FALSE;
+      text = end + 1;
+    }
+  return TRUE;
+} /* ParseSets */
+
+
+/*
+ * ParseList
+ *
+ * arguments:
+ *   char *s: start of the list, e.g. "0-3,8"
+ *   char *end: end of the list
+ *   cpu_set_t *set: receives the numbers in the list
+ *
+ * returns: bool: FALSE if the list is empty or malformed
+ *
+ * Parses one list of numbers and ranges, in the format the kernel
+ * uses for cpulist files.
+ */
+static bool
+ParseList(char* s, char* end, cpu_set_t* set)
+{
+  long lo, hi;
+  char* q;
+
+  CPU_ZERO(set);
+  if (s == end)
+    return FALSE;
+  while (s < end)
+    {
+      lo = hi = strtol(s, &q, 10);
+      if (q == s)
+        return FALSE;
+      s = q;
+      if (s < end && *s == '-')
+        {
+          hi = strtol(++s, &q, 10);
+          if (q == s)
+            return FALSE;
+          s = q;
+        }
+      if (lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+        return FALSE;
+      for (; lo <= hi; lo++)
+        CPU_SET(lo, set);
+      if (s < end && *s++ != ',')
+        return FALSE;
+    }
+  return TRUE;
+} /* ParseList */
+
+
+/*
+ * NodeCpus
+ *
+ * arguments:
+ *   cpu_set_t *nodes: a set of NUMA nodes
+ *   cpu_set_t *cpus: receives the CPUs of those nodes
+ *
+ * returns: bool: FALSE if a node does not exist
+ */
+static bool
+NodeCpus(cpu_set_t* nodes, cpu_set_t* cpus)
+{
+  char path[sizeof(NODEDIR) + 32];
+  char list[LISTMAX];
+  cpu_set_t one;
+  FILE* f;
+  int node;
+  size_t len;
+
+  CPU_ZERO(cpus);
+  for (node = 0; node < CPU_SETSIZE; node++)
+    {
+      if (!CPU_ISSET(node, nodes))
+        continue;
+      sprintf(path, "%s%d/cpulist", NODEDIR, node);
+      if ((f = fopen(path, "r")) == NULL)
+        {
+          fprintf(stderr, "%s: on: no NUMA node %d\n", SHELLNAME, node);
+          return FALSE;
+        }
+      len = fread(list, 1, sizeof(list) - 1, f);
+      fclose(f);
+      while (len > 0 && (list[len - 1] == '\n' || list[len - 1] == ' '))
+        len--;
+      // A node with memory but no CPUs adds nothing.
+      if (len > 0 && ParseList(list, list + len, &one))
+        CPU_OR(cpus, cpus, &one);
+    }
+  return TRUE;
+} /* NodeCpus */
+
+
+/*
+ * SplitSets
+ *
+ * arguments:
+ *   placeT *p: the placement
+ *   int size: CPUs per set
+ *
+ * returns: none
+ *
+ * Replaces the CPU sets of a placement, or the CPUs the shell may run
+ * on if it has none, with consecutive sets of size CPUs.
+ */
+static void
+SplitSets(placeT* p, int size)
+{
+  cpu_set_t all;
+  cpu_set_t* sets;
+  int count, cpu, k = 0;
+  int i;
+
+  CPU_ZERO(&all);
+  if (p->ncpus == 0)
+    sched_getaffinity(0, sizeof(all), &all);
+  for (i = 0; i < p->ncpus; i++)
+    CPU_OR(&all, &all, &p->cpus[i]);
+
+  count = (CPU_COUNT(&all) + size - 1) / size;
+  sets = calloc(count > 0 ? count : 1, sizeof(cpu_set_t));
+  for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    if (CPU_ISSET(cpu, &all))
+      {
+        CPU_SET(cpu, &sets[k / size]);
+        k++;
+      }
+  free(p->cpus);
+  p->cpus = sets;
+  p->ncpus = count;
+} /* SplitSets */
+
+
+/*
+ * ShowPlace
+ *
+ * arguments:
+ *   placeT *p: the placement
+ *
+ * returns: none
+ *
+ * Prints a placement in the form "on" accepts, or nothing if it is
+ * empty.
+ */
+static void
+ShowPlace(placeT* p)
+{
+  int i;
+
+  if (p->ncpus > 0)
+    {
+      printf("cpus=");
+      for (i = 0; i < p->ncpus; i++)
+        {
+          if (i > 0)
+            putchar('/');
+          ShowList(&p->cpus[i]);
+        }
+    }
+  if (p->nnodes > 0)
+    {
+      printf(p->ncpus > 0 ? " node=" : "node=");
+      for (i = 0; i < p->nnodes; i++)
+        {
+          if (i > 0)
+            putchar('/');
+          ShowList(&p->nodes[i]);
+        }
+    }
+  if (p->ncpus > 0 || p->nnodes > 0)
+    PrintNewline();
+} /* ShowPlace */
+
+
+/*
+ * ShowList
+ *
+ * arguments:
+ *   cpu_set_t *set: the set to print
+ *
+ * returns: none
+ *
+ * Prints a set as a list of numbers and ranges.
+ */
+static void
+ShowList(cpu_set_t* set)
+{
+  bool first = TRUE;
+  int lo, hi;
+
+  for (lo = 0; lo < CPU_SETSIZE; lo = hi + 1)
+    {
+      for (; lo < CPU_SETSIZE && !CPU_ISSET(lo, set); lo++)
+        ;
+      if (lo == CPU_SETSIZE)
+        break;
+      for (hi = lo; hi + 1 < CPU_SETSIZE && CPU_ISSET(hi + 1, set); hi++)
+        ;
+      printf(first ? "%d" : ",%d", lo);
+      if (hi > lo)
+        printf("-%d", hi);
+      first = FALSE;
+    }
+} /* ShowList */
+
+
+/*
+ * FreePlace
+ *
+ * arguments:
+ *   placeT *p: the placement
+ *
+ * returns: none
+ *
+ * Empties a placement.
+ */
+static void
+FreePlace(placeT* p)
+{
+  free(p->cpus);
+  free(p->nodes);
+  memset(p, 0, sizeof(*p));
+} /* FreePlace */
@@ -0,0 +1,91 @@
+/***************************************************************************
+ *  Title: Place
+ * -------------------------------------------------------------------------
+ *    Purpose: CPU affinity and NUMA memory placement of launched jobs
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: place.h,v $
+ ***************************************************************************/
+
+#ifndef __PLACE_H__
+#define __PLACE_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "runtime.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __PLACE_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Run the on builtin
+ * ---------------------------------------------------------------------
+ *    Purpose: Implements "on [cpus=LIST] [node=LIST] [split=N] [cmd]".
+ *    With a command, runs it under the given placement; without one,
+ *    makes the placement the default for every job the shell starts.
+ *    Input: the on command line
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RunOn(commandT*);
+
+/***********************************************************************
+ *  Title: Pick the placement of the next job
+ * ---------------------------------------------------------------------
+ *    Purpose: Called in the shell before each fork. Advances the
+ *    round-robin position of the active placement.
+ *    Input: void
+ *    Output: a slot to pass to PlaceApply in the child, or -1 if
+ *    there is no placement in effect
+ ***********************************************************************/
+EXTERN int
+PlaceNext();
+
+/***********************************************************************
+ *  Title: Apply a placement
+ * ---------------------------------------------------------------------
+ *    Purpose: Called in the child between fork and exec. Sets the CPU
+ *    affinity and memory policy of the slot picked by PlaceNext; the
+ *    child exits with status 126 if either cannot be set.
+ *    Input: the slot, or -1 to do nothing
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+PlaceApply(int);
+
+/***********************************************************************
+ *  Title: Release the placement state
+ * ---------------------------------------------------------------------
+ *    Purpose: Frees the default placement. Called once when the shell
+ *    exits.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+PlaceCleanup();
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __PLACE_H__ */
@@ -0,0 +1,52 @@
+/***************************************************************************
+ *  Title: Probe
+ * -------------------------------------------------------------------------
+ *    Purpose: Static tracepoints (USDT probes) that perf, bpftrace or
+ *    SystemTap can attach to in a running tsh
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: probe.c,v $
+ ***************************************************************************/
+#define __PROBE_IMPL__
+
+/************System include***********************************************/
+#include <time.h>
+
+/************Private include**********************************************/
+#include "probe.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+/*
+ * ProbeClock
+ *
+ * arguments: none
+ *
+ * returns: long long: CLOCK_MONOTONIC in nanoseconds
+ *
+ * 0 stands for a duration that was not timed, so it is never given.
+ */
+long long
+ProbeClock()
+{
+  struct timespec ts;
+  long long ns;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  return ns != 0 ? ns : 1;
+} /* ProbeClock */
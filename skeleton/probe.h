@@ -0,0 +1,205 @@
+/***************************************************************************
+ *  Title: Probe
+ * -------------------------------------------------------------------------
+ *    Purpose: Static tracepoints (USDT probes) that perf, bpftrace or
+ *    SystemTap can attach to in a running tsh
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: probe.h,v $
+ ***************************************************************************/
+
+#ifndef __PROBE_H__
+#define __PROBE_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __PROBE_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/*
+ * The probes of provider tsh, and their arguments. Every argument is
+ * passed as a signed 64-bit value; strings are pointers, NULL where
+ * there is none. Durations are in nanoseconds.
+ *
+ *   read_start    ()                        getCommandLine called
+ *   read_done     (line, length, ns)        a line read; NULL at the end
+ *   parse_start   (line)                    getCommand called
+ *   parse_done    (argv[0], argc, ns)
+ *   resolve_start (name)                    getFullPath called
+ *   resolve_done  (name, path, ns)          path NULL if not found
+ *   spawn         (name, pid, ns)           a fork returned in the shell
+ *   exec          (path, argv)              a child about to exec
+ *   wait_start    (pgid)                    the shell waits for a job
+ *   wait_done     (pgid, status, ns)        which finished or stopped
+ *   reap          (pid, status, ns)         a child reaped, ns after its
+ *                                           fork; status as waitpid's
+ *
+ * Each probe is a nop with an ELF note (in .note.stapsdt, the format
+ * of <sys/sdt.h>) giving its address and where its arguments are. The
+ * nop is always executed, so a tracer finds it wherever the probe is
+ * placed. A tracer attaching to a probe also increments its
+ * semaphore; the arguments are only computed, and clocks read for
+ * durations, while the semaphore is set, and are 0 otherwise. Build
+ * with -D TSH_NO_PROBES to leave them out.
+ */
+#if defined(__x86_64__) && defined(__ELF__) && !defined(TSH_NO_PROBES)
+#define TSH_PROBES
+
+/* tests whether a tracer is attached to a probe */
+#define PROBE_ON(name) __builtin_expect(tsh_##name##_semaphore != 0, 0)
+
+/* the probe itself: a nop and its note, always in the code */
+#define PROBE_NOTE(name, args, ...)                                         \
+  __asm__ __volatile__("990: nop\n"                                         \
+                       ".pushsection .note.stapsdt,\"?\",\"note\"\n"        \
+                       ".balign 4\n"                                        \
+                       ".4byte 992f-991f, 994f-993f, 3\n"                   \
+                       "991: .asciz \"stapsdt\"\n"                          \
+                       "992: .balign 4\n"                                   \
+                       "993: .8byte 990b\n"                                 \
+                       ".8byte _.stapsdt.base\n"                            \
+                       ".8byte tsh_" #name "_semaphore\n"                   \
+                       ".asciz \"tsh\"\n"                                   \
+                       ".asciz \"" #name "\"\n"                             \
+                       ".asciz \"" args "\"\n"                              \
+                       "994: .balign 4\n"                                   \
+                       ".popsection\n"                                      \
+                       ".ifndef _.stapsdt.base\n"                           \
+                       ".pushsection .stapsdt.base,\"aG\",\"progbits\","    \
+                       ".stapsdt.base,comdat\n"                             \
+                       ".weak _.stapsdt.base\n"                             \
+                       ".hidden _.stapsdt.base\n"                           \
+                       "_.stapsdt.base: .space 1\n"                         \
+                       ".size _.stapsdt.base, 1\n"                          \
+                       ".popsection\n"                                      \
+                       ".endif\n"                                           \
+                       :: __VA_ARGS__)
+
+#define PROBE0(name)                                                        \
+  do                                                                        \
+    {                                                                       \
+      PROBE_NOTE(name, "");                                                 \
+    }                                                                       \
+  while (0)
+#define PROBE1(name, a)                                                     \
+  do                                                                        \
+    {                                                                       \
+      int probe_on_ = PROBE_ON(name);                                       \
+      long probe_a_ = probe_on_ ? (long) (a) : 0;                           \
+      PROBE_NOTE(name, "-8@%0", "nor"(probe_a_));                           \
+    }                                                                       \
+  while (0)
+#define PROBE2(name, a, b)                                                  \
+  do                                                                        \
+    {                                                                       \
+      int probe_on_ = PROBE_ON(name);                                       \
+      long probe_a_ = probe_on_ ? (long) (a) : 0;                           \
+      long probe_b_ = probe_on_ ? (long) (b) : 0;                           \
+      PROBE_NOTE(name, "-8@%0 -8@%1", "nor"(probe_a_), "nor"(probe_b_));    \
+    }                                                                       \
+  while (0)
+#define PROBE3(name, a, b, c)                                               \
+  do                                                                        \
+    {                                                                       \
+      int probe_on_ = PROBE_ON(name);                                       \
+      long probe_a_ = probe_on_ ? (long) (a) : 0;                           \
+      long probe_b_ = probe_on_ ? (long) (b) : 0;                           \
+      long probe_c_ = probe_on_ ? (long) (c) : 0;                           \
+      PROBE_NOTE(name, "-8@%0 -8@%1 -8@%2", "nor"(probe_a_),                \
+                 "nor"(probe_b_), "nor"(probe_c_));                         \
+    }                                                                       \
+  while (0)
+
+#else
+
+/* the arguments are still seen, so that their variables are used */
+#define PROBE_ON(name) 0
+#define PROBE0(name)
+#define PROBE1(name, a)                                                     \
+  do                                                                        \
+    {                                                                       \
+      if (0)                                                                \
+        (void) (a);                                                         \
+    }                                                                       \
+  while (0)
+#define PROBE2(name, a, b)                                                  \
+  do                                                                        \
+    {                                                                       \
+      if (0)                                                                \
+        (void) (a), (void) (b);                                             \
+    }                                                                       \
+  while (0)
+#define PROBE3(name, a, b, c)                                               \
+  do                                                                        \
+    {                                                                       \
+      if (0)                                                                \
+        (void) (a), (void) (b), (void) (c);                                 \
+    }                                                                       \
+  while (0)
+
+#endif /* TSH_PROBES */
+
+/* a start time for a duration, if the probe reporting it is on */
+#define PROBE_CLOCK(name) (PROBE_ON(name) ? ProbeClock() : 0)
+
+/* the time since a PROBE_CLOCK, or 0 if the probe was off then */
+#define PROBE_SINCE(t) ((t) != 0 ? ProbeClock() - (t) : 0)
+
+/************Global Variables*********************************************/
+
+#ifdef TSH_PROBES
+
+/*
+ * The semaphores, one per probe, named as <sys/sdt.h> names them. A
+ * tracer adds one while attached and takes it away when it leaves.
+ */
+#define PROBESEMA __attribute__ ((section(".probes")))
+EXTERN volatile unsigned short tsh_read_start_semaphore PROBESEMA;
+EXTERN volatile unsigned short tsh_read_done_semaphore PROBESEMA;
+EXTERN volatile unsigned short tsh_parse_start_semaphore PROBESEMA;
+EXTERN volatile unsigned short tsh_parse_done_semaphore PROBESEMA;
+EXTERN volatile unsigned short tsh_resolve_start_semaphore PROBESEMA;
+EXTERN volatile unsigned short tsh_resolve_done_semaphore PROBESEMA;
+EXTERN volatile unsigned short tsh_spawn_semaphore PROBESEMA;
+EXTERN volatile unsigned short tsh_exec_semaphore PROBESEMA;
+EXTERN volatile unsigned short tsh_wait_start_semaphore PROBESEMA;
+EXTERN volatile unsigned short tsh_wait_done_semaphore PROBESEMA;
+EXTERN volatile unsigned short tsh_reap_semaphore PROBESEMA;
+
+#endif /* TSH_PROBES */
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Read the probe clock
+ * ---------------------------------------------------------------------
+ *    Purpose: Gives the start of a duration a probe reports. Called
+ *    through PROBE_CLOCK, only while the probe is on.
+ *    Input: void
+ *    Output: CLOCK_MONOTONIC in nanoseconds, never 0
+ ***********************************************************************/
+EXTERN long long
+ProbeClock();
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __PROBE_H__ */
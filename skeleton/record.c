@@ -0,0 +1,344 @@
+/***************************************************************************
+ *  Title: Record
+ * -------------------------------------------------------------------------
+ *    Purpose: Session recording (tsh -r) and the trace format tshreplay
+ *    reads back
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: record.c,v $
+ ***************************************************************************/
+#define __RECORD_IMPL__
+
+/************System include***********************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "record.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* records are written out when this much is buffered */
+#define RECBUFSIZE 65536
+
+/* longest LEB128 encoding of 64 bits */
+#define VARINTMAX 10
+
+/************Global Variables*********************************************/
+
+/* first bytes of every trace; the digit is the format version */
+static const char kMagic[8] = "TSHREC1\n";
+
+/* the trace being written, or -1 when not recording */
+static int gFd = -1;
+static char* gBuf = NULL;
+static int gUsed = 0;
+
+/* start of the line being run, of the last record written (or of
+ * the session) and of the wait in progress */
+static long long gStart, gLastStart, gWaitStart;
+/* time waited for children since the line started */
+static long long gWait;
+
+/************Function Prototypes******************************************/
+/* reads CLOCK_MONOTONIC in nanoseconds */
+static long long
+Now();
+/* appends a varint to the buffer */
+static void
+PutVarint(unsigned long long);
+/* writes out the buffer */
+static void
+Flush();
+/* reads a varint */
+static bool
+GetVarint(FILE*, unsigned long long*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+/*
+ * RecordOpen
+ *
+ * arguments:
+ *   char *path: where to write the trace
+ *
+ * returns: bool: FALSE if the file could not be created
+ */
+bool
+RecordOpen(char* path)
+{
+  gFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (gFd < 0)
+    return FALSE;
+  gBuf = malloc(RECBUFSIZE);
+  memcpy(gBuf, kMagic, sizeof(kMagic));
+  gUsed = sizeof(kMagic);
+  gLastStart = gStart = Now();
+  return TRUE;
+} /* RecordOpen */
+
+
+/*
+ * RecordStart
+ *
+ * arguments: none
+ *
+ * returns: none
+ */
+void
+RecordStart()
+{
+  if (gFd < 0)
+    return;
+  gStart = Now();
+  gWait = 0;
+} /* RecordStart */
+
+
+/*
+ * RecordLine
+ *
+ * arguments:
+ *   char *text: the line
+ *   int status: $? after it
+ *
+ * returns: none
+ *
+ * Encodes the record into the buffer, writing the buffer out first
+ * if the record might not fit. A line longer than the buffer is
+ * written out on its own.
+ */
+void
+RecordLine(char* text, int status)
+{
+  long long end;
+  size_t len;
+
+  if (gFd < 0)
+    return;
+  end = Now();
+  len = strlen(text);
+  if (gUsed + 6 * VARINTMAX + len > RECBUFSIZE)
+    Flush();
+  PutVarint(gStart - gLastStart);
+  PutVarint(end - gStart);
+  PutVarint(gWait);
+  PutVarint((unsigned) status);
+  PutVarint(len);
+  if (gUsed + len > RECBUFSIZE)
+    {
+      Flush();
+      if (write(gFd, text, len) < 0)
+        perror("record");
+    }
+  else
+    {
+      memcpy(gBuf + gUsed, text, len);
+      gUsed += len;
+    }
+  gLastStart = gStart;
+} /* RecordLine */
+
+
+/*
+ * RecordWait
+ *
+ * arguments:
+ *   bool start: TRUE before a wait, FALSE after it
+ *
+ * returns: none
+ *
+ * Waits may nest, as when fg is run from a function being waited on
+ * through a substitution; only the outermost one is timed.
+ */
+void
+RecordWait(bool start)
+{
+  static int depth = 0;
+
+  if (gFd < 0)
+    return;
+  if (start && depth++ == 0)
+    gWaitStart = Now();
+  else if (!start && --depth == 0)
+    gWait += Now() - gWaitStart;
+} /* RecordWait */
+
+
+/*
+ * RecordClose
+ *
+ * arguments: none
+ *
+ * returns: none
+ */
+void
+RecordClose()
+{
+  if (gFd < 0)
+    return;
+  Flush();
+  close(gFd);
+  gFd = -1;
+  free(gBuf);
+  gBuf = NULL;
+} /* RecordClose */
+
+
+/*
+ * RecordHeader
+ *
+ * arguments:
+ *   FILE *f: a trace
+ *
+ * returns: bool: FALSE if it does not start with this version's magic
+ */
+bool
+RecordHeader(FILE* f)
+{
+  char magic[sizeof(kMagic)];
+
+  return fread(magic, sizeof(magic), 1, f) == 1
+    && memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+} /* RecordHeader */
+
+
+/*
+ * RecordRead
+ *
+ * arguments:
+ *   FILE *f: a trace, past its header
+ *   recT *r: the previous record, or zeroes; receives the next one
+ *
+ * returns: bool: FALSE at the end of the trace or on a short record
+ */
+bool
+RecordRead(FILE* f, recT* r)
+{
+  unsigned long long v[5];
+  int i;
+
+  for (i = 0; i < 5; i++)
+    if (!GetVarint(f, &v[i]))
+      return FALSE;
+  r->start += v[0];
+  r->wall = v[1];
+  r->wait = v[2];
+  r->status = v[3];
+  r->len = v[4];
+  r->text = realloc(r->text, r->len + 1);
+  if (fread(r->text, 1, r->len, f) != r->len)
+    return FALSE;
+  r->text[r->len] = 0;
+  return TRUE;
+} /* RecordRead */
+
+
+/*
+ * Now
+ *
+ * arguments: none
+ *
+ * returns: long long: CLOCK_MONOTONIC in nanoseconds
+ */
+static long long
+Now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+} /* Now */
+
+
+/*
+ * PutVarint
+ *
+ * arguments:
+ *   unsigned long long v: the value
+ *
+ * returns: none
+ *
+ * Appends v seven bits at a time, low bits first, with the top bit of
+ * each byte set when more follow. The caller makes sure it fits.
+ */
+static void
+PutVarint(unsigned long long v)
+{
+  while (v >= 0x80)
+    {
+      gBuf[gUsed++] = (v & 0x7f) | 0x80;
+      v >>= 7;
+    }
+  gBuf[gUsed++] = v;
+} /* PutVarint */
+
+
+/*
+ * Flush
+ *
+ * arguments: none
+ *
+ * returns: none
+ */
+static void
+Flush()
+{
+  char* p = gBuf;
+  ssize_t n;
+
+  while (gUsed > 0)
+    {
+      if ((n = write(gFd, p, gUsed)) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          perror("record");
+          break;
+        }
+      p += n;
+      gUsed -= n;
+    }
+  gUsed = 0;
+} /* Flush */
+
+
+/*
+ * GetVarint
+ *
+ * arguments:
+ *   FILE *f: the trace
+ *   unsigned long long *v: receives the value
+ *
+ * returns: bool: FALSE at the end of the file or on a varint too long
+ *                to be one PutVarint wrote
+ */
+static bool
+GetVarint(FILE* f, unsigned long long* v)
+{
+  int c, shift;
+
+  *v = 0;
+  for (shift = 0; shift < 7 * VARINTMAX; shift += 7)
+    {
+      if ((c = getc(f)) == EOF)
+        return FALSE;
+      *v |= (unsigned long long) (c & 0x7f) << shift;
+      if ((c & 0x80) == 0)
+        return TRUE;
+    }
+  return FALSE;
+} /* GetVarint */
@@ -0,0 +1,138 @@
+/***************************************************************************
+ *  Title: Record
+ * -------------------------------------------------------------------------
+ *    Purpose: Session recording (tsh -r) and the trace format tshreplay
+ *    reads back
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: record.h,v $
+ ***************************************************************************/
+
+#ifndef __RECORD_H__
+#define __RECORD_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+#include <stdio.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __RECORD_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/*
+ * One input line of a recorded session. Times are in nanoseconds of
+ * CLOCK_MONOTONIC. In the file a record is six unsigned LEB128
+ * varints: start less the previous record's start, wall, wait,
+ * status, the length of the text, then the text itself.
+ */
+typedef struct rec_t
+{
+  long long start; /* since the session started */
+  long long wall;  /* from reading the line to being done with it */
+  long long wait;  /* of wall, spent waiting for foreground children */
+  int status;      /* $? afterwards */
+  int len;
+  char* text;      /* len bytes and a NUL */
+} recT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Start recording
+ * ---------------------------------------------------------------------
+ *    Purpose: Creates the trace file and writes its header. Records
+ *    are buffered and written out by RecordClose.
+ *    Input: the path of the trace
+ *    Output: FALSE if the file could not be created
+ ***********************************************************************/
+EXTERN bool
+RecordOpen(char*);
+
+/***********************************************************************
+ *  Title: A line was read
+ * ---------------------------------------------------------------------
+ *    Purpose: Notes the time the next record starts at.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RecordStart();
+
+/***********************************************************************
+ *  Title: A line is done
+ * ---------------------------------------------------------------------
+ *    Purpose: Appends the record of the line started by RecordStart.
+ *    Input: the line and $? after it
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RecordLine(char*, int);
+
+/***********************************************************************
+ *  Title: Time a wait for children
+ * ---------------------------------------------------------------------
+ *    Purpose: Called with TRUE before the shell blocks waiting for a
+ *    foreground child and with FALSE after. The time in between is
+ *    the record's wait rather than shell overhead. Does nothing when
+ *    not recording.
+ *    Input: TRUE at the start of the wait, FALSE at the end
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RecordWait(bool);
+
+/***********************************************************************
+ *  Title: Stop recording
+ * ---------------------------------------------------------------------
+ *    Purpose: Writes out the buffered records and closes the trace.
+ *    Called once when the shell exits.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RecordClose();
+
+/***********************************************************************
+ *  Title: Check a trace header
+ * ---------------------------------------------------------------------
+ *    Purpose: Reads and checks the header at the start of a trace.
+ *    Input: the trace, opened for reading
+ *    Output: FALSE if it is not a trace this version can read
+ ***********************************************************************/
+EXTERN bool
+RecordHeader(FILE*);
+
+/***********************************************************************
+ *  Title: Read a record
+ * ---------------------------------------------------------------------
+ *    Purpose: Reads the next record of a trace. r->text is reused
+ *    from one call to the next and grown as needed; r->start must be
+ *    0 before the first call, as the file only holds differences.
+ *    Input: the trace, past its header, and the record to fill in
+ *    Output: FALSE at the end of the trace or on a truncated record
+ ***********************************************************************/
+EXTERN bool
+RecordRead(FILE*, recT*);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __RECORD_H__ */
@@ -40,25 +40,47 @@
  *    Milestone 1
  *
  ***************************************************************************/
+#define _GNU_SOURCE
 #define __RUNTIME_IMPL__
 
 /************System include***********************************************/
 #include <assert.h>
 #include <errno.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <sys/wait.h>
 #include <sys/param.h>
+#include <sys/syscall.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <stdio_ext.h>
 
 /************Private include**********************************************/
 #include "runtime.h"
+#include "bench.h"
+#include "codec.h"
+#include "enable.h"
 #include "io.h"
+#include "jobring.h"
+#include "memo.h"
+#include "metrics.h"
+#include "place.h"
+#include "probe.h"
+#include "record.h"
+#include "script.h"
+#include "text.h"
+#include "timeout.h"
+#include "memprof.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -71,40 +93,333 @@
 
 #define NBUILTINCOMMANDS (sizeof BuiltInCommands / sizeof(char*))
 
-typedef struct bgjob_l
+/* the names of the builtin commands */
+static char* BuiltInCommands[] = { "echo", "cd", "exit", "xargs", "true",
+                                    "false", "on", "jobs", "fg", "bg",
+                                    "cat", "timeout", "bench", "enable",
+                                    "memo", "wc", "head", "tail" };
+
+#define NPUREBUILTINS (sizeof PureBuiltIns / sizeof(char*))
+
+/* builtins that only write output; see IsPureBuiltIn */
+static char* PureBuiltIns[] = { "echo", "true", "false" };
+
+#define NTHREADBUILTINS (sizeof ThreadBuiltIns / sizeof(char*))
+
+/* builtins a foreground pipeline runs on a worker thread; see
+ * StagesNew */
+static char* ThreadBuiltIns[] = { "echo", "true", "false", "cat" };
+
+/* room left in an xargs batch for the exec path and the kernel */
+#define XARGS_HEADROOM 2048
+/* the longest single argument exec takes: MAX_ARG_STRLEN, with its NUL */
+#define XARGS_MAXARG 131072
+
+/* a directory commands are looked up in, held open */
+typedef struct dir_t
+{
+  char* path;
+  size_t len;
+  int fd;  /* O_PATH descriptor, or -1 for a relative or missing entry */
+} dirT;
+
+/* job states */
+#define J_RUNNING 0
+#define J_STOPPED 1
+
+/* pidfd events CheckJobs handles per call */
+#define NEVENTS 64
+
+/* set in the epoll data of a job's timer, telling it from a procT */
+#define TIMERTAG 1
+
+/* the most a ring's pipe is grown to, the default pipe-max-size */
+#define RINGPIPEMAX (1 << 20)
+
+/* how much of a file the kernel reads for its #! line */
+#define SHEBANGMAX 256
+
+/* bytes in the ring between two builtin stages, a power of two */
+#define STAGERING (64 * 1024)
+
+/* a process of a job */
+typedef struct proc_t
 {
   pid_t pid;
-  struct bgjob_l* next;
-} bgjobL;
+  int fd;       /* pidfd, or -1 once the process is reaped */
+  int status;   /* wait status, once reaped */
+  bool stopped;
+  struct job_t* job;
+  long long started; /* PROBE_CLOCK when added, for the reap probe */
+} procT;
+
+/*
+ * A job: the processes of a command line, in one process group. Jobs
+ * in the background or stopped are numbered and kept in gJobs; the
+ * foreground job is gFg until it stops.
+ */
+typedef struct job_t
+{
+  int id;       /* job number, or 0 for the foreground job */
+  pid_t pgid;
+  int state;
+  procT* procs;
+  int nprocs, maxProcs;
+  int nlive;    /* processes not yet reaped */
+  int nstopped; /* live processes that are stopped */
+  char* text;   /* the command line, set when the job is numbered */
+  timeoutT timeout; /* set by timeout; its fd is -1 without a timer */
+  bool changed; /* on the list CheckJobs is building */
+  struct job_t* nextChanged;
+} jobT;
+
+/*
+ * A builtin stage of a foreground pipeline, run on a worker thread
+ * instead of in a child. Its input and output are the pipes of the
+ * neighbouring stages or, between two builtin stages, a ring.
+ */
+typedef struct stage_t
+{
+  commandT* cmd; /* NULL for a stage that is forked */
+  int in, out;   /* descriptors, or -1 where a ring is used */
+  spscT* rin;
+  spscT* rout;
+  int status;
+  pthread_t thread; /* the worker, while running is set */
+  int running;
+  struct stages_t* set;
+  struct stage_t* next; /* in the queue of stages waiting for a worker */
+} stageT;
+
+/*
+ * The builtin stages of one pipeline. It is freed by whichever of the
+ * shell and the stages lets go of it last: the shell stops waiting
+ * when the job is stopped, but the stages cannot be.
+ */
+typedef struct stages_t
+{
+  unsigned live;  /* stages not done; the shell sleeps on it */
+  int refs;       /* the stages running, and the shell while it waits */
+  int status;     /* of the last stage, if it is a builtin */
+  bool cancel;    /* ^C: the rings were closed under the stages */
+  int nstages;    /* in the pipeline */
+  int nrings;
+  stageT* stage;  /* one per stage of the pipeline */
+  spscT** ring;
+} stagesT;
+
+/* numbered jobs, indexed by number; gLastJob is the highest in use */
+static jobT** gJobs = NULL;
+static int gMaxJobs = 0, gLastJob = 0, gNJobs = 0;
+/* the job fg and bg act on by default, or 0 */
+static int gCurJob = 0;
+/* the foreground job, reused for every command */
+static jobT gFg;
+/* pidfds of the live processes of numbered jobs, with their procT */
+static int gEpoll = -1;
+/* whether foreground jobs are given the terminal */
+static bool gTty = FALSE;
+static pid_t gShellPgid = 0;
+/* whether this is a forked child running part of a command line */
+static bool gSubshell = FALSE;
+/* SIGCHLD as a descriptor, for waits that also watch a timer */
+static int gChldFd = -1;
+/* the tsh binary, as #! lines name it; 0 if it could not be found */
+static dev_t gSelfDev = 0;
+static ino_t gSelfIno = 0;
+/* whether new jobs join the shell's process group instead of leading
+ * their own, as in a script run in a forked subshell */
+static bool gOwnGroup = FALSE;
+
+/* the worker threads, and the stages queued for them, under gStageLock */
+static pthread_mutex_t gStageLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gStageCond = PTHREAD_COND_INITIALIZER;
+static pthread_t* gWorkers = NULL;
+static int gNWorkers = 0, gIdle = 0, gQueued = 0;
+static stageT* gQueueHead = NULL;
+static stageT* gQueueTail = NULL;
+static bool gStageQuit = FALSE;
+/* the stages the shell is waiting on, for StagesInterrupt */
+static stagesT* volatile gStageSet = NULL;
 
-/* the pids of the background processes */
-bgjobL *bgjobs = NULL;
+/* how many RedirSwap calls in effect replaced descriptor 0 */
+static int gStdinSwapped = 0;
+
+/* the shell's working directory, as a path and as an open directory;
+ * loaded on first use and afterwards changed only by cd */
+static char* gCwd = NULL;
+static int gCwdFd = -1;
+
+/* the PATH directories, opened when PATH last changed */
+static dirT* gPathDirs = NULL;
+static int gNPathDirs = 0;
+static char* gPathKey = NULL;
+/* the home directory, searched before the working directory */
+static dirT gHome = { NULL, 0, -1 };
 
 /************Function Prototypes******************************************/
-/* run command */
-static void
-RunCmdFork(commandT*, bool);
 /* runs an external program command after some checks */
 static void
-RunExternalCmd(commandT*, bool);
-/* resolves the path and checks for exutable flag */
-static bool
-ResolveExternalCmd(commandT*);
+RunExternalCmd(commandT*, bool, redirT*);
 /* forks and runs a external program */
 static void
-Exec(commandT*, bool);
+Exec(commandT*, bool, redirT*);
+/* forks a external program without waiting for it */
+static pid_t
+ForkExec(commandT*, pid_t, bool, redirT*);
+/* runs a command with compressed redirections from a child */
+static void
+ExecBeside(commandT*, redirT*);
+/* puts a command's redirections in place in a child */
+static void
+RedirApply(redirT*);
+/* runs a command with one more redirection */
+static void
+RunCmdRedir(commandT*, char*, char*);
+/* sets up a child of the shell between fork and exec */
+static void
+ChildInit(pid_t, bool);
+/* runs a command line as a job */
+static void
+RunJob(commandT*, bool);
+/* forks one stage of a pipeline */
+static pid_t
+ForkStage(char**, int, pid_t, int, int, int, bool, stagesT*);
+/* picks the stages of a pipeline that run on worker threads */
+static stagesT*
+StagesNew(commandT*);
+/* queues the stages for the workers, starting more workers as needed */
+static void
+StagesStart(stagesT*);
+/* waits for the stages of a foreground job */
+static void
+StagesWait(stagesT*);
+/* closes every ring of a pipeline */
+static void
+StagesCancel(stagesT*);
+/* drops a reference to the stages, freeing them with the last */
+static void
+StagesRelease(stagesT*);
+/* a worker thread */
+static void*
+StageWorker(void*);
+/* runs one stage on a worker */
+static void
+StageRun(stageT*);
+/* writes a builtin stage's output */
+static bool
+StagePut(stageT*, char*, size_t);
+/* echo as a stage */
+static void
+StageEcho(stageT*);
+/* cat as a stage */
+static void
+StageCat(stageT*);
+/* copies one input of cat as a stage */
+static bool
+StageCopy(stageT*, int, spscT*);
+/* the handler of SIGURG, which only interrupts a worker's system call */
+static void
+StageNudge(int);
+/* empties a job before it is started */
+static void
+JobStart(jobT*);
+/* adds a forked process to a job */
+static void
+JobAdd(jobT*, pid_t);
+/* waits for the foreground job to finish or stop */
+static void
+JobWait(jobT*, commandT*, bool);
+/* numbers a job and watches its processes */
+static jobT*
+JobNumber(jobT*, commandT*);
+/* resumes a stopped job */
+static void
+JobContinue(jobT*);
+/* acts on the expiry of a job's timer */
+static void
+JobTimeout(jobT*);
+/* sends a signal to the processes of a job */
+static void
+JobSignal(jobT*, int);
+/* sleeps until a process may have changed state or the timer expired */
+static void
+JobPoll(jobT*, procT*);
+/* releases a numbered job */
+static void
+JobFree(jobT*);
+/* finds the job a fg or bg argument names */
+static jobT*
+JobFind(commandT*);
+/* prints a line about a job */
+static void
+JobPrint(jobT*, char*, char*);
+/* adds a job to the ones CheckJobs reports */
+static void
+JobChanged(jobT*, jobT**);
+/* records a state change of a process */
+static void
+ProcEvent(procT*, siginfo_t*);
+/* finds a process of a numbered job */
+static procT*
+ProcFind(pid_t);
+/* runs the jobs builtin */
+static void
+RunJobs(commandT*);
+/* runs the fg and bg builtins */
+static void
+RunFgBg(commandT*);
 /* runs a builtin command */
 static void
 RunBuiltInCmd(commandT*);
-/* checks whether a command is a builtin command */
+/* runs the xargs builtin */
+static void
+RunXargs(commandT*);
+/* runs the cat builtin */
+static void
+RunCat(commandT*);
+/* tells whether cat is left to the program in PATH */
+static bool
+BuiltInExternal(commandT*, int);
+/* runs a builtin loaded by enable */
+static void
+RunLoaded(commandT*, tshBuiltinT*);
+/* fills in the argv of an xargs batch */
+static void
+XargsBatch(commandT*, int, char*, long*, int);
+/* runs one batch of arguments collected by xargs */
+static void
+XargsLaunch(commandT*, pid_t*, int*, int);
+/* checks whether a command is a builtin command, native or loaded */
 static bool
 IsBuiltIn(char*);
+/* makes sure the working directory is cached */
+static bool
+CwdLoad();
+/* changes the working directory and its cache */
+static int
+ChangeDir(char*);
+/* makes sure the PATH directories are open */
+static void
+PathLoad();
+/* makes sure the home directory is open */
+static bool
+HomeLoad();
+/* looks for an executable in one directory */
+static char*
+FindIn(dirT*, char*);
+/* execs a resolved command through its directory's descriptor */
+static void
+ExecPath(char*, char**);
+/* becomes a resolved command, running a tsh script in place */
+static void
+ExecCmd(commandT*);
+/* checks whether a file is a script for this tsh */
+static bool
+IsTshScript(char*);
 /* finds the full path of a given name */
 char * 
 getFullPath(char * name);
-/* checks if the file does exist at path name */
-int 
-doesFileExist(const char * name);
 /* changes argv[0] to contain only the file name */
 void
 argZeroConverter(commandT* cmd);
@@ -126,7 +441,10 @@ argZeroConverter(commandT* cmd);
 void
 RunCmd(commandT* cmd)
 {
-  RunCmdFork(cmd, TRUE);
+  if (IsPipeline(cmd))
+    RunJob(cmd, FALSE);
+  else
+    RunCmdFork(cmd, TRUE);
 } /* RunCmd */
 
 
@@ -140,21 +458,43 @@ RunCmd(commandT* cmd)
  * returns: none
  *
  * Runs a command, switching between built-in and external mode
- * depending on cmd->argv[0].
+ * depending on cmd->argv[0]. Its redirections are opened first; a
+ * builtin runs with them swapped in for the shell's own descriptors,
+ * an external command gets them with dup2 in the child. With nothing
+ * but redirections, the files are just created.
  */
 void
 RunCmdFork(commandT* cmd, bool fork)
 {
+  redirT r;
+  int k;
+
   if (cmd->argc <= 0)
     return;
-  if (IsBuiltIn(cmd->argv[0]))
+  if (!RedirOpen(cmd, &r))
+    {
+      lastStatus = 1;
+      return;
+    }
+  if (cmd->argc == 0)
+    lastStatus = 0;
+  else if (IsBuiltIn(cmd->argv[0])
+           && !BuiltInExternal(cmd, r.fd[0] >= 0 ? r.fd[0] : STDIN_FILENO))
     {
+      RedirSwap(&r);
       RunBuiltInCmd(cmd);
     }
   else
     {
-      RunExternalCmd(cmd, fork);
+      RunExternalCmd(cmd, fork, &r);
+      for (k = 0; k < 3 && gFg.nstopped > 0; k++)
+        if (r.codec[k] != NULL)
+          { // it finishes when the job, if continued, does
+            CodecClose(r.codec[k], FALSE);
+            r.codec[k] = NULL;
+          }
     }
+  RedirRestore(&r);
 } /* RunCmdFork */
 
 
@@ -171,7 +511,7 @@ RunCmdFork(commandT* cmd, bool fork)
 void
 RunCmdBg(commandT* cmd)
 {
-  // TODO
+  RunJob(cmd, TRUE);
 } /* RunCmdBg */
 
 
@@ -190,339 +530,3204 @@ RunCmdBg(commandT* cmd)
 void
 RunCmdPipe(commandT* cmd1, commandT* cmd2)
 {
+  int n = cmd1->argc + 1 + cmd2->argc;
+  commandT* cmd = malloc(sizeof(commandT) + sizeof(char*) * (n + 1));
+
+  memcpy(cmd->argv, cmd1->argv, sizeof(char*) * cmd1->argc);
+  cmd->argv[cmd1->argc] = PIPEMARK;
+  memcpy(cmd->argv + cmd1->argc + 1, cmd2->argv,
+         sizeof(char*) * (cmd2->argc + 1));
+  cmd->argc = n;
+  cmd->name = cmd->argv[0];
+  RunJob(cmd, FALSE);
+  free(cmd);
 } /* RunCmdPipe */
 
 
 /*
- * RunCmdRedirOut
+ * IsPipeline
  *
  * arguments:
- *   commandT *cmd: the command to be run
- *   char *file: the file to be used for standard output
- *
- * returns: none
+ *   commandT *cmd: a command
  *
- * Runs a command, redirecting standard output to a file.
+ * returns: bool: TRUE if argv is several stages separated by PIPEMARK
  */
-void
-RunCmdRedirOut(commandT* cmd, char* file)
+bool
+IsPipeline(commandT* cmd)
 {
-} /* RunCmdRedirOut */
+  int i;
+
+  for (i = 1; i < cmd->argc; i++)
+    if (strcmp(cmd->argv[i], PIPEMARK) == 0)
+      return TRUE;
+  return FALSE;
+} /* IsPipeline */
 
 
 /*
- * RunCmdRedirIn
+ * RunJob
  *
  * arguments:
- *   commandT *cmd: the command to be run
- *   char *file: the file to be used for standard input
+ *   commandT *cmd: the command line, stages separated by PIPEMARK
+ *   bool bg: whether to run it in the background
  *
  * returns: none
  *
- * Runs a command, redirecting a file to standard input.
+ * Forks every stage of a pipeline into one process group, connected
+ * by pipes, and waits for them unless bg is set. Builtins in the
+ * background run in a forked child too. In a foreground pipeline,
+ * echo, true, false and cat run on worker threads of the shell
+ * instead (see StagesNew): two such stages side by side are connected
+ * by a ring, not a pipe, and the others get the pipe of the stage
+ * next to them, so a pipeline of builtins forks nothing. Without a
+ * terminal, a background job reads from /dev/null rather than taking
+ * the shell's input. While JOBOUT is set, a background job's last
+ * stage writes, and every stage writes its errors, to one more pipe,
+ * which the shell drains into a ring for jobs -o.
  */
-void
-RunCmdRedirIn(commandT* cmd, char* file)
+static void
+RunJob(commandT* cmd, bool bg)
 {
-}  /* RunCmdRedirIn */
+  jobT* job = bg ? calloc(1, sizeof(jobT)) : &gFg;
+  int in = STDIN_FILENO, out, fds[2], ring[2] = { -1, -1 };
+  int err = STDERR_FILENO;
+  size_t keep = bg ? JobOutSize() : 0;
+  stagesT* set = bg ? NULL : StagesNew(cmd);
+  stageT* st = NULL;
+  spscT* rin = NULL;
+  int i, k = 0, start = 0;
+  pid_t pid;
+
+  JobStart(job);
+  if (bg && !gTty && (in = open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0)
+    in = STDIN_FILENO;
+  if (keep > 0)
+    {
+      if (pipe2(ring, O_CLOEXEC) != 0)
+        PrintPError("pipe");
+      else
+        { // a pipe as big as the ring holds it all while the shell is busy
+          fcntl(ring[1], F_SETPIPE_SZ, (int) MIN(keep, RINGPIPEMAX));
+          err = ring[1];
+        }
+    }
+  for (i = 0; i <= cmd->argc; i++)
+    {
+      if (i < cmd->argc && strcmp(cmd->argv[i], PIPEMARK) != 0)
+        continue;
+      fds[0] = -1;
+      out = ring[1] >= 0 ? ring[1] : STDOUT_FILENO;
+      st = set != NULL && set->stage[k].cmd != NULL ? &set->stage[k] : NULL;
+      if (i < cmd->argc && st != NULL && set->stage[k + 1].cmd != NULL)
+        { // builtin to builtin
+          st->rout = set->ring[set->nrings++] = SpscNew(STAGERING);
+          out = -1;
+        }
+      else if (i < cmd->argc)
+        {
+          if (pipe2(fds, O_CLOEXEC) != 0)
+            {
+              PrintPError("pipe");
+              break;
+            }
+          out = fds[1];
+        }
+      if (st != NULL)
+        { // the descriptors are the stage's to close
+          st->in = in;
+          st->rin = rin;
+          st->out = out;
+          st->set = set;
+          set->live++;
+        }
+      else
+        {
+          pid = ForkStage(cmd->argv + start, i - start, job->pgid, in, out,
+                          err, !bg, set);
+          if (pid > 0)
+            JobAdd(job, pid);
+          if (in != STDIN_FILENO)
+            close(in);
+          if (out != STDOUT_FILENO && out != ring[1])
+            close(out);
+        }
+      rin = st != NULL ? st->rout : NULL;
+      in = fds[0];
+      start = i + 1;
+      k++;
+    }
+  if (in >= 0 && in != STDIN_FILENO)
+    close(in); // the pipe a failed stage would have read
+  if (ring[1] >= 0)
+    close(ring[1]);
+
+  if (set != NULL && set->live == 0)
+    { // a failed pipe before the first builtin
+      StagesRelease(set);
+      set = NULL;
+    }
+  if (set != NULL)
+    StagesStart(set);
+  if (job->nprocs == 0 && set == NULL)
+    {
+      lastStatus = 1;
+      if (ring[0] >= 0)
+        close(ring[0]);
+      if (bg)
+        free(job);
+      return;
+    }
+  if (!bg)
+    {
+      if (job->nprocs > 0)
+        JobWait(job, cmd, FALSE);
+      if (set != NULL && job->nstopped > 0)
+        StagesRelease(set); // they finish on their own
+      else if (set != NULL)
+        {
+          for (i = 0; i < job->nprocs; i++)
+            if (WIFSIGNALED(job->procs[i].status)
+                && WTERMSIG(job->procs[i].status) == SIGINT)
+              StagesCancel(set); // ^C went to the processes
+          StagesWait(set);
+        }
+      return;
+    }
+  job = JobNumber(job, cmd);
+  gCurJob = job->id;
+  if (ring[0] >= 0)
+    RingAttach(job->id, ring[0], keep);
+  if (gTty)
+    printf("[%d] %d\n", job->id, (int) job->pgid);
+  lastStatus = 0;
+} /* RunJob */
 
 
 /*
- * RunExternalCmd
+ * ForkStage
  *
  * arguments:
- *   commandT *cmd: the command to be run
- *   bool fork: whether to fork
+ *   char **argv: the words of the stage
+ *   int argc: their number
+ *   pid_t pgid: process group of the job, or 0 to lead a new one
+ *   int in: descriptor to use as standard input
+ *   int out: descriptor to use as standard output
+ *   int err: descriptor to use as standard error
+ *   bool fg: whether the job is in the foreground
+ *   stagesT *set: the job's builtin stages, or NULL
  *
- * returns: none
+ * returns: pid_t: the child's pid, or -1 if fork failed
  *
- * Tries to run an external command.
+ * Forks a child that runs one stage, as a builtin or by exec'ing it,
+ * and never returns to the shell. The child closes the descriptors
+ * set up so far for builtin stages: a stage run as a builtin in the
+ * child, not exec'd, would otherwise hold open the write end of its
+ * own input.
  */
-static void
-RunExternalCmd(commandT* cmd, bool fork)
+static pid_t
+ForkStage(char** argv, int argc, pid_t pgid, int in, int out, int err,
+          bool fg, stagesT* set)
 {
-  if (ResolveExternalCmd(cmd)) {
-    Exec(cmd, fork);
-  }
-}  /* RunExternalCmd */
+  commandT* cmd;
+  long long t;
+  pid_t pid;
+  int slot = PlaceNext();
+  int i;
+
+  fflush(stdout);
+  t = MetricsClock();
+  if ((pid = fork()) < 0)
+    {
+      PrintPError("Fork failed");
+      return -1;
+    }
+  if (pid == 0)
+    {
+      ChildInit(pgid, fg);
+      SubshellInit();
+      if (in != STDIN_FILENO)
+        dup2(in, STDIN_FILENO);
+      if (out != STDOUT_FILENO)
+        dup2(out, STDOUT_FILENO);
+      if (err != STDERR_FILENO)
+        dup2(err, STDERR_FILENO);
+      __fpurge(stdin); // the shell's read-ahead is not the stage's input
+      for (i = 0; set != NULL && i < set->nstages; i++)
+        if (set->stage[i].set != NULL)
+          {
+            if (set->stage[i].in > STDERR_FILENO)
+              close(set->stage[i].in);
+            if (set->stage[i].out > STDERR_FILENO)
+              close(set->stage[i].out);
+          }
+      PlaceApply(slot);
+      cmd = malloc(sizeof(commandT) + sizeof(char*) * (argc + 1));
+      memcpy(cmd->argv, argv, sizeof(char*) * argc);
+      cmd->argv[argc] = NULL;
+      cmd->argc = argc;
+      cmd->name = cmd->argv[0];
+      RunCmdFork(cmd, FALSE); // returns only for a builtin
+      fflush(stdout);
+      _exit(lastStatus);
+    }
+  setpgid(pid, pgid == 0 ? pid : pgid);
+  MetricsSpawn(t);
+  PROBE3(spawn, argv[0], pid, PROBE_SINCE(t));
+  return pid;
+} /* ForkStage */
 
 
 /*
- * ResolveExternalCmd
+ * StagesNew
  *
  * arguments:
- *   commandT *cmd: the command to be run
+ *   commandT *cmd: a foreground pipeline
  *
- * returns: bool: whether the given command exists
+ * returns: stagesT*: the stages, with a command for each one to run
+ *                    on a thread, or NULL if there is none
  *
- * Determines whether the command to be run actually exists.
+ * A stage runs on a thread if it is echo, true, false or cat, with no
+ * redirections, and cat is one BuiltInExternal leaves to the builtin. A
+ * first stage reads the shell's own standard input, which cat may not
+ * if it is a terminal.
  */
-static bool
-ResolveExternalCmd(commandT* cmd)
+static stagesT*
+StagesNew(commandT* cmd)
 {
-  char* rootpath = getFullPath(cmd->name);
-  if (rootpath != NULL) {
-    cmd->name = rootpath;
-    return TRUE;
-  }
-  return FALSE;
-} /* ResolveExternalCmd */
+  stagesT* set = NULL;
+  commandT* c;
+  int i, j, k = 0, n = 1, start = 0;
+
+  for (i = 0; i < cmd->argc; i++)
+    if (strcmp(cmd->argv[i], PIPEMARK) == 0)
+      n++;
+  for (i = 0; i <= cmd->argc; i++)
+    {
+      if (i < cmd->argc && strcmp(cmd->argv[i], PIPEMARK) != 0)
+        continue;
+      for (j = 0; j < NTHREADBUILTINS && i > start; j++)
+        if (strcmp(cmd->argv[start], ThreadBuiltIns[j]) == 0)
+          break;
+      if (i > start && j < NTHREADBUILTINS)
+        {
+          c = malloc(sizeof(commandT) + sizeof(char*) * (i - start + 1));
+          memcpy(c->argv, cmd->argv + start, sizeof(char*) * (i - start));
+          c->argv[i - start] = NULL;
+          c->argc = i - start;
+          c->name = c->argv[0];
+          if (HasRedir(c)
+              || BuiltInExternal(c, k == 0 ? STDIN_FILENO : -1))
+            free(c);
+          else
+            {
+              if (set == NULL)
+                {
+                  set = calloc(1, sizeof(stagesT));
+                  set->nstages = n;
+                  set->stage = calloc(n, sizeof(stageT));
+                  set->ring = malloc(sizeof(spscT*) * n);
+                  set->refs = 1;
+                }
+              set->stage[k].cmd = c;
+            }
+        }
+      start = i + 1;
+      k++;
+    }
+  return set;
+} /* StagesNew */
 
 
 /*
- * Exec
+ * StagesStart
  *
  * arguments:
- *   commandT *cmd: the command to be run
- *   bool forceFork: whether to fork
+ *   stagesT *set: the stages RunJob has set up
  *
  * returns: none
  *
- * Executes a command.
+ * Queues the stages and starts enough workers for each to have one:
+ * a stage waiting for a worker held by a stage of the same pipeline
+ * could wait forever. Workers block every signal but SIGURG, so
+ * signals go to the shell's own thread and a write to a closed pipe
+ * fails with EPIPE. They are kept for later pipelines.
  */
 static void
-Exec(commandT* cmd, bool forceFork)
+StagesStart(stagesT* set)
 {
-  
-  if (forceFork) { // Do this if you should fork
-  int pid;
-  sigset_t x;
-  sigemptyset (&x);
-  sigaddset(&x,SIGCHLD);
-  if (sigprocmask(SIG_BLOCK,&x,NULL) != 0) {
-    PrintPError("Signal Block Failure");
-  }
-    if ((pid = fork()) < 0) { // fork returns negative if it fails.
-    PrintPError("Fork failed");
-  } else {
-      if (pid == 0) { // Child - to exec
-        setpgid(0,0); // remove from foreground process group
-        argZeroConverter(cmd);
-        sigprocmask(SIG_UNBLOCK,&x,NULL);
-        execv(cmd->name,cmd->argv);
-          PrintPError("Execv failed");
-      }
-      else {  // Parent - wait for child to be reaped.
-        fgpid = pid; // foreground process id
-        int * status = malloc(sizeof(int));
-        int * freethis = status;
-        waitpid(pid,status,0);
-        fgpid = 0;
-        free(freethis);
-      }
-  }
-  free(cmd->name);
-  }
-} /* Exec */
+  sigset_t all, old;
+  stageT* st;
+  int i;
+
+  fflush(stdout); // builtin output must come before the stages'
+  pthread_mutex_lock(&gStageLock);
+  for (i = 0; i < set->nstages; i++)
+    {
+      st = &set->stage[i];
+      if (st->set == NULL)
+        continue;
+      if (st->rout != NULL && set->stage[i + 1].set == NULL)
+        SpscClose(st->rout, SPSC_READER); // the pipeline was cut short
+      set->refs++;
+      st->next = NULL;
+      if (gQueueTail != NULL)
+        gQueueTail->next = st;
+      else
+        gQueueHead = st;
+      gQueueTail = st;
+      gQueued++;
+    }
+  if (gNWorkers == 0)
+    {
+      struct sigaction sa;
+
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = StageNudge; // and no SA_RESTART
+      sigaction(SIGURG, &sa, NULL);
+    }
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  while (gIdle < gQueued)
+    {
+      gWorkers = realloc(gWorkers, sizeof(pthread_t) * (gNWorkers + 1));
+      // The C library keeps a thread's TLS with its stack for reuse.
+      MemLibc(TRUE);
+      errno = pthread_create(&gWorkers[gNWorkers], NULL, StageWorker, NULL);
+      MemLibc(FALSE);
+      if (errno != 0)
+        {
+          PrintPError("pthread_create");
+          break;
+        }
+      gNWorkers++;
+      gIdle++;
+    }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  pthread_cond_broadcast(&gStageCond);
+  pthread_mutex_unlock(&gStageLock);
+} /* StagesStart */
+
 
 /*
- * argZeroConverter
+ * StagesWait
  *
- * This function takes a commandT* struct and makes the 
- * argv[0] position contain only the file name and 
- * nothing more.
+ * arguments:
+ *   stagesT *set: the stages of the foreground job
  *
- * It returns void
+ * returns: none
+ *
+ * Sleeps until the last stage is done, then sets $? from the last
+ * stage if it is a builtin. ^C while the shell sleeps here cancels
+ * the stages (see StagesCancel) and $? is 130; the shell does not
+ * wait for them to notice.
  */
+static void
+StagesWait(stagesT* set)
+{
+  unsigned live;
+  stageT* last = &set->stage[set->nstages - 1];
+
+  RecordWait(TRUE);
+  gStageSet = set;
+  while ((live = __atomic_load_n(&set->live, __ATOMIC_SEQ_CST)) > 0
+         && !set->cancel)
+    syscall(SYS_futex, &set->live, FUTEX_WAIT_PRIVATE, live, NULL, NULL, 0);
+  gStageSet = NULL;
+  RecordWait(FALSE);
+  if (set->cancel)
+    lastStatus = 128 + SIGINT;
+  else if (last->set != NULL)
+    lastStatus = last->status;
+  StagesRelease(set);
+} /* StagesWait */
+
 
-void
-argZeroConverter(commandT* cmd) {
-  char* current = cmd->argv[0];
-  int slash = -1;
-  int i;
-  for (i = strlen(current); i >= 0; --i) {
-    if (current[i] == '/') {
-      slash = i;  // find the farthest right slash
-      break;
-    }
-  }
-  if (slash != -1) { // if there is a slash, put everything after into argv[0]
-    char* command = malloc((strlen(current) - slash + 1) * sizeof(char));
-    memcpy(command, current + (slash + 1) * sizeof(char), (strlen(current) - slash + 1) * sizeof(char));
-    free(cmd->argv[0]);
-    cmd->argv[0] = command;
-  }
-} /* argZeroConverter */
 /*
- * IsBuiltIn
+ * StagesInterrupt
  *
  * arguments:
- *   char *cmd: a command string (e.g. the first token of the command line)
+ *   int signo: SIGINT or SIGTSTP
  *
- * returns: bool: TRUE if the command string corresponds to a built-in
- *                command, else FALSE.
+ * returns: bool: TRUE if the shell is waiting on builtin stages
  *
- * Checks whether the given string corresponds to a supported built-in
- * command.
+ * Called from the signal handler. Threads cannot be stopped, so only
+ * SIGINT does anything.
  */
-static bool
-IsBuiltIn(char* cmd)
+bool
+StagesInterrupt(int signo)
 {
- if ( strcmp(cmd,"echo") == 0 ||
-    strcmp(cmd,"cd") == 0 ||
-    strcmp(cmd,"exit") == 0) {
-   return TRUE;
- }  
-  return FALSE;
-} /* IsBuiltIn */
+  stagesT* set = gStageSet;
+
+  if (set == NULL)
+    return FALSE;
+  if (signo == SIGINT)
+    StagesCancel(set);
+  return TRUE;
+} /* StagesInterrupt */
 
 
 /*
- * RunBuiltInCmd
+ * StagesCancel
  *
  * arguments:
- *   commandT *cmd: the command to be run
+ *   stagesT *set: stages of a pipeline
  *
  * returns: none
  *
- * Runs a built-in command.
+ * Closes the rings, which stops the stages using them, and sends the
+ * running stages SIGURG, which fails a read or write they are blocked
+ * in with EINTR. Called from the signal handler; a stage that has just
+ * finished may be running another pipeline's stage by the time its
+ * worker is signalled, which then carries on.
  */
 static void
-RunBuiltInCmd(commandT* cmd)
+StagesCancel(stagesT* set)
 {
-  if (strcmp(cmd->argv[0],"echo") == 0) { // runs command echo
-    int i;
-    for(i = 1; i < cmd->argc; i++) {
-      printf("%s ",cmd->argv[i]);
-    }
-    PrintNewline();
-  }
-
-  if (strcmp(cmd->argv[0],"cd") == 0) { // runs command cd
-    int dir = 0;
-    if (cmd->argc > 1) {
-    dir = chdir(cmd->argv[1]);
-    } else {
-      dir = chdir(getenv("HOME"));
-    }
-      //0 if success, -1 if failure
-  if (dir != 0) {
-    PrintPError("cd error");
-  }
-  }
-  if (strcmp(cmd->argv[0],"exit") == 0) { // escapes if command is exit
-    return;
-  }
+  int i;
 
-} /* RunBuiltInCmd */
+  set->cancel = TRUE;
+  for (i = 0; i < set->nrings; i++)
+    SpscClose(set->ring[i], SPSC_READER | SPSC_WRITER);
+  for (i = 0; i < set->nstages; i++)
+    if (__atomic_load_n(&set->stage[i].running, __ATOMIC_SEQ_CST))
+      pthread_kill(set->stage[i].thread, SIGURG);
+} /* StagesCancel */
 
 
 /*
- * CheckJobs
+ * StagesRelease
  *
- * arguments: none
+ * arguments:
+ *   stagesT *set: stages of a pipeline
  *
  * returns: none
- *
- * Checks the status of running jobs.
  */
-void
-CheckJobs()
+static void
+StagesRelease(stagesT* set)
 {
-} /* CheckJobs */
+  int i;
+
+  if (__atomic_sub_fetch(&set->refs, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+  for (i = 0; i < set->nstages; i++)
+    free(set->stage[i].cmd);
+  for (i = 0; i < set->nrings; i++)
+    SpscFree(set->ring[i]);
+  free(set->stage);
+  free(set->ring);
+  free(set);
+} /* StagesRelease */
+
 
 /*
- * getCurrentWorkingDir
+ * StageWorker
  *
- * Takes no arguments, this function uses the getcwd funcion
- * to return the path to the current working directory
+ * arguments:
+ *   void *arg: unused
  *
- * Returns path to current working directory
+ * returns: void*: NULL, when RuntimeCleanup ends the workers
  *
+ * Runs the queued stages one after another. The last to finish of a
+ * pipeline's stages wakes the shell.
  */
-char *
-getCurrentWorkingDir() {
-  char * path = malloc(MAXPATHLEN*sizeof(char*));
-  return getcwd(path,MAXPATHLEN);
-} /* getCurrentWorkingDir */
+static void*
+StageWorker(void* arg)
+{
+  stagesT* set;
+  stageT* st;
+  sigset_t x;
+
+  sigemptyset(&x);
+  sigaddset(&x, SIGURG);
+  pthread_sigmask(SIG_UNBLOCK, &x, NULL);
+  pthread_mutex_lock(&gStageLock);
+  for (;;)
+    {
+      while (gQueueHead == NULL && !gStageQuit)
+        pthread_cond_wait(&gStageCond, &gStageLock);
+      if (gQueueHead == NULL)
+        break;
+      st = gQueueHead;
+      if ((gQueueHead = st->next) == NULL)
+        gQueueTail = NULL;
+      gQueued--;
+      gIdle--;
+      pthread_mutex_unlock(&gStageLock);
+
+      set = st->set;
+      st->thread = pthread_self();
+      __atomic_store_n(&st->running, 1, __ATOMIC_SEQ_CST);
+      StageRun(st);
+      __atomic_store_n(&st->running, 0, __ATOMIC_SEQ_CST);
+      if (__atomic_sub_fetch(&set->live, 1, __ATOMIC_SEQ_CST) == 0)
+        syscall(SYS_futex, &set->live, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+      StagesRelease(set);
+
+      pthread_mutex_lock(&gStageLock);
+      gIdle++;
+    }
+  pthread_mutex_unlock(&gStageLock);
+  return NULL;
+} /* StageWorker */
 
 
 /*
- * getFullPath
+ * StageRun
  *
- * This function takes the cmd->name and returns
- * the full path to the file specified in cmd->name
+ * arguments:
+ *   stageT *st: a stage
  *
- * It returns a pointer to NULL if it failed to find the file.
+ * returns: none
  *
+ * Runs the builtin, then closes the stage's ends: end of file for the
+ * stage after it, and a closed pipe for the one before.
  */
-
+static void
+StageRun(stageT* st)
+{
+  char* name = st->cmd->argv[0];
+
+  MetricsAdd(M_BUILTINS);
+  st->status = 0;
+  if (strcmp(name, "echo") == 0)
+    StageEcho(st);
+  else if (strcmp(name, "false") == 0)
+    st->status = 1;
+  else if (strcmp(name, "cat") == 0)
+    StageCat(st);
+
+  if (st->rout != NULL)
+    SpscClose(st->rout, SPSC_WRITER);
+  else if (st->out != STDOUT_FILENO)
+    close(st->out);
+  if (st->rin != NULL)
+    SpscClose(st->rin, SPSC_READER);
+  else if (st->in != STDIN_FILENO)
+    close(st->in);
+} /* StageRun */
+
+
+/*
+ * StagePut
+ *
+ * arguments:
+ *   stageT *st: a stage
+ *   char *data: its output
+ *   size_t len: the length of it
+ *
+ * returns: bool: FALSE with errno set if it could not all be written;
+ *                EPIPE if the next stage is done reading
+ */
+static bool
+StagePut(stageT* st, char* data, size_t len)
+{
+  ssize_t n;
+  char* p;
+
+  while (len > 0)
+    {
+      if (st->rout != NULL)
+        {
+          if ((n = SpscRoom(st->rout, &p)) == 0)
+            {
+              errno = EPIPE;
+              return FALSE;
+            }
+          n = MIN(n, len);
+          memcpy(p, data, n);
+          SpscPut(st->rout, n);
+        }
+      else if ((n = write(st->out, data, len)) < 0)
+        {
+          if (errno == EINTR && !st->set->cancel)
+            continue;
+          return FALSE;
+        }
+      data += n;
+      len -= n;
+    }
+  return TRUE;
+} /* StagePut */
+
+
+/*
+ * StageEcho
+ *
+ * arguments:
+ *   stageT *st: an echo stage
+ *
+ * returns: none
+ *
+ * Writes what the echo builtin would, gathered in a buffer on the
+ * stack so a short line is one write. Like a forked echo killed by
+ * SIGPIPE, one whose reader is gone exits with 141.
+ */
+static void
+StageEcho(stageT* st)
+{
+  char buf[4096];
+  size_t used = 0, len;
+  bool ok = TRUE;
+  int i;
+
+  for (i = 1; i < st->cmd->argc && ok; i++)
+    {
+      len = strlen(st->cmd->argv[i]);
+      if (used + len + 1 > sizeof(buf))
+        {
+          ok = StagePut(st, buf, used);
+          used = 0;
+        }
+      if (len + 1 > sizeof(buf))
+        ok = ok && StagePut(st, st->cmd->argv[i], len)
+          && StagePut(st, " ", 1);
+      else
+        {
+          memcpy(buf + used, st->cmd->argv[i], len);
+          buf[used + len] = ' ';
+          used += len + 1;
+        }
+    }
+  if (ok && used + 1 > sizeof(buf))
+    {
+      ok = StagePut(st, buf, used);
+      used = 0;
+    }
+  buf[used++] = '\n';
+  if (!ok || !StagePut(st, buf, used))
+    st->status = errno == EPIPE ? 128 + SIGPIPE : 1;
+} /* StageEcho */
+
+
+/*
+ * StageCat
+ *
+ * arguments:
+ *   stageT *st: a cat stage
+ *
+ * returns: none
+ *
+ * The cat builtin (see RunCat) with the stage's input and output,
+ * which may be rings. Its messages are the same.
+ */
+static void
+StageCat(stageT* st)
+{
+  struct stat so, si;
+  char* name;
+  bool in;
+  int i, fd;
+
+  if (st->rout != NULL || fstat(st->out, &so) != 0)
+    so.st_mode = 0;
+  for (i = st->cmd->argc == 1 ? 0 : 1; i < st->cmd->argc; i++)
+    {
+      name = i == 0 ? "-" : st->cmd->argv[i];
+      in = strcmp(name, "-") == 0;
+      fd = in ? st->in : open(name, O_RDONLY | O_CLOEXEC);
+      if (fd < 0 && !(in && st->rin != NULL))
+        {
+          fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+          st->status = 1;
+          continue;
+        }
+      if (S_ISREG(so.st_mode) && fd >= 0 && fstat(fd, &si) == 0
+          && si.st_dev == so.st_dev && si.st_ino == so.st_ino)
+        {
+          fprintf(stderr, "cat: %s: input file is output file\n", name);
+          st->status = 1;
+        }
+      else if (!StageCopy(st, fd, in ? st->rin : NULL))
+        {
+          if (errno == EPIPE || st->set->cancel)
+            { // where a forked cat would have died of SIGPIPE
+              st->status = 128 + SIGPIPE;
+              if (!in)
+                close(fd);
+              return;
+            }
+          fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+          st->status = 1;
+        }
+      if (!in)
+        close(fd);
+    }
+} /* StageCat */
+
+
+/*
+ * StageCopy
+ *
+ * arguments:
+ *   stageT *st: a cat stage
+ *   int fd: descriptor to copy, if rin is NULL
+ *   spscT *rin: ring to copy
+ *
+ * returns: bool: FALSE after a read or write error, with errno set
+ *
+ * Between two descriptors this is CopyFd. A ring is read in place and
+ * handed to StagePut; a descriptor is read straight into the room in
+ * the output ring.
+ */
+static bool
+StageCopy(stageT* st, int fd, spscT* rin)
+{
+  ssize_t n;
+  char* p;
+
+  if (rin == NULL && st->rout == NULL)
+    return CopyFd(fd, st->out);
+  for (;;)
+    {
+      if (rin != NULL)
+        {
+          if ((n = SpscData(rin, &p)) == 0)
+            return TRUE;
+          if (!StagePut(st, p, n))
+            return FALSE;
+          SpscTake(rin, n);
+          continue;
+        }
+      if ((n = SpscRoom(st->rout, &p)) == 0)
+        {
+          errno = EPIPE;
+          return FALSE;
+        }
+      if ((n = read(fd, p, n)) < 0 && errno == EINTR && !st->set->cancel)
+        continue;
+      if (n <= 0)
+        return n == 0;
+      SpscPut(st->rout, n);
+    }
+} /* StageCopy */
+
+
+/*
+ * StageNudge
+ *
+ * arguments:
+ *   int signo: SIGURG
+ *
+ * returns: none
+ */
+static void
+StageNudge(int signo)
+{
+} /* StageNudge */
+
+
+/*
+ * RunCmdRedirOut
+ *
+ * arguments:
+ *   commandT *cmd: the command to be run
+ *   char *file: the file to be used for standard output
+ *
+ * returns: none
+ *
+ * Runs a command, redirecting standard output to a file.
+ */
+void
+RunCmdRedirOut(commandT* cmd, char* file)
+{
+  RunCmdRedir(cmd, REDIRMARK ">", file);
+} /* RunCmdRedirOut */
+
+
+/*
+ * RunCmdRedirIn
+ *
+ * arguments:
+ *   commandT *cmd: the command to be run
+ *   char *file: the file to be used for standard input
+ *
+ * returns: none
+ *
+ * Runs a command, redirecting a file to standard input.
+ */
+void
+RunCmdRedirIn(commandT* cmd, char* file)
+{
+  RunCmdRedir(cmd, REDIRMARK "<", file);
+}  /* RunCmdRedirIn */
+
+
+/*
+ * RunCmdRedir
+ *
+ * arguments:
+ *   commandT *cmd: the command to be run
+ *   char *op: a redirection word, REDIRMARK and the operator
+ *   char *file: the file
+ *
+ * returns: none
+ *
+ * Runs a copy of the command with the redirection added to its argv.
+ */
+static void
+RunCmdRedir(commandT* cmd, char* op, char* file)
+{
+  commandT* c = malloc(sizeof(commandT) + sizeof(char*) * (cmd->argc + 3));
+
+  memcpy(c->argv, cmd->argv, sizeof(char*) * cmd->argc);
+  c->argv[cmd->argc] = op;
+  c->argv[cmd->argc + 1] = file;
+  c->argv[cmd->argc + 2] = NULL;
+  c->argc = cmd->argc + 2;
+  c->name = c->argv[0];
+  RunCmd(c);
+  free(c);
+} /* RunCmdRedir */
+
+
+/*
+ * HasRedir
+ *
+ * arguments:
+ *   commandT *cmd: a command
+ *
+ * returns: bool: TRUE if argv holds a REDIRMARK word
+ */
+bool
+HasRedir(commandT* cmd)
+{
+  int i;
+
+  for (i = 0; i < cmd->argc; i++)
+    if (cmd->argv[i][0] == REDIRMARK[0])
+      return TRUE;
+  return FALSE;
+} /* HasRedir */
+
+
+/*
+ * RedirOpen
+ *
+ * arguments:
+ *   commandT *cmd: a command; its redirections are taken out of argv
+ *   redirT *r: receives the opened files
+ *
+ * returns: bool: FALSE if a file could not be opened
+ *
+ * Opens the files in the parent, so an error is reported once by the
+ * shell and the child only has to dup2. "<" reads, ">" truncates and
+ * ">>" appends; "2>" is standard error and "&>" both outputs. With a
+ * 'z' after the operator the command gets a pipe instead, and a codec
+ * thread (see codec.h) expands the file into it or compresses what
+ * comes out of it into the file.
+ */
+bool
+RedirOpen(commandT* cmd, redirT* r)
+{
+  int i, j, k, fd, flags;
+  codecT* codec;
+  char* op;
+
+  for (k = 0; k < 3; k++)
+    {
+      r->fd[k] = r->saved[k] = -1;
+      r->codec[k] = NULL;
+    }
+  for (i = j = 0; i < cmd->argc; i++)
+    {
+      op = cmd->argv[i];
+      if (op[0] != REDIRMARK[0])
+        {
+          cmd->argv[j++] = op;
+          continue;
+        }
+      op++;
+      if (i + 1 == cmd->argc)
+        { // the file expanded to nothing
+          fprintf(stderr, "%s: %s: ambiguous redirect\n", SHELLNAME, op);
+          RedirRestore(r);
+          return FALSE;
+        }
+      k = op[0] == '<' ? 0 : op[0] == '2' ? 2 : 1;
+      flags = k == 0 ? O_RDONLY : O_WRONLY | O_CREAT
+        | (strstr(op, ">>") != NULL ? O_APPEND : O_TRUNC);
+      codec = NULL;
+      if (op[strlen(op) - 1] == 'z')
+        fd = CodecOpen(cmd->argv[++i], flags, &codec);
+      else if ((fd = open(cmd->argv[++i], flags | O_CLOEXEC, 0666)) < 0)
+        PrintPError(cmd->argv[i]);
+      if (fd < 0)
+        {
+          RedirRestore(r);
+          return FALSE;
+        }
+      if (r->fd[k] >= 0)
+        close(r->fd[k]);
+      if (r->codec[k] != NULL)
+        CodecClose(r->codec[k], TRUE);
+      r->fd[k] = fd;
+      r->codec[k] = codec;
+      if (op[0] == '&')
+        {
+          if (r->fd[2] >= 0)
+            close(r->fd[2]);
+          r->fd[2] = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        }
+    }
+  if (j < cmd->argc)
+    {
+      cmd->argv[j] = NULL;
+      cmd->argc = j;
+      cmd->name = cmd->argv[0];
+    }
+  return TRUE;
+} /* RedirOpen */
+
+
+/*
+ * RedirSwap
+ *
+ * arguments:
+ *   redirT *r: the opened files
+ *
+ * returns: none
+ */
+void
+RedirSwap(redirT* r)
+{
+  int k;
+
+  fflush(stdout);
+  for (k = 0; k < 3; k++)
+    if (r->fd[k] >= 0)
+      {
+        r->saved[k] = fcntl(k, F_DUPFD_CLOEXEC, 3);
+        dup2(r->fd[k], k);
+      }
+  if (r->saved[0] >= 0)
+    gStdinSwapped++;
+} /* RedirSwap */
+
+
+/*
+ * RedirRestore
+ *
+ * arguments:
+ *   redirT *r: the opened files
+ *
+ * returns: none
+ */
+void
+RedirRestore(redirT* r)
+{
+  int k;
+
+  if (r->saved[0] >= 0)
+    gStdinSwapped--;
+  if (r->saved[1] >= 0)
+    fflush(stdout);
+  for (k = 0; k < 3; k++)
+    {
+      if (r->saved[k] >= 0)
+        {
+          dup2(r->saved[k], k);
+          close(r->saved[k]);
+          r->saved[k] = -1;
+        }
+      if (r->fd[k] >= 0)
+        close(r->fd[k]);
+      r->fd[k] = -1;
+    }
+  for (k = 0; k < 3; k++)
+    if (r->codec[k] != NULL)
+      {
+        if (!CodecClose(r->codec[k], TRUE) && lastStatus == 0)
+          lastStatus = 1;
+        r->codec[k] = NULL;
+      }
+} /* RedirRestore */
+
+
+/*
+ * RedirApply
+ *
+ * arguments:
+ *   redirT *r: the opened files, or NULL
+ *
+ * returns: none
+ *
+ * Called in a child between fork and exec. The opened files are
+ * close-on-exec, so only their copies on 0, 1 and 2 survive the exec.
+ */
+static void
+RedirApply(redirT* r)
+{
+  int k;
+
+  if (r == NULL)
+    return;
+  for (k = 0; k < 3; k++)
+    if (r->fd[k] >= 0)
+      dup2(r->fd[k], k);
+} /* RedirApply */
+
+
+/*
+ * RunExternalCmd
+ *
+ * arguments:
+ *   commandT *cmd: the command to be run
+ *   bool fork: whether to fork
+ *   redirT *r: its redirections, or NULL
+ *
+ * returns: none
+ *
+ * Tries to run an external command.
+ */
+static void
+RunExternalCmd(commandT* cmd, bool fork, redirT* r)
+{
+  if (ResolveExternalCmd(cmd)) {
+    Exec(cmd, fork, r);
+  } else {
+    lastStatus = 127;
+  }
+}  /* RunExternalCmd */
+
+
+/*
+ * ResolveExternalCmd
+ *
+ * arguments:
+ *   commandT *cmd: the command to be run
+ *
+ * returns: bool: whether the given command exists
+ *
+ * Determines whether the command to be run actually exists.
+ */
+bool
+ResolveExternalCmd(commandT* cmd)
+{
+  char* rootpath = getFullPath(cmd->name);
+  if (rootpath != NULL) {
+    cmd->name = rootpath;
+    return TRUE;
+  }
+  return FALSE;
+} /* ResolveExternalCmd */
+
+
+/*
+ * Exec
+ *
+ * arguments:
+ *   commandT *cmd: the command to be run
+ *   bool forceFork: whether to fork
+ *   redirT *r: its redirections, or NULL
+ *
+ * returns: none
+ *
+ * Executes a command.
+ */
+static void
+Exec(commandT* cmd, bool forceFork, redirT* r)
+{
+  if (forceFork)
+    { // Do this if you should fork
+      int pid;
+      sigset_t x;
+      sigemptyset(&x);
+      sigaddset(&x, SIGCHLD);
+      if (sigprocmask(SIG_BLOCK, &x, NULL) != 0)
+        PrintPError("Signal Block Failure");
+
+      JobStart(&gFg);
+      if ((pid = ForkExec(cmd, gFg.pgid, TRUE, r)) > 0)
+        { // Parent - wait for child to finish or stop.
+          JobAdd(&gFg, pid);
+          JobWait(&gFg, cmd, FALSE);
+        }
+      sigprocmask(SIG_UNBLOCK, &x, NULL);
+    }
+  else if (r != NULL
+           && (r->codec[0] != NULL || r->codec[1] != NULL
+               || r->codec[2] != NULL))
+    ExecBeside(cmd, r);
+  else
+    { // Already in a child of the shell: become the command.
+      RedirApply(r);
+      ExecCmd(cmd);
+    }
+  free(cmd->name);
+} /* Exec */
+
+
+/*
+ * RunProgram
+ *
+ * arguments:
+ *   commandT *c: a command ResolveExternalCmd found
+ *   commandT *cmd: the command line c is part of
+ *   timeoutT *t: the limit to put on it, or NULL
+ *
+ * returns: bool: FALSE if it could not be forked or it stopped
+ *
+ * Forks c as the foreground job, with SIGCHLD blocked, and waits for
+ * it. A job with a limit run by a forked stage stays in the stage's
+ * process group, which job control signals; JobSignal then signals
+ * only its own processes.
+ */
+bool
+RunProgram(commandT* c, commandT* cmd, timeoutT* t)
+{
+  bool done = FALSE;
+  sigset_t x, old;
+  pid_t pid;
+
+  sigemptyset(&x);
+  sigaddset(&x, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &x, &old);
+  JobStart(&gFg);
+  if (t != NULL && gSubshell)
+    gFg.pgid = getpgrp();
+  if ((pid = ForkExec(c, gFg.pgid, !gSubshell, NULL)) > 0)
+    {
+      JobAdd(&gFg, pid);
+      if (t != NULL)
+        {
+          gFg.timeout = *t;
+          if (t->limit > 0)
+            TimeoutArm(&gFg.timeout, t->limit);
+        }
+      JobWait(&gFg, cmd, FALSE);
+      done = gFg.nstopped == 0;
+    }
+  sigprocmask(SIG_SETMASK, &old, NULL);
+  return done;
+} /* RunProgram */
+
+
+/*
+ * ExecBeside
+ *
+ * arguments:
+ *   commandT *cmd: the command to be run; cmd->name is the resolved path
+ *   redirT *r: its redirections, some of them compressed
+ *
+ * returns: none; the child exits
+ *
+ * A child of the shell, a stage of a pipeline or a background job,
+ * cannot become a command with compressed redirections: their codec
+ * threads would end with the exec. It forks the command instead, in
+ * the same process group, and stays to run the codecs, exiting with
+ * the command's status once they are done. A signal to the job stops
+ * or kills both.
+ */
+static void
+ExecBeside(commandT* cmd, redirT* r)
+{
+  int status = 0;
+  long long t;
+  pid_t pid;
+
+  fflush(stdout);
+  t = MetricsClock();
+  if ((pid = fork()) < 0)
+    PrintPError("Fork failed");
+  else if (pid == 0)
+    {
+      RedirApply(r);
+      ExecCmd(cmd);
+    }
+  else
+    {
+      MetricsSpawn(t);
+      PROBE3(spawn, cmd->name, pid, PROBE_SINCE(t));
+    }
+  while (pid > 0 && waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    ;
+  lastStatus = pid > 0 ? WaitStatus(status) : 1;
+  RedirRestore(r);
+  _exit(lastStatus);
+} /* ExecBeside */
+
+
+/*
+ * WaitStatus
+ *
+ * arguments:
+ *   int status: a status returned by waitpid
+ *
+ * returns: int: the status as the shell reports it in $?
+ *
+ * A normal exit gives the exit code, death by a signal 128 plus the
+ * signal number.
+ */
+int
+WaitStatus(int status)
+{
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return 0;
+} /* WaitStatus */
+
+
+/*
+ * ForkExec
+ *
+ * arguments:
+ *   commandT *cmd: the command to be run; cmd->name is the resolved path
+ *   pid_t pgid: process group to join, or 0 to lead a new one
+ *   bool fg: whether the child is given the terminal
+ *   redirT *r: the command's redirections, or NULL
+ *
+ * returns: pid_t: the child's pid, or -1 if fork failed
+ *
+ * Forks a child that execs the command and returns without waiting
+ * for it. The caller is expected to have SIGCHLD blocked. The child
+ * is placed as "on" says and never returns to the shell, even if
+ * execv fails.
+ */
+static pid_t
+ForkExec(commandT* cmd, pid_t pgid, bool fg, redirT* r)
+{
+  long long t;
+  pid_t pid;
+  int slot = PlaceNext();
+
+  fflush(stdout); // builtin output must come before the child's
+  t = MetricsClock();
+  if ((pid = fork()) < 0)
+    { // fork returns negative if it fails.
+      PrintPError("Fork failed");
+      return -1;
+    }
+  if (pid == 0)
+    { // Child - to exec
+      ChildInit(pgid, fg);
+      PlaceApply(slot);
+      RedirApply(r);
+      ExecCmd(cmd);
+    }
+  // Set the group from the parent too so it is in place before we
+  // signal or wait on it, whichever process runs first.
+  setpgid(pid, pgid == 0 ? pid : pgid);
+  MetricsSpawn(t);
+  PROBE3(spawn, cmd->name, pid, PROBE_SINCE(t));
+  return pid;
+} /* ForkExec */
+
+
+/*
+ * ChildInit
+ *
+ * arguments:
+ *   pid_t pgid: process group to join, or 0 to lead a new one
+ *   bool fg: whether the child is given the terminal
+ *
+ * returns: none
+ *
+ * Moves a new child out of the shell's process group, takes the
+ * terminal for a foreground job (before SIGTTOU stops being ignored)
+ * and restores the signal handling the shell changed. The codecs of
+ * the shell stay behind.
+ */
+static void
+ChildInit(pid_t pgid, bool fg)
+{
+  sigset_t x;
+
+  CodecForget();
+  setpgid(0, pgid); // remove from foreground process group
+  if (fg && gTty)
+    tcsetpgrp(STDIN_FILENO, getpgrp());
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTSTP, SIG_DFL);
+  signal(SIGTTIN, SIG_DFL);
+  signal(SIGTTOU, SIG_DFL);
+  sigemptyset(&x);
+  sigaddset(&x, SIGCHLD);
+  sigprocmask(SIG_UNBLOCK, &x, NULL);
+} /* ChildInit */
+
+/*
+ * argZeroConverter
+ *
+ * This function takes a commandT* struct and makes the 
+ * argv[0] position contain only the file name and 
+ * nothing more.
+ *
+ * It only moves the argv[0] pointer past the last slash, so it
+ * allocates nothing and is safe to call in a child between fork
+ * and exec, whatever argv[0] points into.
+ *
+ * It returns void
+ */
+
+void
+argZeroConverter(commandT* cmd) {
+  char* slash = strrchr(cmd->argv[0], '/'); // find the farthest right slash
+  if (slash != NULL) { // if there is a slash, put everything after into argv[0]
+    cmd->argv[0] = slash + 1;
+  }
+} /* argZeroConverter */
+/*
+ * IsBuiltIn
+ *
+ * arguments:
+ *   char *cmd: a command string (e.g. the first token of the command line)
+ *
+ * returns: bool: TRUE if the command string corresponds to a built-in
+ *                command, else FALSE.
+ *
+ * Checks whether the given string corresponds to a supported built-in
+ * command.
+ */
+static bool
+IsBuiltIn(char* cmd)
+{
+  return IsShellBuiltIn(cmd) || EnableFind(cmd) != NULL;
+} /* IsBuiltIn */
+
+
+/*
+ * IsShellBuiltIn
+ *
+ * arguments:
+ *   char *cmd: a command name
+ *
+ * returns: bool: TRUE if the command is one of the shell's own
+ *                built-ins, not one loaded by enable
+ */
+bool
+IsShellBuiltIn(char* cmd)
+{
+  int i;
+
+  for (i = 0; i < NBUILTINCOMMANDS; i++)
+    if (strcmp(cmd, BuiltInCommands[i]) == 0)
+      return TRUE;
+  return FALSE;
+} /* IsShellBuiltIn */
+
+
+/*
+ * IsPureBuiltIn
+ *
+ * arguments:
+ *   char *cmd: a command name
+ *
+ * returns: bool: TRUE if the command is a built-in that only writes
+ *                output
+ *
+ * Command substitution runs such built-ins in the shell itself;
+ * anything else, like cd or exit, has to run in a subshell.
+ */
+bool
+IsPureBuiltIn(char* cmd)
+{
+  int i;
+
+  for (i = 0; i < NPUREBUILTINS; i++)
+    if (strcmp(cmd, PureBuiltIns[i]) == 0)
+      return TRUE;
+  return FALSE;
+} /* IsPureBuiltIn */
+
+
+/*
+ * RunBuiltInCmd
+ *
+ * arguments:
+ *   commandT *cmd: the command to be run
+ *
+ * returns: none
+ *
+ * Runs a built-in command.
+ */
+static void
+RunBuiltInCmd(commandT* cmd)
+{
+  tshBuiltinT* b = EnableFind(cmd->argv[0]);
+  char* name;
+
+  lastStatus = 0;
+  if (b == NULL && BuiltInExternal(cmd, STDIN_FILENO))
+    { // reached from xargs, which keeps name NULL for a builtin
+      name = cmd->name;
+      cmd->name = cmd->argv[0];
+      RunExternalCmd(cmd, TRUE, NULL);
+      cmd->name = name;
+      return;
+    }
+  MetricsAdd(M_BUILTINS);
+  if (b != NULL)
+    {
+      RunLoaded(cmd, b);
+      return;
+    }
+  if (strcmp(cmd->argv[0],"echo") == 0) { // runs command echo
+    int i;
+    for(i = 1; i < cmd->argc; i++) {
+      printf("%s ",cmd->argv[i]);
+    }
+    PrintNewline();
+  }
+
+  if (strcmp(cmd->argv[0],"cd") == 0) { // runs command cd
+    int dir = 0;
+    if (cmd->argc > 1) {
+    dir = ChangeDir(cmd->argv[1]);
+    } else {
+      dir = ChangeDir(getenv("HOME"));
+    }
+      //0 if success, -1 if failure
+  if (dir != 0) {
+    PrintPError("cd error");
+    lastStatus = 1;
+  }
+  }
+  if (strcmp(cmd->argv[0],"exit") == 0) { // escapes if command is exit
+    if (cmd->argc > 1)
+      lastStatus = atoi(cmd->argv[1]);
+    forceExit = TRUE;
+    return;
+  }
+
+  if (strcmp(cmd->argv[0], "false") == 0)
+    lastStatus = 1;
+
+  if (strcmp(cmd->argv[0], "xargs") == 0)
+    RunXargs(cmd);
+
+  if (strcmp(cmd->argv[0], "on") == 0)
+    RunOn(cmd);
+
+  if (strcmp(cmd->argv[0], "jobs") == 0)
+    RunJobs(cmd);
+
+  if (strcmp(cmd->argv[0], "fg") == 0 || strcmp(cmd->argv[0], "bg") == 0)
+    RunFgBg(cmd);
+
+  if (strcmp(cmd->argv[0], "cat") == 0)
+    RunCat(cmd);
+
+  if (strcmp(cmd->argv[0], "timeout") == 0)
+    RunTimeout(cmd);
+
+  if (strcmp(cmd->argv[0], "bench") == 0)
+    RunBench(cmd);
+
+  if (strcmp(cmd->argv[0], "enable") == 0)
+    RunEnable(cmd);
+
+  if (strcmp(cmd->argv[0], "memo") == 0)
+    RunMemo(cmd);
+
+  if (strcmp(cmd->argv[0], "wc") == 0)
+    RunWc(cmd);
+
+  if (strcmp(cmd->argv[0], "head") == 0)
+    RunHead(cmd);
+
+  if (strcmp(cmd->argv[0], "tail") == 0)
+    RunTail(cmd);
+
+} /* RunBuiltInCmd */
+
+
+/*
+ * RunXargs
+ *
+ * arguments:
+ *   commandT *cmd: the xargs command line
+ *
+ * returns: none
+ *
+ * Implements "xargs [-0] [-n max] [-P procs] [-a file] [cmd [args]]".
+ * Tokens separated by blanks and newlines (or by NUL with -0) are
+ * read from standard input, or from the -a file, and appended to
+ * cmd's arguments. Each batch is sized to the real exec limit, i.e.
+ * sysconf(_SC_ARG_MAX) less the environment, so the command is run as
+ * few times as possible. Up to procs batches run at once; they share
+ * one process group so they can be waited on and interrupted
+ * together. The default command is echo.
+ *
+ * Tokens are collected in a single arena and the batch's commandT is
+ * reused, so steady-state batching allocates nothing. Batches are
+ * forked, so the arena can be refilled while they run.
+ */
+static void
+RunXargs(commandT* cmd)
+{
+  extern char** environ;
+  FILE* in = stdin;
+  char* file = NULL;
+  bool nulDelim = FALSE;
+  int maxArgs = 0, procs = 1, running = 0;
+  pid_t pgid = 0;
+  int i, j;
+
+  // Parse the options.
+  for (i = 1; i < cmd->argc && cmd->argv[i][0] == '-'; i++)
+    {
+      char* opt = cmd->argv[i];
+      char* val = NULL;
+      if (strcmp(opt, "--") == 0)
+        {
+          i++;
+          break;
+        }
+      if (strcmp(opt, "-0") == 0)
+        {
+          nulDelim = TRUE;
+          continue;
+        }
+      if (opt[1] == 0 || strchr("nPa", opt[1]) == NULL)
+        {
+          fprintf(stderr, "%s: xargs: unknown option %s\n", SHELLNAME, opt);
+          return;
+        }
+      if (opt[2] != 0)
+        val = opt + 2;
+      else if (i + 1 < cmd->argc)
+        val = cmd->argv[++i];
+      else
+        {
+          fprintf(stderr, "%s: xargs: %s needs a value\n", SHELLNAME, opt);
+          return;
+        }
+      if (opt[1] == 'n')
+        maxArgs = atoi(val);
+      else if (opt[1] == 'P')
+        procs = atoi(val);
+      else
+        file = val;
+    }
+  if (procs < 1)
+    procs = 1;
+  if (file != NULL && (in = fopen(file, "r")) == NULL)
+    {
+      PrintPError(file);
+      return;
+    }
+  // A redirected descriptor 0 gets a stream of its own: stdin may
+  // hold buffered input that belongs to the shell.
+  if (file == NULL && gStdinSwapped > 0
+      && (in = fdopen(fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0), "r")) == NULL)
+    in = stdin;
+
+  // The fixed part of every batch: the command and its own arguments.
+  char* echoArgv[] = { "echo" };
+  char** fixed = i < cmd->argc ? cmd->argv + i : echoArgv;
+  int nfixed = i < cmd->argc ? cmd->argc - i : 1;
+  bool builtin = IsBuiltIn(fixed[0]);
+  char* path = NULL;
+
+  if (!builtin && (path = getFullPath(fixed[0])) == NULL)
+    {
+      if (in != stdin)
+        fclose(in);
+      return;
+    }
+
+  // Work out how many bytes of arguments fit in one exec.
+  long argMax = sysconf(_SC_ARG_MAX);
+  long budget;
+  if (argMax <= 0)
+    argMax = _POSIX_ARG_MAX;
+  budget = argMax - XARGS_HEADROOM - sizeof(char*);
+  for (j = 0; environ[j] != NULL; j++)
+    budget -= strlen(environ[j]) + 1 + sizeof(char*);
+  for (j = 0; j < nfixed; j++)
+    budget -= strlen(fixed[j]) + 1 + sizeof(char*);
+  if (path != NULL)
+    budget -= strlen(path) + 1;
+  if (budget <= 0)
+    {
+      fprintf(stderr, "%s: xargs: environment too large\n", SHELLNAME);
+      free(path);
+      if (in != stdin)
+        fclose(in);
+      return;
+    }
+
+  // Token storage: bytes in arena, start offsets in offs.
+  char* arena = malloc(budget);
+  long used = 0, cost = 0, tokStart = 0;
+  int ntok = 0, maxTok = 1024;
+  long* offs = malloc(sizeof(long) * maxTok);
+  int slots = nfixed + maxTok + 1;
+  commandT* batch = malloc(sizeof(commandT) + sizeof(char*) * slots);
+  bool inTok = FALSE, tooLong = FALSE;
+  int ch;
+
+  if (arena == NULL || offs == NULL || batch == NULL)
+    {
+      PrintPError("xargs");
+      lastStatus = 1;
+      free(path);
+      free(batch);
+      free(offs);
+      free(arena);
+      if (in != stdin)
+        fclose(in);
+      return;
+    }
+
+  batch->name = path;
+  for (j = 0; j < nfixed; j++)
+    batch->argv[j] = fixed[j];
+
+  sigset_t x;
+  sigemptyset(&x);
+  sigaddset(&x, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &x, NULL);
+
+  flockfile(in);
+  do
+    {
+      bool sep, flush = FALSE;
+      long tokCost;
+
+      ch = getc_unlocked(in);
+      if (ch == EOF)
+        sep = TRUE;
+      else if (nulDelim)
+        sep = ch == '\0';
+      else
+        sep = ch == ' ' || ch == '\t' || ch == '\n';
+      if (sep && !inTok)
+        continue;
+      if (!inTok)
+        {
+          inTok = TRUE;
+          tokStart = used;
+        }
+
+      // Flush the batch when the arena is full or the token that just
+      // ended does not fit in it.
+      tokCost = used - tokStart + 1 + sizeof(char*);
+      if (used == budget)
+        flush = TRUE;
+      else if (sep && ntok > 0)
+        flush = cost + tokCost > budget || (maxArgs > 0 && ntok == maxArgs);
+      if (flush)
+        {
+          if (ntok == 0)
+            {
+              tooLong = TRUE;
+              break;
+            }
+          XargsBatch(batch, nfixed, arena, offs, ntok);
+          XargsLaunch(batch, &pgid, &running, procs);
+          memmove(arena, arena + tokStart, used - tokStart);
+          used -= tokStart;
+          tokStart = 0;
+          ntok = 0;
+          cost = 0;
+        }
+      if (!sep)
+        {
+          // exec refuses a longer argument whatever the batch
+          if (used - tokStart + 1 >= XARGS_MAXARG)
+            {
+              tooLong = TRUE;
+              break;
+            }
+          arena[used++] = ch;
+          continue;
+        }
+
+      // The token is complete.
+      arena[used++] = '\0';
+      inTok = FALSE;
+      if (ntok == maxTok)
+        {
+          maxTok *= 2;
+          offs = realloc(offs, sizeof(long) * maxTok);
+          slots = nfixed + maxTok + 1;
+          batch = realloc(batch, sizeof(commandT) + sizeof(char*) * slots);
+        }
+      offs[ntok++] = tokStart;
+      cost += tokCost;
+    }
+  while (ch != EOF);
+  funlockfile(in);
+
+  if (tooLong)
+    {
+      fprintf(stderr, "%s: xargs: argument line too long\n", SHELLNAME);
+      lastStatus = 1;
+    }
+  else if (ntok > 0)
+    {
+      XargsBatch(batch, nfixed, arena, offs, ntok);
+      XargsLaunch(batch, &pgid, &running, procs);
+    }
+
+  // Wait for the batches still running.
+  while (running > 0)
+    XargsLaunch(NULL, &pgid, &running, 0);
+  sigprocmask(SIG_UNBLOCK, &x, NULL);
+
+  if (in != stdin)
+    fclose(in);
+  else if (isatty(fileno(stdin)))
+    clearerr(stdin); // let the shell keep reading after ^D
+  free(path);
+  free(batch);
+  free(offs);
+  free(arena);
+} /* RunXargs */
+
+
+/*
+ * RunCat
+ *
+ * arguments:
+ *   commandT *cmd: the cat command line
+ *
+ * returns: none
+ *
+ * Implements "cat [file]...": copies each file, or standard input
+ * for "-" or no file, to standard output with CopyFd, so that a
+ * redirected or piped cat moves its data without it passing through
+ * the shell. Messages are those of the cat in PATH, which is run
+ * instead when BuiltInExternal says so.
+ */
+static void
+RunCat(commandT* cmd)
+{
+  struct stat so, si;
+  char* name;
+  int i, fd;
+
+  fflush(stdout);
+  if (fstat(STDOUT_FILENO, &so) != 0)
+    so.st_mode = 0;
+  for (i = cmd->argc == 1 ? 0 : 1; i < cmd->argc; i++)
+    {
+      name = i == 0 ? "-" : cmd->argv[i];
+      fd = strcmp(name, "-") == 0 ? STDIN_FILENO
+        : open(name, O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        {
+          fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+          lastStatus = 1;
+          continue;
+        }
+      if (S_ISREG(so.st_mode) && fstat(fd, &si) == 0
+          && si.st_dev == so.st_dev && si.st_ino == so.st_ino)
+        {
+          fprintf(stderr, "cat: %s: input file is output file\n", name);
+          lastStatus = 1;
+        }
+      else if (!CopyFd(fd, STDOUT_FILENO))
+        {
+          fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+          lastStatus = 1;
+        }
+      if (fd != STDIN_FILENO)
+        close(fd);
+    }
+} /* RunCat */
+
+
+/*
+ * BuiltInExternal
+ *
+ * arguments:
+ *   commandT *cmd: a command line
+ *   int in: the descriptor it would read as standard input, or -1
+ *
+ * returns: bool: TRUE if it is a cat, wc, head or tail the builtins
+ *                leave to PATH
+ *
+ * That is any cat with options, and one that would read a terminal:
+ * the shell cannot be stopped or interrupted like a job. For wc,
+ * head and tail TextExternal decides, on the same grounds.
+ */
+static bool
+BuiltInExternal(commandT* cmd, int in)
+{
+  bool tty;
+  int i;
+
+  if (strcmp(cmd->argv[0], "cat") != 0)
+    return TextExternal(cmd, in);
+  tty = in >= 0 && isatty(in);
+  if (cmd->argc == 1)
+    return tty;
+  for (i = 1; i < cmd->argc; i++)
+    if (cmd->argv[i][0] == '-' && (cmd->argv[i][1] != 0 || tty))
+      return TRUE;
+  return FALSE;
+} /* BuiltInExternal */
+
+
+
+
+
+
+
+
+
+/*
+ * RunLoaded
+ *
+ * arguments:
+ *   commandT *cmd: the command line
+ *   tshBuiltinT *b: the builtin enable loaded for cmd->argv[0]
+ *
+ * returns: none
+ *
+ * Calls the builtin's run with the shell's standard descriptors, which
+ * hold any redirections by now. A builtin that is safe in-process, or
+ * one met in a child of the shell such as a pipeline stage, runs right
+ * here. Otherwise it runs in a forked child as a foreground job, like
+ * an external command, and what it does to the process, or a crash,
+ * stays in the child.
+ */
+static void
+RunLoaded(commandT* cmd, tshBuiltinT* b)
+{
+  int slot, status;
+  long long t;
+  sigset_t x;
+  pid_t pid;
+
+  fflush(stdout); // our output must come before the builtin's
+  if ((b->flags & TSH_BUILTIN_INPROC) || gSubshell)
+    {
+      lastStatus = b->run(cmd->argc, cmd->argv, STDIN_FILENO, STDOUT_FILENO,
+                          STDERR_FILENO) & 0xff;
+      return;
+    }
+
+  sigemptyset(&x);
+  sigaddset(&x, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &x, NULL);
+  JobStart(&gFg);
+  slot = PlaceNext();
+  t = MetricsClock();
+  if ((pid = fork()) < 0)
+    {
+      PrintPError("Fork failed");
+      lastStatus = 1;
+    }
+  else if (pid == 0)
+    {
+      ChildInit(gFg.pgid, TRUE);
+      SubshellInit();
+      PlaceApply(slot);
+      status = b->run(cmd->argc, cmd->argv, STDIN_FILENO, STDOUT_FILENO,
+                      STDERR_FILENO);
+      fflush(stdout);
+      _exit(status & 0xff);
+    }
+  else
+    {
+      setpgid(pid, gFg.pgid == 0 ? pid : gFg.pgid);
+      MetricsSpawn(t);
+      PROBE3(spawn, cmd->argv[0], pid, PROBE_SINCE(t));
+      JobAdd(&gFg, pid);
+      JobWait(&gFg, cmd, FALSE);
+    }
+  sigprocmask(SIG_UNBLOCK, &x, NULL);
+} /* RunLoaded */
+
+
+/*
+ * XargsBatch
+ *
+ * arguments:
+ *   commandT *batch: the batch command, with the fixed arguments set
+ *   int nfixed: number of fixed arguments
+ *   char *arena: the collected tokens
+ *   long *offs: offset of each token in the arena
+ *   int ntok: number of tokens
+ *
+ * returns: none
+ *
+ * Points the batch's argv at the collected tokens.
+ */
+static void
+XargsBatch(commandT* batch, int nfixed, char* arena, long* offs, int ntok)
+{
+  int j;
+
+  for (j = 0; j < ntok; j++)
+    batch->argv[nfixed + j] = arena + offs[j];
+  batch->argv[nfixed + ntok] = NULL;
+  batch->argc = nfixed + ntok;
+} /* XargsBatch */
+
+
+/*
+ * XargsLaunch
+ *
+ * arguments:
+ *   commandT *batch: the batch to run, or NULL to just reap one batch
+ *   pid_t *pgid: process group shared by the running batches, or 0
+ *   int *running: number of batches currently running
+ *   int procs: maximum number of batches to run at once
+ *
+ * returns: none
+ *
+ * Runs one xargs batch. A builtin command runs in the shell. An
+ * external one is forked into the batch process group once fewer
+ * than procs batches are running; batches are reaped through the
+ * group, so other children of the shell are left alone.
+ */
+static void
+XargsLaunch(commandT* batch, pid_t* pgid, int* running, int procs)
+{
+  pid_t pid;
+  int status;
+
+  if (batch != NULL && batch->name == NULL)
+    {
+      RunBuiltInCmd(batch);
+      fflush(stdout);
+      return;
+    }
+
+  while (*running > 0 && (batch == NULL || *running >= procs))
+    {
+      RecordWait(TRUE);
+      pid = waitpid(-*pgid, &status, 0);
+      RecordWait(FALSE);
+      if (pid < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          *running = 0;
+          break;
+        }
+      (*running)--;
+      if (WaitStatus(status) != 0)
+        lastStatus = 123;
+      if (batch == NULL)
+        break;
+    }
+  if (*running == 0)
+    {
+      *pgid = 0; // the old group is gone; the next batch starts a new one
+      fgpid = 0;
+    }
+  if (batch == NULL)
+    return;
+
+  fflush(stdout);
+  if ((pid = ForkExec(batch, *pgid, FALSE, NULL)) < 0)
+    return;
+  if (*pgid == 0)
+    *pgid = pid;
+  fgpid = *pgid;
+  (*running)++;
+} /* XargsLaunch */
+
+
+/*
+ * CheckJobs
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Checks the status of running jobs. Only the pidfds of processes
+ * that have exited are ready in the epoll set, so the cost is in the
+ * number of processes that changed, not the number of jobs. Stops and
+ * continues have no pidfd event and are collected with waitid. The
+ * timers of jobs run by timeout are in the set too, so a stopped or
+ * background job still times out, if only when the shell next checks.
+ * Jobs that finished or stopped are reported in order of their
+ * numbers. Job output kept in rings is drained first, so a job's last
+ * words are in before it is reported done.
+ */
+void
+CheckJobs()
+{
+  struct epoll_event ev[NEVENTS];
+  jobT* changed = NULL;
+  jobT* job;
+  procT* p;
+  siginfo_t si;
+  int i, n;
+
+  OutDrain();
+  if (gNJobs == 0)
+    return;
+
+  n = epoll_wait(gEpoll, ev, NEVENTS, 0);
+  for (i = 0; i < n; i++)
+    {
+      if (ev[i].data.u64 & TIMERTAG)
+        {
+          JobTimeout((jobT*) (uintptr_t) (ev[i].data.u64 & ~TIMERTAG));
+          continue;
+        }
+      p = ev[i].data.ptr;
+      si.si_pid = 0;
+      if (waitid(P_PIDFD, p->fd, &si, WEXITED | WNOHANG) != 0)
+        { // reaped by someone else; nothing more to learn
+          si.si_code = CLD_EXITED;
+          si.si_status = 0;
+        }
+      else if (si.si_pid == 0)
+        continue;
+      ProcEvent(p, &si);
+      JobChanged(p->job, &changed);
+    }
+  for (;;)
+    {
+      si.si_pid = 0;
+      if (waitid(P_ALL, 0, &si, WSTOPPED | WCONTINUED | WNOHANG) != 0
+          || si.si_pid == 0)
+        break;
+      if ((p = ProcFind(si.si_pid)) == NULL)
+        continue;
+      ProcEvent(p, &si);
+      JobChanged(p->job, &changed);
+    }
+
+  while ((job = changed) != NULL)
+    {
+      changed = job->nextChanged;
+      job->changed = FALSE;
+      if (job->nlive == 0)
+        {
+          int status = job->procs[job->nprocs - 1].status;
+          char done[32];
+          if (WIFSIGNALED(status))
+            snprintf(done, sizeof(done), "%s", strsignal(WTERMSIG(status)));
+          else if (WEXITSTATUS(status) != 0)
+            snprintf(done, sizeof(done), "Exit %d", WEXITSTATUS(status));
+          else
+            strcpy(done, "Done");
+          JobPrint(job, done, "");
+          JobFree(job);
+        }
+      else if (job->nstopped == job->nlive && job->state != J_STOPPED)
+        {
+          job->state = J_STOPPED;
+          JobPrint(job, "Stopped", "");
+        }
+      else if (job->nstopped < job->nlive)
+        job->state = J_RUNNING;
+    }
+  fflush(stdout);
+} /* CheckJobs */
+
+
+/*
+ * JobChanged
+ *
+ * arguments:
+ *   jobT *job: a numbered job one of whose processes changed state
+ *   jobT **list: the jobs changed so far, by number
+ *
+ * returns: none
+ */
+static void
+JobChanged(jobT* job, jobT** list)
+{
+  if (job->changed)
+    return;
+  job->changed = TRUE;
+  while (*list != NULL && (*list)->id < job->id)
+    list = &(*list)->nextChanged;
+  job->nextChanged = *list;
+  *list = job;
+} /* JobChanged */
+
+
+/*
+ * JobInit
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Takes the terminal if the shell is in its foreground. The shell
+ * ignores SIGTTOU and SIGTTIN from then on, so it can hand the
+ * terminal to a job and take it back.
+ */
+void
+JobInit()
+{
+  struct stat st;
+
+  if (stat("/proc/self/exe", &st) == 0)
+    {
+      gSelfDev = st.st_dev;
+      gSelfIno = st.st_ino;
+    }
+  gShellPgid = getpgrp();
+  if (!isatty(STDIN_FILENO) || tcgetpgrp(STDIN_FILENO) != gShellPgid)
+    return;
+  signal(SIGTTOU, SIG_IGN);
+  signal(SIGTTIN, SIG_IGN);
+  setpgid(0, 0); // fails harmlessly for a session leader
+  gShellPgid = getpgrp();
+  tcsetpgrp(STDIN_FILENO, gShellPgid);
+  gTty = TRUE;
+} /* JobInit */
+
+
+/*
+ * SubshellInit
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Drops the jobs and the terminal inherited from the shell. The
+ * tables are left allocated; the child exits or execs before long.
+ * The output rings stay readable, as they were at the fork, but their
+ * pipes are closed: what comes later is for the shell to read. The
+ * worker threads were not forked, so the child starts its own.
+ */
+void
+SubshellInit()
+{
+  gTty = FALSE;
+  gSubshell = TRUE;
+  gJobs = NULL;
+  RingForget();
+  gMaxJobs = gLastJob = gNJobs = gCurJob = 0;
+  if (gEpoll >= 0)
+    close(gEpoll);
+  gEpoll = -1;
+  pthread_mutex_init(&gStageLock, NULL);
+  pthread_cond_init(&gStageCond, NULL);
+  gWorkers = NULL;
+  gNWorkers = gIdle = gQueued = 0;
+  gQueueHead = gQueueTail = NULL;
+} /* SubshellInit */
+
+
+/*
+ * JobStart
+ *
+ * arguments:
+ *   jobT *job: a job that is not running
+ *
+ * returns: none
+ *
+ * Empties a job, keeping its process table for reuse.
+ */
+static void
+JobStart(jobT* job)
+{
+  job->id = 0;
+  job->pgid = gOwnGroup ? getpgrp() : 0;
+  job->state = J_RUNNING;
+  job->nprocs = job->nlive = job->nstopped = 0;
+  job->timeout.fd = -1;
+  job->timeout.expired = 0;
+} /* JobStart */
+
+
+/*
+ * JobAdd
+ *
+ * arguments:
+ *   jobT *job: the job
+ *   pid_t pid: a child just forked into the job's process group
+ *
+ * returns: none
+ *
+ * Opens a pidfd for the child. The child cannot be reaped before
+ * this, so the pidfd refers to it and not to a later process that
+ * reused the pid.
+ */
+static void
+JobAdd(jobT* job, pid_t pid)
+{
+  procT* p;
+
+  if (job->nprocs == job->maxProcs)
+    {
+      job->maxProcs = job->maxProcs * 2 + 4;
+      job->procs = realloc(job->procs, sizeof(procT) * job->maxProcs);
+    }
+  p = &job->procs[job->nprocs++];
+  p->pid = pid;
+  p->fd = syscall(SYS_pidfd_open, pid, 0);
+  p->status = 0;
+  p->stopped = FALSE;
+  p->job = job;
+  p->started = PROBE_CLOCK(reap);
+  job->nlive++;
+  if (job->pgid == 0)
+    job->pgid = pid;
+} /* JobAdd */
+
+
+/*
+ * JobWait
+ *
+ * arguments:
+ *   jobT *job: the job to run in the foreground
+ *   commandT *cmd: its command line, if it is gFg
+ *   bool cont: whether to resume the job first
+ *
+ * returns: none
+ *
+ * Gives the job the terminal and waits on the pidfd of each of its
+ * processes until it has exited or stopped. A job that stops is
+ * numbered and reported, and $? becomes 128 plus SIGTSTP; otherwise
+ * $? is the status of the last stage, or 124 if timeout's timer
+ * expired and the job was not killed by SIGKILL. A job with a timer
+ * is polled rather than blocked on, with SIGCHLD blocked so a stop
+ * still wakes the shell. A subshell leaves stops to the shell, which
+ * sees the whole process group stop. Background output kept in rings
+ * is drained while waiting in the same way.
+ */
+static void
+JobWait(jobT* job, commandT* cmd, bool cont)
+{
+  int flags = WEXITED | (gSubshell ? 0 : WSTOPPED);
+  bool polled = job->timeout.fd >= 0 || OutFd() >= 0;
+  long long t = PROBE_CLOCK(wait_done);
+  sigset_t x, old;
+  siginfo_t si;
+  int i;
+
+  PROBE1(wait_start, job->pgid);
+  if (polled)
+    {
+      flags |= WNOHANG;
+      sigemptyset(&x);
+      sigaddset(&x, SIGCHLD);
+      sigprocmask(SIG_BLOCK, &x, &old);
+    }
+  fgpid = job->pgid;
+  if (gTty)
+    tcsetpgrp(STDIN_FILENO, job->pgid);
+  if (cont)
+    JobContinue(job);
+  RecordWait(TRUE);
+  for (i = 0; i < job->nprocs; i++)
+    {
+      procT* p = &job->procs[i];
+      while (p->fd >= 0 && !p->stopped)
+        {
+          si.si_pid = 0;
+          if (waitid(P_PIDFD, p->fd, &si, flags) != 0)
+            {
+              if (errno == EINTR)
+                continue;
+              si.si_code = CLD_EXITED;
+              si.si_status = 0;
+            }
+          else if (si.si_pid == 0)
+            { // only with WNOHANG: nothing yet
+              JobPoll(job, p);
+              continue;
+            }
+          ProcEvent(p, &si);
+        }
+    }
+  RecordWait(FALSE);
+  PROBE3(wait_done, job->pgid,
+         job->nprocs > 0 ? job->procs[job->nprocs - 1].status : 0,
+         PROBE_SINCE(t));
+  if (polled)
+    sigprocmask(SIG_SETMASK, &old, NULL);
+  fgpid = 0;
+  if (gTty)
+    tcsetpgrp(STDIN_FILENO, gShellPgid);
+
+  if (job->nstopped > 0)
+    {
+      if (job->id == 0)
+        job = JobNumber(job, cmd);
+      job->state = J_STOPPED;
+      gCurJob = job->id;
+      JobPrint(job, "Stopped", "");
+      lastStatus = 128 + SIGTSTP;
+      return;
+    }
+  lastStatus = WaitStatus(job->procs[job->nprocs - 1].status);
+  if (job->timeout.expired > 0 && lastStatus != 128 + SIGKILL)
+    lastStatus = 124;
+  if (job->id != 0)
+    JobFree(job);
+  else if (job->timeout.fd >= 0)
+    {
+      close(job->timeout.fd);
+      job->timeout.fd = -1;
+    }
+} /* JobWait */
+
+
+/*
+ * JobNumber
+ *
+ * arguments:
+ *   jobT *job: a job going to the background, or gFg when it stopped
+ *   commandT *cmd: its command line
+ *
+ * returns: jobT*: the numbered job
+ *
+ * Gives the job the number after the highest in use and adds the
+ * pidfds of its live processes, and its timer, to the epoll set. gFg
+ * is moved to the heap first, taking its process table and timer with
+ * it. A ring kept from an earlier job with the number is dropped.
+ */
+static jobT*
+JobNumber(jobT* job, commandT* cmd)
+{
+  struct epoll_event ev;
+  int i, len = 0;
+  char* t;
+
+  if (job == &gFg)
+    {
+      job = malloc(sizeof(jobT));
+      *job = gFg;
+      gFg.procs = NULL;
+      gFg.maxProcs = 0;
+      gFg.timeout.fd = -1;
+      for (i = 0; i < job->nprocs; i++)
+        job->procs[i].job = job;
+    }
+
+  for (i = 0; i < cmd->argc; i++)
+    len += strlen(cmd->argv[i]) + 1;
+  t = job->text = malloc(len + 1);
+  for (i = 0; i < cmd->argc; i++)
+    {
+      char* w = cmd->argv[i];
+      if (strcmp(w, PIPEMARK) == 0)
+        w = "|";
+      else if (w[0] == REDIRMARK[0])
+        w++;
+      t += sprintf(t, i == 0 ? "%s" : " %s", w);
+    }
+  *t = 0;
+
+  if (gLastJob + 1 >= gMaxJobs)
+    {
+      gMaxJobs = gMaxJobs * 2 + 16;
+      gJobs = realloc(gJobs, sizeof(jobT*) * gMaxJobs);
+    }
+  job->id = ++gLastJob;
+  RingDrop(job->id); // the output of the last job with this number
+  job->changed = FALSE;
+  gJobs[job->id] = job;
+  gNJobs++;
+  MetricsJobs(gNJobs);
+
+  if (gEpoll < 0)
+    gEpoll = epoll_create1(EPOLL_CLOEXEC);
+  for (i = 0; i < job->nprocs; i++)
+    if (job->procs[i].fd >= 0)
+      {
+        ev.events = EPOLLIN;
+        ev.data.ptr = &job->procs[i];
+        epoll_ctl(gEpoll, EPOLL_CTL_ADD, job->procs[i].fd, &ev);
+      }
+  if (job->timeout.fd >= 0)
+    {
+      ev.events = EPOLLIN;
+      ev.data.u64 = (uintptr_t) job | TIMERTAG;
+      epoll_ctl(gEpoll, EPOLL_CTL_ADD, job->timeout.fd, &ev);
+    }
+  return job;
+} /* JobNumber */
+
+
+/*
+ * JobContinue
+ *
+ * arguments:
+ *   jobT *job: a numbered job
+ *
+ * returns: none
+ *
+ * Sends SIGCONT to the job's process group. The group id cannot have
+ * been reused: a live process of the job, which has not been reaped,
+ * still holds it. One kill resumes the whole job however many
+ * processes it has.
+ */
+static void
+JobContinue(jobT* job)
+{
+  int i;
+
+  if (job->nstopped > 0 || job->state == J_STOPPED)
+    {
+      kill(-job->pgid, SIGCONT);
+      for (i = 0; i < job->nprocs; i++)
+        job->procs[i].stopped = FALSE;
+      job->nstopped = 0;
+    }
+  job->state = J_RUNNING;
+} /* JobContinue */
+
+
+/*
+ * JobTimeout
+ *
+ * arguments:
+ *   jobT *job: a job whose timer is readable
+ *
+ * returns: none
+ *
+ * Sends the job the signal TimeoutExpire asks for, followed by
+ * SIGCONT so a stopped job gets it.
+ */
+static void
+JobTimeout(jobT* job)
+{
+  int sig = TimeoutExpire(&job->timeout);
+
+  if (sig == 0)
+    return;
+  JobSignal(job, sig);
+  if (sig != SIGKILL && sig != SIGCONT)
+    JobSignal(job, SIGCONT);
+} /* JobTimeout */
+
+
+/*
+ * JobSignal
+ *
+ * arguments:
+ *   jobT *job: a job
+ *   int sig: the signal
+ *
+ * returns: none
+ *
+ * Signals the job's process group, unless that is the caller's own
+ * group, as for timeout run in a pipeline stage; then only the job's
+ * live processes are signalled, and not their neighbours.
+ */
+static void
+JobSignal(jobT* job, int sig)
+{
+  int i;
+
+  if (job->pgid != getpgrp())
+    {
+      kill(-job->pgid, sig);
+      return;
+    }
+  for (i = 0; i < job->nprocs; i++)
+    if (job->procs[i].fd >= 0)
+      kill(job->procs[i].pid, sig);
+} /* JobSignal */
+
+
+/*
+ * JobPoll
+ *
+ * arguments:
+ *   jobT *job: a foreground job with a timer
+ *   procT *p: the process being waited for
+ *
+ * returns: none
+ *
+ * Polls the process's pidfd, which is readable once it exits, the
+ * job's timer, if any, the pipes of the output rings and a signalfd
+ * for SIGCHLD, which the caller has blocked; a stop only shows up as
+ * SIGCHLD. Acts on the timer if it expired and drains the rings. The
+ * caller then checks the process with waitid.
+ */
+static void
+JobPoll(jobT* job, procT* p)
+{
+  struct signalfd_siginfo ssi;
+  struct pollfd fds[4];
+  sigset_t x;
+
+  if (gChldFd < 0)
+    {
+      sigemptyset(&x);
+      sigaddset(&x, SIGCHLD);
+      gChldFd = signalfd(-1, &x, SFD_CLOEXEC | SFD_NONBLOCK);
+    }
+  fds[0].fd = p->fd;
+  fds[1].fd = job->timeout.fd; // poll skips the ones that are -1
+  fds[2].fd = gChldFd;
+  fds[3].fd = OutFd();
+  fds[0].events = fds[1].events = fds[2].events = fds[3].events = POLLIN;
+  if (poll(fds, 4, -1) <= 0)
+    return;
+  if (fds[1].revents & POLLIN)
+    JobTimeout(job);
+  if (fds[2].revents & POLLIN)
+    while (read(gChldFd, &ssi, sizeof(ssi)) > 0)
+      ;
+  if (fds[3].revents & POLLIN)
+    OutDrain();
+} /* JobPoll */
+
+
+
+
+
+
+
+
+
+/*
+ * JobFree
+ *
+ * arguments:
+ *   jobT *job: a numbered job
+ *
+ * returns: none
+ *
+ * Takes the job's pidfds and timer out of the epoll set and closes
+ * them, and frees its number. Closing alone would not do: a forked
+ * builtin may still hold copies, which keep them registered. The
+ * current job passes to the highest numbered one left.
+ */
+static void
+JobFree(jobT* job)
+{
+  int i;
+
+  for (i = 0; i < job->nprocs; i++)
+    if (job->procs[i].fd >= 0)
+      {
+        epoll_ctl(gEpoll, EPOLL_CTL_DEL, job->procs[i].fd, NULL);
+        close(job->procs[i].fd);
+      }
+  if (job->timeout.fd >= 0)
+    {
+      epoll_ctl(gEpoll, EPOLL_CTL_DEL, job->timeout.fd, NULL);
+      close(job->timeout.fd);
+    }
+  gJobs[job->id] = NULL;
+  gNJobs--;
+  MetricsJobs(gNJobs);
+  while (gLastJob > 0 && gJobs[gLastJob] == NULL)
+    gLastJob--;
+  if (gCurJob == job->id)
+    gCurJob = gLastJob;
+  free(job->procs);
+  free(job->text);
+  free(job);
+} /* JobFree */
+
+
+/*
+ * JobFind
+ *
+ * arguments:
+ *   commandT *cmd: a fg or bg command line
+ *
+ * returns: jobT*: the job named by "%N" or "N", or the current job
+ *                 if there is no argument; NULL after an error
+ */
+static jobT*
+JobFind(commandT* cmd)
+{
+  char* spec = cmd->argc > 1 ? cmd->argv[1] : NULL;
+  int id = gCurJob;
+
+  if (spec != NULL)
+    id = atoi(spec[0] == '%' ? spec + 1 : spec);
+  if (id >= 1 && id <= gLastJob && gJobs[id] != NULL)
+    return gJobs[id];
+  if (spec == NULL)
+    fprintf(stderr, "%s: %s: no current job\n", SHELLNAME, cmd->argv[0]);
+  else
+    fprintf(stderr, "%s: %s: %s: no such job\n", SHELLNAME, cmd->argv[0],
+            spec);
+  lastStatus = 1;
+  return NULL;
+} /* JobFind */
+
+
+/*
+ * JobPrint
+ *
+ * arguments:
+ *   jobT *job: a numbered job
+ *   char *state: what to say about it
+ *   char *suffix: appended to the command line
+ *
+ * returns: none
+ */
+static void
+JobPrint(jobT* job, char* state, char* suffix)
+{
+  printf("[%d]%c  %-24s%s%s\n", job->id, job->id == gCurJob ? '+' : ' ',
+         state, job->text, suffix);
+} /* JobPrint */
+
+
+/*
+ * ProcEvent
+ *
+ * arguments:
+ *   procT *p: a process of a job
+ *   siginfo_t *si: what waitid reported for it
+ *
+ * returns: none
+ *
+ * Updates the process and the counts of its job. A reaped process's
+ * pidfd is taken out of the epoll set and closed.
+ */
+static void
+ProcEvent(procT* p, siginfo_t* si)
+{
+  jobT* job = p->job;
+
+  switch (si->si_code)
+    {
+    case CLD_EXITED:
+    case CLD_KILLED:
+    case CLD_DUMPED:
+      p->status = si->si_code == CLD_EXITED
+        ? W_EXITCODE(si->si_status, 0) : W_EXITCODE(0, si->si_status);
+      if (p->stopped)
+        job->nstopped--;
+      p->stopped = FALSE;
+      if (job->id != 0)
+        epoll_ctl(gEpoll, EPOLL_CTL_DEL, p->fd, NULL);
+      close(p->fd);
+      p->fd = -1;
+      job->nlive--;
+      PROBE3(reap, p->pid, p->status, PROBE_SINCE(p->started));
+      break;
+    case CLD_STOPPED:
+    case CLD_TRAPPED:
+      if (!p->stopped)
+        job->nstopped++;
+      p->stopped = TRUE;
+      break;
+    case CLD_CONTINUED:
+      if (p->stopped)
+        job->nstopped--;
+      p->stopped = FALSE;
+      break;
+    }
+} /* ProcEvent */
+
+
+/*
+ * ProcFind
+ *
+ * arguments:
+ *   pid_t pid: a child of the shell
+ *
+ * returns: procT*: the live process of a numbered job with that pid,
+ *                  or NULL
+ *
+ * Used only for stops and continues, which have no pidfd event.
+ */
+static procT*
+ProcFind(pid_t pid)
+{
+  int i, j;
+
+  for (i = 1; i <= gLastJob; i++)
+    if (gJobs[i] != NULL)
+      for (j = 0; j < gJobs[i]->nprocs; j++)
+        if (gJobs[i]->procs[j].pid == pid && gJobs[i]->procs[j].fd >= 0)
+          return &gJobs[i]->procs[j];
+  return NULL;
+} /* ProcFind */
+
+
+/*
+ * RunJobs
+ *
+ * arguments:
+ *   commandT *cmd: the jobs command line
+ *
+ * returns: none
+ *
+ * Implements "jobs": reports finished jobs, then lists the others in
+ * order of their numbers. "jobs -o [%N]" prints instead the output
+ * kept of job N, or of the current job.
+ */
+static void
+RunJobs(commandT* cmd)
+{
+  int i;
+
+  CheckJobs();
+  if (cmd->argc > 1 && strcmp(cmd->argv[1], "-o") == 0)
+    {
+      RingPrint(cmd->argc > 2 ? cmd->argv[2] : NULL, gCurJob);
+      return;
+    }
+  for (i = 1; i <= gLastJob; i++)
+    if (gJobs[i] != NULL)
+      {
+        if (gJobs[i]->state == J_STOPPED)
+          JobPrint(gJobs[i], "Stopped", "");
+        else
+          JobPrint(gJobs[i], "Running", " &");
+      }
+} /* RunJobs */
+
+
+/*
+ * RunFgBg
+ *
+ * arguments:
+ *   commandT *cmd: the fg or bg command line
+ *
+ * returns: none
+ *
+ * Implements "fg [%N]", which resumes a job in the foreground and
+ * waits for it, and "bg [%N]", which resumes a stopped job in the
+ * background. Either way the job's whole process group is resumed
+ * with a single signal.
+ */
+static void
+RunFgBg(commandT* cmd)
+{
+  jobT* job = JobFind(cmd);
+
+  if (job == NULL)
+    return;
+  gCurJob = job->id;
+  if (cmd->argv[0][0] == 'f')
+    {
+      printf("%s\n", job->text);
+      fflush(stdout);
+      JobWait(job, NULL, TRUE);
+      return;
+    }
+  if (job->state != J_STOPPED)
+    {
+      fprintf(stderr, "%s: bg: job %d already in background\n", SHELLNAME,
+              job->id);
+      return;
+    }
+  JobContinue(job);
+  printf("[%d]+ %s &\n", job->id, job->text);
+} /* RunFgBg */
+
+/*
+ * CwdLoad
+ *
+ * arguments: none
+ *
+ * returns: bool: FALSE if the working directory cannot be found
+ *
+ * Fills the working directory cache the first time it is needed.
+ */
+static bool
+CwdLoad()
+{
+  if (gCwdFd < 0)
+    {
+      gCwdFd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+      free(gCwd);
+      gCwd = getcwd(NULL, 0);
+    }
+  return gCwdFd >= 0 && gCwd != NULL;
+} /* CwdLoad */
+
+
+/*
+ * ChangeDir
+ *
+ * arguments:
+ *   char *path: the new working directory
+ *
+ * returns: int: 0 if success, -1 if failure
+ *
+ * chdir for the cd builtin. It is the only place the working
+ * directory changes, so it is the only place the cache is refreshed.
+ */
+static int
+ChangeDir(char* path)
+{
+  if (path == NULL || chdir(path) != 0)
+    return -1;
+  if (gCwdFd >= 0)
+    close(gCwdFd);
+  gCwdFd = -1;
+  CwdLoad();
+  return 0;
+} /* ChangeDir */
+
+
+/*
+ * getFullPath
+ *
+ * This function takes the cmd->name and returns
+ * the full path to the file specified in cmd->name
+ *
+ * A relative name is looked for in the home directory, then the
+ * working directory, then each PATH directory in order, taking the
+ * first executable found. Every check is a faccessat(X_OK) against a
+ * directory descriptor that is already open, so no candidate path is
+ * walked from the root.
+ *
+ * It returns a pointer to NULL if it failed to find the file.
+ *
+ */
+
 char *
 getFullPath(char * name) {
-  bool found = FALSE;
-  char * pathlist = getenv("PATH"); // prepare the memory for the possible paths
-  char * home = getenv("HOME");
-  char * homeCopy = malloc(MAXPATHLEN*sizeof(char*));
-  strcpy(homeCopy,home);
-  char * pathCopy = malloc(MAXPATHLEN*sizeof(char*));
-  strcpy(pathCopy,pathlist);
-  char * result = malloc(MAXPATHLEN*sizeof(char*)); // prepare memory to store the result
-  char * current = getCurrentWorkingDir();
-  strcat(homeCopy,"/");
-  strcat(homeCopy,name);
+  char * result = NULL;
+  long long t = PROBE_CLOCK(resolve_done);
+  dirT cwd;
+  int i;
+
+  PROBE1(resolve_start, name);
   if (name[0] == '/') { // if it is an absolute path, store result.
-    if (doesFileExist(name)) {
-      strcpy(result,name);
-      found = TRUE;
-    }
+    if (access(name, X_OK) == 0)
+      result = strdup(name);
   } else {
-      if (doesFileExist(homeCopy)) { // If it is in the home directory
-        strcpy(result,homeCopy);
-        found = TRUE;
-      }  else {
-        strcat(current,"/");
-        strcat(current,name);
-        if (doesFileExist(current)) { // If it is in the current directory
-          strcpy(result,current);
-          found = TRUE;
-        } else { // Else, check every path in PATH environment variable
-          char* fullpath = strtok(pathCopy, ":");
-            while (fullpath != NULL) {
-              char * path = malloc(MAXPATHLEN*sizeof(char*));
-              strcpy(path,fullpath);
-              strcat(path,"/");
-              if (doesFileExist(strcat(path,name))) {
-                strcpy(result,path);
-                found = TRUE;
-              } 
-              fullpath = strtok(NULL, ":");
-              free(path);
-            }
-          }
-      }
+    if (HomeLoad()) // If it is in the home directory
+      result = FindIn(&gHome, name);
+    if (result == NULL && CwdLoad()) { // If it is in the current directory
+      cwd.path = gCwd;
+      cwd.len = strlen(gCwd);
+      cwd.fd = gCwdFd;
+      result = FindIn(&cwd, name);
+    }
+    if (result == NULL) { // Else, check every path in PATH
+      PathLoad();
+      for (i = 0; i < gNPathDirs && result == NULL; i++)
+        result = FindIn(&gPathDirs[i], name);
+    }
+  }
+  MetricsAdd(M_LOOKUPS);
+  PROBE3(resolve_done, name, result, PROBE_SINCE(t));
+  if (result == NULL) {
+    MetricsAdd(M_NOTFOUND);
+    PrintPError(name);
   }
-free(current);
-free(pathCopy);
-free(homeCopy);
-if (found) {
   return result;
-} else {
-  free(result);
-  PrintPError(name);
-  return NULL;
-}
 } /* getFullPath */
 
 
+/*
+ * PathLoad
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Opens an O_PATH descriptor for each directory in PATH. This is
+ * redone only when PATH has changed since the last call. Relative
+ * entries are not opened, since they follow the working directory.
+ */
+static void
+PathLoad()
+{
+  char* path = getenv("PATH");
+  char* end;
+  int i;
+
+  if (path == NULL)
+    path = "";
+  if (gPathKey != NULL && strcmp(gPathKey, path) == 0)
+    {
+      MetricsAdd(M_PATHHITS);
+      return;
+    }
+  MetricsAdd(M_PATHLOADS);
+
+  for (i = 0; i < gNPathDirs; i++)
+    {
+      if (gPathDirs[i].fd >= 0)
+        close(gPathDirs[i].fd);
+      free(gPathDirs[i].path);
+    }
+  free(gPathKey);
+  gPathKey = strdup(path);
+  gPathDirs = realloc(gPathDirs, sizeof(dirT) * (strlen(path) / 2 + 1));
+  gNPathDirs = 0;
+  for (; *path != 0; path = *end != 0 ? end + 1 : end)
+    {
+      dirT* d = &gPathDirs[gNPathDirs];
+      end = strchr(path, ':');
+      if (end == NULL)
+        end = path + strlen(path);
+      if (end == path)
+        continue; // empty entries were never searched
+      d->len = end - path;
+      d->path = strndup(path, d->len);
+      d->fd = d->path[0] == '/'
+        ? open(d->path, O_PATH | O_DIRECTORY | O_CLOEXEC) : -1;
+      gNPathDirs++;
+    }
+} /* PathLoad */
+
+
+/*
+ * HomeLoad
+ *
+ * arguments: none
+ *
+ * returns: bool: FALSE if there is no home directory to search
+ *
+ * Keeps gHome open on $HOME, reopening it if HOME has changed.
+ */
+static bool
+HomeLoad()
+{
+  char* home = getenv("HOME");
+
+  if (home == NULL || home[0] != '/')
+    return FALSE;
+  if (gHome.path == NULL || strcmp(gHome.path, home) != 0)
+    {
+      if (gHome.fd >= 0)
+        close(gHome.fd);
+      free(gHome.path);
+      gHome.path = strdup(home);
+      gHome.len = strlen(home);
+      gHome.fd = open(home, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    }
+  return gHome.fd >= 0;
+} /* HomeLoad */
+
+
+/*
+ * RuntimeCleanup
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Releases the jobs and closes and frees the cached directories.
+ */
+void
+RuntimeCleanup()
+{
+  int i;
+
+  // Stopped jobs would never run again; running ones are left alone.
+  for (i = gLastJob; i > 0; i--)
+    if (gJobs[i] != NULL)
+      {
+        if (gJobs[i]->state == J_STOPPED)
+          {
+            kill(-gJobs[i]->pgid, SIGHUP);
+            kill(-gJobs[i]->pgid, SIGCONT);
+          }
+        JobFree(gJobs[i]);
+      }
+  RingCleanup();
+  free(gJobs);
+  gJobs = NULL;
+  gMaxJobs = 0;
+  if (gEpoll >= 0)
+    close(gEpoll);
+  gEpoll = -1;
+  if (gChldFd >= 0)
+    close(gChldFd);
+  gChldFd = -1;
+  free(gFg.procs);
+  gFg.procs = NULL;
+  gFg.maxProcs = 0;
+
+  // Workers still busy with the stages of a stopped job are left to
+  // end with the shell.
+  pthread_mutex_lock(&gStageLock);
+  gStageQuit = TRUE;
+  pthread_cond_broadcast(&gStageCond);
+  i = gIdle == gNWorkers ? gNWorkers : 0;
+  pthread_mutex_unlock(&gStageLock);
+  while (i > 0)
+    pthread_join(gWorkers[--i], NULL);
+  free(gWorkers);
+  gWorkers = NULL;
+  gNWorkers = gIdle = 0;
+
+  for (i = 0; i < gNPathDirs; i++)
+    {
+      if (gPathDirs[i].fd >= 0)
+        close(gPathDirs[i].fd);
+      free(gPathDirs[i].path);
+    }
+  free(gPathDirs);
+  free(gPathKey);
+  gPathDirs = NULL;
+  gPathKey = NULL;
+  gNPathDirs = 0;
+  if (gHome.fd >= 0)
+    close(gHome.fd);
+  free(gHome.path);
+  gHome.path = NULL;
+  gHome.fd = -1;
+  if (gCwdFd >= 0)
+    close(gCwdFd);
+  free(gCwd);
+  gCwd = NULL;
+  gCwdFd = -1;
+} /* RuntimeCleanup */
+
+
+/*
+ * FindIn
+ *
+ * arguments:
+ *   dirT *d: a directory
+ *   char *name: a command name
+ *
+ * returns: char*: the full path of name in d if it is executable,
+ *                 else NULL
+ */
+static char*
+FindIn(dirT* d, char* name)
+{
+  char* full = malloc(d->len + strlen(name) + 2);
+
+  sprintf(full, "%s/%s", d->path, name);
+  if (d->fd >= 0 ? faccessat(d->fd, name, X_OK, 0) == 0
+      : access(full, X_OK) == 0)
+    return full;
+  free(full);
+  return NULL;
+} /* FindIn */
+
+
+/*
+ * ExecPath
+ *
+ * arguments:
+ *   char *path: a path returned by getFullPath
+ *   char **argv: the arguments
+ *
+ * returns: none; only if the exec failed
+ *
+ * Execs path relative to the open descriptor of the directory it was
+ * found in, so the kernel resolves one component instead of the whole
+ * path. The descriptors are close-on-exec, which the kernel refuses
+ * for "#!" scripts (it would have to hand the interpreter a
+ * /dev/fd path that no longer exists); those fail with ENOENT and are
+ * exec'd by their full path instead.
+ */
+static void
+ExecPath(char* path, char** argv)
+{
+  extern char** environ;
+  char* slash = strrchr(path, '/');
+  char* rest = NULL;
+  size_t len;
+  int fd = -1;
+  int i;
+
+  if (slash == NULL)
+    {
+      execv(path, argv);
+      return;
+    }
+  len = slash - path;
+  for (i = 0; i < gNPathDirs && fd < 0; i++)
+    if (gPathDirs[i].fd >= 0 && gPathDirs[i].len == len
+        && memcmp(gPathDirs[i].path, path, len) == 0)
+      {
+        fd = gPathDirs[i].fd;
+        rest = slash + 1;
+      }
+  if (fd < 0 && gCwdFd >= 0 && gCwd != NULL)
+    {
+      len = strlen(gCwd);
+      if (strncmp(path, gCwd, len) == 0 && path[len] == '/')
+        {
+          fd = gCwdFd;
+          rest = path + len + 1;
+        }
+    }
+  if (fd < 0 && gHome.fd >= 0 && strncmp(path, gHome.path, gHome.len) == 0
+      && path[gHome.len] == '/')
+    {
+      fd = gHome.fd;
+      rest = path + gHome.len + 1;
+    }
+
+  if (fd >= 0 && syscall(SYS_execveat, fd, rest, argv, environ, 0) < 0
+      && errno != ENOENT)
+    return;
+  execv(path, argv);
+} /* ExecPath */
 
-/* 
- * doesFileExist
+
+/*
+ * ExecCmd
  *
  * arguments:
- *   char * name: the name of the command given
+ *   commandT *cmd: the command; cmd->name is the resolved path
  *
- *   returns: bool, true if the file exists
+ * returns: none; it exits
  *
- *   This is a function that opens and closes a file to check if it 
- *   exists.
+ * Becomes the command in a child of the shell. A script whose #! line
+ * names this tsh is not exec'd: the child already has everything a
+ * new tsh would set up, and the functions and variables of the startup
+ * file, so it runs the script itself, as the new tsh would with the
+ * script's path as $0. Handled signals are reset as exec would reset
+ * them, and the script's commands stay in its process group, so ^C
+ * and ^Z reach them.
  */
+static void
+ExecCmd(commandT* cmd)
+{
+  MetricsAdd(M_EXTERNALS);
+  if (IsTshScript(cmd->name))
+    {
+      SubshellInit();
+      signal(SIGINT, SIG_DFL);
+      signal(SIGTSTP, SIG_DFL);
+      __fpurge(stdin); // the shell's read-ahead is not the script's
+      gOwnGroup = TRUE;
+      cmd->argv[0] = cmd->name;
+      ScriptRun(cmd->name, cmd);
+      fflush(stdout);
+      _exit(lastStatus);
+    }
+  argZeroConverter(cmd);
+  PROBE2(exec, cmd->name, cmd->argv);
+  ExecPath(cmd->name, cmd->argv);
+  PrintPError("Execv failed");
+  _exit(127);
+} /* ExecCmd */
 
-int doesFileExist(const char * name) {
-  FILE * file;
-  if ((file = fopen(name, "r"))) {
-    fclose(file);
-    return TRUE; // file exists
-  }
-  return FALSE; // file doesn't exist
-} /* doesFileExist */
 
+/*
+ * IsTshScript
+ *
+ * arguments:
+ *   char *path: a resolved command
+ *
+ * returns: bool: TRUE if path starts with a #! line naming this tsh,
+ *                with no argument after it
+ *
+ * The interpreter is compared by device and inode, so a link to tsh
+ * counts. An interpreter argument would be an option this tsh does
+ * not have; such scripts are left to exec.
+ */
+static bool
+IsTshScript(char* path)
+{
+  char buf[SHEBANGMAX + 1];
+  struct stat st;
+  char* interp;
+  char* end;
+  ssize_t n;
+  int fd;
+  char c;
+
+  if (gSelfIno == 0 || (fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+    return FALSE;
+  n = read(fd, buf, SHEBANGMAX);
+  close(fd);
+  if (n < 3 || buf[0] != '#' || buf[1] != '!')
+    return FALSE;
+  buf[n] = 0;
+  for (interp = buf + 2; *interp == ' ' || *interp == '\t'; interp++)
+    ;
+  end = interp + strcspn(interp, " \t\n");
+  c = end[strspn(end, " \t")];
+  if (c != '\n' && c != 0)
+    return FALSE;
+  *end = 0;
+  return stat(interp, &st) == 0 && st.st_dev == gSelfDev
+    && st.st_ino == gSelfIno;
+} /* IsTshScript */
@@ -63,6 +63,25 @@ typedef struct command_t
   char* argv[];
 } commandT;
 
+/* a word of its own in argv that separates the stages of a pipeline */
+#define PIPEMARK "\004"
+
+/* starts a word of its own in argv holding a redirection operator;
+ * the word after it is the file */
+#define REDIRMARK "\006"
+
+/* the files a command's redirections opened */
+typedef struct redir_t
+{
+  int fd[3];    /* to put in place of 0, 1 and 2, or -1 */
+  int saved[3]; /* what fd[i] replaced, while it is swapped in */
+  struct codec_t* codec[3]; /* the thread at the other end of fd[i], or
+                             * NULL (see codec.h) */
+} redirT;
+
+/* the limit timeout puts on a job (see timeout.h) */
+struct timeout_t;
+
 /************Global Variables*********************************************/
 
 /***********************************************************************
@@ -71,7 +90,8 @@ typedef struct command_t
  *    Purpose: Signals that a program exit is required
  ***********************************************************************/
 VAREXTERN(bool forceExit, FALSE);
-VAREXTERN(int fgpid, 0); // foreground process id
+VAREXTERN(int fgpid, 0); // foreground process group
+VAREXTERN(int lastStatus, 0); // exit status of the last command ($?)
 
 /************Function Prototypes******************************************/
 
@@ -85,10 +105,140 @@ VAREXTERN(int fgpid, 0); // foreground process id
 EXTERN void
 RunCmd(commandT*);
 
+/***********************************************************************
+ *  Title: Runs a command, optionally without forking
+ * ---------------------------------------------------------------------
+ *    Purpose: Runs a command. Without fork, an external command
+ *    replaces the calling process, which must be a child of the shell.
+ *    Input: a command structure and whether to fork
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RunCmdFork(commandT*, bool);
+
+/***********************************************************************
+ *  Title: Check for a self-contained built-in
+ * ---------------------------------------------------------------------
+ *    Purpose: Tells whether a command is a built-in that only writes
+ *    output: it starts no processes and changes nothing in the shell,
+ *    so it can run in the shell wherever a subshell is expected.
+ *    Input: the command name
+ *    Output: TRUE for such a built-in
+ ***********************************************************************/
+EXTERN bool
+IsPureBuiltIn(char*);
+
+/***********************************************************************
+ *  Title: Check for a native built-in
+ * ---------------------------------------------------------------------
+ *    Purpose: Tells whether a command is one of the shell's own
+ *    built-ins, which a builtin loaded by enable may not replace.
+ *    Input: the command name
+ *    Output: TRUE for such a built-in
+ ***********************************************************************/
+EXTERN bool
+IsShellBuiltIn(char*);
+
+/***********************************************************************
+ *  Title: Look a command up in PATH
+ * ---------------------------------------------------------------------
+ *    Purpose: Finds the program a command names, even if it names a
+ *    builtin, and replaces the command's name with its path.
+ *    Input: the command
+ *    Output: FALSE if no program was found
+ ***********************************************************************/
+EXTERN bool
+ResolveExternalCmd(commandT*);
+
+/***********************************************************************
+ *  Title: Run a program in the foreground
+ * ---------------------------------------------------------------------
+ *    Purpose: Forks a command ResolveExternalCmd found as the
+ *    foreground job and waits for it, as timeout and bench do, and
+ *    sets $?. A job that stops is numbered. A job with a limit runs
+ *    its timer, and in a forked stage stays in the stage's process
+ *    group; $? is 124 if the timer expired, unless SIGKILL ended it.
+ *    Input: the command; the command line it is part of, for the job
+ *    table; and the limit to put on it (see timeout.h), or NULL
+ *    Output: FALSE if it could not be forked or it stopped
+ ***********************************************************************/
+EXTERN bool
+RunProgram(commandT*, commandT*, struct timeout_t*);
+
+/***********************************************************************
+ *  Title: Convert a wait status
+ * ---------------------------------------------------------------------
+ *    Purpose: Turns a status from waitpid into the value of $?.
+ *    Input: the wait status
+ *    Output: the exit code, or 128 plus the number of the signal
+ ***********************************************************************/
+EXTERN int
+WaitStatus(int);
+
+/***********************************************************************
+ *  Title: Check for a pipeline
+ * ---------------------------------------------------------------------
+ *    Purpose: Tells whether a command's argv holds several stages
+ *    separated by PIPEMARK.
+ *    Input: a command structure
+ *    Output: TRUE for a pipeline
+ ***********************************************************************/
+EXTERN bool
+IsPipeline(commandT*);
+
+/***********************************************************************
+ *  Title: Open a command's redirections
+ * ---------------------------------------------------------------------
+ *    Purpose: Opens the file of each redirection in argv (see
+ *    REDIRMARK), close-on-exec, and takes the redirections out of
+ *    argv. A later redirection of the same descriptor wins. A
+ *    compressed one gets a pipe to a codec thread. On an error,
+ *    reports it and leaves nothing open.
+ *    Input: a command structure and the redirT to fill in
+ *    Output: FALSE if a file could not be opened
+ ***********************************************************************/
+EXTERN bool
+RedirOpen(commandT*, redirT*);
+
+/***********************************************************************
+ *  Title: Redirect the shell
+ * ---------------------------------------------------------------------
+ *    Purpose: Puts the opened files in place of the shell's own
+ *    standard descriptors, for a builtin or function, saving those
+ *    for RedirRestore.
+ *    Input: a redirT filled in by RedirOpen
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RedirSwap(redirT*);
+
+/***********************************************************************
+ *  Title: Undo a redirection
+ * ---------------------------------------------------------------------
+ *    Purpose: Puts back what RedirSwap replaced, if anything, closes
+ *    the opened files, and waits for the codecs to finish theirs; $?
+ *    becomes 1 if one failed and it was 0.
+ *    Input: a redirT filled in by RedirOpen
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RedirRestore(redirT*);
+
+/***********************************************************************
+ *  Title: Check for redirections
+ * ---------------------------------------------------------------------
+ *    Purpose: Tells whether a command's argv holds a redirection.
+ *    Input: a command structure
+ *    Output: TRUE if it does
+ ***********************************************************************/
+EXTERN bool
+HasRedir(commandT*);
+
 /***********************************************************************
  *  Title: Runs a command in background
  * ---------------------------------------------------------------------
- *    Purpose: Runs a command in background.
+ *    Purpose: Runs a command or pipeline in background, as a new
+ *    numbered job.
  *    Input: a command structure
  *    Output: void
  ***********************************************************************/
@@ -154,16 +304,6 @@ CreateCmdT(int);
 EXTERN void
 ReleaseCmdT(commandT**);
 
-/***********************************************************************
- *  Title: Get the current working directory
- * ---------------------------------------------------------------------
- *    Purpose: Gets the current working directory.
- *    Input: void
- *    Output: a string containing the current working directory
- ***********************************************************************/
-EXTERN char*
-getCurrentWorkingDir();
-
 /***********************************************************************
  *  Title: Get user name
  * ---------------------------------------------------------------------
@@ -184,6 +324,54 @@ getLogin();
 EXTERN void
 CheckJobs();
 
+/***********************************************************************
+ *  Title: Interrupt builtin stages
+ * ---------------------------------------------------------------------
+ *    Purpose: Called from the handler of SIGINT and SIGTSTP. While the
+ *    shell waits on the builtin stages of a pipeline, which run on
+ *    threads of its own, SIGINT stops them.
+ *    Input: the signal
+ *    Output: TRUE if the shell was waiting on builtin stages
+ ***********************************************************************/
+EXTERN bool
+StagesInterrupt(int);
+
+/***********************************************************************
+ *  Title: Set up job control
+ * ---------------------------------------------------------------------
+ *    Purpose: If the shell runs in the foreground of a terminal, puts
+ *    it in its own process group and takes the terminal, so that
+ *    foreground jobs can be handed the terminal in turn.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+JobInit();
+
+/***********************************************************************
+ *  Title: Start a subshell
+ * ---------------------------------------------------------------------
+ *    Purpose: Called in a forked child that keeps running shell code.
+ *    Forgets the parent's jobs and terminal, which belong to the
+ *    parent.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+SubshellInit();
+
+/***********************************************************************
+ *  Title: Release the runtime state
+ * ---------------------------------------------------------------------
+ *    Purpose: Closes the cached working, home and PATH directories
+ *    and releases the jobs, hanging up the stopped ones. Called once
+ *    when the shell exits.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RuntimeCleanup();
+
 /************External Declaration*****************************************/
 
 /**************Definition***************************************************/
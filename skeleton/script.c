@@ -0,0 +1,2194 @@
+/***************************************************************************
+ *  Title: Script
+ * -------------------------------------------------------------------------
+ *    Purpose: Compiles and runs control-flow constructs
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: script.c,v $
+ ***************************************************************************/
+#define _GNU_SOURCE
+#define __SCRIPT_IMPL__
+
+/************System include***********************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "script.h"
+#include "interpreter.h"
+#include "runtime.h"
+#include "io.h"
+#include "memprof.h"
+#include "metrics.h"
+#include "probe.h"
+#include "record.h"
+#include "text.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* a '$' inside double quotes: expanded, but never split or dropped */
+#define QEXPANDMARK '\002'
+
+/* inside $(...), the characters of kSubPlain are stored as SUBFIRST
+ * and the bytes after it, so getCommand leaves the command alone */
+#define SUBFIRST '\003'
+
+/* an unquoted '&' ending a statement becomes a word of its own made
+ * of BGMARK; an unquoted '|' becomes PIPEMARK (see runtime.h) */
+#define BGMARK "\005"
+
+/* room NextStatement needs for a statement from len bytes of text:
+ * every '|' may grow to three bytes and every '<' or '>' to four */
+#define STMTSIZE(len) ((len) * 4 + 1)
+
+/* node types */
+#define N_CMD      1
+#define N_ASSIGN   2
+#define N_IF       3
+#define N_WHILE    4
+#define N_UNTIL    5
+#define N_FOR      6
+#define N_FUNC     7
+#define N_BREAK    8
+#define N_CONTINUE 9
+#define N_RETURN   10
+#define N_BG       11 /* a command or pipeline ended by '&' */
+
+/* phases of a construct that is still open */
+#define P_COND 1
+#define P_THEN 2
+#define P_ELSE 3
+#define P_HEAD 4
+#define P_BODY 5
+
+/* identifies a compiled rc file; bump SNAPVERSION whenever nodeT,
+ * wordT or the meaning of their fields change */
+#define SNAPMAGIC   "TSHSNAP"
+#define SNAPVERSION 5
+
+/* pending control transfer */
+#define C_NONE     0
+#define C_BREAK    1
+#define C_CONTINUE 2
+#define C_RETURN   3
+
+/*
+ * A compiled statement. Lists are chained through next; all links are
+ * indices into the program's node table, so a program has no internal
+ * pointers.
+ */
+typedef struct node_t
+{
+  int type;
+  int next;   /* next statement in the same list, or -1 */
+  int a;      /* condition list (if, while, until) */
+  int b;      /* then list, loop body or function body */
+  int c;      /* else list */
+  int word;   /* first word in the word table */
+  int nwords; /* number of words */
+} nodeT;
+
+/* a word of a compiled statement */
+typedef struct word_t
+{
+  int off;    /* offset of the text in the string pool */
+  int dyn;    /* whether the text contains expansions */
+} wordT;
+
+/* per-node state reused every time the node runs */
+typedef struct scratch_t
+{
+  commandT* cmd; /* argv handed to RunCmd */
+  int* offs;     /* buffer offset of each expanded argument, or -1 */
+  int slots;     /* argv slots allocated in cmd and offs */
+  char* buf;     /* text of expanded words */
+  int bufMax;
+  bool busy;     /* the node is running further up the stack */
+} scratchT;
+
+typedef struct prog_t
+{
+  nodeT* nodes;
+  int nnodes, maxNodes;
+  wordT* words;
+  int nwords, maxWords;
+  char* pool;
+  int poolLen, poolMax;
+  scratchT* scratch; /* one per node, grown with nodes */
+  int nscratch;
+  int head, tail;    /* top-level statements */
+  bool hasFunc;      /* defines a function, so must outlive the line */
+  void* map;         /* snapshot the tables live in, or NULL */
+  size_t mapLen;
+  struct prog_t* next;
+} progT;
+
+/*
+ * Header of an rc snapshot. It is followed by the node table, the word
+ * table and the string pool of the compiled rc file, which are used in
+ * place from the mapping.
+ */
+typedef struct snap_t
+{
+  char magic[8];
+  int version;
+  int nodeSize;        /* sizeof(nodeT) and sizeof(wordT) of the writer */
+  int wordSize;
+  int nnodes, nwords, poolLen;
+  int head;
+  int hasFunc;
+  long long mtimeSec;  /* the rc file the snapshot was made from */
+  long long mtimeNsec;
+  long long size;
+  long long ino;
+  unsigned long long hash;
+} snapT;
+
+/* a construct that is still open while compiling */
+typedef struct open_t
+{
+  int node;
+  int phase;
+  int last;   /* last statement of the list being filled, or -1 */
+  bool elif;  /* closed by the fi of the enclosing if */
+} openT;
+
+/* where captured output goes */
+typedef struct capture_t
+{
+  scratchT* s;
+  int at;
+} captureT;
+
+typedef struct func_t
+{
+  char* name;
+  progT* prog;
+  int node;
+} funcT;
+
+typedef struct var_t
+{
+  char* name;
+  char* value;
+  int max;
+} varT;
+
+/************Global Variables*********************************************/
+
+/* see SUBFIRST */
+static const char kSubPlain[] = " \"'\\)";
+
+/* program the current lines are compiled into */
+static progT* gProg = NULL;
+/* constructs still open */
+static openT* gOpen = NULL;
+static int gDepth = 0, gMaxDepth = 0;
+/* statement being compiled */
+static char* gStmt = NULL;
+static int gStmtMax = 0;
+/* programs kept alive because they define functions */
+static progT* gRetained = NULL;
+
+static funcT* gFuncs = NULL;
+static int gNFuncs = 0;
+static varT* gVars = NULL;
+static int gNVars = 0;
+
+/* positional parameters of the running function, or NULL */
+static commandT* gArgs = NULL;
+/* pending break/continue/return and its count */
+static int gCtl = C_NONE;
+static int gCtlCount = 0;
+/* loops enclosing the running statement in the current function */
+static int gLoops = 0;
+
+/************Function Prototypes******************************************/
+
+static progT*
+NewProg();
+static void
+FreeProg(progT*);
+static int
+AddNode(progT*, int, int, char**);
+static void
+Append(int);
+static void
+Open(int, int, bool);
+static bool
+LoopControl();
+static bool
+NextStatement(char**, char*);
+static char*
+CopySubst(char*, char*, int*);
+static bool
+Compile(char**, int);
+static void
+SyntaxError(char*);
+static void
+RunList(progT*, int);
+static void
+RunNode(progT*, int);
+static int
+ExpandWords(progT*, int, int, scratchT*, bool);
+static void
+GrowScratch(scratchT*, int);
+static int
+Expand(char*, scratchT*, int);
+static int
+Substitute(char*, int, scratchT*, int);
+static int
+CaptureFork(progT*, commandT*, scratchT*, int);
+static ssize_t
+CaptureWrite(void*, const char*, size_t);
+static char*
+LookupVar(char*, int);
+static funcT*
+FindFunc(char*);
+static void
+DefineFunc(progT*, int);
+static bool
+IsName(char*, int);
+static progT*
+CompileText(char*, size_t);
+static progT*
+MapSnapshot(char*);
+static bool
+CheckSnapshot(progT*);
+static void
+WriteSnapshot(char*, progT*, struct stat*, unsigned long long);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+/*
+ * ScriptFeed
+ *
+ * arguments:
+ *   char *line: the command line
+ *
+ * returns: bool: TRUE if a construct is still open after the line
+ *
+ * Splits the line into statements at unquoted ';', compiles each one
+ * and runs the top-level statements as soon as they are complete.
+ * Compiled programs are reset and reused for the next line unless
+ * they define functions, so plain lines reuse the same node, argv
+ * and expansion storage every time.
+ */
+bool
+ScriptFeed(char* line)
+{
+  char* cursor = line;
+  int len = STMTSIZE(strlen(line));
+
+  MemPhase(MP_PARSE);
+  if (gProg == NULL)
+    gProg = NewProg();
+  if (len > gStmtMax)
+    {
+      gStmtMax = len;
+      gStmt = realloc(gStmt, len);
+    }
+
+  while (!forceExit && NextStatement(&cursor, gStmt))
+    {
+      commandT* cmd = getCommand(gStmt);
+      bool ok = Compile(cmd->argv, cmd->argc);
+      freeCommand(cmd);
+      if (!ok)
+        {
+          // Throw the whole unit away.
+          gDepth = 0;
+          gProg->head = gProg->tail = -1;
+          gProg->nnodes = gProg->nwords = gProg->poolLen = 0;
+          gProg->hasFunc = FALSE;
+          break;
+        }
+      if (gDepth > 0 || gProg->head == -1)
+        continue;
+
+      // A top-level statement is complete: run it. The program is
+      // detached while it runs so that nothing compiles into it.
+      progT* p = gProg;
+      gProg = NULL;
+      MemPhase(MP_RUN);
+      RunList(p, p->head);
+      MemPhase(MP_PARSE);
+      gCtl = C_NONE;
+      if (p->hasFunc)
+        {
+          p->next = gRetained;
+          gRetained = p;
+        }
+      else if (gProg == NULL)
+        {
+          p->head = p->tail = -1;
+          p->nnodes = p->nwords = p->poolLen = 0;
+          gProg = p;
+        }
+      else
+        FreeProg(p);
+      if (gProg == NULL)
+        gProg = NewProg();
+    }
+  return gDepth > 0;
+} /* ScriptFeed */
+
+
+/*
+ * ScriptRunRc
+ *
+ * arguments:
+ *   char *rc: path of the startup file
+ *
+ * returns: none
+ *
+ * Runs the startup file from its compiled snapshot, rc.snap, when
+ * there is a current one, so a normal startup maps one file and parses
+ * nothing. The snapshot is current if its recorded mtime, size and
+ * inode match the rc file; failing that, if the hash of the rc file's
+ * contents matches (the file was only touched or copied), in which
+ * case the snapshot is rewritten with the new key. Otherwise the rc
+ * file is compiled and a new snapshot written. A missing rc file is
+ * not an error, and neither is being unable to write the snapshot.
+ */
+void
+ScriptRunRc(char* rc)
+{
+  struct stat st;
+  snapT* hdr;
+  progT* p;
+  char* snap;
+  char* text;
+  unsigned long long hash;
+  ssize_t got;
+  size_t len;
+  int fd, hit = M_SNAPHITS;
+
+  if ((fd = open(rc, O_RDONLY)) < 0)
+    return;
+  if (fstat(fd, &st) != 0)
+    {
+      close(fd);
+      return;
+    }
+  snap = malloc(strlen(rc) + sizeof(".snap"));
+  sprintf(snap, "%s.snap", rc);
+
+  p = MapSnapshot(snap);
+  hdr = p != NULL ? (snapT*) p->map : NULL;
+  if (hdr == NULL || hdr->mtimeSec != st.st_mtim.tv_sec
+      || hdr->mtimeNsec != st.st_mtim.tv_nsec || hdr->size != st.st_size
+      || hdr->ino != st.st_ino)
+    {
+      // Stale key: look at the contents.
+      text = malloc(st.st_size + 1);
+      for (len = 0; len < st.st_size; len += got)
+        if ((got = read(fd, text + len, st.st_size - len)) <= 0)
+          break;
+      hash = HashText(text, len);
+      if (hdr == NULL || hdr->hash != hash)
+        {
+          if (p != NULL)
+            FreeProg(p);
+          p = CompileText(text, len);
+          hit = M_SNAPMISSES;
+        }
+      WriteSnapshot(snap, p, &st, hash);
+      free(text);
+    }
+  close(fd);
+  free(snap);
+  MetricsAdd(hit);
+
+  RunList(p, p->head);
+  gCtl = C_NONE;
+  if (p->hasFunc)
+    {
+      p->next = gRetained;
+      gRetained = p;
+    }
+  else
+    FreeProg(p);
+} /* ScriptRunRc */
+
+
+/*
+ * ScriptRun
+ *
+ * arguments:
+ *   char *path: the script
+ *   commandT *args: the command that named it; argv[0] is $0 and the
+ *                   rest are $1 on
+ *
+ * returns: none
+ *
+ * Compiles the whole script, then runs it with args as its arguments,
+ * as a function would be. The #! line is a comment to the compiler.
+ * return ends the script. $? is 127 if the script cannot be read.
+ */
+void
+ScriptRun(char* path, commandT* args)
+{
+  struct stat st;
+  commandT* saved = gArgs;
+  int loops = gLoops;
+  progT* p;
+  char* text;
+  ssize_t got;
+  size_t len;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) != 0)
+    {
+      PrintPError(path);
+      if (fd >= 0)
+        close(fd);
+      lastStatus = 127;
+      return;
+    }
+  text = malloc(st.st_size + 1);
+  for (len = 0; len < st.st_size; len += got)
+    if ((got = read(fd, text + len, st.st_size - len)) <= 0)
+      break;
+  close(fd);
+  p = CompileText(text, len);
+  free(text);
+
+  gArgs = args;
+  gLoops = 0;
+  lastStatus = 0;
+  RunList(p, p->head);
+  gCtl = C_NONE;
+  gArgs = saved;
+  gLoops = loops;
+  if (p->hasFunc)
+    {
+      p->next = gRetained;
+      gRetained = p;
+    }
+  else
+    FreeProg(p);
+} /* ScriptRun */
+
+
+/*
+ * CompileText
+ *
+ * arguments:
+ *   char *text: the contents of a script
+ *   size_t len: its length
+ *
+ * returns: progT*: a program whose top-level list is the whole script
+ *
+ * Compiles a script without running any of it. A statement with a
+ * syntax error is reported and dropped together with the construct it
+ * is in; the rest of the script is still compiled.
+ */
+static progT*
+CompileText(char* text, size_t len)
+{
+  progT* saved = gProg;
+  progT* p = NewProg();
+  char* line = malloc(len + 1);
+  char* stmt = malloc(STMTSIZE(len));
+  char* cursor;
+  size_t i = 0, j;
+  int done = -1; // last complete top-level statement
+
+  gProg = p;
+  while (i < len)
+    {
+      for (j = i; j < len && text[j] != '\n'; j++)
+        ;
+      memcpy(line, text + i, j - i);
+      line[j - i] = 0;
+      i = j + 1;
+
+      cursor = line;
+      while (NextStatement(&cursor, stmt))
+        {
+          commandT* cmd = getCommand(stmt);
+          bool ok = Compile(cmd->argv, cmd->argc);
+          freeCommand(cmd);
+          if (!ok)
+            gDepth = 0;
+          if (gDepth == 0)
+            {
+              // Cut off anything an error left half-compiled.
+              if (!ok && done == -1)
+                p->head = -1;
+              else if (!ok)
+                p->nodes[done].next = -1;
+              if (!ok)
+                p->tail = done;
+              done = p->tail;
+            }
+          if (!ok)
+            break;
+        }
+    }
+  if (gDepth > 0)
+    {
+      fprintf(stderr, "%s: syntax error: unexpected end of file\n",
+              SHELLNAME);
+      lastStatus = 2;
+      gDepth = 0;
+      if (done == -1)
+        p->head = -1;
+      else
+        p->nodes[done].next = -1;
+      p->tail = done;
+    }
+  gProg = saved;
+  free(line);
+  free(stmt);
+  return p;
+} /* CompileText */
+
+
+/*
+ * MapSnapshot
+ *
+ * arguments:
+ *   char *snap: path of the snapshot
+ *
+ * returns: progT*: the program, with its tables in the mapping, or
+ *                  NULL if there is no usable snapshot
+ *
+ * Maps a snapshot read-only and checks that it was written by this
+ * version of tsh, is complete and is consistent. The snapT header
+ * stays at the start of p->map for the caller to check the key.
+ */
+static progT*
+MapSnapshot(char* snap)
+{
+  struct stat st;
+  snapT* hdr;
+  progT* p;
+  void* map;
+  int fd;
+
+  if ((fd = open(snap, O_RDONLY)) < 0)
+    return NULL;
+  if (fstat(fd, &st) != 0 || st.st_size < sizeof(snapT))
+    {
+      close(fd);
+      return NULL;
+    }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  hdr = map;
+  if (memcmp(hdr->magic, SNAPMAGIC, sizeof(SNAPMAGIC)) != 0
+      || hdr->version != SNAPVERSION || hdr->nodeSize != sizeof(nodeT)
+      || hdr->wordSize != sizeof(wordT) || hdr->nnodes < 0
+      || hdr->nwords < 0 || hdr->poolLen < 0
+      || hdr->head < -1 || hdr->head >= hdr->nnodes
+      || st.st_size != sizeof(snapT) + hdr->nnodes * sizeof(nodeT)
+         + hdr->nwords * sizeof(wordT) + hdr->poolLen)
+    {
+      munmap(map, st.st_size);
+      return NULL;
+    }
+
+  p = NewProg();
+  p->map = map;
+  p->mapLen = st.st_size;
+  p->nodes = (nodeT*) (hdr + 1);
+  p->nnodes = p->maxNodes = hdr->nnodes;
+  p->words = (wordT*) (p->nodes + hdr->nnodes);
+  p->nwords = p->maxWords = hdr->nwords;
+  p->pool = (char*) (p->words + hdr->nwords);
+  p->poolLen = p->poolMax = hdr->poolLen;
+  p->head = hdr->head;
+  p->hasFunc = hdr->hasFunc;
+  if (!CheckSnapshot(p))
+    {
+      FreeProg(p);
+      return NULL;
+    }
+  return p;
+} /* MapSnapshot */
+
+
+/*
+ * CheckSnapshot
+ *
+ * arguments:
+ *   progT *p: a program mapped from a snapshot
+ *
+ * returns: bool: TRUE if every index in the tables is in bounds
+ *
+ * Checks a mapped program before anything runs from it, so that a
+ * corrupted snapshot is compiled again rather than read out of bounds.
+ * Compile only ever links a node to nodes made after it, so a link
+ * must point forward, which also rules out cycles. Every word must
+ * start in the pool, and the pool end with the terminator of its last
+ * word.
+ */
+static bool
+CheckSnapshot(progT* p)
+{
+  int i;
+
+  if (p->poolLen > 0 && p->pool[p->poolLen - 1] != 0)
+    return FALSE;
+  for (i = 0; i < p->nwords; i++)
+    if (p->words[i].off < 0 || p->words[i].off >= p->poolLen)
+      return FALSE;
+  for (i = 0; i < p->nnodes; i++)
+    {
+      nodeT* node = &p->nodes[i];
+      if (node->type < N_CMD || node->type > N_BG
+          || (node->next != -1
+              && (node->next <= i || node->next >= p->nnodes))
+          || (node->a != -1 && (node->a <= i || node->a >= p->nnodes))
+          || (node->b != -1 && (node->b <= i || node->b >= p->nnodes))
+          || (node->c != -1 && (node->c <= i || node->c >= p->nnodes))
+          || node->word < 0 || node->nwords < 0
+          || node->nwords > p->nwords - node->word
+          || (node->type == N_ASSIGN && node->nwords != 2)
+          || (node->type == N_FUNC && node->nwords < 1))
+        return FALSE;
+    }
+  return TRUE;
+} /* CheckSnapshot */
+
+
+/*
+ * WriteSnapshot
+ *
+ * arguments:
+ *   char *snap: path of the snapshot
+ *   progT *p: the compiled rc file
+ *   struct stat *st: the rc file's status, recorded as the key
+ *   unsigned long long hash: the hash of the rc file's contents
+ *
+ * returns: none
+ *
+ * Writes the snapshot to a temporary file and renames it into place,
+ * so a concurrently starting shell sees either the old or the new one.
+ */
+static void
+WriteSnapshot(char* snap, progT* p, struct stat* st, unsigned long long hash)
+{
+  snapT hdr;
+  char* tmp = malloc(strlen(snap) + sizeof(".XXXXXX"));
+  int fd;
+  bool ok;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, SNAPMAGIC, sizeof(SNAPMAGIC));
+  hdr.version = SNAPVERSION;
+  hdr.nodeSize = sizeof(nodeT);
+  hdr.wordSize = sizeof(wordT);
+  hdr.nnodes = p->nnodes;
+  hdr.nwords = p->nwords;
+  hdr.poolLen = p->poolLen;
+  hdr.head = p->head;
+  hdr.hasFunc = p->hasFunc;
+  hdr.mtimeSec = st->st_mtim.tv_sec;
+  hdr.mtimeNsec = st->st_mtim.tv_nsec;
+  hdr.size = st->st_size;
+  hdr.ino = st->st_ino;
+  hdr.hash = hash;
+
+  sprintf(tmp, "%s.XXXXXX", snap);
+  if ((fd = mkstemp(tmp)) < 0)
+    {
+      free(tmp);
+      return;
+    }
+  ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr)
+    && write(fd, p->nodes, sizeof(nodeT) * p->nnodes)
+       == sizeof(nodeT) * p->nnodes
+    && write(fd, p->words, sizeof(wordT) * p->nwords)
+       == sizeof(wordT) * p->nwords
+    && write(fd, p->pool, p->poolLen) == p->poolLen;
+  if (close(fd) != 0 || !ok || rename(tmp, snap) != 0)
+    unlink(tmp);
+  free(tmp);
+} /* WriteSnapshot */
+
+
+/*
+ * HashText
+ *
+ * arguments:
+ *   char *text: the bytes to hash
+ *   size_t len: their number
+ *
+ * returns: unsigned long long: the 64-bit FNV-1a hash of the bytes
+ */
+unsigned long long
+HashText(char* text, size_t len)
+{
+  unsigned long long h = 14695981039346656037ULL;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      h ^= (unsigned char) text[i];
+      h *= 1099511628211ULL;
+    }
+  return h;
+} /* HashText */
+
+
+/*
+ * NextStatement
+ *
+ * arguments:
+ *   char **cursor: position in the line; advanced past the statement
+ *   char *out: receives the statement text; STMTSIZE of the line long
+ *
+ * returns: bool: FALSE when the line has no statements left
+ *
+ * Copies the next statement, up to an unquoted ';' or '&' or the end
+ * of the line, dropping a trailing '#' comment and turning unquoted tabs into
+ * spaces. Every '$' that starts an expansion is replaced by EXPANDMARK
+ * (or QEXPANDMARK inside double quotes) so that quoting is still
+ * known after getCommand strips the quotes; '$' in single quotes and
+ * "\$" stay literal. A command substitution is copied whole by
+ * CopySubst. An unquoted '|' and an ending '&' are turned into words
+ * of PIPEMARK and BGMARK, and a redirection operator ('<', '>', '>>',
+ * '2>', '2>>', '&>', '&>>', any of them followed by 'z' and a blank)
+ * into a word of REDIRMARK followed by the operator, so that quoting
+ * still keeps them literal.
+ */
+static bool
+NextStatement(char** cursor, char* out)
+{
+  char* s = *cursor;
+  char quote = 0;
+  bool wordStart = TRUE;
+  int o = 0;
+
+  if (*s == 0)
+    return FALSE;
+  for (; *s != 0; s++)
+    {
+      char c = *s;
+      if (quote == '\'')
+        {
+          if (c == '\'')
+            quote = 0;
+          out[o++] = c;
+          continue;
+        }
+      if (c == '\\' && s[1] != 0)
+        {
+          if (s[1] != '$')
+            out[o++] = c;
+          out[o++] = *++s;
+          wordStart = FALSE;
+          continue;
+        }
+      if (c == '"')
+        quote = quote == 0 ? '"' : 0;
+      else if (c == '\'' && quote == 0)
+        quote = '\'';
+      else if (quote == 0 && c == ';')
+        {
+          s++;
+          break;
+        }
+      else if (quote == 0 && c == '&' && s[1] != '>')
+        {
+          out[o++] = ' ';
+          out[o++] = BGMARK[0];
+          s++;
+          break;
+        }
+      else if (quote == 0 && c == '|')
+        {
+          out[o++] = ' ';
+          out[o++] = PIPEMARK[0];
+          out[o++] = ' ';
+          wordStart = TRUE;
+          continue;
+        }
+      else if (quote == 0 && (c == '<' || c == '>'
+                              || (c == '&' && s[1] == '>')
+                              || (c == '2' && wordStart && s[1] == '>')))
+        {
+          out[o++] = ' ';
+          out[o++] = REDIRMARK[0];
+          if (c == '&' || c == '2')
+            out[o++] = *s++;
+          out[o++] = *s;
+          if (*s == '>' && s[1] == '>')
+            out[o++] = *++s;
+          if (s[1] == 'z' && (s[2] == ' ' || s[2] == '\t'))
+            out[o++] = *++s; // compressed; ">z" with a file after is not
+          else if (s[1] == '&')
+            out[o++] = *++s; // "2>&1" and the like, which Compile rejects
+          out[o++] = ' ';
+          wordStart = TRUE;
+          continue;
+        }
+      else if (quote == 0 && c == '#' && wordStart)
+        {
+          s += strlen(s);
+          break;
+        }
+      else if (quote == 0 && c == '\t')
+        c = ' ';
+      else if (c == '$' && s[1] == '(')
+        {
+          out[o++] = quote == 0 ? EXPANDMARK : QEXPANDMARK;
+          out[o++] = '(';
+          s = CopySubst(s + 2, out, &o);
+          wordStart = FALSE;
+          continue;
+        }
+      else if (c == '$' && s[1] != 0 && strchr(" \t\"'", s[1]) == NULL)
+        c = quote == 0 ? EXPANDMARK : QEXPANDMARK;
+      out[o++] = c;
+      wordStart = quote == 0 && c == ' ';
+    }
+  out[o] = 0;
+  *cursor = s;
+  return TRUE;
+} /* NextStatement */
+
+
+/*
+ * CopySubst
+ *
+ * arguments:
+ *   char *s: the text after "$("
+ *   char *out: the statement being built
+ *   int *o: position in out; advanced past the copy
+ *
+ * returns: char*: the last character consumed, normally the ')'
+ *
+ * Copies the command of a substitution up to the matching ')',
+ * following nested parentheses and quotes. Blanks, quotes,
+ * backslashes and inner ')' are encoded (see SUBFIRST), so the whole
+ * substitution stays in one word and the only plain ')' in it is the
+ * closing one. Nothing inside is expanded yet: the command is parsed
+ * again when it runs, which is what makes nesting work.
+ */
+static char*
+CopySubst(char* s, char* out, int* o)
+{
+  char quote = 0;
+  char* plain;
+  int depth = 1;
+
+  for (; *s != 0; s++)
+    {
+      char c = *s;
+      if (quote == '\'')
+        {
+          if (c == '\'')
+            quote = 0;
+        }
+      else if (c == '\\' && s[1] != 0)
+        {
+          out[(*o)++] = SUBFIRST + 3;
+          c = *++s;
+        }
+      else if (c == '"' || c == '\'')
+        quote = quote == c ? 0 : quote == 0 ? c : quote;
+      else if (quote == 0 && c == '(')
+        depth++;
+      else if (quote == 0 && c == ')' && --depth == 0)
+        {
+          out[(*o)++] = ')';
+          return s;
+        }
+      plain = strchr(kSubPlain, c);
+      out[(*o)++] = plain != NULL ? SUBFIRST + (plain - kSubPlain) : c;
+    }
+  return s - 1; // unterminated: the rest of the line is the command
+} /* CopySubst */
+
+
+/*
+ * Compile
+ *
+ * arguments:
+ *   char **w: the words of one statement
+ *   int n: the number of words
+ *
+ * returns: bool: FALSE on a syntax error
+ *
+ * Compiles one statement into gProg. Keywords that may be followed by
+ * a command on the same statement (then, else, do, '{', and the
+ * condition after if/elif/while/until) are consumed and the rest of
+ * the words are compiled as the next statement.
+ */
+static bool
+Compile(char** w, int n)
+{
+  openT* top;
+  int node, i;
+
+  while (n > 0)
+    {
+      top = gDepth > 0 ? &gOpen[gDepth - 1] : NULL;
+
+      if (strcmp(w[0], "if") == 0 || strcmp(w[0], "while") == 0
+          || strcmp(w[0], "until") == 0)
+        {
+          int type = w[0][0] == 'i' ? N_IF : w[0][0] == 'w' ? N_WHILE : N_UNTIL;
+          node = AddNode(gProg, type, 0, NULL);
+          Append(node);
+          Open(node, P_COND, FALSE);
+          w++, n--;
+          continue;
+        }
+      if (strcmp(w[0], "then") == 0)
+        {
+          if (top == NULL || top->phase != P_COND
+              || gProg->nodes[top->node].type != N_IF)
+            break;
+          top->phase = P_THEN;
+          top->last = -1;
+          w++, n--;
+          continue;
+        }
+      if (strcmp(w[0], "elif") == 0)
+        {
+          if (top == NULL || top->phase != P_THEN)
+            break;
+          node = AddNode(gProg, N_IF, 0, NULL);
+          gProg->nodes[top->node].c = node;
+          top->phase = P_ELSE;
+          Open(node, P_COND, TRUE);
+          w++, n--;
+          continue;
+        }
+      if (strcmp(w[0], "else") == 0)
+        {
+          if (top == NULL || top->phase != P_THEN)
+            break;
+          top->phase = P_ELSE;
+          top->last = -1;
+          w++, n--;
+          continue;
+        }
+      if (strcmp(w[0], "fi") == 0)
+        {
+          if (top == NULL || n > 1
+              || (top->phase != P_THEN && top->phase != P_ELSE))
+            break;
+          while (gOpen[--gDepth].elif)
+            ;
+          return TRUE;
+        }
+      if (strcmp(w[0], "do") == 0)
+        {
+          if (top == NULL || (top->phase != P_COND && top->phase != P_HEAD)
+              || gProg->nodes[top->node].type == N_IF
+              || gProg->nodes[top->node].type == N_FUNC)
+            break;
+          top->phase = P_BODY;
+          top->last = -1;
+          w++, n--;
+          continue;
+        }
+      if (strcmp(w[0], "done") == 0)
+        {
+          if (top == NULL || n > 1 || top->phase != P_BODY
+              || gProg->nodes[top->node].type == N_FUNC)
+            break;
+          gDepth--;
+          return TRUE;
+        }
+      if (strcmp(w[0], "for") == 0)
+        {
+          if (n < 3 || !IsName(w[1], strlen(w[1])) || strcmp(w[2], "in") != 0
+              || strcmp(w[n - 1], BGMARK) == 0)
+            break;
+          // Words: the variable name followed by the list.
+          char* in = w[2];
+          w[2] = w[1];
+          w[1] = in;
+          node = AddNode(gProg, N_FOR, n - 2, w + 2);
+          Append(node);
+          Open(node, P_HEAD, FALSE);
+          return TRUE;
+        }
+      if (strcmp(w[0], "function") == 0
+          || (n >= 2 && strcmp(w[1], "()") == 0)
+          || (strlen(w[0]) > 2 && strcmp(w[0] + strlen(w[0]) - 2, "()") == 0))
+        {
+          char* name = w[0];
+          int len;
+          if (strcmp(w[0], "function") == 0)
+            {
+              if (n < 2)
+                {
+                  SyntaxError("newline"); // no name
+                  return FALSE;
+                }
+              name = w[1];
+              w++, n--;
+            }
+          w++, n--;
+          len = strlen(name);
+          if (len > 2 && strcmp(name + len - 2, "()") == 0)
+            len -= 2;
+          if (!IsName(name, len))
+            {
+              SyntaxError(name);
+              return FALSE;
+            }
+          if (n > 0 && strcmp(w[0], "()") == 0)
+            w++, n--;
+          name[len] = 0;
+          node = AddNode(gProg, N_FUNC, 1, &name);
+          Append(node);
+          gProg->hasFunc = TRUE;
+          Open(node, P_HEAD, FALSE);
+          continue;
+        }
+      if (strcmp(w[0], "{") == 0)
+        {
+          if (top == NULL || top->phase != P_HEAD
+              || gProg->nodes[top->node].type != N_FUNC)
+            break;
+          top->phase = P_BODY;
+          w++, n--;
+          continue;
+        }
+      if (strcmp(w[0], "}") == 0)
+        {
+          if (top == NULL || n > 1 || top->phase != P_BODY
+              || gProg->nodes[top->node].type != N_FUNC)
+            break;
+          gDepth--;
+          return TRUE;
+        }
+
+      // A command must go into a list that is being filled.
+      if (top != NULL && top->phase == P_HEAD)
+        break;
+      bool bg = strcmp(w[n - 1], BGMARK) == 0;
+      if (bg && --n == 0)
+        {
+          SyntaxError("&");
+          return FALSE;
+        }
+      if (strcmp(w[0], "break") == 0 || strcmp(w[0], "continue") == 0
+          || strcmp(w[0], "return") == 0)
+        {
+          int type = w[0][0] == 'b' ? N_BREAK
+            : w[0][0] == 'c' ? N_CONTINUE : N_RETURN;
+          if (bg)
+            {
+              SyntaxError("&");
+              return FALSE;
+            }
+          Append(AddNode(gProg, type, n - 1, w + 1));
+          return TRUE;
+        }
+      char* eq = strchr(w[0], '=');
+      if (n == 1 && eq != NULL && IsName(w[0], eq - w[0]))
+        {
+          char* nv[2] = { w[0], eq + 1 };
+          if (bg)
+            {
+              SyntaxError("&");
+              return FALSE;
+            }
+          *eq = 0;
+          Append(AddNode(gProg, N_ASSIGN, 2, nv));
+          return TRUE;
+        }
+      // Every stage of a pipeline needs a command, and every
+      // redirection a file.
+      for (i = 0; i < n; i++)
+        if (strcmp(w[i], PIPEMARK) == 0
+            && (i == 0 || i == n - 1 || strcmp(w[i - 1], PIPEMARK) == 0))
+          {
+            SyntaxError("|");
+            return FALSE;
+          }
+        else if (w[i][0] == REDIRMARK[0] && w[i][strlen(w[i]) - 1] == '&')
+          {
+            SyntaxError(w[i] + 1); // no duplicating of descriptors
+            return FALSE;
+          }
+        else if (w[i][0] == REDIRMARK[0]
+                 && (i == n - 1 || strcmp(w[i + 1], PIPEMARK) == 0
+                     || w[i + 1][0] == REDIRMARK[0]))
+          {
+            SyntaxError(i == n - 1 ? "newline" : w[i + 1][0] == REDIRMARK[0]
+                        ? w[i + 1] + 1 : "|");
+            return FALSE;
+          }
+      Append(AddNode(gProg, bg ? N_BG : N_CMD, n, w));
+      return TRUE;
+    }
+  if (n > 0)
+    {
+      SyntaxError(w[0]);
+      return FALSE;
+    }
+  return TRUE;
+} /* Compile */
+
+
+/*
+ * SyntaxError
+ *
+ * arguments:
+ *   char *near: the word that could not be compiled
+ *
+ * returns: none
+ *
+ * Reports a syntax error on stderr and sets $? to 2, as sh does.
+ */
+static void
+SyntaxError(char* near)
+{
+  fprintf(stderr, "%s: syntax error near '%s'\n", SHELLNAME, near);
+  lastStatus = 2;
+} /* SyntaxError */
+
+
+/*
+ * IsName
+ *
+ * arguments:
+ *   char *s: the candidate text
+ *   int len: its length
+ *
+ * returns: bool: whether the text is a valid variable or function name
+ */
+static bool
+IsName(char* s, int len)
+{
+  int i;
+
+  if (len == 0 || (s[0] >= '0' && s[0] <= '9'))
+    return FALSE;
+  for (i = 0; i < len; i++)
+    if (!(s[i] == '_' || (s[i] >= 'a' && s[i] <= 'z')
+          || (s[i] >= 'A' && s[i] <= 'Z') || (s[i] >= '0' && s[i] <= '9')))
+      return FALSE;
+  return TRUE;
+} /* IsName */
+
+
+/*
+ * NewProg
+ *
+ * returns: progT*: an empty program
+ */
+static progT*
+NewProg()
+{
+  progT* p = calloc(1, sizeof(progT));
+  p->head = p->tail = -1;
+  return p;
+} /* NewProg */
+
+
+/*
+ * FreeProg
+ *
+ * arguments:
+ *   progT *p: the program to free
+ *
+ * returns: none
+ */
+static void
+FreeProg(progT* p)
+{
+  int i;
+
+  for (i = 0; i < p->nscratch; i++)
+    {
+      free(p->scratch[i].cmd);
+      free(p->scratch[i].offs);
+      free(p->scratch[i].buf);
+    }
+  free(p->scratch);
+  if (p->map != NULL)
+    munmap(p->map, p->mapLen);
+  else
+    {
+      free(p->nodes);
+      free(p->words);
+      free(p->pool);
+    }
+  free(p);
+} /* FreeProg */
+
+
+/*
+ * AddNode
+ *
+ * arguments:
+ *   progT *p: the program
+ *   int type: the node type
+ *   int n: number of words
+ *   char **w: the words, copied into the program's string pool
+ *
+ * returns: int: index of the new node
+ */
+static int
+AddNode(progT* p, int type, int n, char** w)
+{
+  nodeT* node;
+  int i;
+
+  if (p->nnodes == p->maxNodes)
+    {
+      p->maxNodes = p->maxNodes * 2 + 16;
+      p->nodes = realloc(p->nodes, sizeof(nodeT) * p->maxNodes);
+    }
+  if (p->nwords + n > p->maxWords)
+    {
+      p->maxWords = (p->nwords + n) * 2 + 16;
+      p->words = realloc(p->words, sizeof(wordT) * p->maxWords);
+    }
+  node = &p->nodes[p->nnodes];
+  node->type = type;
+  node->next = node->a = node->b = node->c = -1;
+  node->word = p->nwords;
+  node->nwords = n;
+
+  for (i = 0; i < n; i++)
+    {
+      int len = strlen(w[i]) + 1;
+      if (p->poolLen + len > p->poolMax)
+        {
+          p->poolMax = (p->poolLen + len) * 2 + 256;
+          p->pool = realloc(p->pool, p->poolMax);
+        }
+      memcpy(p->pool + p->poolLen, w[i], len);
+      p->words[p->nwords].off = p->poolLen;
+      p->words[p->nwords].dyn = strchr(w[i], EXPANDMARK) != NULL
+        || strchr(w[i], QEXPANDMARK) != NULL;
+      p->poolLen += len;
+      p->nwords++;
+    }
+  return p->nnodes++;
+} /* AddNode */
+
+
+/*
+ * Append
+ *
+ * arguments:
+ *   int node: a new statement of gProg
+ *
+ * returns: none
+ *
+ * Adds the statement to the list being filled: the top level, or the
+ * current part of the innermost open construct.
+ */
+static void
+Append(int node)
+{
+  nodeT* nodes = gProg->nodes;
+
+  if (gDepth == 0)
+    {
+      if (gProg->head == -1)
+        gProg->head = node;
+      else
+        nodes[gProg->tail].next = node;
+      gProg->tail = node;
+      return;
+    }
+
+  openT* top = &gOpen[gDepth - 1];
+  if (top->last != -1)
+    nodes[top->last].next = node;
+  else if (top->phase == P_COND)
+    nodes[top->node].a = node;
+  else if (top->phase == P_ELSE)
+    nodes[top->node].c = node;
+  else
+    nodes[top->node].b = node;
+  top->last = node;
+} /* Append */
+
+
+/*
+ * Open
+ *
+ * arguments:
+ *   int node: the if, loop or function node
+ *   int phase: the part of it that follows
+ *   bool elif: whether it is an elif of the enclosing if
+ *
+ * returns: none
+ *
+ * Pushes a construct that later statements are compiled into.
+ */
+static void
+Open(int node, int phase, bool elif)
+{
+  if (gDepth == gMaxDepth)
+    {
+      gMaxDepth = gMaxDepth * 2 + 8;
+      gOpen = realloc(gOpen, sizeof(openT) * gMaxDepth);
+    }
+  gOpen[gDepth].node = node;
+  gOpen[gDepth].phase = phase;
+  gOpen[gDepth].last = -1;
+  gOpen[gDepth].elif = elif;
+  gDepth++;
+} /* Open */
+
+
+/*
+ * RunList
+ *
+ * arguments:
+ *   progT *p: the program
+ *   int n: first statement of the list, or -1
+ *
+ * returns: none
+ *
+ * Runs a list of statements until it ends, the shell is exiting or a
+ * break, continue or return is pending.
+ */
+static void
+RunList(progT* p, int n)
+{
+  while (n != -1 && gCtl == C_NONE && !forceExit)
+    {
+      RunNode(p, n);
+      n = p->nodes[n].next;
+    }
+} /* RunList */
+
+
+/*
+ * LoopControl
+ *
+ * returns: bool: TRUE if the loop must stop
+ *
+ * Consumes one level of a pending break or continue at the end of a
+ * loop iteration.
+ */
+static bool
+LoopControl()
+{
+  if (gCtl == C_BREAK || gCtl == C_CONTINUE)
+    {
+      if (gCtlCount > 1)
+        {
+          gCtlCount--;
+          return TRUE; // leave this loop; the next one up handles it
+        }
+      if (gCtl == C_BREAK)
+        {
+          gCtl = C_NONE;
+          return TRUE;
+        }
+      gCtl = C_NONE;
+    }
+  return gCtl != C_NONE || forceExit;
+} /* LoopControl */
+
+
+/*
+ * RunNode
+ *
+ * arguments:
+ *   progT *p: the program
+ *   int n: the statement to run
+ *
+ * returns: none
+ *
+ * Runs one statement. Simple commands reuse the argv and expansion
+ * buffer in the node's scratch entry; only a node re-entered through
+ * a recursive function call gets temporary storage.
+ */
+static void
+RunNode(progT* p, int n)
+{
+  nodeT* node = &p->nodes[n];
+  scratchT tmp, *s;
+  funcT* f;
+  int i, argc;
+
+  if (p->nscratch < p->nnodes)
+    {
+      p->scratch = realloc(p->scratch, sizeof(scratchT) * p->nnodes);
+      memset(p->scratch + p->nscratch, 0,
+             sizeof(scratchT) * (p->nnodes - p->nscratch));
+      p->nscratch = p->nnodes;
+    }
+  s = &p->scratch[n];
+  if (s->busy)
+    {
+      memset(&tmp, 0, sizeof(tmp));
+      s = &tmp;
+    }
+
+  switch (node->type)
+    {
+    case N_CMD:
+      argc = ExpandWords(p, node->word, node->nwords, s, TRUE);
+      if (argc == 0)
+        break;
+      s->busy = TRUE;
+      if (!IsPipeline(s->cmd) && (f = FindFunc(s->cmd->argv[0])) != NULL)
+        {
+          commandT* saved = gArgs;
+          int loops = gLoops;
+          redirT r;
+          if (!RedirOpen(s->cmd, &r))
+            {
+              lastStatus = 1;
+              s->busy = FALSE;
+              break;
+            }
+          RedirSwap(&r);
+          gArgs = s->cmd;
+          gLoops = 0;
+          lastStatus = 0;
+          RunList(f->prog, f->prog->nodes[f->node].b);
+          if (gCtl == C_RETURN)
+            gCtl = C_NONE;
+          gArgs = saved;
+          gLoops = loops;
+          RedirRestore(&r);
+        }
+      else
+        RunCmd(s->cmd);
+      s->busy = FALSE;
+      break;
+
+    case N_BG:
+      if (ExpandWords(p, node->word, node->nwords, s, TRUE) > 0)
+        RunCmdBg(s->cmd);
+      lastStatus = 0;
+      break;
+
+    case N_ASSIGN:
+      ExpandWords(p, node->word, 2, s, FALSE);
+      SetVar(s->cmd->argv[0], s->cmd->argv[1]);
+      lastStatus = 0;
+      break;
+
+    case N_IF:
+      RunList(p, node->a);
+      if (gCtl != C_NONE)
+        break;
+      if (lastStatus == 0)
+        RunList(p, node->b);
+      else if (node->c != -1)
+        RunList(p, node->c);
+      else
+        lastStatus = 0;
+      break;
+
+    case N_WHILE:
+    case N_UNTIL:
+      gLoops++;
+      for (;;)
+        {
+          RunList(p, node->a);
+          if (gCtl != C_NONE || forceExit)
+            break;
+          if ((lastStatus == 0) != (node->type == N_WHILE))
+            break;
+          RunList(p, node->b);
+          if (LoopControl())
+            break;
+        }
+      gLoops--;
+      break;
+
+    case N_FOR:
+      argc = ExpandWords(p, node->word, node->nwords, s, TRUE);
+      s->busy = TRUE;
+      gLoops++;
+      lastStatus = 0;
+      for (i = 1; i < argc; i++)
+        {
+          SetVar(s->cmd->argv[0], s->cmd->argv[i]);
+          RunList(p, node->b);
+          if (LoopControl())
+            break;
+        }
+      gLoops--;
+      s->busy = FALSE;
+      break;
+
+    case N_FUNC:
+      DefineFunc(p, n);
+      lastStatus = 0;
+      break;
+
+    case N_BREAK:
+    case N_CONTINUE:
+    case N_RETURN:
+      argc = ExpandWords(p, node->word, node->nwords, s, TRUE);
+      i = argc > 0 ? atoi(s->cmd->argv[0]) : 0;
+      if (node->type == N_RETURN)
+        {
+          if (argc > 0)
+            lastStatus = i;
+          if (gArgs != NULL)
+            gCtl = C_RETURN;
+        }
+      else if (gLoops > 0)
+        {
+          gCtl = node->type == N_BREAK ? C_BREAK : C_CONTINUE;
+          gCtlCount = i < 1 ? 1 : i > gLoops ? gLoops : i;
+        }
+      break;
+    }
+
+  if (s == &tmp)
+    {
+      free(tmp.cmd);
+      free(tmp.offs);
+      free(tmp.buf);
+    }
+} /* RunNode */
+
+
+/*
+ * ExpandWords
+ *
+ * arguments:
+ *   progT *p: the program
+ *   int first: first word in the word table
+ *   int n: number of words
+ *   scratchT *s: where argv and the expanded text are built
+ *   bool split: whether unquoted expansions are split on blanks
+ *
+ * returns: int: the resulting argc
+ *
+ * Builds s->cmd from compiled words. Words without expansions are
+ * pointed at the pool directly. With split set, a word whose
+ * expansions are all unquoted is split on blanks and dropped if it
+ * expands to nothing, like an unquoted word in sh. Storage in the
+ * scratch entry only grows, so a node that keeps producing the same
+ * shape of command never allocates.
+ */
+static int
+ExpandWords(progT* p, int first, int n, scratchT* s, bool split)
+{
+  int i, argc = 0, at = 0;
+
+  if (s->slots < n + 1)
+    GrowScratch(s, n + 1);
+
+  // Expanded words are recorded as buffer offsets first, since the
+  // buffer may move while it grows.
+  for (i = 0; i < n; i++)
+    {
+      wordT* w = &p->words[first + i];
+      char* text = p->pool + w->off;
+      int start = at;
+
+      // A split word may have used the slots of the words after it.
+      if (argc + 1 >= s->slots)
+        GrowScratch(s, s->slots * 2);
+      if (!w->dyn)
+        {
+          s->offs[argc] = -1;
+          s->cmd->argv[argc++] = text;
+          continue;
+        }
+      at = Expand(text, s, at);
+      if (!split || strchr(text, QEXPANDMARK) != NULL)
+        {
+          s->offs[argc++] = start;
+          continue;
+        }
+
+      // Unquoted: one word per blank-separated field.
+      int j = start;
+      for (;;)
+        {
+          while (j < at - 1 && (s->buf[j] == ' ' || s->buf[j] == '\t'
+                                || s->buf[j] == '\n'))
+            s->buf[j++] = 0;
+          if (j >= at - 1)
+            break;
+          if (argc + 1 >= s->slots)
+            GrowScratch(s, s->slots * 2);
+          s->offs[argc++] = j;
+          while (j < at - 1 && s->buf[j] != ' ' && s->buf[j] != '\t'
+                 && s->buf[j] != '\n')
+            j++;
+        }
+    }
+
+  for (i = 0; i < argc; i++)
+    if (s->offs[i] >= 0)
+      s->cmd->argv[i] = s->buf + s->offs[i];
+  s->cmd->argv[argc] = NULL;
+  s->cmd->argc = argc;
+  s->cmd->name = s->cmd->argv[0];
+  return argc;
+} /* ExpandWords */
+
+
+/*
+ * GrowScratch
+ *
+ * arguments:
+ *   scratchT *s: the scratch entry
+ *   int slots: the number of argv slots needed
+ *
+ * returns: none
+ */
+static void
+GrowScratch(scratchT* s, int slots)
+{
+  s->slots = slots;
+  s->cmd = realloc(s->cmd, sizeof(commandT) + sizeof(char*) * slots);
+  s->offs = realloc(s->offs, sizeof(int) * slots);
+} /* GrowScratch */
+
+
+/*
+ * Expand
+ *
+ * arguments:
+ *   char *w: a compiled word containing expansion marks
+ *   scratchT *s: the scratch entry whose buffer receives the text
+ *   int at: where in the buffer to write
+ *
+ * returns: int: the buffer position after the terminating NUL
+ *
+ * Expands $NAME, ${NAME}, $0-$9, $#, $?, $$, $@, $* and $(...).
+ */
+static int
+Expand(char* w, scratchT* s, int at)
+{
+  char num[24];
+  char* val;
+  int len, i;
+
+  for (;;)
+    {
+      char* mark = w;
+      while (*mark != 0 && *mark != EXPANDMARK && *mark != QEXPANDMARK)
+        mark++;
+
+      // Literal text up to the mark, or the final NUL.
+      len = mark - w + (*mark == 0);
+      if (at + len > s->bufMax)
+        {
+          s->bufMax = (at + len) * 2 + 64;
+          s->buf = realloc(s->buf, s->bufMax);
+        }
+      if (len > 0)
+        memcpy(s->buf + at, w, len);
+      at += len;
+      if (*mark == 0)
+        return at;
+
+      // The expansion.
+      w = mark + 1;
+      val = NULL;
+      if (*w == '(')
+        {
+          char* end = strchr(w, ')');
+          if (end == NULL)
+            end = w + strlen(w);
+          at = Substitute(w + 1, end - w - 1, s, at);
+          w = *end != 0 ? end + 1 : end;
+          continue;
+        }
+      if (*w == '{')
+        {
+          char* end = strchr(w, '}');
+          if (end != NULL)
+            {
+              val = LookupVar(w + 1, end - w - 1);
+              w = end + 1;
+            }
+        }
+      else if (*w == '?' || *w == '#' || *w == '$')
+        {
+          snprintf(num, sizeof(num), "%d", *w == '?' ? lastStatus
+                   : *w == '$' ? (int) getpid()
+                   : gArgs != NULL ? gArgs->argc - 1 : 0);
+          val = num;
+          w++;
+        }
+      else if (*w >= '0' && *w <= '9')
+        {
+          i = *w - '0';
+          if (gArgs != NULL)
+            val = i < gArgs->argc ? gArgs->argv[i] : NULL;
+          else if (i == 0)
+            val = SHELLNAME;
+          w++;
+        }
+      else if (*w == '@' || *w == '*')
+        {
+          // All the positional parameters, separated by spaces.
+          for (i = 1; gArgs != NULL && i < gArgs->argc; i++)
+            {
+              len = strlen(gArgs->argv[i]) + 1;
+              if (at + len > s->bufMax)
+                {
+                  s->bufMax = (at + len) * 2 + 64;
+                  s->buf = realloc(s->buf, s->bufMax);
+                }
+              memcpy(s->buf + at, gArgs->argv[i], len - 1);
+              at += len - 1;
+              if (i + 1 < gArgs->argc)
+                s->buf[at++] = ' ';
+            }
+          w++;
+        }
+      else
+        {
+          for (len = 0; w[len] == '_' || (w[len] >= 'a' && w[len] <= 'z')
+                 || (w[len] >= 'A' && w[len] <= 'Z')
+                 || (w[len] >= '0' && w[len] <= '9'); len++)
+            ;
+          if (len == 0)
+            val = "$"; // not an expansion after all
+          else
+            {
+              val = LookupVar(w, len);
+              w += len;
+            }
+        }
+
+      if (val != NULL)
+        {
+          len = strlen(val);
+          if (at + len > s->bufMax)
+            {
+              s->bufMax = (at + len) * 2 + 64;
+              s->buf = realloc(s->buf, s->bufMax);
+            }
+          memcpy(s->buf + at, val, len);
+          at += len;
+        }
+    }
+} /* Expand */
+
+
+/*
+ * Substitute
+ *
+ * arguments:
+ *   char *text: the encoded command of a $(...)
+ *   int len: its length
+ *   scratchT *s: the scratch entry whose buffer receives the output
+ *   int at: where in the buffer to write
+ *
+ * returns: int: the buffer position after the output
+ *
+ * Runs the command of a substitution and appends its output, less
+ * trailing newlines. A single builtin that only writes output (see
+ * IsPureBuiltIn) runs in the shell with stdout pointed at the buffer,
+ * as does a wc, head or tail TextPure allows, like $(wc -l < file).
+ * Anything else runs in a forked subshell whose output is read from a
+ * pipe straight into the buffer; a single external command is exec'd
+ * by the subshell itself rather than forked again. Either way the
+ * buffer grows geometrically, so large output is copied once.
+ */
+static int
+Substitute(char* text, int len, scratchT* s, int at)
+{
+  cookie_io_functions_t io = { NULL, CaptureWrite, NULL, NULL };
+  captureT capture;
+  scratchT tmp;
+  commandT* cmd = NULL;
+  FILE* saved;
+  progT* p;
+  char* plain = malloc(len + 1);
+  int start = at;
+  int i;
+
+  for (i = 0; i < len; i++)
+    {
+      char c = text[i];
+      plain[i] = c >= SUBFIRST && c < SUBFIRST + sizeof(kSubPlain) - 1
+        ? kSubPlain[c - SUBFIRST] : c;
+    }
+  plain[len] = 0;
+  p = CompileText(plain, len);
+  free(plain);
+
+  // A lone simple command is expanded here, so that its own
+  // substitutions run in the shell and it can be exec'd directly.
+  memset(&tmp, 0, sizeof(tmp));
+  if (p->head != -1 && p->head == p->tail && p->nodes[p->head].type == N_CMD
+      && ExpandWords(p, p->nodes[p->head].word, p->nodes[p->head].nwords,
+                     &tmp, TRUE) > 0
+      && !IsPipeline(tmp.cmd) && FindFunc(tmp.cmd->argv[0]) == NULL)
+    cmd = tmp.cmd;
+
+  if (cmd != NULL && ((IsPureBuiltIn(cmd->argv[0]) && !HasRedir(cmd))
+                      || TextPure(cmd)))
+    {
+      capture.s = s;
+      capture.at = at;
+      fflush(stdout);
+      saved = stdout;
+      stdout = fopencookie(&capture, "w", io);
+      RunCmd(cmd);
+      fclose(stdout);
+      stdout = saved;
+      at = capture.at;
+    }
+  else if (p->head != -1)
+    at = CaptureFork(p, cmd, s, at);
+
+  while (at > start && s->buf[at - 1] == '\n')
+    at--;
+  free(tmp.cmd);
+  free(tmp.offs);
+  free(tmp.buf);
+  FreeProg(p);
+  return at;
+} /* Substitute */
+
+
+/*
+ * CaptureFork
+ *
+ * arguments:
+ *   progT *p: the compiled command of a substitution
+ *   commandT *cmd: its expanded argv if it is a lone simple command,
+ *                  else NULL
+ *   scratchT *s: the scratch entry whose buffer receives the output
+ *   int at: where in the buffer to write
+ *
+ * returns: int: the buffer position after the output
+ *
+ * Runs a substitution in a subshell and reads its output until the
+ * pipe closes. The subshell leads its own process group, like any
+ * foreground job, so ^C reaches everything it starts.
+ */
+static int
+CaptureFork(progT* p, commandT* cmd, scratchT* s, int at)
+{
+  int fds[2], status, oldFg = fgpid;
+  long long t;
+  ssize_t got;
+  sigset_t x;
+  pid_t pid;
+
+  if (pipe(fds) != 0)
+    {
+      PrintPError("pipe");
+      return at;
+    }
+  sigemptyset(&x);
+  sigaddset(&x, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &x, NULL);
+  fflush(stdout);
+  t = MetricsClock();
+  if ((pid = fork()) < 0)
+    {
+      PrintPError("Fork failed");
+      close(fds[0]);
+      close(fds[1]);
+      sigprocmask(SIG_UNBLOCK, &x, NULL);
+      return at;
+    }
+  if (pid == 0)
+    { // Subshell
+      setpgid(0, 0);
+      SubshellInit();
+      close(fds[0]);
+      dup2(fds[1], STDOUT_FILENO);
+      close(fds[1]);
+      sigprocmask(SIG_UNBLOCK, &x, NULL);
+      if (cmd != NULL)
+        RunCmdFork(cmd, FALSE); // returns only for a builtin
+      else
+        RunList(p, p->head);
+      fflush(stdout);
+      _exit(lastStatus);
+    }
+  setpgid(pid, pid);
+  MetricsSpawn(t);
+  PROBE3(spawn, cmd != NULL ? cmd->argv[0] : NULL, pid, PROBE_SINCE(t));
+  fgpid = pid;
+  close(fds[1]);
+
+  RecordWait(TRUE);
+  for (;;)
+    {
+      if (at + 1 >= s->bufMax)
+        {
+          s->bufMax = s->bufMax * 2 + 4096;
+          s->buf = realloc(s->buf, s->bufMax);
+        }
+      got = read(fds[0], s->buf + at, s->bufMax - at - 1);
+      if (got > 0)
+        at += got;
+      else if (got < 0 && errno == EINTR)
+        continue;
+      else
+        break;
+    }
+  close(fds[0]);
+
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    ;
+  RecordWait(FALSE);
+  lastStatus = WaitStatus(status);
+  fgpid = oldFg;
+  sigprocmask(SIG_UNBLOCK, &x, NULL);
+  return at;
+} /* CaptureFork */
+
+
+/*
+ * CaptureWrite
+ *
+ * arguments:
+ *   void *cookie: the captureT
+ *   const char *data: output of a builtin
+ *   size_t len: its length
+ *
+ * returns: ssize_t: len
+ *
+ * The write function of the stream a builtin's stdout is pointed at
+ * while its output is captured.
+ */
+static ssize_t
+CaptureWrite(void* cookie, const char* data, size_t len)
+{
+  captureT* c = cookie;
+  scratchT* s = c->s;
+
+  if (c->at + len + 1 > s->bufMax)
+    {
+      s->bufMax = (c->at + len + 1) * 2 + 64;
+      s->buf = realloc(s->buf, s->bufMax);
+    }
+  memcpy(s->buf + c->at, data, len);
+  c->at += len;
+  return len;
+} /* CaptureWrite */
+
+
+/*
+ * FindFunc
+ *
+ * arguments:
+ *   char *name: a command name
+ *
+ * returns: funcT*: the function of that name, or NULL
+ */
+static funcT*
+FindFunc(char* name)
+{
+  int i;
+
+  for (i = 0; i < gNFuncs; i++)
+    if (strcmp(gFuncs[i].name, name) == 0)
+      return &gFuncs[i];
+  return NULL;
+} /* FindFunc */
+
+
+/*
+ * DefineFunc
+ *
+ * arguments:
+ *   progT *p: the program holding the definition
+ *   int n: the N_FUNC node
+ *
+ * returns: none
+ *
+ * Makes the function callable, replacing an earlier definition.
+ */
+static void
+DefineFunc(progT* p, int n)
+{
+  char* name = p->pool + p->words[p->nodes[n].word].off;
+  funcT* f = FindFunc(name);
+
+  if (f == NULL)
+    {
+      gFuncs = realloc(gFuncs, sizeof(funcT) * (gNFuncs + 1));
+      f = &gFuncs[gNFuncs++];
+    }
+  f->name = name;
+  f->prog = p;
+  f->node = n;
+} /* DefineFunc */
+
+
+/*
+ * GetVar
+ *
+ * arguments:
+ *   char *name: the variable name
+ *
+ * returns: char*: its value, or NULL if it is not set
+ */
+char*
+GetVar(char* name)
+{
+  return LookupVar(name, strlen(name));
+} /* GetVar */
+
+
+/*
+ * LookupVar
+ *
+ * arguments:
+ *   char *name: the variable name, not necessarily NUL-terminated
+ *   int len: the length of the name
+ *
+ * returns: char*: its value, or NULL if it is not set
+ *
+ * Shell variables shadow the environment.
+ */
+static char*
+LookupVar(char* name, int len)
+{
+  char key[256];
+  int i;
+
+  for (i = 0; i < gNVars; i++)
+    if (strncmp(gVars[i].name, name, len) == 0 && gVars[i].name[len] == 0)
+      return gVars[i].value;
+  if (len >= sizeof(key))
+    return NULL;
+  memcpy(key, name, len);
+  key[len] = 0;
+  return getenv(key);
+} /* LookupVar */
+
+
+/*
+ * SetVar
+ *
+ * arguments:
+ *   char *name: the variable name
+ *   char *value: the new value
+ *
+ * returns: none
+ *
+ * Sets a variable. Names already in the environment are updated
+ * there, so that e.g. PATH keeps affecting commands; anything else
+ * is a shell variable whose storage is reused across assignments.
+ */
+void
+SetVar(char* name, char* value)
+{
+  int i, len = strlen(value) + 1;
+  varT* v = NULL;
+
+  for (i = 0; i < gNVars; i++)
+    if (strcmp(gVars[i].name, name) == 0)
+      v = &gVars[i];
+  if (v == NULL)
+    {
+      if (getenv(name) != NULL)
+        {
+          // The C library never frees what it puts in the environment.
+          MemLibc(TRUE);
+          setenv(name, value, 1);
+          MemLibc(FALSE);
+          return;
+        }
+      gVars = realloc(gVars, sizeof(varT) * (gNVars + 1));
+      v = &gVars[gNVars++];
+      v->name = strdup(name);
+      v->value = NULL;
+      v->max = 0;
+    }
+  if (len > v->max)
+    {
+      v->max = len;
+      v->value = realloc(v->value, len);
+    }
+  memcpy(v->value, value, len);
+} /* SetVar */
+
+
+/*
+ * ScriptEnd
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Reports a construct that the input ended inside of, as sh does, and
+ * throws it away.
+ */
+void
+ScriptEnd()
+{
+  if (gDepth == 0)
+    return;
+  fprintf(stderr, "%s: syntax error: unexpected end of file\n", SHELLNAME);
+  lastStatus = 2;
+  gDepth = 0;
+  gProg->head = gProg->tail = -1;
+  gProg->nnodes = gProg->nwords = gProg->poolLen = 0;
+  gProg->hasFunc = FALSE;
+} /* ScriptEnd */
+
+
+/*
+ * ScriptCleanup
+ *
+ * arguments: none
+ *
+ * returns: none
+ *
+ * Frees all programs, functions and variables.
+ */
+void
+ScriptCleanup()
+{
+  int i;
+
+  while (gRetained != NULL)
+    {
+      progT* p = gRetained;
+      gRetained = p->next;
+      FreeProg(p);
+    }
+  if (gProg != NULL)
+    FreeProg(gProg);
+  gProg = NULL;
+  for (i = 0; i < gNVars; i++)
+    {
+      free(gVars[i].name);
+      free(gVars[i].value);
+    }
+  free(gVars);
+  free(gFuncs);
+  free(gOpen);
+  free(gStmt);
+  gStmt = NULL;
+  gStmtMax = 0;
+  gVars = NULL;
+  gFuncs = NULL;
+  gOpen = NULL;
+  gNVars = gNFuncs = gDepth = gMaxDepth = 0;
+} /* ScriptCleanup */
@@ -0,0 +1,138 @@
+/***************************************************************************
+ *  Title: Script
+ * -------------------------------------------------------------------------
+ *    Purpose: Compiles and runs control-flow constructs
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: script.h,v $
+ ***************************************************************************/
+
+#ifndef __SCRIPT_H__
+#define __SCRIPT_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "runtime.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __SCRIPT_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* marks a '$' that is subject to expansion in a compiled word */
+#define EXPANDMARK '\001'
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Feed one line to the script compiler
+ * ---------------------------------------------------------------------
+ *    Purpose: Compiles the statements on a line and runs every
+ *    top-level statement that is complete. Statements inside an
+ *    unterminated if/while/for/function are kept until the lines
+ *    that close them arrive.
+ *    Input: a command line
+ *    Output: TRUE if a construct is still open
+ ***********************************************************************/
+EXTERN bool
+ScriptFeed(char*);
+
+/***********************************************************************
+ *  Title: Run the startup file
+ * ---------------------------------------------------------------------
+ *    Purpose: Runs a startup file such as ~/.tshrc, from its compiled
+ *    snapshot (the same path plus ".snap") when that is current, and
+ *    refreshes the snapshot otherwise.
+ *    Input: the path of the startup file
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+ScriptRunRc(char*);
+
+/***********************************************************************
+ *  Title: Run a script
+ * ---------------------------------------------------------------------
+ *    Purpose: Runs a tsh script in this shell, with the functions,
+ *    variables and caches it already has, as "tsh script args" would.
+ *    Input: the path of the script and the command that named it
+ *    Output: void; $? is the script's status
+ ***********************************************************************/
+EXTERN void
+ScriptRun(char*, commandT*);
+
+/***********************************************************************
+ *  Title: Look up a variable
+ * ---------------------------------------------------------------------
+ *    Purpose: Returns the value of a shell variable, falling back to
+ *    the environment.
+ *    Input: the variable name
+ *    Output: the value, or NULL if unset
+ ***********************************************************************/
+EXTERN char*
+GetVar(char*);
+
+/***********************************************************************
+ *  Title: Set a variable
+ * ---------------------------------------------------------------------
+ *    Purpose: Sets a shell variable, reusing its storage if it is
+ *    large enough.
+ *    Input: the variable name and value
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+SetVar(char*, char*);
+
+/***********************************************************************
+ *  Title: Hash bytes
+ * ---------------------------------------------------------------------
+ *    Purpose: Computes the 64-bit FNV-1a hash that the startup file
+ *    snapshot and the memo cache key their files on.
+ *    Input: the bytes and their number
+ *    Output: the hash
+ ***********************************************************************/
+EXTERN unsigned long long
+HashText(char*, size_t);
+
+/***********************************************************************
+ *  Title: End the input
+ * ---------------------------------------------------------------------
+ *    Purpose: Reports an if/while/for/function that the input ended
+ *    inside of, with status 2, and discards it.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+ScriptEnd();
+
+/***********************************************************************
+ *  Title: Release the script state
+ * ---------------------------------------------------------------------
+ *    Purpose: Frees functions, variables and any half-compiled
+ *    construct. Called once when the shell exits.
+ *    Input: void
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+ScriptCleanup();
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __SCRIPT_H__ */
@@ -0,0 +1,365 @@
+/*
+ * editfuzz.c - Fuzz test for the tsh line editor
+ *
+ * usage: editfuzz [lines [seed]]
+ * Types random keys at the editor, in random batches, and plays what
+ * EditRender writes on a one-row model of a terminal. After every
+ * update the row must show the window of the line the editor keeps,
+ * blank after it, with the cursor on the cursor's cell; when a line
+ * ends it must match the line a plain editor working one key at a
+ * time makes of the same keys. Typing at the end of a line must cost
+ * one byte. Lines are mostly short, some far wider than the terminal,
+ * whose width changes now and then. Exits non-zero on the first
+ * failure.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../config.h"
+#include "../edit.h"
+
+#define MAXKEYS 20000
+#define MAXCOLS 300
+
+/* edit.c drains job output while it waits; never reached here */
+void JobOutWait(int fd)
+{
+    abort();
+}
+
+static unsigned row[MAXCOLS];
+static int rowx, cols;
+static unsigned long iter;
+
+static void fail(char *what)
+{
+    printf("editfuzz: %s at step %lu\n", what, iter);
+    exit(1);
+}
+
+/*
+ * play - applies the editor's output to the model terminal, which
+ * knows the bytes and sequences edit.c may send and nothing else.
+ */
+static void play(char *out, int n)
+{
+    int i = 0, arg, k;
+
+    while (i < n) {
+	unsigned char c = out[i++];
+	if (c == '\r') {
+	    rowx = 0;
+	} else if (c == '\b') {
+	    if (rowx > 0)
+		rowx--;
+	} else if (c == '\033') {
+	    if (i == n || out[i++] != '[')
+		fail("bad escape");
+	    for (arg = 0; i < n && out[i] >= '0' && out[i] <= '9'; i++)
+		arg = arg * 10 + out[i] - '0';
+	    if (i == n)
+		fail("short escape");
+	    if (arg == 0)
+		arg = 1;
+	    switch (out[i++]) {
+	    case 'C':
+		rowx = rowx + arg < cols ? rowx + arg : cols - 1;
+		break;
+	    case 'D':
+		rowx = rowx - arg > 0 ? rowx - arg : 0;
+		break;
+	    case 'K': /* and what a wider terminal left */
+		for (k = rowx; k < MAXCOLS; k++)
+		    row[k] = 0;
+		break;
+	    case '@':
+		for (k = cols - 1; k >= rowx + arg; k--)
+		    row[k] = row[k - arg];
+		for (k = rowx; k < rowx + arg && k < cols; k++)
+		    row[k] = 0;
+		break;
+	    case 'P':
+		for (k = rowx; k < cols; k++)
+		    row[k] = k + arg < cols ? row[k + arg] : 0;
+		break;
+	    case 'H':
+		rowx = 0;
+		break;
+	    case 'J':
+		memset(row, 0, sizeof(row));
+		break;
+	    default:
+		fail("unknown escape");
+	    }
+	} else if ((c & 0xc0) == 0x80 && rowx > 0
+		   && row[rowx - 1] <= 0xffffff) {
+	    /* joins the character before, as the editor's cells do */
+	    for (k = 1; (row[rowx - 1] >> (8 * k)) != 0; k++)
+		;
+	    row[rowx - 1] |= (unsigned) c << (8 * k);
+	} else if (c >= ' ') {
+	    if (rowx >= (cols > 2 ? cols - 1 : 1))
+		fail("wrote in the last column");
+	    row[rowx++] = c;
+	} else {
+	    fail("control character");
+	}
+    }
+}
+
+/* next cell of a line the way the editor splits it */
+static int cellEnd(char *s, int len, int i)
+{
+    int k;
+
+    for (i++, k = 0; i < len && k < 3 && (s[i] & 0xc0) == 0x80; i++, k++)
+	;
+    return i;
+}
+
+static void check(editT *e)
+{
+    char *s = *e->buf;
+    int w = cols - 1 > EDITMAXW ? EDITMAXW : cols > 2 ? cols - 1 : 1;
+    int i, j, k, n = 0, cur = -1;
+
+    if ((int) strlen(s) != e->len)
+	fail("length");
+    for (i = e->off; i < e->len && n < w; n++) {
+	unsigned cell = 0;
+	j = cellEnd(s, e->len, i);
+	if (i <= e->pos && e->pos < j)
+	    cur = n;
+	for (k = j - 1; k >= i; k--)
+	    cell = (cell << 8) | (unsigned char) s[k];
+	if ((cell & 0xff) < ' ')
+	    cell = (cell & ~0xff) | ' ';
+	if (row[n] != cell)
+	    fail("screen differs from line");
+	i = j;
+    }
+    if (i == e->pos)
+	cur = n;
+    for (k = n; k < cols; k++)
+	if (row[k] != 0)
+	    fail("junk after line");
+    if (cur < 0 || cur >= w)
+	fail("cursor outside window");
+    if (rowx != cur)
+	fail("cursor misplaced");
+}
+
+/* the editor's keys, one at a time, on a plain string */
+static char *refText;
+static int refLen, refPos, refEsc, refArg;
+
+static int refNext(int i)
+{
+    return i < refLen ? cellEnd(refText, refLen, i) : refLen;
+}
+
+static int refPrev(int i)
+{
+    int j, k;
+
+    if (i == 0)
+	return 0;
+    for (j = i - 1; j > 0 && (refText[j] & 0xc0) == 0x80; j--)
+	;
+    while ((k = refNext(j)) < i)
+	j = k;
+    return j;
+}
+
+static void refDelete(int from, int to)
+{
+    if (to <= from)
+	return;
+    memmove(refText + from, refText + to, refLen - to);
+    refLen -= to - from;
+    if (refPos >= to)
+	refPos -= to - from;
+    else if (refPos > from)
+	refPos = from;
+}
+
+/* returns 1 when the key ends the line, -1 for the end of input */
+static int refKey(unsigned char c)
+{
+    int i;
+
+    if (refEsc == 1) {
+	refEsc = 0;
+	if (c == '[' || c == 'O') {
+	    refEsc = 2;
+	    refArg = 0;
+	} else if (c == 'b') {
+	    while (refPos > 0 && refText[refPos - 1] == ' ')
+		refPos--;
+	    while (refPos > 0 && refText[refPos - 1] != ' ')
+		refPos--;
+	} else if (c == 'f') {
+	    while (refPos < refLen && refText[refPos] == ' ')
+		refPos++;
+	    while (refPos < refLen && refText[refPos] != ' ')
+		refPos++;
+	}
+	return 0;
+    }
+    if (refEsc == 2 && c >= '0' && c <= '9') {
+	if (refArg < 1000)
+	    refArg = refArg * 10 + c - '0';
+	return 0;
+    }
+    if (refEsc != 0) {
+	if (c == 27)
+	    refEsc = 1;
+	else if (c == ';')
+	    refEsc = 3;
+	else if (c >= 0x40 || c == '~') {
+	    refEsc = 0;
+	    if (c == 'C')
+		refPos = refNext(refPos);
+	    else if (c == 'D')
+		refPos = refPrev(refPos);
+	    else if (c == 'H' || (c == '~' && (refArg == 1 || refArg == 7)))
+		refPos = 0;
+	    else if (c == 'F' || (c == '~' && (refArg == 4 || refArg == 8)))
+		refPos = refLen;
+	    else if (c == '~' && refArg == 3)
+		refDelete(refPos, refNext(refPos));
+	}
+	return 0;
+    }
+    switch (c) {
+    case '\r': case '\n': return 1;
+    case 1: refPos = 0; break;
+    case 2: refPos = refPrev(refPos); break;
+    case 3: refLen = refPos = 0; return 1;
+    case 4:
+	if (refLen == 0)
+	    return -1;
+	refDelete(refPos, refNext(refPos));
+	break;
+    case 5: refPos = refLen; break;
+    case 6: refPos = refNext(refPos); break;
+    case 8: case 127: refDelete(refPrev(refPos), refPos); break;
+    case 11: refLen = refPos; break;
+    case 21: refDelete(0, refPos); break;
+    case 23:
+	i = refPos;
+	while (i > 0 && refText[i - 1] == ' ')
+	    i--;
+	while (i > 0 && refText[i - 1] != ' ')
+	    i--;
+	refDelete(i, refPos);
+	break;
+    case 27: refEsc = 1; break;
+    default:
+	if (c < ' ' && c != '\t')
+	    break;
+	memmove(refText + refPos + 1, refText + refPos, refLen - refPos);
+	refText[refPos++] = c;
+	refLen++;
+    }
+    return 0;
+}
+
+/* appends one random key, or a few, to keys */
+static int randomKey(char *keys)
+{
+    static char *escapes[] = { "\033[C", "\033[D", "\033[H", "\033[F",
+	"\033OC", "\033OD", "\033[1~", "\033[4~", "\033[3~", "\033[7~",
+	"\033[8~", "\033[1;5C", "\033[1;5D", "\033b", "\033f", "\033[A",
+	"\033[?" };
+    static char ctrls[] = { 1, 2, 4, 5, 6, 8, 11, 12, 21, 23, 127, 127, 9,
+	7 };
+    int r = rand() % 100, n = 0, k;
+
+    if (r < 45) {
+	k = rand() % 8 == 0 ? rand() % 400 + 1 : 1;
+	while (n < k)
+	    keys[n++] = rand() % 5 == 0 ? ' ' : 'a' + rand() % 26;
+    } else if (r < 55) {
+	switch (rand() % 3) {
+	case 0: memcpy(keys, "\303\251", 2); return 2;
+	case 1: memcpy(keys, "\342\202\254", 3); return 3;
+	default: memcpy(keys, "\360\237\231\202", 4); return 4;
+	}
+    } else if (r < 75) {
+	keys[n++] = ctrls[rand() % sizeof(ctrls)];
+    } else if (r < 99) {
+	char *s = escapes[rand() % (sizeof(escapes) / sizeof(char *))];
+	n = strlen(s);
+	memcpy(keys, s, n);
+    } else {
+	keys[n++] = 0x80 + rand() % 64; /* a stray continuation byte */
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    int lines = argc > 1 ? atoi(argv[1]) : 3000;
+    unsigned seed = argc > 2 ? (unsigned) atoi(argv[2]) : 343;
+    char *keys = malloc(MAXKEYS + 512);
+    char *line = malloc(81);
+    char out[EDITOUTMAX];
+    editT *e = malloc(sizeof(editT));
+    int l, nkeys, used, got, n, end, before, wasEnd, was;
+
+    refText = malloc(MAXKEYS + 512);
+    srand(seed);
+    cols = 80;
+    for (l = 0; l < lines; l++) {
+	int target = rand() % 5 == 0 ? rand() % MAXKEYS : rand() % 200;
+	for (nkeys = 0; nkeys < target; )
+	    nkeys += randomKey(keys + nkeys);
+	keys[nkeys++] = rand() % 10 == 0 ? 3 : '\r';
+
+	if (rand() % 10 == 0)
+	    cols = rand() % 3 == 0 ? rand() % 6 + 1 : rand() % MAXCOLS + 1;
+	memset(row, 0, sizeof(row));
+	rowx = 0;
+	EditStart(e, &line, 80, cols);
+	refLen = refPos = refEsc = 0;
+
+	end = 0;
+	for (used = 0; used < nkeys && e->done == 0; used += got) {
+	    n = rand() % 4 == 0 ? rand() % 50 + 1 : 1;
+	    if (n > nkeys - used)
+		n = nkeys - used;
+	    was = cols;
+	    if (rand() % 50 == 0)
+		cols = rand() % MAXCOLS + 1;
+	    before = e->len;
+	    wasEnd = e->pos == e->len && e->esc == 0;
+	    got = EditKeys(e, keys + used, n);
+	    for (n = 0; n < got && end == 0; n++)
+		end = refKey(keys[used + n]);
+	    iter++;
+	    n = EditRender(e, cols, out);
+	    if (n > EDITOUTMAX - 4)
+		fail("too much output");
+	    if (got == 1 && wasEnd && e->len == before + 1
+		&& keys[used] >= 'a' && keys[used] <= 'z' && n != 1
+		&& e->off == 0 && e->pos < cols - 2 && cols > 2 && cols == was)
+		fail("typing at the end cost more than one byte");
+	    play(out, n);
+	    check(e);
+	}
+	if (e->done != end)
+	    fail("line ended differently");
+	if (e->cancel)
+	    refLen = 0, e->len = 0;
+	if (e->len != refLen || memcmp(*e->buf, refText, refLen) != 0)
+	    fail("line differs from reference");
+    }
+    printf("editfuzz: %d lines, %lu updates OK\n", lines, iter);
+    free(keys);
+    free(line);
+    free(refText);
+    free(e);
+    exit(0);
+}
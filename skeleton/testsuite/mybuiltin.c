@@ -0,0 +1,68 @@
+/*
+ * mybuiltin.c - Builtins for testing "enable -f" in your tiny shell
+ *
+ * build: make testsuite/mybuiltin.so (run_testcase.sh builds its own)
+ * usage: enable -f ./mybuiltin.so count greet
+ *
+ * count copies its input to its output and reports the lines it saw
+ * and the total so far; it runs in the shell, so the total carries
+ * over from one run to the next. greet prints its argument and how
+ * often it has run; it runs in a child, so that is always once.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tshbuiltin.h"
+
+static long total;
+static int greets;
+
+static int CountInit(void)
+{
+    total = 0;
+    return 0;
+}
+
+static int CountRun(int argc, char **argv, int in, int out, int err)
+{
+    char buf[4096], msg[64];
+    long lines = 0;
+    ssize_t n, i;
+
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+	for (i = 0; i < n; i++)
+	    lines += buf[i] == '\n';
+	if (write(out, buf, n) != n)
+	    return 1;
+    }
+    total += lines;
+    n = snprintf(msg, sizeof(msg), "%ld lines, %ld in all\n", lines, total);
+    return write(out, msg, n) == n ? 0 : 1;
+}
+
+static void CountFini(void)
+{
+    char msg[64];
+    int n = snprintf(msg, sizeof(msg), "count: %ld lines\n", total);
+
+    if (write(STDOUT_FILENO, msg, n) != n)
+	return;
+}
+
+static int GreetRun(int argc, char **argv, int in, int out, int err)
+{
+    char msg[256];
+    int n;
+
+    if (argc != 2) {
+	n = snprintf(msg, sizeof(msg), "usage: %s name\n", argv[0]);
+	return write(err, msg, n) == n ? 2 : 1;
+    }
+    n = snprintf(msg, sizeof(msg), "hello %s, run %d\n", argv[1], ++greets);
+    return write(out, msg, n) == n ? 0 : 1;
+}
+
+tshBuiltinT count_builtin = { TSH_BUILTIN_ABI, TSH_BUILTIN_INPROC,
+                              CountInit, CountRun, CountFini };
+tshBuiltinT greet_builtin = { TSH_BUILTIN_ABI, 0, NULL, GreetRun, NULL };
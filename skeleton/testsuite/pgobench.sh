@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# Parser and spawn microbenchmarks for tsh. With one shell, runs each
+# workload once (the training run of make tsh-pgo). With two, times
+# both on each workload, best of PGO_RUNS runs (default 3), and prints
+# the speedup of the second over the first.
+#
+#   parse   distinct compound statements, each compiled once
+#   loop    a for loop running assignments and builtins
+#   spawn   external commands, each forked and exec'd
+#   pipe    two-stage pipelines
+#   subst   command substitutions of an external command
+
+BASE=$1
+NEW=$2
+RUNS=${PGO_RUNS:-3}
+DIR=`mktemp -d /tmp/pgobench.XXXXXX` || exit 1
+
+trap 'rm -rf ${DIR}' 0 1 2 15
+
+if [ -z "${BASE}" ]; then
+	echo "usage: $0 shell [shell]"
+	exit 2
+fi
+# the workloads run in ${DIR}
+case ${BASE} in /*) ;; *) BASE=`pwd`/${BASE} ;; esac
+case ${NEW} in /*|"") ;; *) NEW=`pwd`/${NEW} ;; esac
+
+awk 'BEGIN { for (i = 0; i < 100000; i++)
+	printf "A=x%d; if false; then echo $A; elif true; then B=y$A; fi\n", i }' \
+	> ${DIR}/parse
+seq 1 100000 > ${DIR}/words
+echo 'for i in $(cat words); do X=$i; true; done' > ${DIR}/loop
+awk 'BEGIN { for (i = 0; i < 2000; i++) print "/bin/true" }' > ${DIR}/spawn
+awk 'BEGIN { for (i = 0; i < 500; i++) print "/bin/echo x | /bin/cat" }' \
+	> ${DIR}/pipe
+awk 'BEGIN { for (i = 0; i < 1000; i++) print "X=$(/bin/echo a)" }' \
+	> ${DIR}/subst
+
+# best <shell> <workload>: prints the best time of RUNS runs in ms
+best()
+{
+	min=
+	n=0
+	while [ ${n} -lt ${RUNS} ]; do
+		start=`date +%s%N`
+		(cd ${DIR}; HOME=${DIR} $1 < $2 > /dev/null 2>&1)
+		end=`date +%s%N`
+		ms=`expr \( ${end} - ${start} \) / 1000000`
+		[ -z "${min}" ] || [ ${ms} -lt ${min} ] && min=${ms}
+		n=`expr ${n} + 1`
+	done
+	echo ${min}
+}
+
+if [ -z "${NEW}" ]; then
+	for w in parse loop spawn pipe subst; do
+		(cd ${DIR}; HOME=${DIR} ${BASE} < ${w} > /dev/null 2>&1)
+	done
+	exit 0
+fi
+
+printf "%-8s %12s %12s %8s\n" workload "`basename ${BASE}` ms" \
+	"`basename ${NEW}` ms" speedup
+for w in parse loop spawn pipe subst; do
+	a=`best ${BASE} ${DIR}/${w}`
+	b=`best ${NEW} ${DIR}/${w}`
+	awk -v w=${w} -v a=${a} -v b=${b} 'BEGIN {
+		printf "%-8s %12d %12d %7.2fx\n", w, a, b, (b > 0 ? a / b : 0) }'
+done
@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# Times redirected copies of a large file through the shell given as
+# $1 (default ../tsh): the cat builtin, which copies with
+# copy_file_range, splice or sendfile, against the cat in PATH, which
+# tsh execs with its descriptors dup2'd onto the files.
+#
+#   BENCH_MB   size of the test file in MiB (default 2048)
+#   BENCH_DIR  where to put the files (default /tmp)
+#
+# Every output is compared with the input before it is removed.
+
+SHELLPROG=${1:-../tsh}
+MB=${BENCH_MB:-2048}
+DIR=`mktemp -d ${BENCH_DIR:-/tmp}/redirbench.XXXXXX` || exit 1
+CAT=`command -v cat`
+fail=0
+
+trap 'rm -rf ${DIR}' 0 1 2 15
+
+echo "creating ${MB} MiB test file"
+head -c `expr ${MB} \* 1048576` /dev/urandom > ${DIR}/in || exit 1
+
+# run <label> <command line>: times one line in a fresh shell
+run()
+{
+	rm -f ${DIR}/out
+	start=`date +%s%N`
+	echo "cd ${DIR}; $2" | ${SHELLPROG} > /dev/null
+	end=`date +%s%N`
+	ms=`expr \( ${end} - ${start} \) / 1000000`
+	[ ${ms} -gt 0 ] || ms=1
+	printf "%-34s %8d ms %8d MiB/s\n" "$1" ${ms} `expr ${MB} \* 1000 / ${ms}`
+	if [ -e ${DIR}/out ] && ! cmp -s ${DIR}/in ${DIR}/out; then
+		echo "$1: output differs"
+		fail=1
+	fi
+}
+
+run "cat > file"             "cat in > out"
+run "${CAT} > file"          "${CAT} in > out"
+run "cat < file > file"      "cat < in > out"
+run "cat >> file"            "cat in >> out"
+run "${CAT} >> file"         "${CAT} in >> out"
+run "cat | cat > file"       "cat in | cat > out"
+run "${CAT} | ${CAT} > file" "${CAT} in | ${CAT} > out"
+run "cat > /dev/null"        "cat in > /dev/null"
+run "${CAT} > /dev/null"     "${CAT} in > /dev/null"
+
+exit ${fail}
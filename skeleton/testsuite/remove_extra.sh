@@ -1,3 +1,4 @@
 rm ~/.bashrc
 mv ~/.bashrc_orig ~/.bashrc
 rm ~/.tshrc
+rm -f ~/.tshrc.snap
@@ -48,6 +48,7 @@ sh ${TC_DIR}/setup.sh;
 cp ${TC_DIR}/${SDRIVER} .;
 cp ${TC_DIR}/${ORIG} .;
 gcc ${TC_DIR}/myspin.c -o myspin
+gcc -shared -fPIC -I ${SRCDIR} ${TC_DIR}/mybuiltin.c -o mybuiltin.so
 
 # Compile the code
 echo "COMPILE"
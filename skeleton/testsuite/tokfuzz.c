@@ -0,0 +1,181 @@
+/*
+ * tokfuzz.c - Differential fuzz test for the tsh tokenizer
+ *
+ * usage: tokfuzz [iterations [seed]]
+ * Feeds random command lines to getCommand and to a copy of the
+ * original character-at-a-time parser and checks that both produce
+ * the same argv. Lines mix long plain runs (to exercise the vector
+ * scanner) with spaces, quotes and backslashes. Exits non-zero and
+ * prints the offending line on the first mismatch.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../config.h"
+#include "../runtime.h"
+
+extern commandT *getCommand(char *cmdLine);
+extern void freeCommand(commandT *cmd);
+
+/* interpreter.c calls ScriptFeed from Interpret; never reached here */
+bool ScriptFeed(char *line)
+{
+    abort();
+}
+
+/* Interpret counts the line in the shared metrics; nothing to count */
+void MetricsAdd(int counter)
+{
+}
+
+/*
+ * refGetCommand - the parser as it was before the vector fast path,
+ * with only the buffer sizes changed so long lines fit.
+ */
+static commandT *refGetCommand(char *cmdLine)
+{
+    size_t len = strlen(cmdLine);
+    commandT *cmd = malloc(sizeof(commandT) + sizeof(char *) * (len + 2));
+    cmd->argv[0] = 0;
+    cmd->name = 0;
+    cmd->argc = 0;
+
+    int i, inArg = 0;
+    char quote = 0;
+    char escape = 0;
+
+    char *tmp = malloc(len + 1);
+    int tmpLen = 0;
+    tmp[0] = 0;
+
+    for (i = 0; cmdLine[i] != 0; i++) {
+	if (cmdLine[i] == ' ') {
+	    if (inArg == 0)
+		continue;
+	    if (quote == 0) {
+		cmd->argv[cmd->argc] = malloc(sizeof(char) * (tmpLen + 1));
+		strcpy(cmd->argv[cmd->argc], tmp);
+		inArg = 0;
+		tmp[0] = 0;
+		tmpLen = 0;
+		cmd->argc++;
+		cmd->argv[cmd->argc] = 0;
+		continue;
+	    }
+	}
+	inArg = 1;
+	if (cmdLine[i] == '\'' || cmdLine[i] == '"') {
+	    if (escape != 0 && quote != 0 && cmdLine[i] == quote) {
+		tmp[tmpLen++] = cmdLine[i];
+		tmp[tmpLen] = 0;
+		escape = 0;
+		continue;
+	    }
+	    if (quote == 0) {
+		quote = cmdLine[i];
+		continue;
+	    } else if (cmdLine[i] == quote) {
+		quote = 0;
+		continue;
+	    }
+	}
+	if (cmdLine[i] == '\\' && escape == '\\') {
+	    escape = 0;
+	    tmp[tmpLen++] = '\\';
+	    tmp[tmpLen] = 0;
+	    continue;
+	}
+	if (escape == '\\') {
+	    if (quote != 0) {
+		tmp[tmpLen++] = '\\';
+		tmp[tmpLen] = 0;
+	    }
+	    escape = 0;
+	}
+	if (cmdLine[i] == '\\') {
+	    escape = '\\';
+	    continue;
+	}
+	tmp[tmpLen++] = cmdLine[i];
+	tmp[tmpLen] = 0;
+    }
+    if (tmpLen > 0) {
+	cmd->argv[cmd->argc] = malloc(sizeof(char) * (tmpLen + 1));
+	strcpy(cmd->argv[cmd->argc], tmp);
+	cmd->argc++;
+	cmd->argv[cmd->argc] = 0;
+    }
+    free(tmp);
+    cmd->name = cmd->argv[0];
+    return cmd;
+}
+
+/* fill buf with a random line of exactly len bytes */
+static void randomLine(char *buf, int len)
+{
+    static const char special[] = " '\"\\";
+    int i = 0;
+
+    while (i < len) {
+	int r = rand() % 8;
+	if (r < 3) {
+	    /* a plain run, sometimes long enough to span several vectors */
+	    int n = rand() % (r == 0 ? 200 : 20) + 1;
+	    while (n-- > 0 && i < len)
+		buf[i++] = 'a' + rand() % 26;
+	} else if (r < 6) {
+	    buf[i++] = special[rand() % 4];
+	} else {
+	    buf[i++] = 33 + rand() % 94;
+	}
+    }
+    buf[len] = 0;
+}
+
+static int sameCommand(commandT *a, commandT *b)
+{
+    int i;
+
+    if (a->argc != b->argc)
+	return 0;
+    for (i = 0; i <= a->argc; i++) {
+	if (a->argv[i] == NULL || b->argv[i] == NULL) {
+	    if (a->argv[i] != b->argv[i])
+		return 0;
+	} else if (strcmp(a->argv[i], b->argv[i]) != 0)
+	    return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    int iters = argc > 1 ? atoi(argv[1]) : 20000;
+    unsigned seed = argc > 2 ? (unsigned) atoi(argv[2]) : 343;
+    char *line = malloc(40001);
+    int i, j;
+
+    srand(seed);
+    for (i = 0; i < iters; i++) {
+	int len = rand() % 4 == 0 ? rand() % 40000 : rand() % 300;
+	randomLine(line, len);
+
+	commandT *got = getCommand(line);
+	commandT *want = refGetCommand(line);
+	if (!sameCommand(got, want)) {
+	    printf("mismatch at iteration %d (seed %u)\nline: [%s]\n",
+		   i, seed, line);
+	    for (j = 0; j < want->argc || j < got->argc; j++)
+		printf("  %d: want [%s] got [%s]\n", j,
+		       j < want->argc ? want->argv[j] : "",
+		       j < got->argc ? got->argv[j] : "");
+	    exit(1);
+	}
+	freeCommand(got);
+	freeCommand(want);
+    }
+    printf("tokfuzz: %d lines OK\n", iters);
+    free(line);
+    exit(0);
+}
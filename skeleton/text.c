@@ -0,0 +1,1391 @@
+/***************************************************************************
+ *  Title: Text
+ * -------------------------------------------------------------------------
+ *    Purpose: The wc, head and tail builtins, which count and cut
+ *    lines of text without forking
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: text.c,v $
+ ***************************************************************************/
+#define _GNU_SOURCE
+#define __TEXT_IMPL__
+
+/************System include***********************************************/
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wchar.h>
+#include <wctype.h>
+#if defined(__x86_64__) && !defined(TSH_NO_SIMD)
+#define TEXT_SIMD
+#include <immintrin.h>
+#endif
+
+/************Private include**********************************************/
+#include "text.h"
+#include "io.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* bytes read at a time */
+#define TEXTBLOCK (1 << 18)
+
+/* the most one sendfile is asked to move */
+#define TEXTSEND (1 << 30)
+
+/* what went wrong with a file, besides opening it */
+#define T_READ 1
+#define T_WRITE 2
+
+/* how a byte or character stands to words, for wc -w */
+#define W_OTHER 0
+#define W_SPACE 1
+#define W_PRINT 2
+
+/* what a wc, head or tail command line asks for */
+typedef struct text_opts_t
+{
+  char* tool;
+  bool lines;       /* wc: the counts to print */
+  bool words;
+  bool bytes;
+  bool chars;       /* head, tail: count bytes rather than lines */
+  bool start;       /* tail: count from the start, for +N */
+  long long n;      /* head, tail: how many lines or bytes */
+  int verbose;      /* 1 for -v, -1 for -q */
+  bool first;       /* no header printed yet */
+  int nfiles;
+  char** files;     /* the operands, room for argc of them */
+} textOptsT;
+
+/* what wc counted in a file */
+typedef struct text_counts_t
+{
+  long long lines;
+  long long words;
+  long long bytes;
+} textCountsT;
+
+/************Global Variables*********************************************/
+
+/* the block files are read into; the builtins never run at once */
+static char gBlock[TEXTBLOCK];
+
+/************Function Prototypes******************************************/
+/* reads the options and operands of a command line */
+static bool
+TextParse(commandT*, textOptsT*);
+/* reads the N of -n N or -c N */
+static bool
+TextCount(char*, bool, textOptsT*);
+/* tells whether a command line is wc, head or tail */
+static bool
+IsTextTool(char*);
+/* opens an operand, "-" being standard input */
+static int
+TextOpen(char*);
+/* finds the offset and size of a regular file */
+static bool
+TextSeekable(int, off_t*, off_t*);
+/* reads, at an offset unless it is negative, retrying on EINTR */
+static ssize_t
+TextRead(int, char*, size_t, off_t);
+/* writes bytes to the standard output */
+static bool
+TextPut(char*, size_t);
+/* writes part of a regular file to the standard output */
+static int
+TextSend(int, off_t*, off_t);
+/* copies the rest of a descriptor to the standard output */
+static int
+TextRest(int);
+/* prints the header before a file */
+static void
+TextHeader(textOptsT*, char*);
+/* reports an error with errno and sets $? */
+static void
+TextError(char*, char*, char*);
+/* counts newlines */
+static size_t
+Newlines(const char*, size_t);
+/* finds the nth newline */
+static char*
+NthFromStart(char*, size_t, long long*);
+/* finds the nth newline from the end */
+static char*
+NthFromEnd(char*, size_t, long long*);
+/* counts one file for wc */
+static bool
+WcFile(int, textOptsT*, textCountsT*);
+/* counts the words in a block */
+static long long
+WcWords(unsigned char*, size_t, bool*, mbstate_t*);
+/* finds the width of wc's columns */
+static int
+WcWidth(textOptsT*);
+/* prints one line of counts */
+static void
+WcPrint(textOptsT*, textCountsT*, int, char*);
+/* the name of a file in wc's messages */
+static char*
+WcQuote(char*, char*, size_t);
+/* prints the start of one file for head */
+static int
+HeadFile(int, textOptsT*);
+/* prints the end of one file for tail */
+static int
+TailFile(int, textOptsT*);
+/* prints a large regular file from the lines or bytes at its end */
+static int
+TailBack(int, textOptsT*, off_t, off_t);
+/* prints a file from a line or byte counted from its start */
+static int
+TailFrom(int, textOptsT*);
+/* where the lines or bytes tail prints start in a buffer */
+static size_t
+TailStart(char*, size_t, textOptsT*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+/*
+ * RunWc
+ *
+ * arguments:
+ *   commandT *cmd: the wc command line
+ *
+ * returns: none
+ *
+ * Implements "wc [-lwc] [file]...", counting lines, words and bytes of
+ * each file, or standard input for "-" or no file, and their total if
+ * there are several. Output and messages are those of GNU wc,
+ * column widths included. Words are told apart as in the locale the
+ * environment names, which is made the thread's own while counting
+ * them. Only bytes of a regular file are taken from its size.
+ */
+void
+RunWc(commandT* cmd)
+{
+  char* files[cmd->argc + 1];
+  locale_t loc = (locale_t) 0, old = (locale_t) 0;
+  textCountsT total, c;
+  textOptsT o;
+  char quoted[PATH_MAX + 3];
+  char* name;
+  int i, fd, width;
+
+  o.files = files;
+  if (!TextParse(cmd, &o))
+    return;
+  if (!o.lines && !o.words && !o.bytes)
+    o.lines = o.words = o.bytes = TRUE;
+  if (o.words && (loc = newlocale(LC_CTYPE_MASK, "", (locale_t) 0)) != 0)
+    old = uselocale(loc);
+  width = WcWidth(&o);
+  memset(&total, 0, sizeof(total));
+  for (i = 0; i < (o.nfiles == 0 ? 1 : o.nfiles); i++)
+    {
+      name = o.nfiles == 0 ? NULL : files[i];
+      if ((fd = TextOpen(name == NULL ? "-" : name)) < 0)
+        {
+          TextError("wc", "%s", WcQuote(name, quoted, sizeof(quoted)));
+          continue;
+        }
+      if (!WcFile(fd, &o, &c))
+        TextError("wc", "%s", WcQuote(name, quoted, sizeof(quoted)));
+      WcPrint(&o, &c, width, name);
+      total.lines += c.lines;
+      total.words += c.words;
+      total.bytes += c.bytes;
+      if (fd != STDIN_FILENO)
+        close(fd);
+    }
+  if (o.nfiles > 1)
+    WcPrint(&o, &total, width, "total");
+  if (loc != 0)
+    {
+      uselocale(old);
+      freelocale(loc);
+    }
+  fflush(stdout);
+} /* RunWc */
+
+
+/*
+ * RunHead
+ *
+ * arguments:
+ *   commandT *cmd: the head command line
+ *
+ * returns: none
+ *
+ * Implements "head [-qv] [-n N | -c N] [file]...", printing the first
+ * N lines, or bytes, of each file, by default 10 lines. With several
+ * files each is headed by its name unless -q is given, as with -v
+ * even for one. Of a regular file, the end of what to print is found
+ * first, with pread, and the range is then sent with sendfile; the
+ * file is left at the end of it, so a command reading the same input
+ * next carries on from there.
+ */
+void
+RunHead(commandT* cmd)
+{
+  char* files[cmd->argc + 1];
+  textOptsT o;
+  char* name;
+  int i, fd, r;
+
+  o.files = files;
+  if (!TextParse(cmd, &o))
+    return;
+  if (o.nfiles == 0)
+    files[o.nfiles++] = "-";
+  if (o.verbose == 0)
+    o.verbose = o.nfiles > 1 ? 1 : -1;
+  for (i = 0; i < o.nfiles; i++)
+    {
+      name = strcmp(files[i], "-") == 0 ? "standard input" : files[i];
+      if ((fd = TextOpen(files[i])) < 0)
+        {
+          TextError("head", "cannot open '%s' for reading", name);
+          continue;
+        }
+      TextHeader(&o, name);
+      r = HeadFile(fd, &o);
+      if (fd != STDIN_FILENO)
+        close(fd);
+      if (r == T_READ)
+        TextError("head", "error reading '%s'", name);
+      else if (r == T_WRITE)
+        {
+          TextError("head", "error writing '%s'", "standard output");
+          break;
+        }
+    }
+  fflush(stdout);
+} /* RunHead */
+
+
+/*
+ * RunTail
+ *
+ * arguments:
+ *   commandT *cmd: the tail command line
+ *
+ * returns: none
+ *
+ * Implements "tail [-qv] [-n [+]N | -c [+]N] [file]...", printing the
+ * last N lines, or bytes, of each file, by default 10 lines, or with
+ * +N all from the Nth on. Headers are as for head. A regular file
+ * too large for one block is read backward from its end, a block at a
+ * time, and what is found is sent with sendfile; anything else is
+ * read through, keeping only what may still be printed. With N of 0
+ * and no +, nothing is opened.
+ */
+void
+RunTail(commandT* cmd)
+{
+  char* files[cmd->argc + 1];
+  textOptsT o;
+  char* name;
+  int i, fd, r;
+
+  o.files = files;
+  if (!TextParse(cmd, &o) || (o.n == 0 && !o.start))
+    return;
+  if (o.nfiles == 0)
+    files[o.nfiles++] = "-";
+  if (o.verbose == 0)
+    o.verbose = o.nfiles > 1 ? 1 : -1;
+  for (i = 0; i < o.nfiles; i++)
+    {
+      name = strcmp(files[i], "-") == 0 ? "standard input" : files[i];
+      if ((fd = TextOpen(files[i])) < 0)
+        {
+          TextError("tail", "cannot open '%s' for reading", name);
+          continue;
+        }
+      TextHeader(&o, name);
+      r = o.start ? TailFrom(fd, &o) : TailFile(fd, &o);
+      if (fd != STDIN_FILENO)
+        close(fd);
+      if (r == T_READ)
+        TextError("tail", "error reading '%s'", name);
+      else if (r == T_WRITE)
+        {
+          TextError("tail", "error writing '%s'", "standard output");
+          break;
+        }
+    }
+  fflush(stdout);
+} /* RunTail */
+
+
+/*
+ * TextExternal
+ *
+ * arguments:
+ *   commandT *cmd: a command line, without redirections
+ *   int in: the descriptor it would read as standard input, or -1
+ *
+ * returns: bool: TRUE if it is a wc, head or tail the builtins leave
+ *                to PATH
+ *
+ * That is one with an option TextParse does not know, such as wc -m,
+ * head -n -N or tail -f, and one that would read a terminal: the
+ * shell cannot be stopped or interrupted like a job.
+ */
+bool
+TextExternal(commandT* cmd, int in)
+{
+  char* files[cmd->argc + 1];
+  textOptsT o;
+  int i;
+
+  if (!IsTextTool(cmd->argv[0]))
+    return FALSE;
+  o.files = files;
+  if (!TextParse(cmd, &o))
+    return TRUE;
+  if (in < 0 || !isatty(in))
+    return FALSE;
+  for (i = 0; i < o.nfiles; i++)
+    if (strcmp(files[i], "-") == 0)
+      return TRUE;
+  return o.nfiles == 0;
+} /* TextExternal */
+
+
+/*
+ * TextPure
+ *
+ * arguments:
+ *   commandT *cmd: a command line, with its redirections
+ *
+ * returns: bool: TRUE if the shell can run it in a substitution
+ *
+ * A substitution catches what the shell writes through stdout, not
+ * its descriptor, so the builtin may have input and error output
+ * redirected but not its output.
+ */
+bool
+TextPure(commandT* cmd)
+{
+  commandT* c;
+  bool pure = TRUE, in = FALSE;
+  int i, j;
+
+  if (!IsTextTool(cmd->argv[0]))
+    return FALSE;
+  c = malloc(sizeof(commandT) + sizeof(char*) * (cmd->argc + 1));
+  for (i = j = 0; i < cmd->argc; i++)
+    if (cmd->argv[i][0] == REDIRMARK[0])
+      {
+        if (cmd->argv[i][1] == '<')
+          in = TRUE;
+        else if (cmd->argv[i][1] != '2')
+          pure = FALSE;
+        i++; // the file
+      }
+    else
+      c->argv[j++] = cmd->argv[i];
+  c->argv[j] = NULL;
+  c->argc = j;
+  c->name = c->argv[0];
+  pure = pure && !TextExternal(c, in ? -1 : STDIN_FILENO);
+  free(c);
+  return pure;
+} /* TextPure */
+
+
+/*
+ * TextParse
+ *
+ * arguments:
+ *   commandT *cmd: a wc, head or tail command line
+ *   textOptsT *o: receives what it asks for; o->files must have room
+ *                 for argc operands
+ *
+ * returns: bool: FALSE for an option the builtin does not know
+ *
+ * Options may come after operands, as getopt allows, up to "--". wc
+ * takes -l, -w, -c and their long names. head and tail take -n N,
+ * -c N, --lines=N, --bytes=N, -q, -v and their long names, and -N as
+ * the first word; tail also +N for the counts. N is plain digits: a
+ * suffix, or for head a negative count, goes to PATH.
+ */
+static bool
+TextParse(commandT* cmd, textOptsT* o)
+{
+  bool wc = strcmp(cmd->argv[0], "wc") == 0;
+  bool tail = strcmp(cmd->argv[0], "tail") == 0;
+  bool dashes = FALSE;
+  char* a;
+  char* v;
+  int i, k;
+
+  o->tool = cmd->argv[0];
+  o->lines = o->words = o->bytes = o->chars = o->start = FALSE;
+  o->n = 10;
+  o->verbose = 0;
+  o->first = TRUE;
+  o->nfiles = 0;
+  for (i = 1; i < cmd->argc; i++)
+    {
+      a = cmd->argv[i];
+      if (dashes || a[0] != '-' || a[1] == 0)
+        o->files[o->nfiles++] = a;
+      else if (strcmp(a, "--") == 0)
+        dashes = TRUE;
+      else if (wc && a[1] == '-')
+        {
+          if (strcmp(a, "--lines") == 0)
+            o->lines = TRUE;
+          else if (strcmp(a, "--words") == 0)
+            o->words = TRUE;
+          else if (strcmp(a, "--bytes") == 0)
+            o->bytes = TRUE;
+          else
+            return FALSE;
+        }
+      else if (a[1] == '-')
+        {
+          if (strcmp(a, "--quiet") == 0 || strcmp(a, "--silent") == 0)
+            o->verbose = -1;
+          else if (strcmp(a, "--verbose") == 0)
+            o->verbose = 1;
+          else if ((strncmp(a, "--lines", 7) == 0
+                    || strncmp(a, "--bytes", 7) == 0)
+                   && (a[7] == 0 || a[7] == '='))
+            {
+              v = a[7] == '=' ? a + 8 : cmd->argv[++i];
+              if (!TextCount(v, tail, o))
+                return FALSE;
+              o->chars = a[2] == 'b';
+            }
+          else
+            return FALSE;
+        }
+      else if (!wc && i == 1 && isdigit((unsigned char) a[1]))
+        {
+          if (!TextCount(a + 1, FALSE, o))
+            return FALSE;
+          o->chars = FALSE;
+        }
+      else
+        for (k = 1; a[k] != 0; k++)
+          {
+            if (wc && (a[k] == 'l' || a[k] == 'w' || a[k] == 'c'))
+              {
+                o->lines |= a[k] == 'l';
+                o->words |= a[k] == 'w';
+                o->bytes |= a[k] == 'c';
+              }
+            else if (!wc && (a[k] == 'q' || a[k] == 'v'))
+              o->verbose = a[k] == 'q' ? -1 : 1;
+            else if (!wc && (a[k] == 'n' || a[k] == 'c'))
+              {
+                v = a[k + 1] != 0 ? a + k + 1 : cmd->argv[++i];
+                if (!TextCount(v, tail, o))
+                  return FALSE;
+                o->chars = a[k] == 'c';
+                break;
+              }
+            else
+              return FALSE;
+          }
+    }
+  return TRUE;
+} /* TextParse */
+
+
+/*
+ * TextCount
+ *
+ * arguments:
+ *   char *v: the count, or NULL if it is missing
+ *   bool tail: whether a sign is allowed
+ *   textOptsT *o: receives the count and, for tail, whether it had a +
+ *
+ * returns: bool: FALSE if it is not one the builtins take
+ */
+static bool
+TextCount(char* v, bool tail, textOptsT* o)
+{
+  int i;
+
+  if (v == NULL)
+    return FALSE;
+  o->start = FALSE;
+  if (tail && (v[0] == '+' || v[0] == '-'))
+    o->start = *v++ == '+';
+  for (i = 0; isdigit((unsigned char) v[i]); i++)
+    ;
+  if (i == 0 || i > 18 || v[i] != 0)
+    return FALSE;
+  o->n = atoll(v);
+  return TRUE;
+} /* TextCount */
+
+
+/*
+ * IsTextTool
+ *
+ * arguments:
+ *   char *name: a command name
+ *
+ * returns: bool: TRUE for wc, head and tail
+ */
+static bool
+IsTextTool(char* name)
+{
+  return strcmp(name, "wc") == 0 || strcmp(name, "head") == 0
+    || strcmp(name, "tail") == 0;
+} /* IsTextTool */
+
+
+/*
+ * TextOpen
+ *
+ * arguments:
+ *   char *name: a file, or "-"
+ *
+ * returns: int: a descriptor to read, or -1 with errno set
+ */
+static int
+TextOpen(char* name)
+{
+  if (strcmp(name, "-") == 0)
+    return STDIN_FILENO;
+  return open(name, O_RDONLY | O_CLOEXEC);
+} /* TextOpen */
+
+
+/*
+ * TextSeekable
+ *
+ * arguments:
+ *   int fd: an open file
+ *   off_t *pos: receives its offset
+ *   off_t *size: receives its size
+ *
+ * returns: bool: TRUE if it is a regular file that can be read at
+ *                offsets
+ */
+static bool
+TextSeekable(int fd, off_t* pos, off_t* size)
+{
+  struct stat st;
+
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    return FALSE;
+  *size = st.st_size;
+  return (*pos = lseek(fd, 0, SEEK_CUR)) >= 0;
+} /* TextSeekable */
+
+
+/*
+ * TextRead
+ *
+ * arguments:
+ *   int fd: the file
+ *   char *buf: where to read
+ *   size_t len: the most to read
+ *   off_t off: where to read from with pread, or -1 to read
+ *
+ * returns: ssize_t: bytes read, 0 at the end, or -1 with errno set
+ */
+static ssize_t
+TextRead(int fd, char* buf, size_t len, off_t off)
+{
+  ssize_t n;
+
+  do
+    n = off < 0 ? read(fd, buf, len) : pread(fd, buf, len, off);
+  while (n < 0 && errno == EINTR);
+  return n;
+} /* TextRead */
+
+
+/*
+ * TextPut
+ *
+ * arguments:
+ *   char *p: the bytes
+ *   size_t len: how many
+ *
+ * returns: bool: FALSE after an error, with errno set
+ *
+ * Inside a substitution stdout is the shell's capture and has no
+ * descriptor; otherwise what stdout holds, such as a header, is
+ * flushed first and the bytes are written to the descriptor at once.
+ */
+static bool
+TextPut(char* p, size_t len)
+{
+  ssize_t n;
+
+  if (fileno(stdout) < 0)
+    return fwrite(p, 1, len, stdout) == len;
+  fflush(stdout);
+  while (len > 0)
+    {
+      if ((n = write(STDOUT_FILENO, p, len)) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return FALSE;
+        }
+      p += n;
+      len -= n;
+    }
+  return TRUE;
+} /* TextPut */
+
+
+/*
+ * TextSend
+ *
+ * arguments:
+ *   int fd: a regular file
+ *   off_t *off: where to start; moved past what is sent
+ *   off_t len: the most to send
+ *
+ * returns: int: 0, or T_READ or T_WRITE with errno set
+ *
+ * Sends with sendfile, which leaves the file's own offset alone and
+ * stops at its end. Where sendfile cannot, as into an O_APPEND file
+ * or a substitution, the range goes through the block.
+ */
+static int
+TextSend(int fd, off_t* off, off_t len)
+{
+  ssize_t n = 1;
+
+  if (fileno(stdout) >= 0)
+    {
+      fflush(stdout);
+      while (len > 0
+             && ((n = sendfile(STDOUT_FILENO, fd, off, MIN(len, TEXTSEND))) > 0
+                 || (n < 0 && errno == EINTR)))
+        if (n > 0)
+          len -= n;
+      if (n >= 0)
+        return 0;
+      if (errno != EINVAL && errno != ENOSYS)
+        return T_WRITE;
+    }
+  while (len > 0 && (n = TextRead(fd, gBlock, MIN(len, TEXTBLOCK), *off)) > 0)
+    {
+      if (!TextPut(gBlock, n))
+        return T_WRITE;
+      *off += n;
+      len -= n;
+    }
+  return n < 0 ? T_READ : 0;
+} /* TextSend */
+
+
+/*
+ * TextRest
+ *
+ * arguments:
+ *   int fd: a file that is not read at offsets
+ *
+ * returns: int: 0, or T_READ or T_WRITE with errno set
+ *
+ * Copies what is left with CopyFd, so a pipe goes on with splice,
+ * unless the output is a substitution's.
+ */
+static int
+TextRest(int fd)
+{
+  struct stat st;
+  ssize_t n;
+
+  if (fstat(fd, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+      errno = EISDIR;
+      return T_READ;
+    }
+  if (fileno(stdout) >= 0)
+    {
+      fflush(stdout);
+      return CopyFd(fd, STDOUT_FILENO) ? 0 : T_WRITE;
+    }
+  while ((n = TextRead(fd, gBlock, TEXTBLOCK, -1)) > 0)
+    if (!TextPut(gBlock, n))
+      return T_WRITE;
+  return n < 0 ? T_READ : 0;
+} /* TextRest */
+
+
+/*
+ * TextHeader
+ *
+ * arguments:
+ *   textOptsT *o: the options, with verbose set once there are headers
+ *   char *name: the file's name
+ *
+ * returns: none
+ */
+static void
+TextHeader(textOptsT* o, char* name)
+{
+  if (o->verbose <= 0)
+    return;
+  printf("%s==> %s <==\n", o->first ? "" : "\n", name);
+  o->first = FALSE;
+} /* TextHeader */
+
+
+/*
+ * TextError
+ *
+ * arguments:
+ *   char *tool: the builtin
+ *   char *what: a format with one %s for the name
+ *   char *name: the file
+ *
+ * returns: none
+ *
+ * Prints what errno says after the message, once what is printed so
+ * far is out, and sets $? to 1.
+ */
+static void
+TextError(char* tool, char* what, char* name)
+{
+  int err = errno;
+
+  fflush(stdout);
+  fprintf(stderr, "%s: ", tool);
+  fprintf(stderr, what, name);
+  fprintf(stderr, ": %s\n", strerror(err));
+  lastStatus = 1;
+} /* TextError */
+
+
+/*
+ * NewlinesScalar
+ *
+ * arguments:
+ *   const char *s: the bytes
+ *   size_t n: how many
+ *
+ * returns: size_t: the number of newlines among them
+ *
+ * Portable version of the newline counter.
+ */
+static size_t
+NewlinesScalar(const char* s, size_t n)
+{
+  size_t i, k = 0;
+
+  for (i = 0; i < n; i++)
+    k += s[i] == '\n';
+  return k;
+} /* NewlinesScalar */
+
+
+#ifdef TEXT_SIMD
+/*
+ * NewlinesSSE2
+ *
+ * Same contract as NewlinesScalar. A compare gives -1 in each byte
+ * that is a newline, and subtracting it counts up in that byte; 255
+ * vectors later, before a byte can wrap, sad_epu8 adds the bytes into
+ * two 64-bit totals. The tail shorter than a vector is handed to the
+ * scalar version.
+ */
+static size_t
+NewlinesSSE2(const char* s, size_t n)
+{
+  const __m128i nl = _mm_set1_epi8('\n');
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sum = zero, acc;
+  size_t i = 0;
+  int k;
+
+  while (i + 16 <= n)
+    {
+      acc = zero;
+      for (k = 0; k < 255 && i + 16 <= n; k++, i += 16)
+        acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(
+          _mm_loadu_si128((const __m128i*) (s + i)), nl));
+      sum = _mm_add_epi64(sum, _mm_sad_epu8(acc, zero));
+    }
+  return _mm_cvtsi128_si64(sum)
+    + _mm_cvtsi128_si64(_mm_unpackhi_epi64(sum, sum))
+    + NewlinesScalar(s + i, n - i);
+} /* NewlinesSSE2 */
+
+
+/*
+ * NewlinesAVX2
+ *
+ * Same contract as NewlinesScalar, 32 bytes at a time, with four
+ * totals. Only called when the CPU reports AVX2 support.
+ */
+__attribute__((target("avx2")))
+static size_t
+NewlinesAVX2(const char* s, size_t n)
+{
+  const __m256i nl = _mm256_set1_epi8('\n');
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i sum = zero, acc;
+  size_t i = 0;
+  int k;
+
+  while (i + 32 <= n)
+    {
+      acc = zero;
+      for (k = 0; k < 255 && i + 32 <= n; k++, i += 32)
+        acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(
+          _mm256_loadu_si256((const __m256i*) (s + i)), nl));
+      sum = _mm256_add_epi64(sum, _mm256_sad_epu8(acc, zero));
+    }
+  return _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1)
+    + _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3)
+    + NewlinesSSE2(s + i, n - i);
+} /* NewlinesAVX2 */
+#endif /* TEXT_SIMD */
+
+
+/*
+ * Newlines
+ *
+ * Dispatches to the widest newline counter the CPU supports. The
+ * choice is made once, on the first call.
+ */
+static size_t
+Newlines(const char* s, size_t n)
+{
+#ifdef TEXT_SIMD
+  static size_t (*count)(const char*, size_t) = NULL;
+
+  if (count == NULL)
+    {
+      __builtin_cpu_init();
+      count = __builtin_cpu_supports("avx2") ? NewlinesAVX2 : NewlinesSSE2;
+    }
+  return count(s, n);
+#else
+  return NewlinesScalar(s, n);
+#endif
+} /* Newlines */
+
+
+/*
+ * NthFromStart
+ *
+ * arguments:
+ *   char *p: the bytes
+ *   size_t len: how many
+ *   long long *need: which newline to find, at least 1
+ *
+ * returns: char*: the newline, or NULL with need lowered by the number
+ *                 of newlines there are
+ *
+ * The newlines are counted first, so a block without enough of them
+ * is passed over at the speed of Newlines.
+ */
+static char*
+NthFromStart(char* p, size_t len, long long* need)
+{
+  long long k = Newlines(p, len);
+  char* end = p + len;
+
+  if (k < *need)
+    {
+      *need -= k;
+      return NULL;
+    }
+  for (p = memchr(p, '\n', len); --*need > 0;
+       p = memchr(p + 1, '\n', end - p - 1))
+    ;
+  return p;
+} /* NthFromStart */
+
+
+/*
+ * NthFromEnd
+ *
+ * Same as NthFromStart, counting from the end.
+ */
+static char*
+NthFromEnd(char* p, size_t len, long long* need)
+{
+  long long k = Newlines(p, len);
+  char* nl;
+
+  if (k < *need)
+    {
+      *need -= k;
+      return NULL;
+    }
+  for (nl = memrchr(p, '\n', len); --*need > 0; nl = memrchr(p, '\n', nl - p))
+    ;
+  return nl;
+} /* NthFromEnd */
+
+
+/*
+ * WcFile
+ *
+ * arguments:
+ *   int fd: the file
+ *   textOptsT *o: the counts asked for
+ *   textCountsT *c: receives the counts
+ *
+ * returns: bool: FALSE after a read error, with errno set and what was
+ *                counted before it in c
+ *
+ * Bytes alone of a regular file are its size less the offset, then
+ * what is read past that size. GNU wc trusts no size that is a
+ * multiple of the page size, as a file in /proc or /sys has, and
+ * reads those through.
+ */
+static bool
+WcFile(int fd, textOptsT* o, textCountsT* c)
+{
+  bool wide = o->words && MB_CUR_MAX > 1;
+  bool in = FALSE;
+  off_t pos, size;
+  mbstate_t mb;
+  ssize_t n;
+
+  memset(c, 0, sizeof(textCountsT));
+  memset(&mb, 0, sizeof(mb));
+  if (o->bytes && !o->lines && !o->words && TextSeekable(fd, &pos, &size)
+      && size % getpagesize() != 0 && pos < size
+      && lseek(fd, size, SEEK_SET) == size)
+    c->bytes = size - pos;
+  while ((n = TextRead(fd, gBlock, TEXTBLOCK, -1)) > 0)
+    {
+      c->bytes += n;
+      if (o->lines)
+        c->lines += Newlines(gBlock, n);
+      if (o->words)
+        c->words += WcWords((unsigned char*) gBlock, n, &in,
+                            wide ? &mb : NULL);
+    }
+  return n == 0;
+} /* WcFile */
+
+
+/*
+ * WcWords
+ *
+ * arguments:
+ *   unsigned char *s: a block of the file
+ *   size_t len: its length
+ *   bool *in: whether a word is open, carried from block to block
+ *   mbstate_t *mb: the state of a multibyte locale, or NULL for bytes
+ *
+ * returns: long long: the number of words started in the block
+ *
+ * As in GNU wc, a word starts at a printable character and ends at a
+ * space, which here includes the no-break spaces; other characters,
+ * and bytes that are no character, do neither. ASCII outside a
+ * multibyte character is told apart without the locale. A character
+ * split between blocks is finished from mb.
+ */
+static long long
+WcWords(unsigned char* s, size_t len, bool* in, mbstate_t* mb)
+{
+  unsigned char* end = s + len;
+  long long words = 0;
+  wchar_t wc;
+  size_t k;
+  int w;
+
+  while (s < end)
+    {
+      if (mb == NULL || (*s < 0x80 && mbsinit(mb)))
+        {
+          w = *s == ' ' || (*s >= '\t' && *s <= '\r') ? W_SPACE
+            : *s > ' ' && *s < 0x7f ? W_PRINT : W_OTHER;
+          s++;
+        }
+      else
+        {
+          k = mbrtowc(&wc, (char*) s, end - s, mb);
+          if (k == (size_t) -2)
+            break;
+          if (k == (size_t) -1)
+            {
+              memset(mb, 0, sizeof(mbstate_t));
+              s++;
+              continue;
+            }
+          s += k == 0 ? 1 : k;
+          w = iswspace(wc) || wc == 0xa0 || wc == 0x2007 || wc == 0x202f
+            || wc == 0x2060 ? W_SPACE : iswprint(wc) ? W_PRINT : W_OTHER;
+        }
+      if (w == W_SPACE)
+        *in = FALSE;
+      else if (w == W_PRINT && !*in)
+        {
+          *in = TRUE;
+          words++;
+        }
+    }
+  return words;
+} /* WcWords */
+
+
+/*
+ * WcWidth
+ *
+ * arguments:
+ *   textOptsT *o: the options and files
+ *
+ * returns: int: the width of each column
+ *
+ * GNU wc's rule: 1 for a single count of a single file; otherwise
+ * wide enough for the total size of the regular files among those
+ * that can be stat'ed, and at least 7 if any of them is not regular.
+ */
+static int
+WcWidth(textOptsT* o)
+{
+  unsigned long long total = 0;
+  int i, width = 1, least = 1;
+  struct stat st;
+  char* name;
+
+  if (o->nfiles <= 1 && o->lines + o->words + o->bytes == 1)
+    return 1;
+  for (i = 0; i < (o->nfiles == 0 ? 1 : o->nfiles); i++)
+    {
+      name = o->nfiles == 0 ? "-" : o->files[i];
+      if ((strcmp(name, "-") == 0 ? fstat(STDIN_FILENO, &st)
+           : stat(name, &st)) != 0)
+        continue;
+      if (S_ISREG(st.st_mode))
+        total += st.st_size;
+      else
+        least = 7;
+    }
+  for (; total >= 10; total /= 10)
+    width++;
+  return MAX(width, least);
+} /* WcWidth */
+
+
+/*
+ * WcPrint
+ *
+ * arguments:
+ *   textOptsT *o: the counts asked for
+ *   textCountsT *c: the counts
+ *   int width: the width of each column
+ *   char *name: the file, or NULL for standard input without operands
+ *
+ * returns: none
+ */
+static void
+WcPrint(textOptsT* o, textCountsT* c, int width, char* name)
+{
+  char* sep = "";
+
+  if (o->lines)
+    {
+      printf("%*lld", width, c->lines);
+      sep = " ";
+    }
+  if (o->words)
+    {
+      printf("%s%*lld", sep, width, c->words);
+      sep = " ";
+    }
+  if (o->bytes)
+    printf("%s%*lld", sep, width, c->bytes);
+  if (name != NULL)
+    printf(" %s", name);
+  printf("\n");
+} /* WcPrint */
+
+
+/*
+ * WcQuote
+ *
+ * arguments:
+ *   char *name: a file, or NULL for standard input without operands
+ *   char *buf: room for the name in quotes
+ *   size_t size: the size of buf
+ *
+ * returns: char*: the name as wc's messages show it
+ *
+ * GNU wc quotes a name only if a shell would need it to be.
+ */
+static char*
+WcQuote(char* name, char* buf, size_t size)
+{
+  int i;
+
+  if (name == NULL)
+    name = "standard input";
+  for (i = 0; name[i] != 0; i++)
+    if (!isalnum((unsigned char) name[i])
+        && strchr("%+,-./:=@_^", name[i]) == NULL)
+      {
+        snprintf(buf, size, "'%s'", name);
+        return buf;
+      }
+  return name;
+} /* WcQuote */
+
+
+/*
+ * HeadFile
+ *
+ * arguments:
+ *   int fd: the file
+ *   textOptsT *o: what to print
+ *
+ * returns: int: 0, or T_READ or T_WRITE with errno set
+ */
+static int
+HeadFile(int fd, textOptsT* o)
+{
+  long long need = o->n;
+  off_t pos, size, end;
+  ssize_t n = 0;
+  char* nl = NULL;
+  int r;
+
+  if (need == 0)
+    return 0;
+  if (TextSeekable(fd, &pos, &size))
+    {
+      end = pos + need;
+      if (!o->chars)
+        for (end = pos; (n = TextRead(fd, gBlock, TEXTBLOCK, end)) > 0;
+             end += n)
+          if ((nl = NthFromStart(gBlock, n, &need)) != NULL)
+            {
+              end += nl - gBlock + 1;
+              break;
+            }
+      if (n < 0)
+        return T_READ;
+      r = TextSend(fd, &pos, end - pos);
+      lseek(fd, pos, SEEK_SET);
+      return r;
+    }
+  while (need > 0
+         && (n = TextRead(fd, gBlock, o->chars ? MIN(need, TEXTBLOCK)
+                          : TEXTBLOCK, -1)) > 0)
+    {
+      if (o->chars)
+        need -= n;
+      else if ((nl = NthFromStart(gBlock, n, &need)) != NULL)
+        n = nl - gBlock + 1;
+      if (!TextPut(gBlock, n))
+        return T_WRITE;
+      if (nl != NULL)
+        break;
+    }
+  return n < 0 ? T_READ : 0;
+} /* HeadFile */
+
+
+/*
+ * TailFile
+ *
+ * arguments:
+ *   int fd: the file
+ *   textOptsT *o: what to print, N not counted from the start
+ *
+ * returns: int: 0, or T_READ or T_WRITE with errno set
+ *
+ * A regular file of at least a block goes to TailBack. Anything else,
+ * and a file whose size says nothing, as in /proc, is read through
+ * into a buffer; whenever it would have to grow, what can no longer
+ * be printed is dropped first, and it only grows if that leaves it
+ * more than half full.
+ */
+static int
+TailFile(int fd, textOptsT* o)
+{
+  size_t len = 0, max = 0, start;
+  off_t pos, size;
+  char* buf = NULL;
+  ssize_t n;
+  int r;
+
+  if (TextSeekable(fd, &pos, &size) && size - pos >= TEXTBLOCK)
+    return TailBack(fd, o, pos, size);
+  for (;;)
+    {
+      if (max - len < TEXTBLOCK)
+        {
+          if (len > 0 && (start = TailStart(buf, len, o)) > 0)
+            {
+              memmove(buf, buf + start, len - start);
+              len -= start;
+            }
+          if (max - len < max / 2 || max - len < TEXTBLOCK)
+            {
+              max = max == 0 ? 2 * TEXTBLOCK : 2 * max;
+              buf = realloc(buf, max);
+            }
+        }
+      if ((n = TextRead(fd, buf + len, max - len, -1)) <= 0)
+        break;
+      len += n;
+    }
+  if (n < 0)
+    r = T_READ;
+  else
+    {
+      start = TailStart(buf, len, o);
+      r = TextPut(buf + start, len - start) ? 0 : T_WRITE;
+    }
+  free(buf);
+  return r;
+} /* TailFile */
+
+
+/*
+ * TailBack
+ *
+ * arguments:
+ *   int fd: a regular file
+ *   textOptsT *o: what to print
+ *   off_t pos: its offset, where reading stops
+ *   off_t size: its size
+ *
+ * returns: int: 0, or T_READ or T_WRITE with errno set
+ *
+ * A newline that ends the file ends its last line rather than
+ * starting another, so lines are counted back from before it.
+ */
+static int
+TailBack(int fd, textOptsT* o, off_t pos, off_t size)
+{
+  long long need = o->n;
+  off_t start, end = size, b;
+  char* nl;
+  ssize_t n;
+  char last;
+  int r;
+
+  if (o->chars)
+    start = size - pos > need ? size - need : pos;
+  else
+    {
+      start = pos;
+      if (TextRead(fd, &last, 1, size - 1) == 1 && last == '\n')
+        end--;
+      while (end > pos)
+        {
+          b = end - pos > TEXTBLOCK ? end - TEXTBLOCK : pos;
+          if ((n = TextRead(fd, gBlock, end - b, b)) < 0)
+            return T_READ;
+          if ((nl = NthFromEnd(gBlock, n, &need)) != NULL)
+            {
+              start = b + (nl - gBlock) + 1;
+              break;
+            }
+          end = b;
+        }
+    }
+  r = TextSend(fd, &start, size - start);
+  lseek(fd, start, SEEK_SET);
+  return r;
+} /* TailBack */
+
+
+/*
+ * TailFrom
+ *
+ * arguments:
+ *   int fd: the file
+ *   textOptsT *o: what to print, N counted from the start
+ *
+ * returns: int: 0, or T_READ or T_WRITE with errno set
+ *
+ * Skips N - 1 lines or bytes, then prints the rest: sent to the end
+ * of a regular file, else copied on from the block it was found in.
+ */
+static int
+TailFrom(int fd, textOptsT* o)
+{
+  long long need = o->n > 0 ? o->n - 1 : 0;
+  off_t pos, size, end;
+  ssize_t n = 0;
+  char* nl;
+  int r;
+
+  if (TextSeekable(fd, &pos, &size))
+    {
+      end = pos + need;
+      if (!o->chars && need > 0)
+        for (end = pos; (n = TextRead(fd, gBlock, TEXTBLOCK, end)) > 0;
+             end += n)
+          if ((nl = NthFromStart(gBlock, n, &need)) != NULL)
+            {
+              end += nl - gBlock + 1;
+              break;
+            }
+      if (n < 0)
+        return T_READ;
+      r = TextSend(fd, &end, LLONG_MAX - end);
+      lseek(fd, end, SEEK_SET);
+      return r;
+    }
+  while (need > 0
+         && (n = TextRead(fd, gBlock, o->chars ? MIN(need, TEXTBLOCK)
+                          : TEXTBLOCK, -1)) > 0)
+    if (o->chars)
+      need -= n;
+    else if ((nl = NthFromStart(gBlock, n, &need)) != NULL
+             && !TextPut(nl + 1, gBlock + n - nl - 1))
+      return T_WRITE;
+  if (n < 0)
+    return T_READ;
+  return TextRest(fd);
+} /* TailFrom */
+
+
+/*
+ * TailStart
+ *
+ * arguments:
+ *   char *buf: the end of a file, so far
+ *   size_t len: its length
+ *   textOptsT *o: what to print
+ *
+ * returns: size_t: where in buf what tail would print starts
+ */
+static size_t
+TailStart(char* buf, size_t len, textOptsT* o)
+{
+  long long need = o->n;
+  char* nl;
+
+  if (o->chars)
+    return len > need ? len - need : 0;
+  if (len > 0 && buf[len - 1] == '\n')
+    len--;
+  nl = NthFromEnd(buf, len, &need);
+  return nl == NULL ? 0 : nl - buf + 1;
+} /* TailStart */
@@ -0,0 +1,105 @@
+/***************************************************************************
+ *  Title: Text
+ * -------------------------------------------------------------------------
+ *    Purpose: The wc, head and tail builtins, which count and cut
+ *    lines of text without forking
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: text.h,v $
+ ***************************************************************************/
+
+#ifndef __TEXT_H__
+#define __TEXT_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "runtime.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __TEXT_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Run the wc builtin
+ * ---------------------------------------------------------------------
+ *    Purpose: Implements "wc [-lwc] [file]...", printing what the wc
+ *    in PATH would. Lines are counted with SIMD compares.
+ *    Input: the wc command line
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RunWc(commandT*);
+
+/***********************************************************************
+ *  Title: Run the head builtin
+ * ---------------------------------------------------------------------
+ *    Purpose: Implements "head [-qv] [-n N | -c N] [file]...". What is
+ *    printed of a regular file goes out with sendfile.
+ *    Input: the head command line
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RunHead(commandT*);
+
+/***********************************************************************
+ *  Title: Run the tail builtin
+ * ---------------------------------------------------------------------
+ *    Purpose: Implements "tail [-qv] [-n [+]N | -c [+]N] [file]...".
+ *    A large regular file is read backward from its end, only as far
+ *    as the lines asked for go.
+ *    Input: the tail command line
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RunTail(commandT*);
+
+/***********************************************************************
+ *  Title: Leave a text command to PATH
+ * ---------------------------------------------------------------------
+ *    Purpose: Tells whether a wc, head or tail has options the
+ *    builtins do not know, or would read a terminal, and so is run
+ *    from PATH instead.
+ *    Input: the command line, without redirections, and the
+ *    descriptor it would read as standard input, or -1
+ *    Output: TRUE to run the command in PATH, FALSE for the builtin or
+ *    for any other command
+ ***********************************************************************/
+EXTERN bool
+TextExternal(commandT*, int);
+
+/***********************************************************************
+ *  Title: Check for a text builtin a substitution can run
+ * ---------------------------------------------------------------------
+ *    Purpose: Tells whether a command is a wc, head or tail the
+ *    builtin runs and whose output is not redirected, so that
+ *    $(wc -l < file) needs no subshell.
+ *    Input: the command line, with its redirections
+ *    Output: TRUE if the shell can run it itself
+ ***********************************************************************/
+EXTERN bool
+TextPure(commandT*);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __TEXT_H__ */
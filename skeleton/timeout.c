@@ -0,0 +1,261 @@
+/***************************************************************************
+ *  Title: Timeout
+ * -------------------------------------------------------------------------
+ *    Purpose: The timeout builtin, and the timerfd that limits how long
+ *    the job it runs may take
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: timeout.c,v $
+ ***************************************************************************/
+#define _GNU_SOURCE
+#define __TIMEOUT_IMPL__
+
+/************System include***********************************************/
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "timeout.h"
+#include "io.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* how long timeout waits after its signal before sending SIGKILL */
+#define TIMEOUT_GRACE 5000000000LL
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+/* parses a signal name or number */
+static int
+ParseSignal(char*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+/*
+ * RunTimeout
+ *
+ * arguments:
+ *   commandT *cmd: the timeout command line
+ *
+ * returns: none
+ *
+ * Implements "timeout [-s sig] [-k grace] duration command [arg]...",
+ * the options also being allowed after the duration. The command is
+ * looked up in PATH even if it names a builtin, forked like any
+ * external command and waited for as the foreground job, with a
+ * timerfd polled alongside its pidfd rather than a timeout process of
+ * its own. When the duration runs out the job gets sig (SIGTERM by
+ * default) and, if still alive grace later (5 seconds by default, 0
+ * for never), SIGKILL. $? is then 124, or 137 if SIGKILL ended it;
+ * 125 is timeout's own usage error. A duration of 0 sets no timer.
+ * A job that stops is numbered with its timer still running.
+ */
+void
+RunTimeout(commandT* cmd)
+{
+  long long limit = -1, grace = TIMEOUT_GRACE;
+  int sig = SIGTERM, i, n;
+  timeoutT t;
+  commandT* c;
+
+  lastStatus = 125;
+  for (i = 1; i < cmd->argc; i++)
+    {
+      char* a = cmd->argv[i];
+      char* v;
+
+      if (strcmp(a, "--") == 0 && limit < 0)
+        continue;
+      if (a[0] != '-' || a[1] == 0)
+        {
+          if (limit >= 0)
+            break;
+          if (!ParseDuration(a, &limit))
+            {
+              fprintf(stderr, "timeout: invalid time interval '%s'\n", a);
+              return;
+            }
+          continue;
+        }
+      if ((a[1] != 's' && a[1] != 'k')
+          || (v = a[2] != 0 ? a + 2 : cmd->argv[++i]) == NULL)
+        {
+          fprintf(stderr, "usage: timeout [-s sig] [-k grace] duration "
+                  "command [arg]...\n");
+          return;
+        }
+      if (a[1] == 's' && (sig = ParseSignal(v)) < 0)
+        {
+          fprintf(stderr, "timeout: %s: invalid signal\n", v);
+          return;
+        }
+      if (a[1] == 'k' && !ParseDuration(v, &grace))
+        {
+          fprintf(stderr, "timeout: invalid time interval '%s'\n", v);
+          return;
+        }
+    }
+  if (i >= cmd->argc)
+    {
+      fprintf(stderr, "usage: timeout [-s sig] [-k grace] duration "
+              "command [arg]...\n");
+      return;
+    }
+
+  n = cmd->argc - i;
+  c = malloc(sizeof(commandT) + sizeof(char*) * (n + 1));
+  memcpy(c->argv, cmd->argv + i, sizeof(char*) * n);
+  c->argv[n] = NULL;
+  c->argc = n;
+  c->name = c->argv[0];
+  if (!ResolveExternalCmd(c))
+    {
+      lastStatus = 127;
+      free(c);
+      return;
+    }
+
+  t.limit = limit;
+  t.sig = sig;
+  t.grace = grace;
+  t.fd = -1;
+  t.expired = 0;
+  RunProgram(c, cmd, &t);
+  free(c->name);
+  free(c);
+} /* RunTimeout */
+
+
+/*
+ * ParseDuration
+ *
+ * arguments:
+ *   char *s: a number, possibly fractional, and an optional suffix of
+ *            s, m, h or d
+ *   long long *ns: receives it in nanoseconds
+ *
+ * returns: bool: FALSE if s is not a duration
+ */
+bool
+ParseDuration(char* s, long long* ns)
+{
+  double d;
+  char* end;
+
+  errno = 0;
+  d = strtod(s, &end);
+  if (end == s || errno != 0 || d < 0)
+    return FALSE;
+  switch (*end)
+    {
+    case 'd':
+      d *= 24;
+      /* fall through */
+    case 'h':
+      d *= 60;
+      /* fall through */
+    case 'm':
+      d *= 60;
+      /* fall through */
+    case 's':
+      end++;
+      break;
+    }
+  if (*end != 0 || d * 1e9 > 9e18)
+    return FALSE;
+  *ns = (long long) (d * 1e9);
+  if (*ns == 0 && d > 0)
+    *ns = 1; // a tiny duration is not "no limit"
+  return TRUE;
+} /* ParseDuration */
+
+
+/*
+ * ParseSignal
+ *
+ * arguments:
+ *   char *s: a signal number, or a name with or without "SIG"
+ *
+ * returns: int: the signal number, or -1 if s names none
+ */
+static int
+ParseSignal(char* s)
+{
+  const char* name;
+  int sig;
+
+  if (s[0] >= '0' && s[0] <= '9')
+    return (sig = atoi(s)) > 0 && sig < NSIG ? sig : -1;
+  if (strncasecmp(s, "SIG", 3) == 0)
+    s += 3;
+  for (sig = 1; sig < NSIG; sig++)
+    if ((name = sigabbrev_np(sig)) != NULL && strcasecmp(s, name) == 0)
+      return sig;
+  return -1;
+} /* ParseSignal */
+
+
+/*
+ * TimeoutArm
+ *
+ * arguments:
+ *   timeoutT *t: the limit of a job run by timeout
+ *   long long ns: nanoseconds from now, or 0 to disarm the timer
+ *
+ * returns: none
+ *
+ * Creates the timerfd the first time.
+ */
+void
+TimeoutArm(timeoutT* t, long long ns)
+{
+  struct itimerspec it;
+
+  memset(&it, 0, sizeof(it));
+  it.it_value.tv_sec = ns / 1000000000LL;
+  it.it_value.tv_nsec = ns % 1000000000LL;
+  if (t->fd < 0)
+    t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (t->fd >= 0 && timerfd_settime(t->fd, 0, &it, NULL) != 0)
+    PrintPError("timeout");
+} /* TimeoutArm */
+
+
+/*
+ * TimeoutExpire
+ *
+ * arguments:
+ *   timeoutT *t: a limit whose timer is readable
+ *
+ * returns: int: the signal to send the job, or 0 for none
+ *
+ * The first expiry asks for the limit's signal and arms the timer for
+ * the grace period; the second asks for SIGKILL.
+ */
+int
+TimeoutExpire(timeoutT* t)
+{
+  uint64_t n;
+
+  if (read(t->fd, &n, sizeof(n)) != sizeof(n))
+    return 0; // already read, or disarmed since
+  if (t->expired++ > 0)
+    return SIGKILL;
+  TimeoutArm(t, t->sig == SIGKILL ? 0 : t->grace);
+  return t->sig;
+} /* TimeoutExpire */
@@ -0,0 +1,105 @@
+/***************************************************************************
+ *  Title: Timeout
+ * -------------------------------------------------------------------------
+ *    Purpose: The timeout builtin, and the timerfd that limits how long
+ *    the job it runs may take
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: timeout.h,v $
+ ***************************************************************************/
+
+#ifndef __TIMEOUT_H__
+#define __TIMEOUT_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "runtime.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __TIMEOUT_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/*
+ * The limit timeout puts on a job. The timer is a timerfd counting
+ * CLOCK_MONOTONIC, so the time a job spends stopped counts too.
+ */
+typedef struct timeout_t
+{
+  long long limit; /* nanoseconds until sig, or 0 for no limit */
+  int sig;         /* sent when the limit runs out */
+  long long grace; /* then nanoseconds until SIGKILL, or 0 for never */
+  int fd;          /* the timerfd, or -1 until armed */
+  int expired;     /* signals the timer has sent */
+} timeoutT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Run the timeout builtin
+ * ---------------------------------------------------------------------
+ *    Purpose: Implements "timeout [-s sig] [-k grace] duration
+ *    command [arg]...": runs the command as the foreground job and
+ *    signals it if it outlives the duration.
+ *    Input: the timeout command line
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+RunTimeout(commandT*);
+
+/***********************************************************************
+ *  Title: Parse a duration
+ * ---------------------------------------------------------------------
+ *    Purpose: Reads a number of seconds, possibly fractional, with an
+ *    optional suffix of s, m, h or d, as timeout and memo take them.
+ *    Input: the text and where to put the duration in nanoseconds
+ *    Output: FALSE if the text is not a duration
+ ***********************************************************************/
+EXTERN bool
+ParseDuration(char*, long long*);
+
+/***********************************************************************
+ *  Title: Arm a timer
+ * ---------------------------------------------------------------------
+ *    Purpose: Sets the timer to expire some time from now, creating
+ *    its timerfd the first time.
+ *    Input: the limit, and nanoseconds from now or 0 to disarm it
+ *    Output: void
+ ***********************************************************************/
+EXTERN void
+TimeoutArm(timeoutT*, long long);
+
+/***********************************************************************
+ *  Title: Act on an expiry
+ * ---------------------------------------------------------------------
+ *    Purpose: Reads a timer that polled readable. The first expiry
+ *    arms it again for the grace period and asks for the limit's
+ *    signal; the second asks for SIGKILL.
+ *    Input: the limit
+ *    Output: the signal to send the job, or 0 if the timer had not
+ *    expired after all
+ ***********************************************************************/
+EXTERN int
+TimeoutExpire(timeoutT*);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __TIMEOUT_H__ */
@@ -0,0 +1,350 @@
+/***************************************************************************
+ *  Title: Replay
+ * -------------------------------------------------------------------------
+ *    Purpose: tshreplay, which reruns a session recorded with tsh -r and
+ *    compares the shell's overhead per line with the recording
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: replay.c,v $
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "../record.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define USAGE "usage: tshreplay [-p] [-v] [-t pct] trace [shell]\n"
+
+/* how much of each line the report shows */
+#define TEXTMAX 40
+
+/* nanoseconds to the microseconds the report shows */
+#define US(ns) ((ns) / 1000.0)
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+/* reads every record of a trace */
+static recT*
+LoadTrace(char*, int*);
+/* runs the shell on the recorded lines, recording it in turn */
+static bool
+Replay(char*, char*, recT*, int, bool, bool);
+/* compares the replay with the recording */
+static bool
+Report(recT*, int, recT*, int, double);
+/* frees what LoadTrace returned */
+static void
+FreeTrace(recT*, int);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+/*
+ * main
+ *
+ * arguments:
+ *   int argc: the number of arguments provided on the command line
+ *   char *argv[]: array of strings provided on the command line
+ *
+ * returns: int: 0 if the replay matched the recording, 1 if it did
+ *               not, 2 on a usage or file error
+ *
+ * Implements "tshreplay [-p] [-v] [-t pct] trace [shell]". The lines
+ * of the trace are fed to shell (./tsh by default) as fast as it
+ * reads them or, with -p, at the times they were recorded at. The
+ * shell is run with -r, so it records the replay itself, and the two
+ * recordings are compared line by line. The shell's output is
+ * discarded unless -v is given. The replay fails if a line ends with
+ * another status than it was recorded with or, with -t, if the total
+ * shell overhead grew by more than pct percent.
+ */
+int
+main(int argc, char* argv[])
+{
+  char out[] = "/tmp/tshreplay.XXXXXX";
+  char* shell = "./tsh";
+  double threshold = -1;
+  bool paced = FALSE, verbose = FALSE, fail;
+  recT* recs;
+  recT* again;
+  int n, m, c, fd;
+
+  while ((c = getopt(argc, argv, "pvt:")) != -1)
+    switch (c)
+      {
+      case 'p':
+        paced = TRUE;
+        break;
+      case 'v':
+        verbose = TRUE;
+        break;
+      case 't':
+        threshold = atof(optarg);
+        break;
+      default:
+        fprintf(stderr, USAGE);
+        return 2;
+      }
+  if (optind == argc || argc - optind > 2)
+    {
+      fprintf(stderr, USAGE);
+      return 2;
+    }
+  if (argc - optind == 2)
+    shell = argv[optind + 1];
+  if (access(shell, X_OK) != 0)
+    {
+      perror(shell);
+      return 2;
+    }
+  if ((recs = LoadTrace(argv[optind], &n)) == NULL)
+    return 2;
+
+  if ((fd = mkstemp(out)) < 0)
+    {
+      perror(out);
+      return 2;
+    }
+  close(fd);
+  if (!Replay(shell, out, recs, n, paced, verbose)
+      || (again = LoadTrace(out, &m)) == NULL)
+    {
+      unlink(out);
+      return 2;
+    }
+  unlink(out);
+
+  fail = Report(recs, n, again, m, threshold);
+  FreeTrace(recs, n);
+  FreeTrace(again, m);
+  return fail ? 1 : 0;
+} /* main */
+
+
+/*
+ * LoadTrace
+ *
+ * arguments:
+ *   char *path: a trace written by tsh -r
+ *   int *n: receives the number of records
+ *
+ * returns: recT*: the records, or NULL after reporting an error
+ */
+static recT*
+LoadTrace(char* path, int* n)
+{
+  FILE* f = fopen(path, "r");
+  recT* recs = NULL;
+  recT r;
+  int max = 0;
+
+  if (f == NULL)
+    {
+      perror(path);
+      return NULL;
+    }
+  if (!RecordHeader(f))
+    {
+      fprintf(stderr, "tshreplay: %s: not a tsh trace\n", path);
+      fclose(f);
+      return NULL;
+    }
+  memset(&r, 0, sizeof(r));
+  for (*n = 0; RecordRead(f, &r); (*n)++)
+    {
+      if (*n == max)
+        {
+          max = max * 2 + 64;
+          recs = realloc(recs, sizeof(recT) * max);
+        }
+      recs[*n] = r;
+      recs[*n].text = strdup(r.text);
+    }
+  free(r.text);
+  fclose(f);
+  return recs != NULL ? recs : calloc(1, sizeof(recT));
+} /* LoadTrace */
+
+
+/*
+ * Replay
+ *
+ * arguments:
+ *   char *shell: the tsh to run
+ *   char *out: where it is to record the replay
+ *   recT *recs: the recorded lines
+ *   int n: their number
+ *   bool paced: whether to feed each line at its recorded time
+ *   bool verbose: whether to keep the shell's output
+ *
+ * returns: bool: FALSE if the shell could not be forked
+ *
+ * The lines go through a pipe, which the shell reads as it would a
+ * terminal or a script; when the lines run out the pipe is closed and
+ * the shell exits. A shell that could not be exec'd leaves out empty.
+ */
+static bool
+Replay(char* shell, char* out, recT* recs, int n, bool paced, bool verbose)
+{
+  struct timespec ts;
+  struct iovec iov[2];
+  long long base, at;
+  int fds[2], status, i, null;
+  pid_t pid;
+
+  if (pipe(fds) != 0)
+    {
+      perror("pipe");
+      return FALSE;
+    }
+  if ((pid = fork()) < 0)
+    {
+      perror("fork");
+      return FALSE;
+    }
+  if (pid == 0)
+    {
+      dup2(fds[0], STDIN_FILENO);
+      close(fds[0]);
+      close(fds[1]);
+      if (!verbose && (null = open("/dev/null", O_WRONLY)) >= 0)
+        {
+          dup2(null, STDOUT_FILENO);
+          dup2(null, STDERR_FILENO);
+          close(null);
+        }
+      execl(shell, shell, "-r", out, (char*) NULL);
+      perror(shell);
+      _exit(127);
+    }
+  close(fds[0]);
+  signal(SIGPIPE, SIG_IGN); // the shell may exit before reading it all
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  base = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  iov[1].iov_base = "\n";
+  iov[1].iov_len = 1;
+  for (i = 0; i < n; i++)
+    {
+      if (paced)
+        {
+          at = base + recs[i].start;
+          ts.tv_sec = at / 1000000000LL;
+          ts.tv_nsec = at % 1000000000LL;
+          while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+                 != 0)
+            ;
+        }
+      iov[0].iov_base = recs[i].text;
+      iov[0].iov_len = recs[i].len;
+      if (writev(fds[1], iov, 2) < 0)
+        break;
+    }
+  close(fds[1]);
+
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    ;
+  return TRUE;
+} /* Replay */
+
+
+/*
+ * Report
+ *
+ * arguments:
+ *   recT *recs: the recording
+ *   int n: its number of lines
+ *   recT *again: the replay
+ *   int m: its number of lines
+ *   double threshold: the allowed growth of the total overhead in
+ *                     percent, or negative for none
+ *
+ * returns: bool: TRUE if the replay does not match the recording
+ *
+ * Prints one row per line: the wall time of the replay, the part of
+ * it spent waiting for children, the rest, which is the shell's own
+ * overhead, and the overhead that was recorded. Times are in
+ * microseconds.
+ */
+static bool
+Report(recT* recs, int n, recT* again, int m, double threshold)
+{
+  long long wall = 0, wait = 0, was = 0;
+  bool fail = FALSE;
+  int i;
+
+  printf("%5s %6s %12s %12s %12s %12s  %s\n", "line", "status", "wall",
+         "child", "overhead", "recorded", "text");
+  for (i = 0; i < n && i < m; i++)
+    {
+      recT* r = &again[i];
+      bool differs = r->status != recs[i].status;
+      printf("%5d %5d%c %12.1f %12.1f %12.1f %12.1f  %.*s\n", i + 1,
+             r->status, differs ? '!' : ' ', US(r->wall), US(r->wait),
+             US(r->wall - r->wait), US(recs[i].wall - recs[i].wait),
+             TEXTMAX, r->text);
+      if (differs)
+        {
+          printf("tshreplay: line %d: status %d, recorded %d\n", i + 1,
+                 r->status, recs[i].status);
+          fail = TRUE;
+        }
+      wall += r->wall;
+      wait += r->wait;
+      was += recs[i].wall - recs[i].wait;
+    }
+  printf("%5s %6s %12.1f %12.1f %12.1f %12.1f\n", "total", "", US(wall),
+         US(wait), US(wall - wait), US(was));
+  if (m != n)
+    {
+      printf("tshreplay: %d lines replayed, %d recorded\n", m, n);
+      fail = TRUE;
+    }
+  if (threshold >= 0 && wall - wait > was * (1 + threshold / 100))
+    {
+      printf("tshreplay: overhead grew by %.1f%%, more than %g%%\n",
+             was > 0 ? 100.0 * (wall - wait - was) / was : 100.0, threshold);
+      fail = TRUE;
+    }
+  return fail;
+} /* Report */
+
+
+/*
+ * FreeTrace
+ *
+ * arguments:
+ *   recT *recs: records returned by LoadTrace
+ *   int n: their number
+ *
+ * returns: none
+ */
+static void
+FreeTrace(recT* recs, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    free(recs[i].text);
+  free(recs);
+} /* FreeTrace */
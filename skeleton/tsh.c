@@ -21,6 +21,12 @@
 #include "io.h"
 #include "interpreter.h"
 #include "runtime.h"
+#include "script.h"
+#include "place.h"
+#include "enable.h"
+#include "memprof.h"
+#include "metrics.h"
+#include "record.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -30,6 +36,7 @@
  */
 
 #define BUFSIZE 80
+#define RCFILE "/.tshrc"
 
 /************Global Variables*********************************************/
 
@@ -52,25 +59,83 @@ sig(int);
  * returns: int: 0 = OK, else error
  *
  * This sets up signal handling and implements the main loop of tsh.
+ * With -c, the next argument is run as a command line instead and tsh
+ * exits without reading standard input or the startup file, so the
+ * startup file's snapshot (see script.h) does not apply to it. With
+ * -r file, which comes first, every line read is recorded in file
+ * with its timing and status (see record.h). Given a script and its
+ * arguments, tsh runs the startup file and then the script, and exits.
+ * tsh --top [seconds] runs no shell but shows the metrics of the shells
+ * publishing them (see metrics.h).
  */
 int
 main(int argc, char *argv[])
 {
+  char* cmdLine;
+  char* home = getenv("HOME");
+  char* rc;
+  commandT* script;
+  int arg = 1;
+
+  MemInit();
+  if (argc > 1 && strcmp(argv[1], "--top") == 0)
+    return MetricsTop(argc > 2 ? argv[2] : NULL);
   /* Initialize command buffer */
-  char* cmdLine = malloc(sizeof(char*) * BUFSIZE);
+  cmdLine = malloc(sizeof(char*) * BUFSIZE);
 
   /* shell initialization */
   if (signal(SIGINT, sig) == SIG_ERR)
     PrintPError("SIGINT");
   if (signal(SIGTSTP, sig) == SIG_ERR)
     PrintPError("SIGTSTP");
-  
+  JobInit();
+  MetricsInit();
 
+  if (argc > arg + 1 && strcmp(argv[arg], "-r") == 0)
+    {
+      if (!RecordOpen(argv[arg + 1]))
+        PrintPError(argv[arg + 1]);
+      arg += 2;
+    }
+  if (argc > arg + 1 && strcmp(argv[arg], "-c") == 0)
+    {
+      RecordStart();
+      Interpret(argv[arg + 1]);
+      RecordLine(argv[arg + 1], lastStatus);
+      forceExit = TRUE;
+    }
+  else
+    {
+      if (home != NULL)
+        {
+          rc = malloc(strlen(home) + sizeof(RCFILE));
+          sprintf(rc, "%s%s", home, RCFILE);
+          ScriptRunRc(rc);
+          free(rc);
+        }
+      if (arg < argc && !forceExit)
+        {
+          script = malloc(sizeof(commandT) + sizeof(char*) * (argc - arg + 1));
+          script->name = argv[arg];
+          script->argc = argc - arg;
+          memcpy(script->argv, argv + arg, sizeof(char*) * (argc - arg + 1));
+          RecordStart();
+          ScriptRun(argv[arg], script);
+          RecordLine(argv[arg], lastStatus);
+          free(script);
+          forceExit = TRUE;
+        }
+    }
+  MemLine("(startup)");
 
   while (!forceExit) /* repeat forever */
     {
       /* read command line */
-      getCommandLine(&cmdLine, BUFSIZE);
+      MemPhase(MP_READ);
+      /* end of input, e.g. after xargs consumed the rest of stdin */
+      if (!getCommandLine(&cmdLine, BUFSIZE))
+        break;
+      RecordStart();
 
       /* checks the status of background jobs */
       CheckJobs();
@@ -78,14 +143,23 @@ main(int argc, char *argv[])
       /* interpret command and line
        * includes executing of commands */
       Interpret(cmdLine);
-
-      if (strcmp(cmdLine, "exit") == 0)
-        forceExit = TRUE;
+      RecordLine(cmdLine, lastStatus);
+      MemLine(cmdLine);
     }
 
   /* shell termination */
+  ScriptEnd();
+  MemPhase(MP_EXIT);
+  RecordClose();
+  MetricsCleanup();
+  ScriptCleanup();
+  PlaceCleanup();
+  EnableCleanup();
+  RuntimeCleanup();
   free(cmdLine);
-  return 0;
+  if (MemReport())
+    return MEMPROF_FAIL;
+  return lastStatus;
 } /* main */
 
 /*
@@ -96,14 +170,19 @@ main(int argc, char *argv[])
  *
  * returns: none
  *
- * This should handle signals sent to tsh.
+ * This should handle signals sent to tsh. SIGINT and SIGTSTP are
+ * passed on as they are to the foreground job's process group. When
+ * tsh owns a terminal, the terminal signals that group itself. With
+ * no process in the foreground, SIGINT stops the builtin stages of a
+ * pipeline running on threads.
  */
 static void
 sig(int signo)
 {
   if (fgpid == 0) {
-    PrintNewline();
+    if (!StagesInterrupt(signo))
+      PrintNewline();
   } else {
-    kill (fgpid, SIGINT);
+    kill (-fgpid, signo); /* the whole foreground process group */
   }
 } /* sig */
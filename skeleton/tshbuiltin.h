@@ -0,0 +1,78 @@
+/***************************************************************************
+ *  Title: Loadable builtins
+ * -------------------------------------------------------------------------
+ *    Purpose: The interface between tsh and the builtins it loads from
+ *    shared objects with "enable -f"
+ *    Author: Matthew Markwell
+ *    Version: $Revision: 1.1 $
+ *    File: $RCSfile: tshbuiltin.h,v $
+ ***************************************************************************/
+
+#ifndef __TSHBUILTIN_H__
+#define __TSHBUILTIN_H__
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/*
+ * The version of tshBuiltinT below. It changes only when the layout
+ * or the meaning of a field does, and tsh refuses a builtin built for
+ * another one.
+ */
+#define TSH_BUILTIN_ABI 1
+
+/* the builtin may run in the shell's own process */
+#define TSH_BUILTIN_INPROC 0x1
+
+/*
+ * A builtin in a shared object. For "enable -f lib.so name", lib.so
+ * defines a tshBuiltinT called name_builtin:
+ *
+ *   tshBuiltinT hello_builtin = { TSH_BUILTIN_ABI, TSH_BUILTIN_INPROC,
+ *                                 NULL, HelloRun, NULL };
+ *
+ * init is called once when the builtin is enabled, and a nonzero
+ * return refuses it; fini is called when it is disabled or the shell
+ * exits, but not in a child that ran it. Either may be NULL.
+ *
+ * run gets the words of the command, argv[0] being the name and
+ * argv[argc] NULL, and the descriptors to use as its standard input,
+ * output and error, with redirections already applied. It returns the
+ * command's status, 0 to 255. It must not keep argv or close the
+ * descriptors, and must not call exit: the shell may be the process
+ * running it. Output written through stdio must be flushed before run
+ * returns.
+ *
+ * With TSH_BUILTIN_INPROC, a command run by the shell itself calls run
+ * in the shell, so whatever it does to the process, such as changing
+ * the working directory, stays done. Without it, the shell forks a
+ * child to call run in, as for an external command, and the builtin
+ * can be stopped and interrupted like one. In a pipeline or the
+ * background every builtin runs in a child of its own.
+ */
+typedef struct tsh_builtin_t
+{
+  int abi;     /* TSH_BUILTIN_ABI */
+  int flags;   /* TSH_BUILTIN_* */
+  int (*init)(void);
+  int (*run)(int argc, char** argv, int in, int out, int err);
+  void (*fini)(void);
+} tshBuiltinT;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __TSHBUILTIN_H__ */